@@ -0,0 +1,173 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * Copyright (C) 2025, Raspberry Pi Ltd
+ *
+ * rpicam_encode_bench.cpp - measure the software video encoder profiles on synthetic frames, without a camera.
+ */
+
+// Example: rpicam-encode-bench --width 1920 --height 1080 --framerate 30
+//          rpicam-encode-bench --libav-video-codec libx265 --profiles realtime,headroom --libav-affinity 2,3
+
+#include <sys/resource.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <sstream>
+
+#include "core/rpicam_app.hpp"
+#include "core/video_options.hpp"
+
+#include "encoder/encoder.hpp"
+#include "encoder/software_profiles.hpp"
+#include "encoder/synthetic_frames.hpp"
+
+struct EncodeBenchOptions : public VideoOptions
+{
+	EncodeBenchOptions() : VideoOptions()
+	{
+		using namespace boost::program_options;
+		// clang-format off
+		options_->add_options()
+			("profiles", value<std::string>(&profiles)->default_value("all"),
+			 "Comma separated list of --libav-profile values to measure, \"default\" for the codec defaults, "
+			 "or \"all\"")
+			;
+		// clang-format on
+	}
+
+	std::string profiles;
+
+	virtual bool Parse(int argc, char *argv[]) override
+	{
+		if (VideoOptions::Parse(argc, argv) == false)
+			return false;
+
+		// Only the software codecs have profiles. The default hardware codec name means "use libx264".
+		Set().codec = "libav";
+		if (Get().libav_video_codec == "h264_v4l2m2m")
+			Set().libav_video_codec = "libx264";
+		if (!Get().frames)
+			Set().frames = 300;
+
+		return true;
+	}
+};
+
+class RPiCamEncodeBench : public RPiCamApp
+{
+public:
+	RPiCamEncodeBench() : RPiCamApp(std::make_unique<EncodeBenchOptions>()) {}
+	EncodeBenchOptions *GetOptions() const { return static_cast<EncodeBenchOptions *>(RPiCamApp::GetOptions()); }
+};
+
+static double cpu_seconds()
+{
+	rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+static void run_profile(EncodeBenchOptions const *options, std::string const &profile, StreamInfo const &info,
+						std::vector<std::vector<uint8_t>> const &frames)
+{
+	VideoOptions encode_options;
+	encode_options.Set() = options->Get();
+	encode_options.Set().libav_profile = profile == "default" ? "" : profile;
+	encode_options.Set().libav_audio = false;
+	encode_options.Set().output.clear(); // discard the output
+
+	std::mutex mutex;
+	std::condition_variable cv;
+	unsigned int in_flight = 0;
+
+	std::unique_ptr<Encoder> encoder(Encoder::Create(&encode_options, info));
+	encoder->SetInputDoneCallback([&](EncodeToken) {
+		std::lock_guard<std::mutex> lock(mutex);
+		in_flight--;
+		cv.notify_one();
+	});
+	encoder->SetOutputReadyCallback([](void *, size_t, int64_t, bool) {});
+
+	double framerate = options->Get().framerate.value_or(DEFAULT_FRAMERATE);
+	double cpu_start = cpu_seconds();
+	auto start = std::chrono::steady_clock::now();
+
+	for (unsigned int i = 0; i < options->Get().frames; i++)
+	{
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			cv.wait(lock, [&] { return in_flight < SYNTHETIC_IN_FLIGHT; });
+			in_flight++;
+		}
+		std::vector<uint8_t> const &frame = frames[i % SYNTHETIC_NUM_FRAMES];
+		encoder->EncodeBuffer(-1, frame.size(), (void *)frame.data(), info, i * 1000000 / framerate, i);
+	}
+	// Deleting the encoder waits for everything to be encoded and written.
+	encoder.reset();
+
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	double fps = options->Get().frames / elapsed.count();
+	double cores = (cpu_seconds() - cpu_start) / elapsed.count();
+	// How many cores a real time encode at the requested framerate would keep busy.
+	double cores_needed = cores * std::min(1.0, framerate / fps);
+
+	std::cout << profile << "," << fps << "," << cores << "," << cores_needed << ","
+			  << (fps >= framerate ? "yes" : "no") << std::endl;
+}
+
+static void run_bench(RPiCamEncodeBench &app)
+{
+	EncodeBenchOptions const *options = app.GetOptions();
+
+	// Textured frames with some motion, a little harder to compress than real scenes usually are.
+	StreamInfo info = synthetic_stream_info(options->Get().width, options->Get().height);
+	std::vector<std::vector<uint8_t>> frames = make_synthetic_frames(info, "texture");
+
+	std::vector<std::string> profiles;
+	if (options->profiles == "all")
+	{
+		profiles.push_back("default");
+		for (auto const &profile : software_profiles)
+			profiles.push_back(profile.name);
+	}
+	else
+	{
+		std::stringstream ss(options->profiles);
+		for (std::string profile; std::getline(ss, profile, ',');)
+		{
+			if (profile != "default" && !find_software_profile(profile))
+				throw std::runtime_error("no such profile " + profile);
+			profiles.push_back(profile);
+		}
+	}
+
+	std::cout << options->Get().libav_video_codec << " " << info.width << "x" << info.height << " at "
+			  << options->Get().framerate.value_or(DEFAULT_FRAMERATE) << "fps, " << options->Get().frames
+			  << " frames" << std::endl;
+	std::cout << "profile,fps,cores,cores_at_framerate,realtime" << std::endl;
+	for (auto const &profile : profiles)
+		run_profile(options, profile, info, frames);
+}
+
+int main(int argc, char *argv[])
+{
+	try
+	{
+		RPiCamEncodeBench app;
+		EncodeBenchOptions *options = app.GetOptions();
+		if (options->Parse(argc, argv))
+		{
+			if (options->Get().verbose >= 2)
+				options->Print();
+
+			run_bench(app);
+		}
+	}
+	catch (std::exception const &e)
+	{
+		LOG_ERROR("ERROR: *** " << e.what() << " ***");
+		return -1;
+	}
+	return 0;
+}
@@ -0,0 +1,418 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * Copyright (C) 2025, Raspberry Pi Ltd
+ *
+ * rpicam_encode_check.cpp - check that encoders keep to their callback contracts, and measure them,
+ * using synthetic frames and no camera.
+ */
+
+// Example: rpicam-encode-check --encoders null,mjpeg,libav --width 1280 --height 720 --pattern noise
+//          rpicam-encode-check --encoders libav --realtime --framerate 30 --intra 30
+
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+#include "core/rpicam_app.hpp"
+#include "core/video_options.hpp"
+
+#include "encoder/encoder.hpp"
+#include "encoder/synthetic_frames.hpp"
+
+struct EncodeCheckOptions : public VideoOptions
+{
+	EncodeCheckOptions() : VideoOptions()
+	{
+		using namespace boost::program_options;
+		// clang-format off
+		options_->add_options()
+			("encoders", value<std::string>(&encoders)->default_value("null,mjpeg,libav"),
+			 "Comma separated list of registered encoders to check")
+			("pattern", value<std::string>(&pattern)->default_value("moving"),
+			 "Synthetic frames to encode: \"bars\" (the same every frame), \"moving\", \"texture\" or "
+			 "\"noise\" (hardest to compress)")
+			("realtime", value<bool>(&realtime)->default_value(false)->implicit_value(true),
+			 "Give frames to the encoder at --framerate, like a camera, instead of as fast as it takes them")
+			;
+		// clang-format on
+	}
+
+	std::string encoders;
+	std::string pattern;
+	bool realtime;
+
+	virtual bool Parse(int argc, char *argv[]) override
+	{
+		if (VideoOptions::Parse(argc, argv) == false)
+			return false;
+
+		if (!is_synthetic_pattern(pattern))
+			throw std::runtime_error("unknown pattern " + pattern);
+		// There's no hardware codec for libav to use without a camera system.
+		if (Get().libav_video_codec == "h264_v4l2m2m")
+			Set().libav_video_codec = "libx264";
+		if (!Get().frames)
+			Set().frames = 300;
+
+		return true;
+	}
+};
+
+class RPiCamEncodeCheck : public RPiCamApp
+{
+public:
+	RPiCamEncodeCheck() : RPiCamApp(std::make_unique<EncodeCheckOptions>()) {}
+	EncodeCheckOptions *GetOptions() const { return static_cast<EncodeCheckOptions *>(RPiCamApp::GetOptions()); }
+};
+
+// Camera timestamps are never zero, and some encoders treat zero specially.
+static constexpr int64_t START_TIMESTAMP_US = 1000000;
+// How far either side of a keyframe request we accept the keyframe, as encoders may already have
+// started on some of the frames they've been given.
+static constexpr unsigned int KEYFRAME_REQUEST_WINDOW = SYNTHETIC_IN_FLIGHT + 2;
+// Stop reporting the same kind of problem after this many.
+static constexpr unsigned int MAX_ERRORS = 10;
+
+// Everything the callbacks tell us, checked as it happens and again at the end.
+class Checker
+{
+public:
+	using Clock = std::chrono::steady_clock;
+
+	Checker(std::string const &name) : name_(name) {}
+
+	void Submitted(EncodeToken token, int64_t timestamp_us, void const *mem, size_t size)
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		frames_.push_back({ timestamp_us, (uint8_t const *)mem, size, Clock::now(), {}, false, false });
+		by_timestamp_[timestamp_us] = token;
+		in_flight_++;
+	}
+
+	void WaitForSpace()
+	{
+		std::unique_lock<std::mutex> lock(mutex_);
+		cv_.wait(lock, [this] { return in_flight_ < SYNTHETIC_IN_FLIGHT; });
+	}
+
+	void InputDone(EncodeToken token)
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		if (closed_)
+			error("input done callback after the encoder was deleted");
+		if (token >= frames_.size())
+			error("input done for unknown token " + std::to_string(token));
+		else if (frames_[token].input_done)
+			error("input done twice for token " + std::to_string(token));
+		else
+		{
+			frames_[token].input_done = true;
+			in_flight_--;
+			cv_.notify_one();
+		}
+	}
+
+	void OutputReady(void *mem, size_t size, int64_t timestamp_us, bool keyframe)
+	{
+		Clock::time_point now = Clock::now();
+		bool overlap = in_output_++ > 0;
+
+		std::lock_guard<std::mutex> lock(mutex_);
+		if (overlap)
+			error("output ready callbacks overlap");
+		if (closed_)
+			error("output ready callback after the encoder was deleted");
+		if (!mem || !size)
+			error("empty output buffer");
+
+		// Encoders may rebase timestamps to start from zero, which we discover from the first output.
+		if (outputs_.empty())
+			timestamp_offset_ = frames_.empty() ? 0 : frames_[0].timestamp_us - timestamp_us;
+		int64_t ts = timestamp_us + timestamp_offset_;
+		outputs_.push_back({ ts, keyframe });
+
+		auto it = by_timestamp_.find(ts);
+		if (it == by_timestamp_.end())
+			error("output timestamp " + std::to_string(timestamp_us) + " doesn't match any frame");
+		else
+		{
+			Frame &frame = frames_[it->second];
+			if (frame.output)
+				error("more than one output for timestamp " + std::to_string(ts));
+			// Encoders may write straight out of the input buffer (as the null encoder can), but
+			// then they must keep hold of it until the output is done.
+			uint8_t const *out = (uint8_t const *)mem;
+			if (frame.input_done && out + size > frame.mem && out < frame.mem + frame.size)
+				error("output from an input buffer already returned, for timestamp " + std::to_string(ts));
+			frame.output = true;
+			frame.output_time = now;
+		}
+
+		// Codecs with B frames may output frames out of order, but never before the keyframe that
+		// starts their group.
+		if (outputs_.size() > 1 && ts <= outputs_[outputs_.size() - 2].timestamp_us)
+		{
+			reordered_++;
+			if (ts <= last_keyframe_us_ || keyframe)
+				error("timestamp " + std::to_string(ts) + " goes back before the last keyframe");
+		}
+		if (keyframe)
+			last_keyframe_us_ = ts;
+
+		in_output_--;
+	}
+
+	void KeyframeRequested()
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		keyframe_request_ = frames_.size();
+	}
+
+	// Call once the encoder has been deleted, so should have finished with everything.
+	void Close(unsigned int intra)
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		closed_ = true;
+
+		unsigned int lost = 0, not_returned = 0;
+		for (auto const &frame : frames_)
+		{
+			lost += !frame.output;
+			not_returned += !frame.input_done;
+		}
+		if (not_returned)
+			error(std::to_string(not_returned) + " input buffers never returned");
+		if (lost)
+			error(std::to_string(lost) + " frames never output (not drained at shutdown?)");
+
+		if (!outputs_.empty() && !outputs_[0].keyframe)
+			error("first output is not a keyframe");
+		if (intra)
+		{
+			unsigned int since_keyframe = 0;
+			for (auto const &output : outputs_)
+			{
+				since_keyframe = output.keyframe ? 0 : since_keyframe + 1;
+				if (since_keyframe >= intra)
+				{
+					error("no keyframe for " + std::to_string(since_keyframe + 1) + " frames with intra " +
+						  std::to_string(intra));
+					break;
+				}
+			}
+		}
+		if (keyframe_request_)
+		{
+			size_t first = std::min<size_t>(keyframe_request_ - std::min(keyframe_request_, KEYFRAME_REQUEST_WINDOW),
+											outputs_.size());
+			size_t last = std::min<size_t>(keyframe_request_ + KEYFRAME_REQUEST_WINDOW, outputs_.size());
+			if (std::none_of(outputs_.begin() + first, outputs_.begin() + last,
+							 [](Output const &output) { return output.keyframe; }))
+				error("no keyframe near frame " + std::to_string(keyframe_request_) + " when one was requested");
+		}
+	}
+
+	// Latencies from giving each frame to the encoder until its output, in ms and sorted.
+	std::vector<double> Latencies() const
+	{
+		std::vector<double> latencies;
+		for (auto const &frame : frames_)
+		{
+			if (frame.output)
+				latencies.push_back(
+					std::chrono::duration<double, std::milli>(frame.output_time - frame.submit_time).count());
+		}
+		std::sort(latencies.begin(), latencies.end());
+		return latencies;
+	}
+
+	unsigned int Errors() const { return errors_; }
+	unsigned int Reordered() const { return reordered_; }
+
+private:
+	struct Frame
+	{
+		int64_t timestamp_us;
+		uint8_t const *mem;
+		size_t size;
+		Clock::time_point submit_time;
+		Clock::time_point output_time;
+		bool input_done;
+		bool output;
+	};
+	struct Output
+	{
+		int64_t timestamp_us;
+		bool keyframe;
+	};
+
+	void error(std::string const &msg)
+	{
+		if (errors_++ < MAX_ERRORS)
+			LOG_ERROR(name_ << ": FAIL: " << msg);
+	}
+
+	std::string name_;
+	std::mutex mutex_;
+	std::condition_variable cv_;
+	std::vector<Frame> frames_; // indexed by token
+	std::map<int64_t, EncodeToken> by_timestamp_;
+	std::vector<Output> outputs_;
+	std::atomic<unsigned int> in_output_ { 0 };
+	unsigned int in_flight_ = 0;
+	int64_t timestamp_offset_ = 0;
+	int64_t last_keyframe_us_ = -1;
+	unsigned int keyframe_request_ = 0;
+	unsigned int reordered_ = 0;
+	unsigned int errors_ = 0;
+	bool closed_ = false;
+};
+
+static double peak_rss_mb()
+{
+	rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_maxrss / 1024.0;
+}
+
+static double percentile(std::vector<double> const &sorted, double p)
+{
+	if (sorted.empty())
+		return 0;
+	return sorted[std::min<size_t>(sorted.size() - 1, sorted.size() * p / 100)];
+}
+
+// Returns false if the encoder failed any of the checks.
+static bool check_encoder(EncodeCheckOptions const *options, std::string const &name, StreamInfo const &info,
+						  std::vector<std::vector<uint8_t>> const &frames)
+{
+	EncoderFactory &factory = EncoderFactory::GetInstance();
+	if (!factory.HasEncoder(name))
+	{
+		LOG_ERROR(name << ": FAIL: no such encoder");
+		return false;
+	}
+
+	VideoOptions encode_options;
+	encode_options.Set() = options->Get();
+	encode_options.Set().libav_audio = false;
+	// The output is thrown away, but libav only hands encoded frames to the output callback for H.264
+	// elementary streams, which it still wants to open as a file.
+	std::string scratch_file;
+	if (name == "libav")
+	{
+		char const *tmpdir = getenv("TMPDIR");
+		scratch_file = std::string(tmpdir ? tmpdir : "/tmp") + "/rpicam-encode-check-" + std::to_string(getpid()) +
+					   ".h264";
+		encode_options.Set().output = scratch_file;
+		encode_options.Set().libav_format = "h264";
+	}
+	else
+		encode_options.Set().output.clear();
+
+	Checker checker(name);
+	std::unique_ptr<Encoder> encoder;
+	try
+	{
+		encoder.reset(factory.CreateEncoder(name)(&encode_options, info));
+	}
+	catch (std::exception const &e)
+	{
+		LOG_ERROR(name << ": FAIL: could not create encoder: " << e.what());
+		if (!scratch_file.empty())
+			unlink(scratch_file.c_str());
+		return false;
+	}
+	encoder->SetInputDoneCallback(std::bind(&Checker::InputDone, &checker, std::placeholders::_1));
+	encoder->SetOutputReadyCallback(std::bind(&Checker::OutputReady, &checker, std::placeholders::_1,
+											  std::placeholders::_2, std::placeholders::_3, std::placeholders::_4));
+
+	double framerate = options->Get().framerate.value_or(DEFAULT_FRAMERATE);
+	unsigned int num_frames = options->Get().frames;
+	auto start = std::chrono::steady_clock::now();
+
+	for (unsigned int i = 0; i < num_frames; i++)
+	{
+		if (options->realtime)
+			std::this_thread::sleep_until(start + std::chrono::microseconds((int64_t)(i * 1000000 / framerate)));
+		checker.WaitForSpace();
+
+		// Halfway through, see if the encoder can make a keyframe when asked.
+		if (i == num_frames / 2 && encoder->RequestKeyframe())
+			checker.KeyframeRequested();
+
+		std::vector<uint8_t> const &frame = frames[i % SYNTHETIC_NUM_FRAMES];
+		int64_t timestamp_us = START_TIMESTAMP_US + (int64_t)(i * 1000000 / framerate);
+		checker.Submitted(i, timestamp_us, frame.data(), frame.size());
+		encoder->EncodeBuffer(-1, frame.size(), (void *)frame.data(), info, timestamp_us, i);
+	}
+	// Deleting the encoder must wait for everything to be encoded and handed back.
+	encoder.reset();
+	if (!scratch_file.empty())
+		unlink(scratch_file.c_str());
+
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	checker.Close(options->Get().intra);
+
+	std::vector<double> latencies = checker.Latencies();
+	bool pass = !checker.Errors();
+	std::cout << name << "," << num_frames / elapsed.count() << "," << percentile(latencies, 0) << ","
+			  << percentile(latencies, 50) << "," << percentile(latencies, 90) << "," << percentile(latencies, 99)
+			  << "," << percentile(latencies, 100) << "," << peak_rss_mb() << "," << checker.Reordered() << ","
+			  << (pass ? "pass" : "FAIL") << std::endl;
+	return pass;
+}
+
+static bool run_checks(RPiCamEncodeCheck &app)
+{
+	EncodeCheckOptions const *options = app.GetOptions();
+	EncoderFactory::GetInstance().LoadEncoderLibraries(options->Get().encoder_libs);
+
+	StreamInfo info = synthetic_stream_info(options->Get().width, options->Get().height);
+	std::vector<std::vector<uint8_t>> frames = make_synthetic_frames(info, options->pattern);
+
+	std::cout << info.width << "x" << info.height << " " << options->pattern << " at "
+			  << options->Get().framerate.value_or(DEFAULT_FRAMERATE) << "fps"
+			  << (options->realtime ? " (realtime), " : ", ") << options->Get().frames << " frames" << std::endl;
+	// Peak memory is for the whole process so far, so can only go up from one encoder to the next.
+	std::cout << "encoder,fps,latency_min_ms,latency_p50_ms,latency_p90_ms,latency_p99_ms,latency_max_ms,peak_rss_mb,"
+				 "reordered,result"
+			  << std::endl;
+
+	bool pass = true;
+	std::stringstream ss(options->encoders);
+	for (std::string name; std::getline(ss, name, ',');)
+		pass &= check_encoder(options, name, info, frames);
+	return pass;
+}
+
+int main(int argc, char *argv[])
+{
+	try
+	{
+		RPiCamEncodeCheck app;
+		EncodeCheckOptions *options = app.GetOptions();
+		if (options->Parse(argc, argv))
+		{
+			if (options->Get().verbose >= 2)
+				options->Print();
+
+			if (!run_checks(app))
+				return 1;
+		}
+	}
+	catch (std::exception const &e)
+	{
+		LOG_ERROR("ERROR: *** " << e.what() << " ***");
+		return -1;
+	}
+	return 0;
+}
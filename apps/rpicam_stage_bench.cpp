@@ -0,0 +1,439 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * Copyright (C) 2025, Raspberry Pi Ltd
+ *
+ * rpicam_stage_bench.cpp - run post-processing stages on synthetic or recorded frames, without a camera.
+ */
+
+// Example: rpicam-stage-bench --post-process-file hdr.json --width 1920 --height 1080 --frames 200
+//          rpicam-stage-bench --stage sobel_cv --input recording.yuv --width 1280 --height 720
+
+#include <sys/mman.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+#include <boost/property_tree/ptree.hpp>
+
+#include <libcamera/control_ids.h>
+#include <libcamera/formats.h>
+#include <libcamera/stream.h>
+
+#include "core/rpicam_app.hpp"
+#include "core/buffer_sync.hpp"
+#include "core/dma_heaps.hpp"
+#include "core/options.hpp"
+#include "core/plugin_loader.hpp"
+
+#include "post_processing_stages/post_processing_stage.hpp"
+
+#include "config.h"
+
+using libcamera::FrameBuffer;
+using libcamera::Span;
+using libcamera::StreamConfiguration;
+
+struct StageBenchOptions : public Options
+{
+	StageBenchOptions() : Options()
+	{
+		using namespace boost::program_options;
+		// clang-format off
+		options_->add_options()
+			("stage", value<std::string>(&stage),
+			 "Comma separated list of stages to run with their default parameters, instead of --post-process-file")
+			("list-stages", value<bool>(&list_stages)->default_value(false)->implicit_value(true),
+			 "List the stages that can be benchmarked and exit")
+			("input", value<std::string>(&input),
+			 "Read YUV420 frames of the given width and height from this file, instead of making synthetic ones")
+			("frames", value<unsigned int>(&frames)->default_value(100),
+			 "Number of frames to process")
+			;
+		// clang-format on
+	}
+
+	std::string stage;
+	bool list_stages;
+	std::string input;
+	unsigned int frames;
+
+	virtual bool Parse(int argc, char *argv[]) override
+	{
+		if (Options::Parse(argc, argv) == false)
+			return false;
+
+		if (!Get().width || !Get().height)
+		{
+			Set().width = 1920;
+			Set().height = 1080;
+		}
+		if (!list_stages && stage.empty() && Get().post_process_file.empty())
+			throw std::runtime_error("a --stage or --post-process-file is required");
+		if (!frames)
+			throw std::runtime_error("--frames must be at least 1");
+
+		return true;
+	}
+
+	virtual void Print() const override
+	{
+		Options::Print();
+		std::cerr << "    stage: " << stage << std::endl;
+		std::cerr << "    input: " << input << std::endl;
+		std::cerr << "    frames: " << frames << std::endl;
+	}
+};
+
+// A stream that never belonged to a camera. libcamera only lets cameras configure streams, but the
+// configuration is a protected member, so we may fill it in ourselves.
+class OfflineStream : public libcamera::Stream
+{
+public:
+	OfflineStream(StreamConfiguration const &config) { configuration_ = config; }
+};
+
+class RPiCamStageBench : public RPiCamApp
+{
+public:
+	RPiCamStageBench() : RPiCamApp(std::make_unique<StageBenchOptions>()) {}
+	StageBenchOptions *GetOptions() const { return static_cast<StageBenchOptions *>(RPiCamApp::GetOptions()); }
+
+	using RPiCamApp::AddOfflineStream;
+	using RPiCamApp::GetLoresFormat;
+};
+
+// Synthetic or recorded YUV420 frames at the main stream size, with no padding between rows.
+class FrameSource
+{
+public:
+	FrameSource(std::string const &filename, unsigned int width, unsigned int height)
+		: width_(width), height_(height), frame_(width * height * 3 / 2)
+	{
+		if (filename.empty())
+			return;
+
+		file_.open(filename, std::ios::binary);
+		if (!file_)
+			throw std::runtime_error("failed to open input file " + filename);
+	}
+
+	// Returns the next frame, going back to the start of the file when we run out.
+	std::vector<uint8_t> const &Next(unsigned int count)
+	{
+		if (!file_.is_open())
+		{
+			synthesise(count);
+			return frame_;
+		}
+
+		if (!file_.read(reinterpret_cast<char *>(frame_.data()), frame_.size()))
+		{
+			file_.clear();
+			file_.seekg(0);
+			if (!file_.read(reinterpret_cast<char *>(frame_.data()), frame_.size()))
+				throw std::runtime_error("input file holds less than one " + std::to_string(width_) + "x" +
+										 std::to_string(height_) + " YUV420 frame");
+		}
+		return frame_;
+	}
+
+private:
+	// Diagonal bands that move a little every frame, with a slowly changing colour, so that stages
+	// looking for edges or motion have something to find.
+	void synthesise(unsigned int count)
+	{
+		uint8_t *y = frame_.data();
+		for (unsigned int row = 0; row < height_; row++)
+			for (unsigned int col = 0; col < width_; col++)
+				*(y++) = (((row + col + 4 * count) / 32) & 1) ? 200 : 40;
+
+		unsigned int uv_size = (width_ / 2) * (height_ / 2);
+		std::fill(frame_.begin() + width_ * height_, frame_.begin() + width_ * height_ + uv_size, 128 + count % 64);
+		std::fill(frame_.begin() + width_ * height_ + uv_size, frame_.end(), 128 - count % 64);
+	}
+
+	unsigned int width_;
+	unsigned int height_;
+	std::vector<uint8_t> frame_;
+	std::ifstream file_;
+};
+
+static void write_yuv420(std::vector<uint8_t> const &src, unsigned int src_w, unsigned int src_h, uint8_t *dst,
+						 StreamConfiguration const &config)
+{
+	// Nearest neighbour scaling is fine here, we're only after realistic content.
+	for (unsigned int plane = 0; plane < 3; plane++)
+	{
+		unsigned int shift = plane ? 1 : 0;
+		unsigned int sw = src_w >> shift, sh = src_h >> shift;
+		unsigned int dw = config.size.width >> shift, dh = config.size.height >> shift;
+		unsigned int dstride = config.stride >> shift;
+		uint8_t const *s = src.data() + (plane ? src_w * src_h + (plane - 1) * sw * sh : 0);
+		uint8_t *d = dst + (plane ? config.stride * config.size.height + (plane - 1) * dstride * dh : 0);
+
+		for (unsigned int row = 0; row < dh; row++)
+		{
+			uint8_t const *s_row = s + (row * sh / dh) * sw;
+			for (unsigned int col = 0; col < dw; col++)
+				d[row * dstride + col] = s_row[col * sw / dw];
+		}
+	}
+}
+
+static void write_rgb(std::vector<uint8_t> const &src, unsigned int src_w, unsigned int src_h, uint8_t *dst,
+					  StreamConfiguration const &config)
+{
+	// BT.601 full range. libcamera's BGR888 stores red first in memory, which is what the stages expect.
+	bool red_first = config.pixelFormat == libcamera::formats::BGR888;
+	uint8_t const *u_plane = src.data() + src_w * src_h;
+	uint8_t const *v_plane = u_plane + (src_w / 2) * (src_h / 2);
+
+	for (unsigned int row = 0; row < config.size.height; row++)
+	{
+		unsigned int sy = row * src_h / config.size.height;
+		uint8_t *d = dst + row * config.stride;
+		for (unsigned int col = 0; col < config.size.width; col++)
+		{
+			unsigned int sx = col * src_w / config.size.width;
+			int y = src[sy * src_w + sx];
+			int u = u_plane[(sy / 2) * (src_w / 2) + sx / 2] - 128;
+			int v = v_plane[(sy / 2) * (src_w / 2) + sx / 2] - 128;
+			int r = std::clamp(y + ((91881 * v) >> 16), 0, 255);
+			int g = std::clamp(y - ((22554 * u + 46802 * v) >> 16), 0, 255);
+			int b = std::clamp(y + ((116130 * u) >> 16), 0, 255);
+			*(d++) = red_first ? r : b;
+			*(d++) = g;
+			*(d++) = red_first ? b : r;
+		}
+	}
+}
+
+static StreamConfiguration make_config(unsigned int width, unsigned int height, libcamera::PixelFormat format,
+									   unsigned int buffer_count)
+{
+	StreamConfiguration config;
+	config.size = libcamera::Size(width, height);
+	config.pixelFormat = format;
+	config.bufferCount = buffer_count;
+	config.colorSpace = libcamera::ColorSpace::Rec709;
+	return config;
+}
+
+static void finalise_config(StreamConfiguration &config)
+{
+	// Match the 64 byte row alignment the ISP gives us.
+	if (config.pixelFormat == libcamera::formats::YUV420)
+	{
+		config.stride = (config.size.width + 63) & ~63;
+		config.frameSize = config.stride * config.size.height * 3 / 2;
+	}
+	else
+	{
+		config.stride = (config.size.width * 3 + 63) & ~63;
+		config.frameSize = config.stride * config.size.height;
+	}
+}
+
+static std::vector<std::unique_ptr<FrameBuffer>> allocate_buffers(DmaHeap &dma_heap, StreamConfiguration const &config,
+																  std::map<FrameBuffer *, std::vector<Span<uint8_t>>> &mapped)
+{
+	std::vector<std::unique_ptr<FrameBuffer>> buffers;
+	for (unsigned int i = 0; i < config.bufferCount; i++)
+	{
+		std::string name("rpicam-stage-bench" + std::to_string(i));
+		libcamera::UniqueFD fd = dma_heap.alloc(name.c_str(), config.frameSize);
+		if (!fd.isValid())
+			throw std::runtime_error("failed to allocate benchmark buffers");
+
+		std::vector<FrameBuffer::Plane> plane(1);
+		plane[0].fd = libcamera::SharedFD(std::move(fd));
+		plane[0].offset = 0;
+		plane[0].length = config.frameSize;
+
+		buffers.push_back(std::make_unique<FrameBuffer>(plane));
+		void *memory = mmap(NULL, config.frameSize, PROT_READ | PROT_WRITE, MAP_SHARED, plane[0].fd.get(), 0);
+		if (memory == MAP_FAILED)
+			throw std::runtime_error("failed to mmap benchmark buffer");
+		mapped[buffers.back().get()].push_back(Span<uint8_t>(static_cast<uint8_t *>(memory), config.frameSize));
+	}
+	return buffers;
+}
+
+static void list_stages(StageBenchOptions const *options)
+{
+	PluginLoader loader;
+	loader.SetPath(options->Get().post_process_libs, POSTPROC_LIB_DIR);
+	loader.LoadAll();
+
+	std::cout << "Available post-processing stages:" << std::endl;
+	for (auto const &[name, create] : GetPostProcessingStages())
+		std::cout << "    " << name << std::endl;
+}
+
+static void run_bench(RPiCamStageBench &app)
+{
+	StageBenchOptions const *options = app.GetOptions();
+	PostProcessor post_processor(&app);
+
+	post_processor.LoadModules(options->Get().post_process_libs);
+	if (!options->Get().post_process_file.empty())
+		post_processor.Read(options->Get().post_process_file);
+	else
+	{
+		boost::property_tree::ptree root;
+		std::stringstream names(options->stage);
+		std::string name;
+		while (std::getline(names, name, ','))
+			root.push_back({ name, boost::property_tree::ptree() });
+		post_processor.Read(root);
+	}
+
+	// Stages may ask for more buffers, just as they would from the camera.
+	unsigned int buffer_count = options->Get().buffer_count ? options->Get().buffer_count : 4;
+	StreamConfiguration main_config =
+		make_config(options->Get().width, options->Get().height, libcamera::formats::YUV420, buffer_count);
+	post_processor.AdjustConfig("video", &main_config);
+	finalise_config(main_config);
+
+	bool have_lores = options->Get().lores_width && options->Get().lores_height;
+	StreamConfiguration lores_config = make_config(options->Get().lores_width, options->Get().lores_height,
+												   app.GetLoresFormat(), main_config.bufferCount);
+	if (have_lores)
+		finalise_config(lores_config);
+
+	DmaHeap dma_heap;
+	if (!dma_heap.isValid())
+		throw std::runtime_error("no dma-heap available to allocate benchmark buffers from");
+
+	std::map<FrameBuffer *, std::vector<Span<uint8_t>>> mapped;
+	OfflineStream main_stream(main_config), lores_stream(lores_config);
+	std::vector<std::unique_ptr<FrameBuffer>> main_buffers = allocate_buffers(dma_heap, main_config, mapped);
+	std::vector<std::unique_ptr<FrameBuffer>> lores_buffers;
+	if (have_lores)
+		lores_buffers = allocate_buffers(dma_heap, lores_config, mapped);
+	// From here on the application owns the mappings, and Teardown() will unmap them.
+	app.AddOfflineStream("video", &main_stream, mapped);
+	if (have_lores)
+		app.AddOfflineStream("lores", &lores_stream, {});
+
+	LOG(1, "Benchmarking " << options->frames << " frames of " << main_config.toString()
+						   << (have_lores ? " with lores " + lores_config.toString() : ""));
+
+	std::mutex mutex;
+	std::condition_variable cv;
+	std::vector<bool> busy(main_buffers.size(), false);
+	unsigned int output_frames = 0;
+
+	post_processor.SetCallback([&](CompletedRequestPtr &) {
+		std::lock_guard<std::mutex> lock(mutex);
+		output_frames++;
+	});
+
+	FrameSource source(options->input, options->Get().width, options->Get().height);
+
+	post_processor.Configure();
+	post_processor.Start();
+
+	std::chrono::nanoseconds frame_interval(0);
+	if (options->Get().framerate && options->Get().framerate.value() > 0)
+		frame_interval = std::chrono::nanoseconds((int64_t)(1e9 / options->Get().framerate.value()));
+
+	auto start_time = std::chrono::steady_clock::now();
+	for (unsigned int count = 0; count < options->frames; count++)
+	{
+		unsigned int slot = count % main_buffers.size();
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			cv.wait(lock, [&] { return !busy[slot]; });
+			busy[slot] = true;
+		}
+
+		if (frame_interval.count())
+			std::this_thread::sleep_until(start_time + count * frame_interval);
+
+		std::vector<uint8_t> const &frame = source.Next(count);
+		CompletedRequest::BufferMap buffers;
+		buffers[&main_stream] = main_buffers[slot].get();
+		{
+			BufferWriteSync w(&app, main_buffers[slot].get());
+			write_yuv420(frame, options->Get().width, options->Get().height, w.Get()[0].data(), main_config);
+		}
+		if (have_lores)
+		{
+			buffers[&lores_stream] = lores_buffers[slot].get();
+			BufferWriteSync w(&app, lores_buffers[slot].get());
+			if (lores_config.pixelFormat == libcamera::formats::YUV420)
+				write_yuv420(frame, options->Get().width, options->Get().height, w.Get()[0].data(), lores_config);
+			else
+				write_rgb(frame, options->Get().width, options->Get().height, w.Get()[0].data(), lores_config);
+		}
+
+		libcamera::ControlList metadata(libcamera::controls::controls);
+		int64_t timestamp = std::chrono::duration_cast<std::chrono::nanoseconds>(
+								std::chrono::steady_clock::now().time_since_epoch()).count();
+		metadata.set(libcamera::controls::SensorTimestamp, timestamp);
+		metadata.set(libcamera::controls::ExposureTime, 10000);
+		metadata.set(libcamera::controls::AnalogueGain, 1.0f);
+		metadata.set(libcamera::controls::DigitalGain, 1.0f);
+		metadata.set(libcamera::controls::FrameDuration, INT64_C(33333));
+
+		// The deleter runs once the last stage (or the output callback) lets go of the frame, whether
+		// or not it was dropped, so only then may the buffer be filled again.
+		CompletedRequestPtr request(new CompletedRequest(count, buffers, metadata), [&, slot](CompletedRequest *r) {
+			delete r;
+			std::lock_guard<std::mutex> lock(mutex);
+			busy[slot] = false;
+			cv.notify_all();
+		});
+		request->framerate = frame_interval.count() ? 1e9 / frame_interval.count() : 30;
+		post_processor.Process(request);
+	}
+
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		cv.wait(lock, [&] { return std::none_of(busy.begin(), busy.end(), [](bool b) { return b; }); });
+	}
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start_time;
+
+	post_processor.Stop();
+
+	std::cout << "frames " << options->frames << " output " << output_frames << " time " << elapsed.count()
+			  << "s fps " << options->frames / elapsed.count() << std::endl;
+	std::cout << "stage,frames,dropped,min_us,avg_us,p99_us,max_us" << std::endl;
+	for (auto const &t : post_processor.GetStageTimings())
+		std::cout << t.name << "," << t.frames << "," << t.dropped << "," << t.min_us << "," << t.avg_us << ","
+				  << t.p99_us << "," << t.max_us << std::endl;
+
+	post_processor.Teardown();
+	app.Teardown();
+}
+
+int main(int argc, char *argv[])
+{
+	try
+	{
+		RPiCamStageBench app;
+		StageBenchOptions *options = app.GetOptions();
+		if (options->Parse(argc, argv))
+		{
+			if (options->Get().verbose >= 2)
+				options->Print();
+
+			if (options->list_stages)
+				list_stages(options);
+			else
+				run_bench(app);
+		}
+	}
+	catch (std::exception const &e)
+	{
+		LOG_ERROR("ERROR: *** " << e.what() << " ***");
+		return -1;
+	}
+	return 0;
+}
@@ -6,11 +6,13 @@
  */
 
 #include <chrono>
+#include <cmath>
 #include <poll.h>
 #include <signal.h>
 #include <sys/signalfd.h>
 #include <sys/stat.h>
 
+#include "core/event_trigger.hpp"
 #include "core/rpicam_encoder.hpp"
 #include "output/output.hpp"
 #include "core/camera_control_unit.hpp"
@@ -61,6 +63,36 @@ static int get_colourspace_flags(std::string const &codec)
 		return RPiCamEncoder::FLAG_VIDEO_NONE;
 }
 
+// Start or stop recording an event, and return whether this frame should be encoded.
+
+static bool update_event(RPiCamEncoder &app, Output *output, EventTrigger *event_trigger,
+						 CompletedRequestPtr &completed_request, bool &event_active, unsigned int &idle_count)
+{
+	VideoOptions const *options = app.GetOptions();
+	bool active = event_trigger->Update(completed_request->post_process_metadata);
+	output->Trigger(active);
+
+	// When nothing was encoded while idle, the event can't be written until there's a keyframe.
+	if (active && !event_active && options->Get().event_idle == "skip")
+		app.RequestKeyframe();
+	if (active != event_active)
+		idle_count = 0;
+	event_active = active;
+
+	if (active || options->Get().event_idle == "encode")
+		return true;
+	else if (options->Get().event_idle == "keyframes")
+	{
+		// Each frame we do encode is a keyframe, so that the pre-roll can start from any of them.
+		unsigned int interval = std::max(1.0f, std::round(options->Get().framerate.value_or(DEFAULT_FRAMERATE)));
+		if (idle_count++ % interval)
+			return false;
+		app.RequestKeyframe();
+		return true;
+	}
+	return false;
+}
+
 // The main even loop for the application.
 
 static void event_loop(RPiCamEncoder &app)
@@ -69,6 +101,18 @@ static void event_loop(RPiCamEncoder &app)
 	std::unique_ptr<Output> output = std::unique_ptr<Output>(Output::Create(options));
 	app.SetEncodeOutputReadyCallback(std::bind(&Output::OutputReady, output.get(), _1, _2, _3, _4));
 	app.SetMetadataReadyCallback(std::bind(&Output::MetadataReady, output.get(), _1));
+	output->SetKeyframeRequestCallback([&app]() { app.RequestKeyframe(); });
+
+	// Each simulcast encoder writes to its own output.
+	std::vector<std::unique_ptr<Output>> simulcast_outputs;
+	for (VideoOptions const *simulcast_options : app.GetSimulcastOptions())
+	{
+		simulcast_outputs.emplace_back(Output::Create(simulcast_options));
+		unsigned int index = simulcast_outputs.size() - 1;
+		app.SetSimulcastOutputReadyCallback(index,
+											std::bind(&Output::OutputReady, simulcast_outputs.back().get(), _1, _2, _3, _4));
+		simulcast_outputs.back()->SetKeyframeRequestCallback([&app, index]() { app.RequestKeyframe(index); });
+	}
 
 	app.OpenCamera();
 	app.ConfigureVideo(get_colourspace_flags(options->Get().codec));
@@ -77,6 +121,14 @@ static void event_loop(RPiCamEncoder &app)
 	auto start_time = std::chrono::high_resolution_clock::now();
 
 	CameraControlUnit ccu = CameraControlUnit(&app, 56788);
+	ccu.setEncoder(&app);
+
+	// With adaptive bitrate, the rate controller watches how well the output keeps up.
+	if (RateController *rate_controller = app.GetRateController())
+	{
+		output->SetFeedbackCallback(std::bind(&RateController::Feedback, rate_controller, _1, _2));
+		ccu.setRateController(rate_controller);
+	}
 
 	// Monitoring for keypresses and signals.
 	signal(SIGUSR1, default_signal_handler);
@@ -88,6 +140,13 @@ static void event_loop(RPiCamEncoder &app)
 	signal(SIGPIPE, default_signal_handler);
 	pollfd p[1] = { { STDIN_FILENO, POLLIN, 0 } };
 
+	// With --event, the output only records while the post-processing metadata says so.
+	std::unique_ptr<EventTrigger> event_trigger;
+	if (!options->Get().event.empty())
+		event_trigger = std::make_unique<EventTrigger>(options->Get().event, options->Get().event_postroll);
+	bool event_active = false;
+	unsigned int idle_count = 0;
+
 	for (unsigned int count = 0; ; count++)
 	{
 		RPiCamEncoder::Msg msg = app.Wait();
@@ -123,7 +182,10 @@ static void event_loop(RPiCamEncoder &app)
 			return;
 		}
 		CompletedRequestPtr &completed_request = std::get<CompletedRequestPtr>(msg.payload);
-		if (!app.EncodeBuffer(completed_request, app.VideoStream()))
+		bool encode = true;
+		if (event_trigger)
+			encode = update_event(app, output.get(), event_trigger.get(), completed_request, event_active, idle_count);
+		if (encode && !app.EncodeBuffer(completed_request, app.VideoStream()))
 		{
 			// Keep advancing our "start time" if we're still waiting to start recording (e.g.
 			// waiting for synchronisation with another camera).
@@ -0,0 +1,158 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * Copyright (C) 2025, Raspberry Pi Ltd
+ *
+ * buffer_tuner.cpp - Find the number of camera buffers the pipeline really needs.
+ */
+
+#include <algorithm>
+#include <cmath>
+
+#include "core/buffer_tuner.hpp"
+
+namespace
+{
+
+unsigned int configured_count(std::string const &use_case, std::vector<BufferTuner::StreamMemory> const &streams)
+{
+	for (auto const &s : streams)
+	{
+		if (s.name == use_case)
+			return s.buffer_count;
+	}
+	return streams.empty() ? 0 : streams[0].buffer_count;
+}
+
+double percentile(std::vector<double> samples, double p)
+{
+	if (samples.empty())
+		return 0;
+	size_t n = std::min(samples.size() - 1, (size_t)(samples.size() * p / 100));
+	std::nth_element(samples.begin(), samples.begin() + n, samples.end());
+	return samples[n];
+}
+
+} // namespace
+
+void BufferTuner::Start(std::string const &use_case, std::vector<StreamMemory> const &streams)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	running_ = true;
+	use_case_ = use_case;
+	streams_ = streams;
+	held_.clear();
+	max_held_ = 0;
+	hold_ms_.clear();
+	hold_index_ = 0;
+	max_hold_ms_ = 0;
+	frames_ = 0;
+	dropped_ = 0;
+	last_timestamp_ = 0;
+	min_interval_ns_ = 0;
+	recommended_ = 0;
+}
+
+void BufferTuner::FrameArrived(void const *frame, unsigned int sequence, uint64_t timestamp_ns)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	if (!running_)
+		return;
+
+	// A gap in the sequence numbers means the sensor delivered frames that we had no buffer for.
+	if (frames_ && sequence > last_sequence_ + 1)
+		dropped_ += sequence - last_sequence_ - 1;
+	if (frames_ && timestamp_ns > last_timestamp_)
+	{
+		uint64_t interval = timestamp_ns - last_timestamp_;
+		if (!min_interval_ns_ || interval < min_interval_ns_)
+			min_interval_ns_ = interval;
+	}
+	last_sequence_ = sequence;
+	last_timestamp_ = timestamp_ns;
+	frames_++;
+
+	held_[frame] = Clock::now();
+	max_held_ = std::max(max_held_, (unsigned int)held_.size());
+}
+
+void BufferTuner::FrameReleased(void const *frame)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	auto it = held_.find(frame);
+	if (it == held_.end())
+		return;
+
+	std::chrono::duration<double, std::milli> t = Clock::now() - it->second;
+	held_.erase(it);
+
+	if (hold_ms_.size() < HOLD_HISTORY)
+		hold_ms_.push_back(t.count());
+	else
+		hold_ms_[hold_index_] = t.count();
+	hold_index_ = (hold_index_ + 1) % HOLD_HISTORY;
+	max_hold_ms_ = std::max(max_hold_ms_, t.count());
+}
+
+bool BufferTuner::Stop()
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	if (!running_)
+		return false;
+	running_ = false;
+	held_.clear();
+
+	if (frames_ < 2 || !min_interval_ns_ || hold_ms_.empty())
+		return true;
+
+	// Frames held for longer than the interval overlap, so this many are held at once. The camera
+	// needs its own few on top, and if we still dropped frames, we must have needed more than we had.
+	double interval_ms = min_interval_ns_ / 1e6;
+	unsigned int held = std::max(1u, (unsigned int)std::ceil(percentile(hold_ms_, 99) / interval_ms));
+	recommended_ = held + CAMERA_QUEUE_DEPTH;
+	unsigned int configured = configured_count(use_case_, streams_);
+	if (dropped_ && recommended_ <= configured)
+		recommended_ = configured + 1;
+
+	recommendations_[use_case_] = recommended_;
+	return true;
+}
+
+unsigned int BufferTuner::Recommendation(std::string const &use_case) const
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	auto it = recommendations_.find(use_case);
+	return it == recommendations_.end() ? 0 : it->second;
+}
+
+void BufferTuner::Report(std::ostream &os) const
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	constexpr double MB = 1024.0 * 1024.0;
+
+	os << "Buffer tuning (" << use_case_ << "): " << frames_ << " frames, " << dropped_ << " dropped";
+	if (min_interval_ns_)
+		os << ", frame interval " << min_interval_ns_ / 1e6 << "ms";
+	os << std::endl;
+	double avg_hold_ms = 0;
+	for (double t : hold_ms_)
+		avg_hold_ms += t / hold_ms_.size();
+	os << "    held: avg " << avg_hold_ms << "ms p99 " << percentile(hold_ms_, 99) << "ms max " << max_hold_ms_
+	   << "ms, up to " << max_held_ << " at once" << std::endl;
+
+	double total = 0, recommended_total = 0;
+	for (auto const &s : streams_)
+	{
+		double size = s.buffer_count * s.frame_size / MB;
+		os << "    " << s.name << ": " << s.buffer_count << " x " << s.frame_size / MB << "MB = " << size << "MB"
+		   << std::endl;
+		total += size;
+		recommended_total += (recommended_ ? recommended_ : s.buffer_count) * s.frame_size / MB;
+	}
+	os << "    total: " << total << "MB" << std::endl;
+
+	if (recommended_)
+		os << "    recommended buffer count " << recommended_ << " (currently " << configured_count(use_case_, streams_)
+		   << "), using " << recommended_total << "MB" << std::endl;
+	else
+		os << "    not enough frames to make a recommendation" << std::endl;
+}
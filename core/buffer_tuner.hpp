@@ -0,0 +1,74 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * Copyright (C) 2025, Raspberry Pi Ltd
+ *
+ * buffer_tuner.hpp - Find the number of camera buffers the pipeline really needs.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Measures how long the application holds on to each completed request (for post-processing,
+// encoding, preview and so on) compared to the frame interval. From this we work out how many
+// buffers are needed so that the camera always has a request to fill, and we count the frames
+// that the sensor produced but that never reached us because it had none.
+//
+// The recommendation is remembered per use case ("viewfinder", "still" or "video") so that it can
+// be applied the next time the camera is configured the same way. Nothing persists from one run
+// to the next.
+class BufferTuner
+{
+public:
+	using Clock = std::chrono::steady_clock;
+
+	struct StreamMemory
+	{
+		std::string name;
+		unsigned int buffer_count;
+		size_t frame_size;
+	};
+
+	// Requests that are queued in the camera (being filled, or ready to be) on top of the ones
+	// that the application holds. Fewer than this and the sensor will start dropping frames.
+	static constexpr unsigned int CAMERA_QUEUE_DEPTH = 2;
+	// Hold times kept to estimate the 99th percentile from.
+	static constexpr unsigned int HOLD_HISTORY = 1024;
+
+	// Start measuring the configuration that use_case has just been set up with.
+	void Start(std::string const &use_case, std::vector<StreamMemory> const &streams);
+	// A successful frame has arrived, and is now held until FrameReleased() is called.
+	void FrameArrived(void const *frame, unsigned int sequence, uint64_t timestamp_ns);
+	void FrameReleased(void const *frame);
+	// Finish measuring, and remember the recommendation for the use case. Returns false if we
+	// weren't measuring anything.
+	bool Stop();
+
+	// The buffer count recommended for use_case, or 0 if we have never measured it.
+	unsigned int Recommendation(std::string const &use_case) const;
+
+	void Report(std::ostream &os = std::cerr) const;
+
+private:
+	mutable std::mutex mutex_;
+	bool running_ = false;
+	std::string use_case_;
+	std::vector<StreamMemory> streams_;
+	std::map<void const *, Clock::time_point> held_;
+	unsigned int max_held_ = 0;
+	std::vector<double> hold_ms_;
+	unsigned int hold_index_ = 0;
+	double max_hold_ms_ = 0;
+	uint64_t frames_ = 0;
+	uint64_t dropped_ = 0;
+	unsigned int last_sequence_ = 0;
+	uint64_t last_timestamp_ = 0;
+	uint64_t min_interval_ns_ = 0;
+	unsigned int recommended_ = 0;
+	std::map<std::string, unsigned int> recommendations_;
+};
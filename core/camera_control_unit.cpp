@@ -20,6 +20,7 @@
 #include <math.h>
 
 #include "camera_control_unit.hpp"
+#include "rpicam_encoder.hpp"
 
 int listenSocket(struct in_addr *address, unsigned short port){
         struct sockaddr_in local_sock_addr;
@@ -67,6 +68,98 @@ bool CameraControlUnit::shutdownCallback(int index, Ccu_Callback_Mode_e mode, co
 	return(true);
 }
 
+bool CameraControlUnit::queueCallback(int index, Ccu_Callback_Mode_e mode, const char *args){
+	char clientRequest[128];
+	fprintf(stderr, "%s(%i, mode=%i, %s)" "\n", __func__, index, mode, args);
+	switch(mode){
+		case CCU_CALLBACK_MODE_READ:
+		case CCU_CALLBACK_MODE_COMMAND:{
+			RPiCamApp::MsgQueueStats stats = cameraApp->GetMsgQueueStats();
+			snprintf(clientRequest, sizeof(clientRequest) - 1, "Message queue depth: %u (max %u), dropped frames: %llu" "\n", stats.depth, stats.max_depth, (unsigned long long)stats.dropped);
+			sendString(clients[index].fd, clientRequest);
+		}
+		break;
+		default:
+			break;
+	}
+	return(true);
+}
+
+bool CameraControlUnit::bitrateCallback(int index, Ccu_Callback_Mode_e mode, const char *args){
+	char clientRequest[128];
+	fprintf(stderr, "%s(%i, mode=%i, %s)" "\n", __func__, index, mode, args);
+	if(!rateController){
+		snprintf(clientRequest, sizeof(clientRequest) - 1, "Adaptive bitrate not enabled (use --abr-max)" "\n");
+		sendString(clients[index].fd, clientRequest);
+		return(true);
+	}
+	switch(mode){
+		case CCU_CALLBACK_MODE_READ:
+		case CCU_CALLBACK_MODE_COMMAND:{
+			RateController::Params params = rateController->Get();
+			snprintf(clientRequest, sizeof(clientRequest) - 1, "Target bitrate: %llukbps (%llu-%llukbps), intra: %u, frame skip: %u" "\n", (unsigned long long)params.bitrate_bps / 1000, (unsigned long long)rateController->MinBitrate() / 1000, (unsigned long long)rateController->MaxBitrate() / 1000, params.intra_period, params.frame_skip);
+			sendString(clients[index].fd, clientRequest);
+		}
+		break;
+		case CCU_CALLBACK_MODE_WRITE:{
+			unsigned long kbps = strtoul(args + 1, NULL, 10);
+			rateController->SetBitrate((uint64_t)kbps * 1000);
+			snprintf(clientRequest, sizeof(clientRequest) - 1, "Requested bitrate: %lukbps" "\n", kbps);
+			sendString(clients[index].fd, clientRequest);
+		}
+		break;
+		case CCU_CALLBACK_MODE_SYNTAX:
+			snprintf(clientRequest, sizeof(clientRequest) - 1, "bitrate=<kbps>" "\n");
+			sendString(clients[index].fd, clientRequest);
+			break;
+		default:
+			break;
+	}
+	return(true);
+}
+
+bool CameraControlUnit::keyframeCallback(int index, Ccu_Callback_Mode_e mode, const char *args){
+	char clientRequest[128];
+	fprintf(stderr, "%s(%i, mode=%i, %s)" "\n", __func__, index, mode, args);
+	switch(mode){
+		case CCU_CALLBACK_MODE_COMMAND:
+			if(cameraEncoder && cameraEncoder->RequestKeyframe()){
+				snprintf(clientRequest, sizeof(clientRequest) - 1, "Requested keyframe" "\n");
+			}else{
+				snprintf(clientRequest, sizeof(clientRequest) - 1, "Encoder can't make keyframes on request" "\n");
+			}
+			sendString(clients[index].fd, clientRequest);
+			break;
+		default:
+			break;
+	}
+	return(true);
+}
+
+bool CameraControlUnit::intraCallback(int index, Ccu_Callback_Mode_e mode, const char *args){
+	char clientRequest[128];
+	fprintf(stderr, "%s(%i, mode=%i, %s)" "\n", __func__, index, mode, args);
+	switch(mode){
+		case CCU_CALLBACK_MODE_WRITE:{
+			unsigned long frames = strtoul(args + 1, NULL, 10);
+			if(cameraEncoder && cameraEncoder->SetIntraPeriod(frames)){
+				snprintf(clientRequest, sizeof(clientRequest) - 1, "Requested intra period: %lu frames" "\n", frames);
+			}else{
+				snprintf(clientRequest, sizeof(clientRequest) - 1, "Encoder can't change intra period to %lu" "\n", frames);
+			}
+			sendString(clients[index].fd, clientRequest);
+		}
+		break;
+		case CCU_CALLBACK_MODE_SYNTAX:
+			snprintf(clientRequest, sizeof(clientRequest) - 1, "intra=<frames>" "\n");
+			sendString(clients[index].fd, clientRequest);
+			break;
+		default:
+			break;
+	}
+	return(true);
+}
+
 bool CameraControlUnit::gaindbCallback(int index, Ccu_Callback_Mode_e mode, const char *args){
 	char clientRequest[128];
 	fprintf(stderr, "%s(%i, mode=%i, %s)" "\n", __func__, index, mode, args);
@@ -282,6 +375,10 @@ CameraControlUnit::CameraControlUnit(RPiCamApp *app, unsigned short tcpListenPor
 	map["speed"] = &CameraControlUnit::shutterSpeedCallback;
 	map["angle"] = &CameraControlUnit::shutterAngleCallback;
 	map["shutdown"] = &CameraControlUnit::shutdownCallback;
+	map["queue"] = &CameraControlUnit::queueCallback;
+	map["bitrate"] = &CameraControlUnit::bitrateCallback;
+	map["keyframe"] = &CameraControlUnit::keyframeCallback;
+	map["intra"] = &CameraControlUnit::intraCallback;
 	struct in_addr listenAddress = {0}; // bind to this address for incoming connections
 	listeningSocket = listenSocket(&listenAddress, htons(tcpListenPort));
 	for(int i = 0 ; i < CAMERA_CONTROL_UNIT_MAX_CLIENT ; i++){
@@ -9,6 +9,7 @@
 #include <stdlib.h>
 #include <unistd.h>
 
+#include "rate_controller.hpp"
 #include "rpicam_app.hpp"
 
 #define CAMERA_CONTROL_UNIT_MAX_CLIENT (16)
@@ -21,6 +22,7 @@ struct InputParser {
 };
 
 class CameraControlUnit;
+class RPiCamEncoder;
 
 typedef enum {
 	CCU_CALLBACK_MODE_WRITE = 0,   // set a value  (speed=16000)
@@ -38,9 +40,13 @@ class CameraControlUnit
 		~CameraControlUnit();
 		bool run(void);
 		void updateFromMetadata(libcamera::ControlList &metadata);
+		void setRateController(RateController *controller) { rateController = controller; }
+		void setEncoder(RPiCamEncoder *encoder) { cameraEncoder = encoder; }
 	private:
 
 	RPiCamApp *cameraApp;
+	RateController *rateController = nullptr;
+	RPiCamEncoder *cameraEncoder = nullptr;
 	int listeningSocket;
 	struct pollfd clients[CAMERA_CONTROL_UNIT_MAX_CLIENT];
 	InputParser parsers[CAMERA_CONTROL_UNIT_MAX_CLIENT];
@@ -57,6 +63,10 @@ class CameraControlUnit
 	bool awbgainsCallback(int index, Ccu_Callback_Mode_e mode, const char *args);
 	bool temperatureCallback(int index, Ccu_Callback_Mode_e mode, const char *args);
 	bool shutdownCallback(int index, Ccu_Callback_Mode_e mode, const char *args);
+	bool queueCallback(int index, Ccu_Callback_Mode_e mode, const char *args);
+	bool bitrateCallback(int index, Ccu_Callback_Mode_e mode, const char *args);
+	bool keyframeCallback(int index, Ccu_Callback_Mode_e mode, const char *args);
+	bool intraCallback(int index, Ccu_Callback_Mode_e mode, const char *args);
 	bool gaindbCallback(int index, Ccu_Callback_Mode_e mode, const char *args);
 	bool gainCallback(int index, Ccu_Callback_Mode_e mode, const char *args);
 	bool shutterSpeedCallback(int index, Ccu_Callback_Mode_e mode, const char *args);
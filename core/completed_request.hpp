@@ -13,6 +13,7 @@
 #include <libcamera/request.h>
 
 #include "core/metadata.hpp"
+#include "core/preprocess_cache.hpp"
 
 struct CompletedRequest
 {
@@ -25,12 +26,18 @@ struct CompletedRequest
 	{
 		r->reuse();
 	}
+	// For frames that don't come from the camera at all, such as in rpicam-stage-bench.
+	CompletedRequest(unsigned int seq, BufferMap const &b, ControlList const &m)
+		: sequence(seq), buffers(b), metadata(m), request(nullptr)
+	{
+	}
 	unsigned int sequence;
 	BufferMap buffers;
 	ControlList metadata;
 	Request *request;
 	float framerate;
 	Metadata post_process_metadata;
+	PreprocessCache preprocess_cache;
 };
 
 using CompletedRequestPtr = std::shared_ptr<CompletedRequest>;
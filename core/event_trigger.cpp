@@ -0,0 +1,103 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * Copyright (C) 2025, Raspberry Pi Ltd
+ *
+ * event_trigger.cpp - Decide when to record events, from the post-processing metadata.
+ */
+
+#include <algorithm>
+#include <cstdlib>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+#include "core/event_trigger.hpp"
+#include "core/logging.hpp"
+
+#include "post_processing_stages/object_detect.hpp"
+
+EventTrigger::EventTrigger(std::string const &predicate, unsigned int postroll_frames)
+	: op_(Op::Truthy), number_(0), postroll_frames_(postroll_frames)
+{
+	size_t pos = predicate.find_first_of("=<>");
+	key_ = predicate.substr(0, pos);
+	if (key_.empty())
+		throw std::runtime_error("event: no metadata key in " + predicate);
+	if (pos == std::string::npos)
+		return;
+
+	op_ = predicate[pos] == '=' ? Op::Equal : predicate[pos] == '>' ? Op::Greater : Op::Less;
+	value_ = predicate.substr(pos + 1);
+	char *end;
+	number_ = strtod(value_.c_str(), &end);
+	if (op_ != Op::Equal && (value_.empty() || *end))
+		throw std::runtime_error("event: expected a number in " + predicate);
+}
+
+bool EventTrigger::Update(Metadata &metadata)
+{
+	bool result;
+	if (evaluate(metadata, result))
+		last_result_ = result;
+
+	if (last_result_)
+	{
+		if (!active_)
+			LOG(1, "Event started (" << key_ << ")");
+		active_ = true;
+		quiet_frames_ = 0;
+	}
+	else if (active_ && ++quiet_frames_ > postroll_frames_)
+	{
+		active_ = false;
+		LOG(1, "Event ended (" << key_ << ")");
+	}
+
+	return active_;
+}
+
+bool EventTrigger::compare(double value) const
+{
+	switch (op_)
+	{
+	case Op::Truthy:
+		return value != 0;
+	case Op::Equal:
+		return value == number_;
+	case Op::Greater:
+		return value > number_;
+	case Op::Less:
+		return value < number_;
+	}
+	return false;
+}
+
+bool EventTrigger::evaluate(Metadata &metadata, bool &result) const
+{
+	std::lock_guard<Metadata> lock(metadata);
+
+	if (bool *b = metadata.GetLocked<bool>(key_))
+		result = compare(*b);
+	else if (int *i = metadata.GetLocked<int>(key_))
+		result = compare(*i);
+	else if (unsigned int *u = metadata.GetLocked<unsigned int>(key_))
+		result = compare(*u);
+	else if (float *f = metadata.GetLocked<float>(key_))
+		result = compare(*f);
+	else if (double *d = metadata.GetLocked<double>(key_))
+		result = compare(*d);
+	else if (std::string *s = metadata.GetLocked<std::string>(key_))
+		result = op_ == Op::Truthy ? !s->empty() : op_ == Op::Equal ? *s == value_ : compare(strtod(s->c_str(), nullptr));
+	else if (std::vector<Detection> *detections = metadata.GetLocked<std::vector<Detection>>(key_))
+	{
+		if (op_ == Op::Equal)
+			result = std::any_of(detections->begin(), detections->end(),
+								 [this](Detection const &detection) { return detection.name == value_; });
+		else
+			result = compare(detections->size());
+	}
+	else
+		return false; // not there, or not a type we know how to compare
+
+	return true;
+}
@@ -0,0 +1,53 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * Copyright (C) 2025, Raspberry Pi Ltd
+ *
+ * event_trigger.hpp - Decide when to record events, from the post-processing metadata.
+ */
+
+#pragma once
+
+#include <string>
+
+#include "core/metadata.hpp"
+
+// Watches one value in each frame's post-processing metadata (such as "motion_detect.result") and
+// reports an event while it holds, and for a number of quiet frames afterwards. The predicate is
+// one of:
+//   key        - the value is true, non-zero, or a non-empty string or list of detections
+//   key=value  - the value equals this (for detections, any of them has this name)
+//   key>value  - the value (or number of detections) is more than this
+//   key<value  - the value (or number of detections) is less than this
+// Stages that don't run on every frame leave the value out, so we keep the last result until the
+// next one arrives. Values of any other type are ignored in the same way.
+class EventTrigger
+{
+public:
+	EventTrigger(std::string const &predicate, unsigned int postroll_frames);
+
+	// Call once per frame. Returns true while an event is in progress, including its post-roll.
+	bool Update(Metadata &metadata);
+	bool Active() const { return active_; }
+
+private:
+	enum class Op
+	{
+		Truthy,
+		Equal,
+		Greater,
+		Less
+	};
+
+	// Returns false if this frame doesn't have the value at all.
+	bool evaluate(Metadata &metadata, bool &result) const;
+	bool compare(double value) const;
+
+	std::string key_;
+	Op op_;
+	std::string value_;
+	double number_;
+	unsigned int postroll_frames_;
+	bool last_result_ = false;
+	bool active_ = false;
+	unsigned int quiet_frames_ = 0;
+};
@@ -12,6 +12,8 @@
 #include <linux/v4l2-controls.h>
 #include <linux/videodev2.h>
 #include <map>
+#include <sched.h>
+#include <sstream>
 #include <string>
 #include <sys/ioctl.h>
 
@@ -20,6 +22,7 @@
 #include <libcamera/property_ids.h>
 
 #include "core/options.hpp"
+#include "encoder/software_profiles.hpp"
 
 namespace fs = std::filesystem;
 
@@ -237,6 +240,8 @@ Options::Options()
 			"Set the file name for configuring the post-processing")
 		("post-process-libs", value<std::string>(&v_->post_process_libs),
 			"Set a custom location for the post-processing library .so files")
+		("startup-profile", value<bool>(&v_->startup_profile)->default_value(false)->implicit_value(true),
+			"Report the time taken by each start-up phase, up to the first frame from the camera")
 		("nopreview,n", value<bool>(&v_->nopreview)->default_value(false)->implicit_value(true),
 			"Do not show a preview window")
 		("preview,p", value<std::string>(&v_->preview)->default_value("0,0,0,0"),
@@ -303,6 +308,14 @@ Options::Options()
 			"Camera mode for preview as W:H:bit-depth:packing, where packing is P (packed) or U (unpacked)")
 		("buffer-count", value<unsigned int>(&v_->buffer_count)->default_value(0), "Number of in-flight requests (and buffers) configured for video, raw, and still.")
 		("viewfinder-buffer-count", value<unsigned int>(&v_->viewfinder_buffer_count)->default_value(0), "Number of in-flight requests (and buffers) configured for preview window.")
+		("buffer-tuning", value<std::string>(&v_->buffer_tuning)->default_value("off"),
+			"Measure how long frames are held to find the buffer count needed (off, report, auto). With auto, the "
+			"measured count is used when the camera is next configured for the same use case in the same run, "
+			"such as going back to the preview after a still capture. Nothing is remembered between runs")
+		("msg-queue-depth", value<unsigned int>(&v_->msg_queue_depth)->default_value(0),
+			"Maximum number of completed requests waiting for the application (0 = unlimited)")
+		("msg-queue-policy", value<std::string>(&v_->msg_queue_policy)->default_value("drop-oldest"),
+			"What to do with a completed request when the message queue is full (drop-oldest, drop-newest, block)")
 		("no-raw", value<bool>(&v_->no_raw)->default_value(false)->implicit_value(true),
 			"Disable requesting of a RAW stream. Will override any manual mode reqest the mode choice when setting framerate.")
 		("autofocus-mode", value<std::string>(&v_->afMode)->default_value("default"),
@@ -405,6 +418,12 @@ bool OptsInternal::Parse(boost::program_options::variables_map &vm, RPiCamApp *a
 	if (hdr != "off" && hdr != "single-exp" && hdr != "sensor" && hdr != "auto")
 		throw std::runtime_error("Invalid HDR option provided: " + hdr);
 
+	if (buffer_tuning != "off" && buffer_tuning != "report" && buffer_tuning != "auto")
+		throw std::runtime_error("Invalid buffer tuning option provided: " + buffer_tuning);
+
+	if (msg_queue_policy != "drop-oldest" && msg_queue_policy != "drop-newest" && msg_queue_policy != "block")
+		throw std::runtime_error("Invalid message queue policy: " + msg_queue_policy);
+
 	if (!verbose || list_cameras)
 		libcamera::logSetTarget(libcamera::LoggingTargetNone);
 
@@ -693,6 +712,7 @@ void OptsInternal::Print() const
 	std::cerr << "    output: " << output << std::endl;
 	std::cerr << "    post_process_file: " << post_process_file << std::endl;
 	std::cerr << "    post_process_libs: " << post_process_libs << std::endl;
+	std::cerr << "    startup_profile: " << startup_profile << std::endl;
 	if (nopreview)
 		std::cerr << "    preview: none" << std::endl;
 	else if (fullscreen)
@@ -754,15 +774,30 @@ void OptsInternal::Print() const
 		std::cerr << "    buffer-count: " << buffer_count << std::endl;
 	if (viewfinder_buffer_count > 0)
 		std::cerr << "    viewfinder-buffer-count: " << viewfinder_buffer_count << std::endl;
+	if (buffer_tuning != "off")
+		std::cerr << "    buffer-tuning: " << buffer_tuning << std::endl;
+	if (msg_queue_depth > 0)
+		std::cerr << "    msg-queue: " << msg_queue_depth << " " << msg_queue_policy << std::endl;
 	std::cerr << "    metadata: " << metadata << std::endl;
 	std::cerr << "    metadata-format: " << metadata_format << std::endl;
 }
 
-bool OptsInternal::ParseVideo()
+bool OptsInternal::LibavContainer(Platform platform) const
+{
+	// These follow Encoder::Create's choice of encoder, and how LibAvEncoder picks an elementary stream.
+	if (codec != "libav" && (codec != "h264" || platform == Platform::VC4))
+		return false;
+	bool h264_file = output.size() >= 3 && output.compare(output.size() - 3, 3, "264") == 0;
+	return !((libav_format.empty() || libav_format == "h264") && h264_file);
+}
+
+bool OptsInternal::ParseVideo(Platform platform)
 {
 	bitrate.set(bitrate_);
 	av_sync.set(av_sync_);
 	audio_bitrate.set(audio_bitrate_);
+	abr_min.set(abr_min_);
+	abr_max.set(abr_max_);
 	if (width == 0)
 		width = 640;
 	if (height == 0)
@@ -777,16 +812,61 @@ bool OptsInternal::ParseVideo()
 		codec = "mjpeg";
 	else
 		throw std::runtime_error("unrecognised codec " + codec);
+	if (yuv_layout != "i420" && yuv_layout != "nv12" && yuv_layout != "padded")
+		throw std::runtime_error("incorrect yuv-layout value " + yuv_layout);
 	if (strcasecmp(initial.c_str(), "pause") == 0)
 		pause = true;
 	else if (strcasecmp(initial.c_str(), "record") == 0)
 		pause = false;
 	else
 		throw std::runtime_error("incorrect initial value " + initial);
-	if ((pause || split || segment || circular) && !inline_headers)
-		LOG_ERROR("WARNING: consider inline headers with 'pause'/split/segment/circular");
-	if ((split || segment) && output.find('%') == std::string::npos)
+	if ((pause || split || segment || circular || !event.empty()) && !inline_headers)
+		LOG_ERROR("WARNING: consider inline headers with 'pause'/split/segment/circular/event");
+	if ((split || segment || !event.empty()) && output.find('%') == std::string::npos)
 		LOG_ERROR("WARNING: expected % directive in output filename");
+	if (libav_fragment && codec != "libav")
+		throw std::runtime_error("libav-fragment is only supported by the libav codec");
+	if (!libav_profile.empty() && !find_software_profile(libav_profile))
+		throw std::runtime_error("no such libav-profile " + libav_profile);
+	// Video is only ever configured once, so there is never a next time to use a measurement.
+	if (buffer_tuning == "auto")
+		throw std::runtime_error("buffer-tuning auto has no effect on video, use report and then --buffer-count");
+	if (codec == "libav" && !libav_mux_queue)
+		throw std::runtime_error("libav-mux-queue must be at least 1");
+	libav_cpus.clear();
+	std::stringstream cpus(libav_affinity);
+	for (std::string cpu; std::getline(cpus, cpu, ',');)
+	{
+		size_t end = 0;
+		unsigned long n = CPU_SETSIZE;
+		if (!cpu.empty() && std::all_of(cpu.begin(), cpu.end(), ::isdigit))
+			n = std::stoul(cpu, &end);
+		if (end != cpu.size() || n >= CPU_SETSIZE)
+			throw std::runtime_error("libav-affinity: \"" + cpu + "\" is not a CPU number from 0 to " +
+									 std::to_string(CPU_SETSIZE - 1));
+		libav_cpus.push_back(n);
+	}
+	if (abr_max)
+	{
+		if (abr_min.bps() > abr_max.bps())
+			throw std::runtime_error("abr-min must not be more than abr-max");
+		// The encoder must start in a constant bitrate mode to be able to adjust it.
+		if (!bitrate)
+			bitrate = abr_max;
+	}
+	if (!tee.empty() && LibavContainer(platform))
+		throw std::runtime_error("tee is only supported by the libav codec for H.264 elementary streams");
+	if (!tee.empty() && !tee_queue)
+		throw std::runtime_error("tee-queue must be at least 1");
+	if (!event.empty())
+	{
+		if (event_idle != "encode" && event_idle != "keyframes" && event_idle != "skip")
+			throw std::runtime_error("incorrect event-idle value " + event_idle);
+		if (LibavContainer(platform) || !tee.empty() || circular)
+			throw std::runtime_error("event can't be used with tee, circular or libav containers");
+		if (output.empty())
+			throw std::runtime_error("event needs an output file name");
+	}
 
 	// From https://en.wikipedia.org/wiki/Advanced_Video_Coding#Levels
 	double mbps = ((width + 15) >> 4) * ((height + 15) >> 4) * framerate.value_or(DEFAULT_FRAMERATE);
@@ -820,12 +900,34 @@ void OptsInternal::PrintVideo() const
 	std::cerr << "    save-pts: " << save_pts << std::endl;
 	std::cerr << "    codec: " << codec << std::endl;
 	std::cerr << "    quality (for MJPEG): " << quality << std::endl;
+	if (codec == "yuv420")
+		std::cerr << "    yuv-layout: " << yuv_layout << std::endl;
 	std::cerr << "    keypress: " << keypress << std::endl;
 	std::cerr << "    signal: " << signal << std::endl;
 	std::cerr << "    initial: " << initial << std::endl;
 	std::cerr << "    split: " << split << std::endl;
 	std::cerr << "    segment: " << segment << std::endl;
 	std::cerr << "    circular: " << circular << std::endl;
+	if (abr_max)
+		std::cerr << "    abr: " << abr_min.kbps() << "-" << abr_max.kbps() << "kbps, latency " << abr_latency
+				  << "ms" << std::endl;
+	if (!simulcast.empty())
+		std::cerr << "    simulcast: " << simulcast << std::endl;
+	if (!event.empty())
+		std::cerr << "    event: " << event << ", preroll " << event_preroll << "ms, postroll " << event_postroll
+				  << " frames, idle " << event_idle << std::endl;
+	if (!tee.empty())
+	{
+		std::cerr << "    tee: " << tee << std::endl;
+		std::cerr << "    tee-queue: " << tee_queue << std::endl;
+	}
+	if (codec == "libav")
+	{
+		std::cerr << "    libav-mux-queue: " << libav_mux_queue << std::endl;
+		std::cerr << "    libav-fragment: " << libav_fragment << std::endl;
+		std::cerr << "    libav-profile: " << libav_profile << std::endl;
+		std::cerr << "    libav-affinity: " << libav_affinity << std::endl;
+	}
 #ifndef DISABLE_RPI_FEATURES
 	std::cerr << "    sync: " << sync << std::endl;
 #endif
@@ -175,8 +175,10 @@ struct OptsInternal
 	bool Parse(boost::program_options::variables_map &vm, RPiCamApp *app);
 	void Print() const;
 
-	bool ParseVideo();
+	bool ParseVideo(Platform platform);
 	void PrintVideo() const;
+	// Whether the libav encoder will write a container itself, so the Output class never sees the frames.
+	bool LibavContainer(Platform platform) const;
 
 	bool ParseStill();
 	void PrintStill() const;
@@ -190,6 +192,7 @@ struct OptsInternal
 	std::string output;
 	std::string post_process_file;
 	std::string post_process_libs;
+	bool startup_profile;
 	unsigned int width;
 	unsigned int height;
 	bool nopreview;
@@ -236,6 +239,9 @@ struct OptsInternal
 	Mode viewfinder_mode;
 	unsigned int buffer_count;
 	unsigned int viewfinder_buffer_count;
+	std::string buffer_tuning;
+	unsigned int msg_queue_depth;
+	std::string msg_queue_policy;
 	std::string afMode;
 	int afMode_index;
 	std::string afRange;
@@ -270,6 +276,11 @@ struct OptsInternal
 	std::string libav_video_codec;
 	std::string libav_video_codec_opts;
 	std::string libav_format;
+	std::string libav_profile;
+	std::string libav_affinity;
+	std::vector<unsigned int> libav_cpus; // parsed from libav_affinity
+	unsigned int libav_mux_queue;
+	uint32_t libav_fragment;
 	bool libav_audio;
 	std::string audio_codec;
 	std::string audio_device;
@@ -280,6 +291,7 @@ struct OptsInternal
 	TimeVal<std::chrono::microseconds> av_sync;
 	std::string save_pts;
 	int quality;
+	std::string yuv_layout;
 	bool listen;
 	bool keypress;
 	bool signal;
@@ -288,14 +300,26 @@ struct OptsInternal
 	bool split;
 	uint32_t segment;
 	size_t circular;
+	std::string tee;
+	std::string simulcast;
+	unsigned int tee_queue;
+	std::string event;
+	uint32_t event_preroll;
+	unsigned int event_postroll;
+	std::string event_idle;
 	uint32_t frames;
 	bool low_latency;
+	Bitrate abr_min;
+	Bitrate abr_max;
+	uint32_t abr_latency;
 #ifndef DISABLE_RPI_FEATURES
 	uint32_t sync;
 #endif
 	std::string bitrate_;
 	std::string av_sync_;
 	std::string audio_bitrate_;
+	std::string abr_min_;
+	std::string abr_max_;
 #ifndef DISABLE_RPI_FEATURES
 	std::string sync_;
 #endif
@@ -0,0 +1,118 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * Copyright (C) 2025, Raspberry Pi Ltd
+ *
+ * plugin_loader.cpp - On-demand loading of plugin libraries.
+ */
+
+#include <chrono>
+
+#include <boost/property_tree/json_parser.hpp>
+#include <boost/property_tree/ptree.hpp>
+
+#include "core/logging.hpp"
+#include "core/plugin_loader.hpp"
+
+namespace fs = std::filesystem;
+
+void PluginLoader::SetPath(const std::string &lib_dir, const std::string &default_dir)
+{
+	const fs::path path(!lib_dir.empty() ? lib_dir : default_dir);
+
+	std::scoped_lock<std::mutex> lock(mutex_);
+	if (path == path_)
+		return;
+
+	path_ = path;
+	all_loaded_ = false;
+	readManifest();
+}
+
+bool PluginLoader::Load(const std::string &name)
+{
+	std::scoped_lock<std::mutex> lock(mutex_);
+
+	auto it = manifest_.find(name);
+	if (it != manifest_.end())
+	{
+		const fs::path library_path = path_ / it->second;
+		if (fs::exists(library_path))
+			return loadLibrary(library_path.string());
+		LOG(1, "Plugin library " << library_path.string() << " for \"" << name << "\" is missing");
+	}
+
+	if (all_loaded_)
+		return false;
+
+	LOG(2, "No plugin manifest entry for \"" << name << "\", loading all of " << path_.string());
+	const size_t num_libraries = libraries_.size();
+	loadAll();
+
+	return libraries_.size() != num_libraries;
+}
+
+void PluginLoader::LoadAll()
+{
+	std::scoped_lock<std::mutex> lock(mutex_);
+	loadAll();
+}
+
+void PluginLoader::Clear()
+{
+	std::scoped_lock<std::mutex> lock(mutex_);
+
+	libraries_.clear();
+	loaded_library_paths_.clear();
+	all_loaded_ = false;
+}
+
+void PluginLoader::readManifest()
+{
+	manifest_.clear();
+
+	const fs::path manifest_path = path_ / "manifest.json";
+	if (!fs::exists(manifest_path))
+		return;
+
+	try
+	{
+		boost::property_tree::ptree root;
+		boost::property_tree::read_json(manifest_path.string(), root);
+		for (auto const &entry : root)
+			manifest_[entry.first] = entry.second.get_value<std::string>();
+	}
+	catch (std::exception const &e)
+	{
+		// A broken manifest only costs us start-up time, so carry on without it.
+		LOG_ERROR("WARNING: ignoring plugin manifest " << manifest_path.string() << ": " << e.what());
+		manifest_.clear();
+	}
+}
+
+void PluginLoader::loadAll()
+{
+	if (all_loaded_ || !fs::exists(path_))
+		return;
+
+	for (auto const &p : fs::recursive_directory_iterator(path_))
+	{
+		if (p.path().extension() == ".so")
+			loadLibrary(p.path().string());
+	}
+	all_loaded_ = true;
+}
+
+bool PluginLoader::loadLibrary(const std::string &library_path)
+{
+	// Check if this library has already been loaded
+	if (loaded_library_paths_.find(library_path) != loaded_library_paths_.end())
+		return false;
+
+	auto start = std::chrono::steady_clock::now();
+	libraries_.emplace_back(library_path);
+	loaded_library_paths_.insert(library_path);
+	std::chrono::duration<double, std::milli> t = std::chrono::steady_clock::now() - start;
+
+	LOG(2, "Loaded plugin library " << library_path << " in " << t.count() << "ms");
+	return true;
+}
@@ -0,0 +1,55 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * Copyright (C) 2025, Raspberry Pi Ltd
+ *
+ * plugin_loader.hpp - On-demand loading of plugin libraries.
+ */
+
+#pragma once
+
+#include <filesystem>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "core/dl_lib.hpp"
+
+// Loads the plugin libraries from a directory only when something they provide is asked for.
+//
+// Each plugin directory may contain a manifest.json file, generated at build time, which maps
+// the name of every stage, encoder or preview to the library that registers it, for example:
+//
+//	{ "hdr": "core-postproc.so", "sobel_cv": "opencv-postproc.so" }
+//
+// Without a manifest, or for a name the manifest doesn't know about, we fall back to loading
+// every library in the directory, as that's the only way to find out what they contain.
+class PluginLoader
+{
+public:
+	PluginLoader() = default;
+	PluginLoader(const PluginLoader &) = delete;
+	PluginLoader &operator=(const PluginLoader &) = delete;
+
+	// Set the directory to load plugins from, with an empty lib_dir selecting default_dir.
+	void SetPath(const std::string &lib_dir, const std::string &default_dir);
+	// Load whatever provides name. Returns false if nothing new could be loaded.
+	bool Load(const std::string &name);
+	// Load every library in the directory.
+	void LoadAll();
+	// Unload all libraries. Anything created from them must have been destroyed first.
+	void Clear();
+
+private:
+	void readManifest();
+	void loadAll();
+	bool loadLibrary(const std::string &library_path);
+
+	std::filesystem::path path_;
+	std::map<std::string, std::string> manifest_;
+	std::vector<DlLib> libraries_;
+	std::set<std::string> loaded_library_paths_;
+	bool all_loaded_ = false;
+	std::mutex mutex_;
+};
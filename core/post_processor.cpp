@@ -5,8 +5,8 @@
  * post_processor.cpp - Post processor implementation.
  */
 
+#include <algorithm>
 #include <dlfcn.h>
-#include <filesystem>
 #include <iostream>
 #include <map>
 
@@ -23,7 +23,47 @@
 
 #include "config.h"
 
-namespace fs = std::filesystem;
+void StageStats::Add(double us, bool dropped)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	frames_++;
+	dropped_ += dropped;
+	total_us_ += us;
+	if (frames_ == 1 || us < min_us_)
+		min_us_ = us;
+	max_us_ = std::max(max_us_, us);
+
+	if (reservoir_.size() < RESERVOIR_SIZE)
+		reservoir_.push_back(us);
+	else
+	{
+		uint64_t i = rng_() % frames_;
+		if (i < RESERVOIR_SIZE)
+			reservoir_[i] = us;
+	}
+}
+
+StageTiming StageStats::Get(std::string const &name)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	StageTiming timing;
+	timing.name = name;
+	timing.frames = frames_;
+	timing.dropped = dropped_;
+	if (!frames_)
+		return timing;
+
+	timing.min_us = min_us_;
+	timing.max_us = max_us_;
+	timing.avg_us = total_us_ / frames_;
+
+	std::vector<double> samples = reservoir_;
+	size_t n = std::min(samples.size() - 1, (samples.size() * 99) / 100);
+	std::nth_element(samples.begin(), samples.begin() + n, samples.end());
+	timing.p99_us = samples[n];
+
+	return timing;
+}
 
 PostProcessor::PostProcessor(RPiCamApp *app) : app_(app)
 {
@@ -33,32 +73,25 @@ PostProcessor::~PostProcessor()
 {
 	// Must clear stages_ before dynamic_stages_ as the latter will unload the necessary symbols.
 	stages_.clear();
-	dynamic_stages_.clear();
+	dynamic_stages_.Clear();
 }
 
 void PostProcessor::LoadModules(const std::string &lib_dir)
 {
-	static std::vector<DlLib> dynamic_stages_;
-
-	const fs::path path(!lib_dir.empty() ? lib_dir : POSTPROC_LIB_DIR);
-	const std::string ext(".so");
-
-	if (!fs::exists(path))
-		return;
-
-	// Dynamically load all .so files from the system postprocessing lib path.
-	// This will automatically register the stages with the factory.
-	for (auto const &p : fs::recursive_directory_iterator(path))
-	{
-		if (p.path().extension() == ext)
-			dynamic_stages_.emplace_back(p.path().string());
-	}
+	// Libraries are only loaded once a stage they provide is asked for, see createPostProcessingStage().
+	// Loading a library will automatically register its stages with the factory.
+	dynamic_stages_.SetPath(lib_dir, POSTPROC_LIB_DIR);
 }
 
 void PostProcessor::Read(std::string const &filename)
 {
 	boost::property_tree::ptree root;
 	boost::property_tree::read_json(filename, root);
+	Read(root);
+}
+
+void PostProcessor::Read(boost::property_tree::ptree const &root)
+{
 	for (auto const &key_and_value : root)
 	{
 		if (key_and_value.first == "rpicam-apps")
@@ -112,6 +145,8 @@ void PostProcessor::Read(std::string const &filename)
 PostProcessingStage *PostProcessor::createPostProcessingStage(char const *name)
 {
 	auto it = GetPostProcessingStages().find(std::string(name));
+	if (it == GetPostProcessingStages().end() && dynamic_stages_.Load(name))
+		it = GetPostProcessingStages().find(std::string(name));
 	return it != GetPostProcessingStages().end() ? (*it->second)(app_) : nullptr;
 }
 
@@ -141,6 +176,10 @@ void PostProcessor::Start()
 	quit_ = false;
 	output_thread_ = std::thread(&PostProcessor::outputThread, this);
 
+	stage_stats_.clear();
+	for (unsigned int i = 0; i < stages_.size(); i++)
+		stage_stats_.push_back(std::make_unique<StageStats>());
+
 	for (auto &stage : stages_)
 	{
 		stage->Start();
@@ -161,13 +200,14 @@ void PostProcessor::Process(CompletedRequestPtr &request)
 	std::promise<bool> promise;
 	auto process_fn = [this](CompletedRequestPtr &request, std::promise<bool> promise) {
 		bool drop_request = false;
-		for (auto &stage : stages_)
+		for (unsigned int i = 0; i < stages_.size(); i++)
 		{
-			if (stage->Process(request))
-			{
-				drop_request = true;
+			auto t1 = std::chrono::steady_clock::now();
+			drop_request = stages_[i]->Process(request);
+			std::chrono::duration<double, std::micro> t = std::chrono::steady_clock::now() - t1;
+			stage_stats_[i]->Add(t.count(), drop_request);
+			if (drop_request)
 				break;
-			}
 		}
 		promise.set_value(drop_request);
 		cv_.notify_one();
@@ -223,6 +263,23 @@ void PostProcessor::Stop()
 	}
 
 	output_thread_.join();
+
+	for (auto const &timing : GetStageTimings())
+	{
+		if (!timing.frames)
+			continue;
+		LOG(2, "Stage \"" << timing.name << "\": " << timing.frames << " frames, " << timing.dropped
+							<< " dropped, min " << timing.min_us << "us avg " << timing.avg_us << "us p99 "
+							<< timing.p99_us << "us max " << timing.max_us << "us");
+	}
+}
+
+std::vector<StageTiming> PostProcessor::GetStageTimings()
+{
+	std::vector<StageTiming> timings;
+	for (unsigned int i = 0; i < stage_stats_.size(); i++)
+		timings.push_back(stage_stats_[i]->Get(stages_[i]->Name()));
+	return timings;
 }
 
 void PostProcessor::Teardown()
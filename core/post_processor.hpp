@@ -12,10 +12,15 @@
 #include <future>
 #include <mutex>
 #include <queue>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <boost/property_tree/ptree_fwd.hpp>
 
 #include "core/completed_request.hpp"
-#include "core/dl_lib.hpp"
 #include "core/logging.hpp"
+#include "core/plugin_loader.hpp"
 
 namespace libcamera
 {
@@ -30,6 +35,39 @@ using PostProcessorCallback = std::function<void(CompletedRequestPtr &)>;
 using StreamConfiguration = libcamera::StreamConfiguration;
 typedef std::unique_ptr<PostProcessingStage> StagePtr;
 
+// Summary of the time spent in one stage's Process() call, in microseconds.
+struct StageTiming
+{
+	std::string name;
+	uint64_t frames = 0;
+	uint64_t dropped = 0;
+	double min_us = 0;
+	double avg_us = 0;
+	double p99_us = 0;
+	double max_us = 0;
+};
+
+// Accumulates the Process() timings for one stage. Stages run concurrently on several threads, so
+// this is locked. Percentiles come from a bounded reservoir sample so that long runs don't grow.
+class StageStats
+{
+public:
+	static constexpr unsigned int RESERVOIR_SIZE = 4096;
+
+	void Add(double us, bool dropped);
+	StageTiming Get(std::string const &name);
+
+private:
+	std::mutex mutex_;
+	uint64_t frames_ = 0;
+	uint64_t dropped_ = 0;
+	double min_us_ = 0;
+	double max_us_ = 0;
+	double total_us_ = 0;
+	std::vector<double> reservoir_;
+	std::minstd_rand rng_;
+};
+
 class PostProcessor
 {
 public:
@@ -41,6 +79,9 @@ public:
 
 	void Read(std::string const &filename);
 
+	// As above, but for a JSON tree that has already been parsed.
+	void Read(boost::property_tree::ptree const &root);
+
 	void SetCallback(PostProcessorCallback callback);
 
 	void AdjustConfig(std::string const &use_case, StreamConfiguration *config);
@@ -55,12 +96,16 @@ public:
 
 	void Teardown();
 
+	// Per-stage timings since the last Start(). These are also logged (at verbosity 2) when the post-processor stops.
+	std::vector<StageTiming> GetStageTimings();
+
 private:
 	PostProcessingStage *createPostProcessingStage(char const *name);
 
 	RPiCamApp *app_;
 	std::vector<StagePtr> stages_;
-	std::vector<DlLib> dynamic_stages_;
+	std::vector<std::unique_ptr<StageStats>> stage_stats_;
+	PluginLoader dynamic_stages_;
 	void outputThread();
 
 	std::queue<CompletedRequestPtr> requests_;
@@ -0,0 +1,103 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * Copyright (C) 2025, Raspberry Pi Ltd
+ *
+ * preprocess_cache.cpp - share converted copies of a request's images between post-processing stages
+ */
+
+#include "core/preprocess_cache.hpp"
+
+// Free buffers, kept for the next request that wants one. Every request needs the same sizes, so
+// this settles down to a handful of buffers that just go round and round.
+class BufferPool
+{
+public:
+	std::vector<uint8_t> Acquire(size_t size)
+	{
+		std::vector<uint8_t> buffer;
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			// Take the smallest buffer that's big enough.
+			auto best = free_.end();
+			for (auto it = free_.begin(); it != free_.end(); it++)
+			{
+				if (it->capacity() >= size && (best == free_.end() || it->capacity() < best->capacity()))
+					best = it;
+			}
+			if (best != free_.end())
+			{
+				buffer = std::move(*best);
+				free_.erase(best);
+			}
+		}
+		buffer.resize(size);
+		return buffer;
+	}
+
+	void Release(std::vector<uint8_t> &&buffer)
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		if (free_.size() < MAX_FREE)
+			free_.push_back(std::move(buffer));
+	}
+
+private:
+	static constexpr unsigned int MAX_FREE = 16;
+	std::mutex mutex_;
+	std::vector<std::vector<uint8_t>> free_;
+};
+
+// Images hold a reference to the pool, so it's still there however late the last of them goes.
+static std::shared_ptr<BufferPool> get_pool()
+{
+	static std::shared_ptr<BufferPool> pool = std::make_shared<BufferPool>();
+	return pool;
+}
+
+unsigned int PreprocessKey::Stride() const
+{
+	switch (format)
+	{
+	case Format::Y:
+		return width;
+	case Format::RGB:
+		return width * 3;
+	case Format::RGB_FLOAT:
+		return width * 3 * sizeof(float);
+	}
+	return 0;
+}
+
+PreprocessedImage::PreprocessedImage(PreprocessKey const &key)
+	: key(key), stride(key.Stride()), pool_(get_pool()), buffer_(pool_->Acquire(stride * key.height))
+{
+}
+
+PreprocessedImage::~PreprocessedImage()
+{
+	pool_->Release(std::move(buffer_));
+}
+
+PreprocessedImagePtr PreprocessCache::Get(PreprocessKey const &key,
+										  std::function<void(PreprocessedImage &)> const &fill)
+{
+	// Holding the lock while filling stops two stages making the same image at once.
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	auto it = images_.find(key);
+	if (it != images_.end())
+		return it->second;
+
+	auto image = std::make_shared<PreprocessedImage>(key);
+	fill(*image);
+	images_[key] = image;
+	return image;
+}
+
+PreprocessedImagePtr PreprocessCache::Find(PreprocessKey const &key)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	auto it = images_.find(key);
+	return it == images_.end() ? nullptr : it->second;
+}
@@ -0,0 +1,88 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * Copyright (C) 2025, Raspberry Pi Ltd
+ *
+ * preprocess_cache.hpp - share converted copies of a request's images between post-processing stages
+ */
+
+#pragma once
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <tuple>
+#include <vector>
+
+namespace libcamera
+{
+class Stream;
+}
+
+// Describes a converted copy of one of a request's (YUV420) images. The image is cropped from the
+// centre to the given size, as PostProcessingStage::Yuv420ToRgb does.
+struct PreprocessKey
+{
+	enum class Format
+	{
+		Y, // 8-bit luma only
+		RGB, // 8-bit packed RGB
+		RGB_FLOAT, // packed RGB as floats, each (value - offset) / scale
+	};
+
+	libcamera::Stream *stream;
+	unsigned int width;
+	unsigned int height;
+	Format format;
+	float offset = 0;
+	float scale = 1;
+
+	unsigned int Stride() const;
+	bool operator<(PreprocessKey const &other) const
+	{
+		return std::tie(stream, width, height, format, offset, scale) <
+			   std::tie(other.stream, other.width, other.height, other.format, other.offset, other.scale);
+	}
+};
+
+class BufferPool;
+
+// The memory comes from a pool, and goes back there when the last stage using the image lets go of it.
+class PreprocessedImage
+{
+public:
+	PreprocessedImage(PreprocessKey const &key);
+	~PreprocessedImage();
+
+	PreprocessKey const key;
+	unsigned int const stride; // in bytes
+
+	uint8_t *Data() { return buffer_.data(); }
+	uint8_t const *Data() const { return buffer_.data(); }
+	size_t Size() const { return buffer_.size(); }
+
+private:
+	std::shared_ptr<BufferPool> pool_;
+	std::vector<uint8_t> buffer_;
+};
+
+using PreprocessedImagePtr = std::shared_ptr<const PreprocessedImage>;
+
+// Each CompletedRequest has one of these, so that when several stages want the same conversion of
+// an image, only the first of them does it. The images may be kept beyond the request's lifetime,
+// for example by stages that run asynchronously.
+class PreprocessCache
+{
+public:
+	// Returns the image if someone has already made it for this request; otherwise makes it by
+	// calling fill on a fresh image.
+	PreprocessedImagePtr Get(PreprocessKey const &key, std::function<void(PreprocessedImage &)> const &fill);
+
+	// Returns the image only if someone has already made it for this request, otherwise nullptr. For
+	// stages that can manage without a full conversion, but will happily share one that's there anyway.
+	PreprocessedImagePtr Find(PreprocessKey const &key);
+
+private:
+	std::mutex mutex_;
+	std::map<PreprocessKey, PreprocessedImagePtr> images_;
+};
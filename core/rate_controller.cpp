@@ -0,0 +1,113 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * Copyright (C) 2025, Raspberry Pi Ltd
+ *
+ * rate_controller.cpp - Adapt the encoder to what the output can keep up with.
+ */
+
+#include <algorithm>
+
+#include "core/logging.hpp"
+#include "core/rate_controller.hpp"
+
+RateController::RateController(uint64_t min_bps, uint64_t max_bps, uint64_t start_bps, unsigned int intra_period,
+							   double target_latency_ms)
+	: min_bps_(min_bps), max_bps_(max_bps), base_intra_(intra_period), target_latency_ms_(target_latency_ms),
+	  last_update_(Clock::now())
+{
+	params_.bitrate_bps = std::clamp(start_bps, min_bps_, max_bps_);
+	params_.intra_period = base_intra_;
+	params_.frame_skip = 0;
+}
+
+void RateController::Feedback(double latency_ms, unsigned int queued)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	latency_sum_ms_ += latency_ms;
+	latency_count_++;
+	max_queued_ = std::max(max_queued_, queued);
+}
+
+bool RateController::Update(Params &params)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	Clock::time_point now = Clock::now();
+	if (now - last_update_ >= INTERVAL)
+	{
+		last_update_ = now;
+		double latency_ms = latency_count_ ? latency_sum_ms_ / latency_count_ : 0;
+		bool behind = latency_ms > target_latency_ms_ || max_queued_ > MAX_QUEUED;
+		latency_sum_ms_ = 0;
+		latency_count_ = 0;
+		max_queued_ = 0;
+
+		if (behind)
+		{
+			good_intervals_ = 0;
+			bool step = true;
+			if (params_.bitrate_bps > min_bps_)
+				params_.bitrate_bps = std::max(min_bps_, params_.bitrate_bps * 7 / 10);
+			else if (base_intra_ && params_.intra_period < base_intra_ * MAX_INTRA_SCALE)
+				params_.intra_period *= 2;
+			else if (params_.frame_skip < MAX_FRAME_SKIP)
+				params_.frame_skip++;
+			else
+				step = false;
+			if (step)
+			{
+				changed_ = true;
+				LOG(1, "RateController: output behind (" << latency_ms << "ms), now " << params_.bitrate_bps / 1000
+														 << "kbps, intra " << params_.intra_period << ", skip "
+														 << params_.frame_skip);
+			}
+		}
+		else if (++good_intervals_ >= RECOVER_INTERVALS)
+		{
+			good_intervals_ = 0;
+			bool step = true;
+			if (params_.frame_skip)
+				params_.frame_skip--;
+			else if (params_.intra_period > base_intra_)
+				params_.intra_period /= 2;
+			else if (params_.bitrate_bps < max_bps_)
+				params_.bitrate_bps = std::min(max_bps_, params_.bitrate_bps + params_.bitrate_bps / 10 + 50000);
+			else
+				step = false;
+			if (step)
+			{
+				changed_ = true;
+				LOG(2, "RateController: output keeping up, now " << params_.bitrate_bps / 1000 << "kbps, intra "
+																 << params_.intra_period << ", skip "
+																 << params_.frame_skip);
+			}
+		}
+	}
+
+	if (!changed_)
+		return false;
+	changed_ = false;
+	params = params_;
+	return true;
+}
+
+bool RateController::DropFrame()
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	return (frame_count_++ % (params_.frame_skip + 1)) != 0;
+}
+
+RateController::Params RateController::Get() const
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	return params_;
+}
+
+void RateController::SetBitrate(uint64_t bps)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	params_.bitrate_bps = std::clamp(bps, min_bps_, max_bps_);
+	params_.intra_period = base_intra_;
+	params_.frame_skip = 0;
+	good_intervals_ = 0;
+	changed_ = true;
+}
@@ -0,0 +1,72 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * Copyright (C) 2025, Raspberry Pi Ltd
+ *
+ * rate_controller.hpp - Adapt the encoder to what the output can keep up with.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+
+// Watches how long the output takes to send each encoded frame, and how many frames are waiting to
+// be sent, and turns the encoder down when the output is falling behind (such as a network link
+// getting slower). The bitrate goes down first; once that reaches the minimum, keyframes (which are
+// large) are spread further apart, and finally frames are dropped. Once the output has been
+// keeping up for a while, these are undone in the opposite order.
+class RateController
+{
+public:
+	using Clock = std::chrono::steady_clock;
+
+	struct Params
+	{
+		uint64_t bitrate_bps;
+		// 0 leaves the encoder's own keyframe interval alone.
+		unsigned int intra_period;
+		// Encode only one frame in every frame_skip + 1.
+		unsigned int frame_skip;
+	};
+
+	// How often we review what the output has been doing.
+	static constexpr std::chrono::milliseconds INTERVAL { 500 };
+	// Intervals the output must keep up for before we try a higher rate again.
+	static constexpr unsigned int RECOVER_INTERVALS = 4;
+	// Frames waiting to be sent before we count the output as falling behind.
+	static constexpr unsigned int MAX_QUEUED = 2;
+	static constexpr unsigned int MAX_FRAME_SKIP = 3;
+	static constexpr unsigned int MAX_INTRA_SCALE = 4;
+
+	RateController(uint64_t min_bps, uint64_t max_bps, uint64_t start_bps, unsigned int intra_period,
+				   double target_latency_ms);
+
+	// Outputs call this for every frame they send.
+	void Feedback(double latency_ms, unsigned int queued);
+	// Call once per frame. Returns true, and the new params, when the encoder should change.
+	bool Update(Params &params);
+	// Call once per frame to find out if this one should be skipped.
+	bool DropFrame();
+
+	Params Get() const;
+	// Start again from this bitrate (limited to the min and max), as if the output had just recovered.
+	void SetBitrate(uint64_t bps);
+	uint64_t MinBitrate() const { return min_bps_; }
+	uint64_t MaxBitrate() const { return max_bps_; }
+
+private:
+	mutable std::mutex mutex_;
+	uint64_t min_bps_;
+	uint64_t max_bps_;
+	unsigned int base_intra_;
+	double target_latency_ms_;
+	Params params_;
+	bool changed_ = false;
+	Clock::time_point last_update_;
+	double latency_sum_ms_ = 0;
+	unsigned int latency_count_ = 0;
+	unsigned int max_queued_ = 0;
+	unsigned int good_intervals_ = 0;
+	uint64_t frame_count_ = 0;
+};
@@ -114,11 +114,13 @@ RPiCamApp::~RPiCamApp()
 
 void RPiCamApp::initCameraManager()
 {
+	auto start = StartupProfile::Clock::now();
 	camera_manager_.reset();
 	camera_manager_ = std::make_unique<CameraManager>();
 	int ret = camera_manager_->start();
 	if (ret)
 		throw std::runtime_error("camera manager failed to start, code " + std::to_string(-ret));
+	startup_profile_.Record("camera manager init", start);
 }
 
 std::string const &RPiCamApp::CameraId() const
@@ -134,14 +136,18 @@ std::string RPiCamApp::CameraModel() const
 void RPiCamApp::OpenCamera()
 {
 	// Make a preview window.
+	auto start = StartupProfile::Clock::now();
 	preview_ = std::unique_ptr<Preview>(make_preview(RPiCamApp::GetOptions()));
 	preview_->SetDoneCallback(std::bind(&RPiCamApp::previewDoneCallback, this, std::placeholders::_1));
+	startup_profile_.Record("preview", start);
 
 	LOG(2, "Opening camera...");
 
 	if (!camera_manager_)
 		initCameraManager();
 
+	start = StartupProfile::Clock::now();
+
 	std::vector<std::shared_ptr<libcamera::Camera>> cameras = GetCameras();
 	if (cameras.size() == 0)
 		throw std::runtime_error("no cameras available");
@@ -159,15 +165,23 @@ void RPiCamApp::OpenCamera()
 	camera_acquired_ = true;
 
 	LOG(2, "Acquired camera " << cam_id);
+	startup_profile_.Record("camera open", start);
 
 	if (!options_->Get().post_process_file.empty())
 	{
+		start = StartupProfile::Clock::now();
 		post_processor_.LoadModules(options_->Get().post_process_libs);
 		post_processor_.Read(options_->Get().post_process_file);
+		startup_profile_.Record("post-processing stages", start);
 	}
 	// The queue takes over ownership from the post-processor.
 	post_processor_.SetCallback(
-		[this](CompletedRequestPtr &r) { this->msg_queue_.Post(Msg(MsgType::RequestComplete, std::move(r))); });
+		[this](CompletedRequestPtr &r)
+		{
+			if (!this->msg_queue_.Post(Msg(MsgType::RequestComplete, std::move(r)), true) &&
+				this->msg_queue_.Stats().dropped == 1)
+				LOG(1, "WARNING: message queue full, dropping frames (see --msg-queue-depth)");
+		});
 
 	// We're going to make a list of all the available sensor modes, but we only populate
 	// the framerate field if the user has requested a framerate (as this requires us actually
@@ -280,6 +294,7 @@ Mode RPiCamApp::selectMode(const Mode &mode) const
 
 void RPiCamApp::ConfigureViewfinder()
 {
+	auto start = StartupProfile::Clock::now();
 	LOG(2, "Configuring viewfinder...");
 
 	int lores_stream_num = 0, raw_stream_num = 0;
@@ -328,6 +343,8 @@ void RPiCamApp::ConfigureViewfinder()
 	configuration_->at(0).size = size;
 	if (options_->Get().viewfinder_buffer_count > 0)
 		configuration_->at(0).bufferCount = options_->Get().viewfinder_buffer_count;
+	else if (unsigned int count = tunedBufferCount("viewfinder"))
+		configuration_->at(0).bufferCount = count;
 
 	if (have_lores_stream)
 	{
@@ -339,6 +356,7 @@ void RPiCamApp::ConfigureViewfinder()
 		configuration_->at(lores_stream_num).size = lores_size;
 		configuration_->at(lores_stream_num).bufferCount = configuration_->at(0).bufferCount;
 		configuration_->at(lores_stream_num).colorSpace = configuration_->at(0).colorSpace;
+		post_processor_.AdjustConfig("lores", &configuration_->at(lores_stream_num));
 	}
 
 	if (!options_->Get().no_raw)
@@ -369,11 +387,13 @@ void RPiCamApp::ConfigureViewfinder()
 
 	post_processor_.Configure();
 
+	startup_profile_.Record("configuration", start);
 	LOG(2, "Viewfinder setup complete");
 }
 
 void RPiCamApp::ConfigureZsl(unsigned int still_flags)
 {
+	auto start = StartupProfile::Clock::now();
 	LOG(2, "Configuring ZSL...");
 
 	StreamRoles stream_roles = { StreamRole::StillCapture, StreamRole::Viewfinder };
@@ -464,11 +484,13 @@ void RPiCamApp::ConfigureZsl(unsigned int still_flags)
 
 	post_processor_.Configure();
 
+	startup_profile_.Record("configuration", start);
 	LOG(2, "ZSL setup complete");
 }
 
 void RPiCamApp::ConfigureStill(unsigned int flags)
 {
+	auto start = StartupProfile::Clock::now();
 	LOG(2, "Configuring still capture...");
 
 	// Always request a raw stream as this forces the full resolution capture mode,
@@ -498,6 +520,8 @@ void RPiCamApp::ConfigureStill(unsigned int flags)
 		configuration_->at(0).bufferCount = 3;
 	else if (options_->Get().buffer_count > 0)
 		configuration_->at(0).bufferCount = options_->Get().buffer_count;
+	else if (unsigned int count = tunedBufferCount("still"))
+		configuration_->at(0).bufferCount = count;
 	if (options_->Get().width)
 		configuration_->at(0).size.width = options_->Get().width;
 	if (options_->Get().height)
@@ -529,11 +553,13 @@ void RPiCamApp::ConfigureStill(unsigned int flags)
 
 	post_processor_.Configure();
 
+	startup_profile_.Record("configuration", start);
 	LOG(2, "Still capture setup complete");
 }
 
 void RPiCamApp::ConfigureVideo(unsigned int flags)
 {
+	auto start = StartupProfile::Clock::now();
 	LOG(2, "Configuring video...");
 
 	bool have_lores_stream = options_->Get().lores_width && options_->Get().lores_height;
@@ -553,6 +579,8 @@ void RPiCamApp::ConfigureVideo(unsigned int flags)
 	cfg.bufferCount = 6; // 6 buffers is better than 4
 	if (options_->Get().buffer_count > 0)
 		cfg.bufferCount = options_->Get().buffer_count;
+	else if (unsigned int count = tunedBufferCount("video"))
+		cfg.bufferCount = count;
 	if (options_->Get().width)
 		cfg.size.width = options_->Get().width;
 	if (options_->Get().height)
@@ -591,6 +619,7 @@ void RPiCamApp::ConfigureVideo(unsigned int flags)
 		configuration_->at(lores_index).size = lores_size;
 		configuration_->at(lores_index).bufferCount = configuration_->at(0).bufferCount;
 		configuration_->at(lores_index).colorSpace = configuration_->at(0).colorSpace;
+		post_processor_.AdjustConfig("lores", &configuration_->at(lores_index));
 	}
 	configuration_->orientation = libcamera::Orientation::Rotate0 * options_->Get().transform;
 
@@ -605,6 +634,7 @@ void RPiCamApp::ConfigureVideo(unsigned int flags)
 
 	post_processor_.Configure();
 
+	startup_profile_.Record("configuration", start);
 	LOG(2, "Video setup complete");
 }
 
@@ -633,8 +663,28 @@ void RPiCamApp::Teardown()
 	streams_.clear();
 }
 
+void RPiCamApp::AddOfflineStream(std::string const &name, Stream *stream,
+								 std::map<FrameBuffer *, std::vector<libcamera::Span<uint8_t>>> const &buffers)
+{
+	streams_[name] = stream;
+	mapped_buffers_.insert(buffers.begin(), buffers.end());
+}
+
+unsigned int RPiCamApp::tunedBufferCount(std::string const &use_case) const
+{
+	if (options_->Get().buffer_tuning != "auto")
+		return 0;
+
+	unsigned int count = buffer_tuner_.Recommendation(use_case);
+	if (count)
+		LOG(1, "Using " << count << " buffers for " << use_case << ", as measured by buffer tuning");
+	return count;
+}
+
 void RPiCamApp::StartCamera()
 {
+	auto start = StartupProfile::Clock::now();
+
 	// This makes all the Request objects that we shall need.
 	makeRequests();
 
@@ -805,8 +855,28 @@ void RPiCamApp::StartCamera()
 	camera_started_ = true;
 	last_timestamp_ = 0;
 
+	static const std::map<std::string, MsgQueuePolicy> policies = {
+		{ "drop-oldest", MsgQueuePolicy::DropOldest },
+		{ "drop-newest", MsgQueuePolicy::DropNewest },
+		{ "block", MsgQueuePolicy::Block },
+	};
+	msg_queue_.Configure(options_->Get().msg_queue_depth, policies.at(options_->Get().msg_queue_policy));
+
 	post_processor_.Start();
 
+	if (options_->Get().buffer_tuning != "off")
+	{
+		std::vector<BufferTuner::StreamMemory> streams;
+		std::string use_case;
+		for (auto const &[name, stream] : streams_)
+		{
+			streams.push_back({ name, stream->configuration().bufferCount, stream->configuration().frameSize });
+			if (stream == GetMainStream())
+				use_case = name;
+		}
+		buffer_tuner_.Start(use_case, streams);
+	}
+
 	camera_->requestCompleted.connect(this, &RPiCamApp::requestComplete);
 
 	for (std::unique_ptr<Request> &request : requests_)
@@ -815,11 +885,15 @@ void RPiCamApp::StartCamera()
 			throw std::runtime_error("Failed to queue request");
 	}
 
+	startup_profile_.Record("camera start", start);
 	LOG(2, "Camera started!");
 }
 
 void RPiCamApp::StopCamera()
 {
+	// Nothing may block, or release requests, in the message queue while we stop.
+	msg_queue_.Drain();
+
 	{
 		// We don't want QueueRequest to run asynchronously while we stop the camera.
 		std::lock_guard<std::mutex> lock(camera_stop_mutex_);
@@ -843,6 +917,14 @@ void RPiCamApp::StopCamera()
 
 	msg_queue_.Clear();
 
+	if (buffer_tuner_.Stop() && !options_->Get().help && GetVerbosity() >= 1)
+		buffer_tuner_.Report();
+
+	MsgQueueStats stats = msg_queue_.Stats();
+	unsigned int stats_level = stats.dropped ? 1 : 2;
+	if (!options_->Get().help && stats.max_depth)
+		LOG(stats_level, "Message queue: max depth " << stats.max_depth << ", dropped " << stats.dropped << " frames");
+
 	requests_.clear();
 
 	controls_.clear(); // no need for mutex here
@@ -856,8 +938,21 @@ RPiCamApp::Msg RPiCamApp::Wait()
 	return msg_queue_.Wait();
 }
 
+void RPiCamApp::Wait(std::vector<Msg> &msgs, unsigned int max_msgs)
+{
+	msg_queue_.Wait(msgs, max_msgs);
+}
+
+RPiCamApp::MsgQueueStats RPiCamApp::GetMsgQueueStats()
+{
+	return msg_queue_.Stats();
+}
+
 void RPiCamApp::queueRequest(CompletedRequest *completed_request)
 {
+	if (options_->Get().buffer_tuning != "off")
+		buffer_tuner_.FrameReleased(completed_request);
+
 	BufferMap buffers(std::move(completed_request->buffers));
 
 	// This function may run asynchronously so needs protection from the
@@ -1134,6 +1229,9 @@ void RPiCamApp::requestComplete(Request *request)
 	if (r->buffers.begin()->second->metadata().status != libcamera::FrameMetadata::FrameSuccess)
 		return;
 
+	if (startup_profile_.FirstFrame() && options_->Get().startup_profile)
+		startup_profile_.Report();
+
 	// We calculate the instantaneous framerate in case anyone wants it.
 	// Use the sensor timestamp if possible as it ought to be less glitchy than
 	// the buffer timestamps.
@@ -1145,6 +1243,9 @@ void RPiCamApp::requestComplete(Request *request)
 		payload->framerate = 1e9 / (timestamp - last_timestamp_);
 	last_timestamp_ = timestamp;
 
+	if (options_->Get().buffer_tuning != "off")
+		buffer_tuner_.FrameArrived(r, r->buffers.begin()->second->metadata().sequence, timestamp);
+
 	post_processor_.Process(payload); // post-processor can re-use our shared_ptr
 }
 
@@ -9,10 +9,13 @@
 
 #include <sys/mman.h>
 
+#include <algorithm>
 #include <condition_variable>
+#include <cstdint>
 #include <iostream>
 #include <memory>
 #include <mutex>
+#include <optional>
 #include <queue>
 #include <set>
 #include <sstream>
@@ -31,9 +34,11 @@
 #include <libcamera/property_ids.h>
 
 #include "core/buffer_sync.hpp"
+#include "core/buffer_tuner.hpp"
 #include "core/completed_request.hpp"
 #include "core/dma_heaps.hpp"
 #include "core/post_processor.hpp"
+#include "core/startup_profile.hpp"
 #include "core/stream_info.hpp"
 
 struct Options;
@@ -66,6 +71,19 @@ public:
 		Timeout,
 		Quit
 	};
+	// What to do with a completed request when the message queue is full.
+	enum class MsgQueuePolicy
+	{
+		DropOldest,
+		DropNewest,
+		Block
+	};
+	struct MsgQueueStats
+	{
+		unsigned int depth;
+		unsigned int max_depth;
+		uint64_t dropped;
+	};
 	typedef std::variant<CompletedRequestPtr> MsgPayload;
 	struct Msg
 	{
@@ -145,7 +163,10 @@ public:
 	void StopCamera();
 
 	Msg Wait();
+	// Wait for the next message, then collect any others that are ready, up to max_msgs in total.
+	void Wait(std::vector<Msg> &msgs, unsigned int max_msgs = 0);
 	void PostMessage(MsgType &t, MsgPayload &p);
+	MsgQueueStats GetMsgQueueStats();
 
 	Stream *GetStream(std::string const &name, StreamInfo *info = nullptr) const;
 	Stream *ViewfinderStream(StreamInfo *info = nullptr) const;
@@ -191,37 +212,173 @@ public:
 
 protected:
 	std::unique_ptr<Options> options_;
+	// Timings for --startup-profile.
+	StartupProfile startup_profile_;
+
+	// Make a stream, and buffers that have already been mmapped, known to the application without any
+	// camera, so that tools such as rpicam-stage-bench can run post-processing on frames of their own.
+	// Teardown() unmaps the buffers just like ones we allocated ourselves.
+	void AddOfflineStream(std::string const &name, Stream *stream,
+						  std::map<FrameBuffer *, std::vector<libcamera::Span<uint8_t>>> const &buffers);
+	// The lores format requested by the post-processing file, if any.
+	libcamera::PixelFormat GetLoresFormat() const { return lores_format_; }
 
 private:
+	// A bounded ring of messages from the camera, post-processing and preview threads to the
+	// application thread. Only droppable messages (completed requests) count towards the depth
+	// and are subject to the overflow policy; control messages such as Quit are never lost.
 	template <typename T>
 	class MessageQueue
 	{
 	public:
+		MessageQueue() : ring_(16) {}
+		// A depth of zero leaves the queue unbounded.
+		void Configure(unsigned int depth, MsgQueuePolicy policy)
+		{
+			std::unique_lock<std::mutex> lock(mutex_);
+			depth_ = depth;
+			policy_ = policy;
+			draining_ = false;
+			if (ring_.size() < depth_ + 4)
+				grow(depth_ + 4);
+		}
+		// Returns false if the queue overflowed and a message had to be dropped.
 		template <typename U>
-		void Post(U &&msg)
+		bool Post(U &&msg, bool droppable = false)
 		{
+			// Anything we drop is only released once the lock is gone, as releasing a request
+			// may re-queue it to the camera.
+			std::optional<T> dropped;
 			std::unique_lock<std::mutex> lock(mutex_);
-			queue_.push(std::forward<U>(msg));
+
+			if (droppable && depth_ && !draining_)
+			{
+				if (policy_ == MsgQueuePolicy::Block)
+					not_full_.wait(lock, [this] { return droppable_count_ < depth_ || draining_; });
+				else if (droppable_count_ >= depth_)
+				{
+					dropped_++;
+					if (policy_ == MsgQueuePolicy::DropNewest)
+					{
+						dropped.emplace(std::forward<U>(msg));
+						return false;
+					}
+					dropOldest(dropped);
+				}
+			}
+
+			push(std::forward<U>(msg), droppable);
 			cond_.notify_one();
+			return !dropped;
 		}
 		T Wait()
 		{
 			std::unique_lock<std::mutex> lock(mutex_);
-			cond_.wait(lock, [this] { return !queue_.empty(); });
-			T msg = std::move(queue_.front());
-			queue_.pop();
-			return msg;
+			cond_.wait(lock, [this] { return count_ != 0; });
+			return pop();
+		}
+		// Wait for at least one message, then return every message that is ready, up to
+		// max_msgs of them (zero meaning no limit).
+		void Wait(std::vector<T> &msgs, unsigned int max_msgs = 0)
+		{
+			std::unique_lock<std::mutex> lock(mutex_);
+			cond_.wait(lock, [this] { return count_ != 0; });
+			while (count_ && (!max_msgs || msgs.size() < max_msgs))
+				msgs.push_back(pop());
+		}
+		// Stop blocking producers, and stop dropping messages, so that threads posting to us
+		// can finish while the camera is being stopped. Configure() resumes normal operation.
+		void Drain()
+		{
+			std::unique_lock<std::mutex> lock(mutex_);
+			draining_ = true;
+			not_full_.notify_all();
 		}
 		void Clear()
+		{
+			std::vector<std::optional<T>> ring;
+			std::unique_lock<std::mutex> lock(mutex_);
+			ring.swap(ring_);
+			ring_.resize(ring.size());
+			head_ = count_ = droppable_count_ = 0;
+			not_full_.notify_all();
+		}
+		MsgQueueStats Stats()
 		{
 			std::unique_lock<std::mutex> lock(mutex_);
-			queue_ = {};
+			return { count_, max_count_, dropped_ };
 		}
 
 	private:
-		std::queue<T> queue_;
+		template <typename U>
+		void push(U &&msg, bool droppable)
+		{
+			if (count_ == ring_.size())
+				grow(2 * ring_.size());
+			size_t tail = (head_ + count_) % ring_.size();
+			ring_[tail].emplace(std::forward<U>(msg));
+			droppable_[tail] = droppable;
+			count_++;
+			droppable_count_ += droppable;
+			max_count_ = std::max(max_count_, count_);
+		}
+		T pop()
+		{
+			T msg = std::move(*ring_[head_]);
+			ring_[head_].reset();
+			droppable_count_ -= droppable_[head_];
+			head_ = (head_ + 1) % ring_.size();
+			count_--;
+			not_full_.notify_one();
+			return msg;
+		}
+		// Remove the oldest droppable message, closing up the gap it leaves.
+		void dropOldest(std::optional<T> &dropped)
+		{
+			unsigned int i = 0;
+			while (i < count_ && !droppable_[(head_ + i) % ring_.size()])
+				i++;
+			if (i == count_)
+				return;
+			dropped = std::move(ring_[(head_ + i) % ring_.size()]);
+			for (; i > 0; i--)
+			{
+				size_t dst = (head_ + i) % ring_.size(), src = (head_ + i - 1) % ring_.size();
+				ring_[dst] = std::move(ring_[src]);
+				droppable_[dst] = droppable_[src];
+			}
+			ring_[head_].reset();
+			head_ = (head_ + 1) % ring_.size();
+			count_--;
+			droppable_count_--;
+		}
+		void grow(size_t size)
+		{
+			std::vector<std::optional<T>> ring(size);
+			std::vector<bool> droppable(size);
+			for (unsigned int i = 0; i < count_; i++)
+			{
+				ring[i] = std::move(ring_[(head_ + i) % ring_.size()]);
+				droppable[i] = droppable_[(head_ + i) % ring_.size()];
+			}
+			ring_.swap(ring);
+			droppable_.swap(droppable);
+			head_ = 0;
+		}
+
+		std::vector<std::optional<T>> ring_;
+		std::vector<bool> droppable_ = std::vector<bool>(16);
+		size_t head_ = 0;
+		unsigned int count_ = 0;
+		unsigned int droppable_count_ = 0;
+		unsigned int max_count_ = 0;
+		uint64_t dropped_ = 0;
+		unsigned int depth_ = 0;
+		MsgQueuePolicy policy_ = MsgQueuePolicy::DropOldest;
+		bool draining_ = false;
 		std::mutex mutex_;
 		std::condition_variable cond_;
+		std::condition_variable not_full_;
 	};
 	struct PreviewItem
 	{
@@ -242,6 +399,7 @@ private:
 	void setupCapture();
 	void makeRequests();
 	void queueRequest(CompletedRequest *completed_request);
+	unsigned int tunedBufferCount(std::string const &use_case) const;
 	void requestComplete(Request *request);
 	void previewDoneCallback(int fd);
 	void startPreview();
@@ -261,6 +419,8 @@ private:
 	std::vector<std::unique_ptr<Request>> requests_;
 	std::mutex completed_requests_mutex_;
 	std::set<CompletedRequest *> completed_requests_;
+	// Measures the buffer count we need, for --buffer-tuning.
+	BufferTuner buffer_tuner_;
 	bool camera_started_ = false;
 	std::mutex camera_stop_mutex_;
 	MessageQueue<Msg> msg_queue_;
@@ -7,6 +7,12 @@
 
 #pragma once
 
+#include <deque>
+#include <map>
+#include <mutex>
+#include <sstream>
+
+#include "core/rate_controller.hpp"
 #include "core/rpicam_app.hpp"
 #include "core/stream_info.hpp"
 #include "core/video_options.hpp"
@@ -26,14 +32,23 @@ public:
 
 	void StartEncoder()
 	{
+		auto start = StartupProfile::Clock::now();
 		createEncoder();
-		encoder_->SetInputDoneCallback(std::bind(&RPiCamEncoder::encodeBufferDone, this, std::placeholders::_1));
+		startup_profile_.Record("encoder", start);
+		encoder_->SetInputDoneCallback(
+			std::bind(&RPiCamEncoder::encodeBufferDone, this, nullptr, std::placeholders::_1));
 		encoder_->SetOutputReadyCallback(encode_output_ready_callback_);
+		createSimulcastEncoders();
+
+		VideoOptions const *options = GetOptions();
+		if (options->Get().abr_max)
+			rate_controller_ = std::make_unique<RateController>(
+				options->Get().abr_min.bps(), options->Get().abr_max.bps(), options->Get().bitrate.bps(),
+				options->Get().intra, options->Get().abr_latency);
 
 #ifndef DISABLE_RPI_FEATURES
 		// Set up the encode function to wait for synchronisation with another camera system,
 		// when this has been requested in the options.
-		VideoOptions const *options = GetOptions();
 		libcamera::ControlList cl;
 		if (options->Get().sync == 0)
 			cl.set(libcamera::controls::rpi::SyncMode, libcamera::controls::rpi::SyncModeOff);
@@ -47,6 +62,20 @@ public:
 	// This is callback when the encoder gives you the encoded output data.
 	void SetEncodeOutputReadyCallback(EncodeOutputReadyCallback callback) { encode_output_ready_callback_ = callback; }
 	void SetMetadataReadyCallback(MetadataReadyCallback callback) { metadata_ready_callback_ = callback; }
+	// The options for each --simulcast encoder, which the application uses to create its Output.
+	std::vector<VideoOptions const *> GetSimulcastOptions()
+	{
+		parseSimulcast();
+		std::vector<VideoOptions const *> options;
+		for (auto const &s : simulcast_)
+			options.push_back(s.options.get());
+		return options;
+	}
+	void SetSimulcastOutputReadyCallback(unsigned int index, EncodeOutputReadyCallback callback)
+	{
+		parseSimulcast();
+		simulcast_.at(index).output_ready_callback = callback;
+	}
 	bool EncodeBuffer(CompletedRequestPtr &completed_request, Stream *stream)
 	{
 		assert(encoder_);
@@ -58,26 +87,56 @@ public:
 			return false;
 #endif
 
-		StreamInfo info = GetStreamInfo(stream);
-		FrameBuffer *buffer = completed_request->buffers[stream];
-		BufferReadSync r(this, buffer);
-		libcamera::Span span = r.Get()[0];
-		void *mem = span.data();
-		if (!buffer || !mem)
-			throw std::runtime_error("no buffer to encode");
-		auto ts = completed_request->metadata.get(controls::FrameWallClock);
-		int64_t timestamp_ns = ts ? *ts : buffer->metadata().timestamp;
-		{
-			std::lock_guard<std::mutex> lock(encode_buffer_queue_mutex_);
-			encode_buffer_queue_.push(completed_request); // creates a new reference
-		}
-		encoder_->EncodeBuffer(buffer->planes()[0].fd.get(), span.size(), mem, info, timestamp_ns / 1000);
+		if (rate_controller_ && !adaptEncoder())
+			return true; // the rate controller is dropping this frame
+		encode(encoder_.get(), nullptr, completed_request, stream);
+		// A simulcast encoder can take the same stream as the main one, as their buffers are queued apart.
+		for (auto &s : simulcast_)
+			encode(s.encoder.get(), s.stream, completed_request, s.stream);
 
 		// Tell our caller that encoding is underway.
 		return true;
 	}
+	// Change the main encoder's keyframe interval while it's running. Returns false if it can't.
+	bool SetIntraPeriod(unsigned int intra_period)
+	{
+		assert(encoder_);
+		return encoder_->SetIntraPeriod(intra_period);
+	}
+	// Ask the main encoder, or the given simulcast encoder, for a keyframe straight away. Outputs call
+	// this from the encoder's own threads, which can still be running while StopEncoder() deletes it.
+	bool RequestKeyframe(int simulcast_index = -1)
+	{
+		std::lock_guard<std::mutex> lock(encoder_mutex_);
+		Encoder *encoder = simulcast_index < 0 ? encoder_.get() : simulcast_.at(simulcast_index).encoder.get();
+		if (!encoder)
+			return false;
+		if (!encoder->RequestKeyframe())
+		{
+			LOG(2, "Encoder can't make keyframes on request");
+			return false;
+		}
+		return true;
+	}
 	VideoOptions *GetOptions() const { return static_cast<VideoOptions *>(RPiCamApp::GetOptions()); }
-	void StopEncoder() { encoder_.reset(); }
+	// Only there when --abr-max was given. Outputs should pass it their feedback.
+	RateController *GetRateController() const { return rate_controller_.get(); }
+	void StopEncoder()
+	{
+		// Take the encoders out from under the lock, so that RequestKeyframe() can't see them any more, but
+		// delete them outside it, as that waits for their threads, which may be calling RequestKeyframe().
+		std::unique_ptr<Encoder> encoder;
+		std::vector<std::unique_ptr<Encoder>> simulcast_encoders;
+		{
+			std::lock_guard<std::mutex> lock(encoder_mutex_);
+			encoder = std::move(encoder_);
+			for (auto &s : simulcast_)
+				simulcast_encoders.push_back(std::move(s.encoder));
+		}
+		encoder.reset();
+		simulcast_encoders.clear();
+		rate_controller_.reset();
+	}
 
 protected:
 	virtual void createEncoder()
@@ -89,28 +148,184 @@ protected:
 		encoder_ = std::unique_ptr<Encoder>(Encoder::Create(GetOptions(), info));
 	}
 	std::unique_ptr<Encoder> encoder_;
+	std::mutex encoder_mutex_; // so that RequestKeyframe() doesn't race with StopEncoder()
 
 private:
-	void encodeBufferDone(void *mem)
+	// Each --simulcast encoder has its own copy of the options, with its settings applied.
+	struct Simulcast
+	{
+		std::string stream_name;
+		std::unique_ptr<VideoOptions> options;
+		Stream *stream = nullptr;
+		std::unique_ptr<Encoder> encoder;
+		EncodeOutputReadyCallback output_ready_callback;
+	};
+
+	void parseSimulcast()
 	{
-		// If non-NULL, mem would indicate which buffer has been completed, but
-		// currently we're just assuming everything is done in order. (We could
-		// handle this by replacing the queue with a vector of <mem, completed_request>
-		// pairs.)
-		assert(mem == nullptr);
+		if (simulcast_parsed_)
+			return;
+		simulcast_parsed_ = true;
+
+		std::stringstream specs(GetOptions()->Get().simulcast);
+		std::string spec;
+		while (std::getline(specs, spec, ';'))
+		{
+			if (spec.empty())
+				continue;
+			Simulcast s;
+			size_t colon = spec.find(':');
+			s.stream_name = spec.substr(0, colon);
+			if (s.stream_name != "video" && s.stream_name != "lores")
+				throw std::runtime_error("simulcast: unknown stream " + s.stream_name);
+
+			// Start from the main encoder's settings, but everything written alongside the video
+			// (timestamps, metadata, audio) belongs to the main output only.
+			s.options = std::make_unique<VideoOptions>();
+			OptsInternal &opts = s.options->Set();
+			opts = GetOptions()->Get();
+			opts.simulcast.clear();
+			opts.tee.clear();
+			opts.event.clear();
+			opts.output.clear();
+			opts.save_pts.clear();
+			opts.metadata.clear();
+			opts.libav_audio = false;
+			opts.circular = 0;
+			opts.split = false;
+			opts.pause = false;
+
+			std::stringstream settings(colon == std::string::npos ? "" : spec.substr(colon + 1));
+			std::string setting;
+			while (std::getline(settings, setting, ','))
+			{
+				size_t equals = setting.find('=');
+				if (equals == std::string::npos)
+					throw std::runtime_error("simulcast: expected key=value, not " + setting);
+				std::string key = setting.substr(0, equals), value = setting.substr(equals + 1);
+				if (key == "codec")
+				{
+					if (value != "h264" && value != "libav" && value != "mjpeg" && value != "yuv420")
+						throw std::runtime_error("simulcast: unrecognised codec " + value);
+					opts.codec = value;
+				}
+				else if (key == "bitrate")
+					opts.bitrate.set(value);
+				else if (key == "intra")
+					opts.intra = std::stoul(value);
+				else if (key == "profile")
+					opts.profile = value;
+				else if (key == "level")
+					opts.level = value;
+				else if (key == "inline")
+					opts.inline_headers = value == "1" || value == "true";
+				else if (key == "quality")
+					opts.quality = std::stoi(value);
+				else if (key == "output")
+					opts.output = value;
+				else
+					throw std::runtime_error("simulcast: unknown setting " + key);
+			}
+
+			simulcast_.push_back(std::move(s));
+		}
+	}
+
+	void createSimulcastEncoders()
+	{
+		parseSimulcast();
+		for (unsigned int i = 0; i < simulcast_.size(); i++)
+		{
+			Simulcast &s = simulcast_[i];
+			StreamInfo info;
+			s.stream = GetStream(s.stream_name, &info);
+			if (!s.stream || !info.width || !info.height || !info.stride)
+				throw std::runtime_error("simulcast: " + s.stream_name + " stream is not configured");
+
+			auto start = StartupProfile::Clock::now();
+			s.encoder = std::unique_ptr<Encoder>(Encoder::Create(s.options.get(), info));
+			startup_profile_.Record("simulcast encoder " + std::to_string(i), start);
+			s.encoder->SetInputDoneCallback(
+				std::bind(&RPiCamEncoder::encodeBufferDone, this, s.stream, std::placeholders::_1));
+			s.encoder->SetOutputReadyCallback(s.output_ready_callback);
+			LOG(1, "Simulcast encoder " << i << ": " << s.stream_name << " " << info.width << "x" << info.height << " "
+										<< s.options->Get().codec << " to " << s.options->Get().output);
+		}
+	}
+
+	// Apply any changes the rate controller wants, and return false if this frame should be dropped.
+	bool adaptEncoder()
+	{
+		double latency_ms;
+		unsigned int queued;
+		if (encoder_->GetOutputFeedback(latency_ms, queued))
+			rate_controller_->Feedback(latency_ms, queued);
+
+		RateController::Params params;
+		if (rate_controller_->Update(params))
+		{
+			if (!encoder_->SetBitrate(params.bitrate_bps))
+				LOG(2, "Encoder can't change bitrate");
+			if (params.intra_period && !encoder_->SetIntraPeriod(params.intra_period))
+				LOG(2, "Encoder can't change intra period");
+		}
+
+		return !rate_controller_->DropFrame();
+	}
+
+	void encode(Encoder *encoder, Stream *queue, CompletedRequestPtr &completed_request, Stream *stream)
+	{
+		StreamInfo info = GetStreamInfo(stream);
+		FrameBuffer *buffer = completed_request->buffers[stream];
+		BufferReadSync r(this, buffer);
+		libcamera::Span span = r.Get()[0];
+		void *mem = span.data();
+		if (!buffer || !mem)
+			throw std::runtime_error("no buffer to encode");
+		auto ts = completed_request->metadata.get(controls::FrameWallClock);
+		int64_t timestamp_ns = ts ? *ts : buffer->metadata().timestamp;
+		EncodeToken token;
 		{
 			std::lock_guard<std::mutex> lock(encode_buffer_queue_mutex_);
-			if (encode_buffer_queue_.empty())
-				throw std::runtime_error("no buffer available to return");
-			CompletedRequestPtr &completed_request = encode_buffer_queue_.front();
-			if (metadata_ready_callback_ && !GetOptions()->Get().metadata.empty())
-				metadata_ready_callback_(completed_request->metadata);
-			encode_buffer_queue_.pop(); // drop shared_ptr reference
+			token = next_token_++;
+			encode_buffer_queue_[queue].push_back({ token, completed_request }); // creates a new reference
 		}
+		// Encoded frames come out in the order they go in, so the output can pair them up with the metadata
+		// queued here. It's queued now so that encoders can hold on to their input until it's been output.
+		if (!queue && metadata_ready_callback_ && !GetOptions()->Get().metadata.empty())
+			metadata_ready_callback_(completed_request->metadata);
+		encoder->EncodeBuffer(buffer->planes()[0].fd.get(), span.size(), mem, info, timestamp_ns / 1000, token);
 	}
 
-	std::queue<CompletedRequestPtr> encode_buffer_queue_;
+	// The main encoder's buffers are queued under nullptr, and simulcast encoders under their stream.
+	void encodeBufferDone(Stream *stream, EncodeToken token)
+	{
+		// Encoders may finish with their input buffers in any order, and each buffer goes back to the
+		// camera straight away. Each request is only returned to the camera once every encoder is done
+		// with it.
+		CompletedRequestPtr completed_request; // dropped only once we have released the lock
+		std::lock_guard<std::mutex> lock(encode_buffer_queue_mutex_);
+		std::deque<EncodeItem> &queue = encode_buffer_queue_[stream];
+		auto it = std::find_if(queue.begin(), queue.end(),
+							   [token](EncodeItem const &item) { return item.token == token; });
+		if (it == queue.end())
+			throw std::runtime_error("no buffer available to return");
+
+		completed_request = std::move(it->completed_request);
+		queue.erase(it);
+	}
+
+	struct EncodeItem
+	{
+		EncodeToken token;
+		CompletedRequestPtr completed_request;
+	};
+	std::map<Stream *, std::deque<EncodeItem>> encode_buffer_queue_;
+	EncodeToken next_token_ = 0;
 	std::mutex encode_buffer_queue_mutex_;
 	EncodeOutputReadyCallback encode_output_ready_callback_;
 	MetadataReadyCallback metadata_ready_callback_;
+	std::vector<Simulcast> simulcast_;
+	std::unique_ptr<RateController> rate_controller_;
+	bool simulcast_parsed_ = false;
 };
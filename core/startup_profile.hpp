@@ -0,0 +1,69 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * Copyright (C) 2025, Raspberry Pi Ltd
+ *
+ * startup_profile.hpp - Timing of the application start-up phases.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Collects how long each phase of the application start-up takes, from creating the
+// application up to the first frame arriving. Phases that happen more than once, such
+// as restarting the camera manager, are accumulated.
+class StartupProfile
+{
+public:
+	using Clock = std::chrono::steady_clock;
+
+	StartupProfile() : start_(Clock::now()) {}
+
+	// Add the time elapsed since start to the named phase.
+	void Record(std::string const &phase, Clock::time_point start)
+	{
+		std::chrono::duration<double, std::milli> t = Clock::now() - start;
+		std::lock_guard<std::mutex> lock(mutex_);
+		for (auto &p : phases_)
+		{
+			if (p.first == phase)
+			{
+				p.second += t.count();
+				return;
+			}
+		}
+		phases_.emplace_back(phase, t.count());
+	}
+
+	// Call when a frame arrives. Returns true only for the very first one.
+	bool FirstFrame()
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		if (first_frame_ms_ >= 0)
+			return false;
+		std::chrono::duration<double, std::milli> t = Clock::now() - start_;
+		first_frame_ms_ = t.count();
+		return true;
+	}
+
+	void Report(std::ostream &os = std::cerr)
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		os << "Startup profile:" << std::endl;
+		for (auto const &p : phases_)
+			os << "    " << p.first << ": " << p.second << "ms" << std::endl;
+		if (first_frame_ms_ >= 0)
+			os << "    first frame: " << first_frame_ms_ << "ms after start-up" << std::endl;
+	}
+
+private:
+	Clock::time_point start_;
+	std::vector<std::pair<std::string, double>> phases_;
+	double first_frame_ms_ = -1;
+	std::mutex mutex_;
+};
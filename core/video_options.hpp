@@ -40,6 +40,9 @@ struct VideoOptions : public Options
 			 "Save a timestamp file with this name")
 			("quality,q", value<int>(&v_->quality)->default_value(50),
 			 "Set the MJPEG quality parameter (mjpeg only)")
+			("yuv-layout", value<std::string>(&v_->yuv_layout)->default_value("padded"),
+			 "How to write frames with the yuv420 codec: \"padded\" (exactly as the camera produces them), "
+			 "\"i420\" (planar, without row padding) or \"nv12\" (interleaved chroma, without row padding)")
 			("listen,l", value<bool>(&v_->listen)->default_value(false)->implicit_value(true),
 			 "Listen for an incoming client network connection before sending data to the client")
 			("keypress,k", value<bool>(&v_->keypress)->default_value(false)->implicit_value(true),
@@ -54,6 +57,28 @@ struct VideoOptions : public Options
 			 "Break the recording into files of approximately this many milliseconds")
 			("circular", value<size_t>(&v_->circular)->default_value(0)->implicit_value(4),
 			 "Write output to a circular buffer of the given size (in MB) which is saved on exit")
+			("tee", value<std::string>(&v_->tee),
+			 "Comma separated list of further outputs to write the same encoded stream to, alongside --output. "
+			 "Each is a file name, a udp:// or tcp:// address, or circular:<file> for a circular buffer.")
+			("tee-queue", value<unsigned int>(&v_->tee_queue)->default_value(32),
+			 "Number of encoded frames each --tee output may fall behind by before it drops frames until "
+			 "the next keyframe")
+			("simulcast", value<std::string>(&v_->simulcast),
+			 "Encode further streams at the same time, each with its own settings and output. Give each as "
+			 "<stream>:<key>=<value>,... separated by \";\", where the stream is \"lores\" (set --lores-width and "
+			 "--lores-height) or \"video\", and the keys are codec, bitrate, intra, profile, level, inline, quality "
+			 "and output. e.g.: \"lores:codec=h264,bitrate=1mbps,output=udp://192.168.1.2:5000\"")
+			("event", value<std::string>(&v_->event),
+			 "Record only while something is happening, writing a new file (named like --segment) for each "
+			 "event. Give the post-processing metadata that starts an event, e.g. \"motion_detect.result\", or a "
+			 "comparison such as \"object_detect.results=person\" or \"object_detect.results>1\"")
+			("event-preroll", value<uint32_t>(&v_->event_preroll)->default_value(2000),
+			 "Milliseconds of video from before each event to include at the start of its file")
+			("event-postroll", value<unsigned int>(&v_->event_postroll)->default_value(30),
+			 "Number of quiet frames after which an event ends and its file is closed")
+			("event-idle", value<std::string>(&v_->event_idle)->default_value("encode"),
+			 "What to do between events: \"encode\" every frame (needed for the pre-roll), \"keyframes\" to "
+			 "encode only a keyframe each second, or \"skip\" to encode nothing")
 			("frames", value<unsigned int>(&v_->frames)->default_value(0),
 			 "Run for the exact number of frames specified. This will override any timeout set.")
 			("libav-video-codec", value<std::string>(&v_->libav_video_codec)->default_value("h264_v4l2m2m"),
@@ -65,10 +90,22 @@ struct VideoOptions : public Options
 			 "Separate key and value with \"=\" and multiple options with \";\". "
 			 "e.g.: \"preset=ultrafast;profile=high;partitions=i8x8,i4x4\". "
 			 "To list available options for a given codec, run the \"ffmpeg -h encoder=libx264\" command for libx264.")
+			("libav-profile", value<std::string>(&v_->libav_profile),
+			 "Performance profile for the libx264 and libx265 software codecs: \"realtime\" (lowest latency), "
+			 "\"headroom\" (fewest cores), \"balanced\" or \"quality\". Leave blank for the codec defaults. "
+			 "Use rpicam-encode-bench to see what each achieves.")
+			("libav-affinity", value<std::string>(&v_->libav_affinity),
+			 "Comma separated list of CPUs to run the libav video encoder on, e.g. \"2,3\"")
 			("libav-format", value<std::string>(&v_->libav_format),
 			 "Sets the libav encoder output format to use. "
 			 "Leave blank to try and deduce this from the filename.\n"
 			 "To list available formats, run  the \"ffmpeg -formats\" command.")
+			("libav-mux-queue", value<unsigned int>(&v_->libav_mux_queue)->default_value(128),
+			 "Number of encoded packets that may wait to be written out by the libav muxer. Beyond this, packets "
+			 "are dropped until the next keyframe so that a slow output never holds up the encoder.")
+			("libav-fragment", value<uint32_t>(&v_->libav_fragment)->default_value(0),
+			 "Write fragmented MP4 (CMAF) with fragments of about this many milliseconds, for low latency live "
+			 "output. Only for the mp4 and mov formats.")
 			("libav-audio", value<bool>(&v_->libav_audio)->default_value(false)->implicit_value(true),
 			 "Records an audio stream together with the video.")
 			("audio-codec", value<std::string>(&v_->audio_codec)->default_value("aac"),
@@ -93,6 +130,14 @@ struct VideoOptions : public Options
 			 "The offset value can be either positive or negative.")
 			("low-latency", value<bool>(&v_->low_latency)->default_value(false)->implicit_value(true),
 			 "Enables the libav/libx264 low latency presets for video encoding.")
+			("abr-max", value<std::string>(&v_->abr_max_)->default_value("0bps"),
+			 "Adapt the encoding to what the output can keep up with, using at most this bitrate. Once the bitrate "
+			 "reaches --abr-min, keyframes are spaced further apart and then frames are dropped.")
+			("abr-min", value<std::string>(&v_->abr_min_)->default_value("0bps"),
+			 "The lowest bitrate to use with --abr-max")
+			("abr-latency", value<uint32_t>(&v_->abr_latency)->default_value(100),
+			 "With --abr-max, the time in milliseconds that sending a frame may take before the output is "
+			 "considered to be falling behind")
 #ifndef DISABLE_RPI_FEATURES
 			 ("sync", value<std::string>(&v_->sync_)->default_value("off"),
 			  "Whether to synchronise with another camera. Use \"off\", \"server\" or \"client\".")
@@ -106,7 +151,7 @@ struct VideoOptions : public Options
 		if (Options::Parse(argc, argv) == false)
 			return false;
 
-		return v_->ParseVideo();
+		return v_->ParseVideo(GetPlatform());
 	}
 
 	virtual void Print() const override
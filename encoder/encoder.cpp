@@ -7,7 +7,6 @@
 
 #include <cstring>
 #include <fcntl.h>
-#include <filesystem>
 #include <sys/ioctl.h>
 #include <sys/stat.h>
 
@@ -22,8 +21,6 @@
 
 #include "config.h"
 
-namespace fs = std::filesystem;
-
 EncoderFactory &EncoderFactory::GetInstance()
 {
 	static EncoderFactory instance;
@@ -38,40 +35,25 @@ void EncoderFactory::RegisterEncoder(const std::string &name, EncoderCreateFunc
 EncoderCreateFunc EncoderFactory::CreateEncoder(const std::string &name)
 {
 	auto it = encoders_.find(name);
+	if (it == encoders_.end() && encoder_libraries_.Load(name))
+		it = encoders_.find(name);
 	if (it != encoders_.end())
 		return it->second;
 	return nullptr;
 }
 
-bool EncoderFactory::HasEncoder(const std::string &name) const
+bool EncoderFactory::HasEncoder(const std::string &name)
 {
+	if (encoders_.find(name) == encoders_.end())
+		encoder_libraries_.Load(name);
 	return encoders_.find(name) != encoders_.end();
 }
 
 void EncoderFactory::LoadEncoderLibraries(const std::string &lib_dir)
 {
-	const fs::path path(!lib_dir.empty() ? lib_dir : ENCODER_LIB_DIR);
-	const std::string ext(".so");
-
-	if (!fs::exists(path))
-		return;
-
-	// Dynamically load all .so files from the system encoder lib path.
-	// This will automatically register the stages with the factory.
-	for (auto const &p : fs::recursive_directory_iterator(path))
-	{
-		if (p.path().extension() == ext)
-		{
-			const std::string library_path = p.path().string();
-
-			// Check if this library has already been loaded
-			if (loaded_library_paths_.find(library_path) == loaded_library_paths_.end())
-			{
-				encoder_libraries_.emplace_back(library_path);
-				loaded_library_paths_.insert(library_path);
-			}
-		}
-	}
+	// Libraries are only loaded once an encoder they provide is asked for. Loading a library
+	// will automatically register its encoders with the factory.
+	encoder_libraries_.SetPath(lib_dir, ENCODER_LIB_DIR);
 }
 
 RegisterEncoder::RegisterEncoder(char const *name, EncoderCreateFunc create_func)
@@ -10,10 +10,14 @@
 #include <functional>
 #include <map>
 
+#include "core/plugin_loader.hpp"
 #include "core/stream_info.hpp"
 #include "core/video_options.hpp"
 
-typedef std::function<void(void *)> InputDoneCallback;
+// Identifies a frame given to EncodeBuffer(). Encoders pass it back to the input done callback as soon
+// as they have finished reading the frame's pixels, in whatever order that happens.
+typedef uint64_t EncodeToken;
+typedef std::function<void(EncodeToken)> InputDoneCallback;
 typedef std::function<void(void *, size_t, int64_t, bool)> OutputReadyCallback;
 
 class Encoder
@@ -24,15 +28,27 @@ public:
 	Encoder(VideoOptions const *options) : options_(options) {}
 	virtual ~Encoder() {}
 	// This is where the application sets the callback it gets whenever the encoder
-	// has finished with an input buffer, so the application can re-use it.
+	// has finished with an input buffer, so the application can re-use it. This must
+	// happen before the encoded output for that buffer is passed on.
 	void SetInputDoneCallback(InputDoneCallback callback) { input_done_callback_ = callback; }
 	// This callback is how the application is told that an encoded buffer is
 	// available. The application may not hang on to the memory once it returns
 	// (but the callback is already running in its own thread).
 	void SetOutputReadyCallback(OutputReadyCallback callback) { output_ready_callback_ = callback; }
 	// Encode the given buffer. The buffer is specified both by an fd and size
-	// describing a DMABUF, and by a mmapped userland pointer.
-	virtual void EncodeBuffer(int fd, size_t size, void *mem, StreamInfo const &info, int64_t timestamp_us) = 0;
+	// describing a DMABUF, and by a mmapped userland pointer. The token is returned
+	// through the input done callback once the buffer may be re-used.
+	virtual void EncodeBuffer(int fd, size_t size, void *mem, StreamInfo const &info, int64_t timestamp_us,
+							  EncodeToken token) = 0;
+	// Change the bitrate or keyframe interval while encoding. Encoders return false if they can't.
+	virtual bool SetBitrate(uint64_t /* bitrate_bps */) { return false; }
+	virtual bool SetIntraPeriod(unsigned int /* intra_period */) { return false; }
+	// Make the next frame a keyframe, so that new viewers or recordings needn't wait for the next
+	// one to come round. Returns false if the encoder can't.
+	virtual bool RequestKeyframe() { return false; }
+	// Encoders that write their own output (rather than through the output ready callback) report
+	// how long the last write took and how many packets are waiting.
+	virtual bool GetOutputFeedback(double & /* latency_ms */, unsigned int & /* queued */) { return false; }
 
 protected:
 	InputDoneCallback input_done_callback_;
@@ -56,7 +72,8 @@ public:
 
 	EncoderCreateFunc CreateEncoder(const std::string &name);
 
-	bool HasEncoder(const std::string &name) const;
+	// Looking up an encoder may load the library that provides it.
+	bool HasEncoder(const std::string &name);
 	const std::map<std::string, EncoderCreateFunc> &GetEncoders() const { return encoders_; }
 
 private:
@@ -64,8 +81,7 @@ private:
 	~EncoderFactory() = default;
 
 	std::map<std::string, EncoderCreateFunc> encoders_;
-	std::vector<DlLib> encoder_libraries_;
-	std::set<std::string> loaded_library_paths_;
+	PluginLoader encoder_libraries_;
 };
 
 struct RegisterEncoder
@@ -243,7 +243,8 @@ H264Encoder::~H264Encoder()
 	LOG(2, "H264Encoder closed");
 }
 
-void H264Encoder::EncodeBuffer(int fd, size_t size, void *mem, StreamInfo const &info, int64_t timestamp_us)
+void H264Encoder::EncodeBuffer(int fd, size_t size, void *mem, StreamInfo const &info, int64_t timestamp_us,
+							   EncodeToken token)
 {
 	int index;
 	{
@@ -254,6 +255,7 @@ void H264Encoder::EncodeBuffer(int fd, size_t size, void *mem, StreamInfo const
 			throw std::runtime_error("no buffers available to queue codec input");
 		index = input_buffers_available_.front();
 		input_buffers_available_.pop();
+		input_tokens_[index] = token;
 	}
 	v4l2_buffer buf = {};
 	v4l2_plane planes[VIDEO_MAX_PLANES] = {};
@@ -272,6 +274,47 @@ void H264Encoder::EncodeBuffer(int fd, size_t size, void *mem, StreamInfo const
 		throw std::runtime_error("failed to queue input to codec");
 }
 
+bool H264Encoder::SetBitrate(uint64_t bitrate_bps)
+{
+	// The codec accepts these controls while it's streaming.
+	v4l2_control ctrl = {};
+	ctrl.id = V4L2_CID_MPEG_VIDEO_BITRATE;
+	ctrl.value = bitrate_bps;
+	if (xioctl(fd_, VIDIOC_S_CTRL, &ctrl) < 0)
+	{
+		LOG_ERROR("WARNING: H264Encoder: failed to change bitrate");
+		return false;
+	}
+	return true;
+}
+
+bool H264Encoder::SetIntraPeriod(unsigned int intra_period)
+{
+	v4l2_control ctrl = {};
+	ctrl.id = V4L2_CID_MPEG_VIDEO_H264_I_PERIOD;
+	ctrl.value = intra_period;
+	if (xioctl(fd_, VIDIOC_S_CTRL, &ctrl) < 0)
+	{
+		LOG_ERROR("WARNING: H264Encoder: failed to change intra period");
+		return false;
+	}
+	return true;
+}
+
+bool H264Encoder::RequestKeyframe()
+{
+	// Applies to the next frame we queue.
+	v4l2_control ctrl = {};
+	ctrl.id = V4L2_CID_MPEG_VIDEO_FORCE_KEY_FRAME;
+	ctrl.value = 1;
+	if (xioctl(fd_, VIDIOC_S_CTRL, &ctrl) < 0)
+	{
+		LOG_ERROR("WARNING: H264Encoder: failed to request keyframe");
+		return false;
+	}
+	return true;
+}
+
 void H264Encoder::pollThread()
 {
 	while (true)
@@ -302,11 +345,13 @@ void H264Encoder::pollThread()
 			{
 				// Return this to the caller, first noting that this buffer, identified
 				// by its index, is available for queueing up another frame.
+				EncodeToken token;
 				{
 					std::lock_guard<std::mutex> lock(input_buffers_available_mutex_);
 					input_buffers_available_.push(buf.index);
+					token = input_tokens_[buf.index];
 				}
-				input_done_callback_(nullptr);
+				input_done_callback_(token);
 			}
 
 			buf = {};
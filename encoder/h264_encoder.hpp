@@ -20,7 +20,11 @@ public:
 	H264Encoder(VideoOptions const *options, StreamInfo const &info);
 	~H264Encoder();
 	// Encode the given DMABUF.
-	void EncodeBuffer(int fd, size_t size, void *mem, StreamInfo const &info, int64_t timestamp_us) override;
+	void EncodeBuffer(int fd, size_t size, void *mem, StreamInfo const &info, int64_t timestamp_us,
+					  EncodeToken token) override;
+	bool SetBitrate(uint64_t bitrate_bps) override;
+	bool SetIntraPeriod(unsigned int intra_period) override;
+	bool RequestKeyframe() override;
 
 private:
 	// We want at least as many output buffers as there are in the camera queue
@@ -53,6 +57,7 @@ private:
 	std::thread poll_thread_;
 	std::mutex input_buffers_available_mutex_;
 	std::queue<int> input_buffers_available_;
+	EncodeToken input_tokens_[NUM_OUTPUT_BUFFERS];
 	struct OutputItem
 	{
 		void *mem;
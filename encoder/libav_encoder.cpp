@@ -7,6 +7,8 @@
 
 #include <fcntl.h>
 #include <poll.h>
+#include <pthread.h>
+#include <sched.h>
 #include <string.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
@@ -18,6 +20,7 @@
 #include <iostream>
 
 #include "libav_encoder.hpp"
+#include "software_profiles.hpp"
 
 namespace {
 
@@ -111,12 +114,81 @@ void encoderOptionsLibx264(VideoOptions const *options, AVCodecContext *codec)
 	av_opt_set(codec->priv_data, "mixed_ref", "0", 0);
 }
 
+void encoderOptionsLibx265(VideoOptions const *options, AVCodecContext *codec)
+{
+	codec->thread_count = 0;
+	codec->max_b_frames = 0;
+	av_opt_set(codec->priv_data, "preset", options->Get().low_latency ? "ultrafast" : "superfast", 0);
+	if (options->Get().low_latency)
+		av_opt_set(codec->priv_data, "tune", "zerolatency", 0);
+}
+
 const std::map<std::string, std::function<void(VideoOptions const *, AVCodecContext *)>> optionsMap =
 {
 	{ "h264_v4l2m2m", encoderOptionsH264M2M },
 	{ "libx264", encoderOptionsLibx264 },
+	{ "libx265", encoderOptionsLibx265 },
 };
 
+// Apply a --libav-profile over the codec's own defaults. --libav-video-codec-opts still override these.
+void encoderProfileSoftware(VideoOptions const *options, AVCodecContext *codec)
+{
+	std::string const &codec_name = options->Get().libav_video_codec;
+	if (options->Get().libav_profile.empty())
+		return;
+	if (codec_name != "libx264" && codec_name != "libx265")
+		throw std::runtime_error("libav: --libav-profile only applies to libx264 and libx265");
+
+	SoftwareProfile const *profile = find_software_profile(options->Get().libav_profile);
+	if (!profile)
+		throw std::runtime_error("libav: no such profile " + options->Get().libav_profile);
+
+	av_opt_set(codec->priv_data, "preset", profile->preset, 0);
+	if (profile->tune)
+		av_opt_set(codec->priv_data, "tune", profile->tune, 0);
+
+	if (codec_name == "libx264")
+	{
+		codec->thread_type = profile->slice_threads ? FF_THREAD_SLICE : FF_THREAD_FRAME;
+		codec->thread_count = profile->threads;
+		codec->slices = profile->slices;
+		codec->max_b_frames = profile->lookahead ? 1 : 0;
+		av_opt_set_int(codec->priv_data, "intra-refresh", profile->intra_refresh, 0);
+		av_opt_set_int(codec->priv_data, "rc-lookahead", profile->lookahead, 0);
+	}
+	else
+	{
+		// x265 has no slice threads; it always runs frames in parallel, with a pool of worker threads.
+		std::string params = "pools=" + std::to_string(profile->threads) +
+							 ":frame-threads=" + std::to_string(profile->slice_threads ? 1 : profile->threads) +
+							 ":slices=" + std::to_string(profile->slices) +
+							 ":rc-lookahead=" + std::to_string(profile->lookahead) +
+							 (profile->intra_refresh ? ":intra-refresh=1" : "");
+		av_opt_set(codec->priv_data, "x265-params", params.c_str(), 0);
+	}
+}
+
+// Pin the calling thread, and so any threads it goes on to create, to the --libav-affinity CPUs.
+// Returns false if no affinity was asked for.
+bool setAffinity(VideoOptions const *options, cpu_set_t *old_cpus = nullptr)
+{
+	// The CPU numbers were checked when the options were parsed.
+	std::vector<unsigned int> const &cpus = options->Get().libav_cpus;
+	if (cpus.empty())
+		return false;
+
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	for (unsigned int cpu : cpus)
+		CPU_SET(cpu, &set);
+
+	if (old_cpus)
+		pthread_getaffinity_np(pthread_self(), sizeof(*old_cpus), old_cpus);
+	if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set))
+		throw std::runtime_error("libav: cannot set CPU affinity " + options->Get().libav_affinity);
+	return true;
+}
+
 } // namespace
 
 void LibAvEncoder::initVideoCodec(VideoOptions const *options, StreamInfo const &info)
@@ -182,6 +254,7 @@ void LibAvEncoder::initVideoCodec(VideoOptions const *options, StreamInfo const
 	auto fn = optionsMap.find(options->Get().libav_video_codec);
 	if (fn != optionsMap.end())
 		fn->second(options, codec_ctx_[Video]);
+	encoderProfileSoftware(options, codec_ctx_[Video]);
 
 	// Apply general options.
 	encoderOptionsGeneral(options, codec_ctx_[Video]);
@@ -201,6 +274,8 @@ void LibAvEncoder::initVideoCodec(VideoOptions const *options, StreamInfo const
 		{
 			if (options->Get().libav_video_codec == "h264_v4l2m2m" || options->Get().libav_video_codec == "libx264")
 				format = "h264";
+			else if (options->Get().libav_video_codec == "libx265")
+				format = "hevc";
 			else
 				throw std::runtime_error("libav: please specify output format with the --libav-format argument");
 		}
@@ -223,10 +298,10 @@ void LibAvEncoder::initVideoCodec(VideoOptions const *options, StreamInfo const
 						 (output_file_.find("264", output_file_.length() - 3) != std::string::npos ||
 						  output_file_.find("h264", output_file_.length() - 4) != std::string::npos);
 
-	if (!elementary_stream_ && (options->Get().circular || options->Get().segment || !options->Get().save_pts.empty() ||
+	if (!elementary_stream_ && (options->Get().circular || !options->Get().save_pts.empty() ||
 								options->Get().split || options->Get().initial == "pause"))
 	{
-		LOG_ERROR("\nERROR: The libav encoder does not currently support the circular, segment, save_pts, "
+		LOG_ERROR("\nERROR: The libav encoder does not currently support the circular, save_pts, "
 				  "split, or pause command line options with non-elementary streams!\n");
 		throw std::runtime_error("libav: Incompatible options selected.");
 	}
@@ -236,10 +311,21 @@ void LibAvEncoder::initVideoCodec(VideoOptions const *options, StreamInfo const
 	if (!out_fmt_ctx_)
 		throw std::runtime_error("libav: cannot allocate output context, try setting with --libav-format");
 
+	// Fragmented output relies on the MP4 muxer's movflags.
+	if (options->Get().libav_fragment &&
+		(elementary_stream_ || !out_fmt_ctx_->priv_data ||
+		 !av_opt_find(out_fmt_ctx_->priv_data, "movflags", nullptr, 0, 0)))
+		throw std::runtime_error("libav: --libav-fragment needs the mp4 or mov format");
+
 	if (out_fmt_ctx_->oformat->flags & AVFMT_GLOBALHEADER)
 		codec_ctx_[Video]->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
 
+	// The codec starts its worker threads when it's opened, and they inherit our CPU affinity.
+	cpu_set_t old_cpus;
+	bool pinned = setAffinity(options, &old_cpus);
 	int ret = avcodec_open2(codec_ctx_[Video], codec, nullptr);
+	if (pinned)
+		pthread_setaffinity_np(pthread_self(), sizeof(old_cpus), &old_cpus);
 	if (ret < 0)
 		throw std::runtime_error("libav: unable to open video codec: " + std::to_string(ret));
 
@@ -358,9 +444,11 @@ void LibAvEncoder::initAudioOutCodec(VideoOptions const *options, StreamInfo con
 }
 
 LibAvEncoder::LibAvEncoder(VideoOptions const *options, StreamInfo const &info)
-	: Encoder(options), output_ready_(false), abort_video_(false), abort_audio_(false), video_start_ts_(0),
+	: Encoder(options), output_ready_(false), pending_bitrate_(0), keyframe_requested_(false), intra_period_(0),
+	  frames_since_keyframe_(0), forced_keyframe_pts_(AV_NOPTS_VALUE), write_latency_us_(0), abort_video_(false),
+	  abort_audio_(false), abort_mux_(false), mux_dropping_(false), mux_dropped_(0), video_start_ts_(0),
 	  in_fmt_ctx_(nullptr), out_fmt_ctx_(nullptr), output_file_(options->Get().output), output_initialised_(false),
-	  elementary_stream_(false)
+	  elementary_stream_(false), segment_count_(0), segment_start_us_(-1), segment_offset_us_(0)
 {
 	avdevice_register_all();
 
@@ -379,6 +467,11 @@ LibAvEncoder::LibAvEncoder(VideoOptions const *options, StreamInfo const &info)
 
 	LOG(2, "libav: codec init completed");
 
+	// Writing to a container happens in its own thread, so that slow storage or a slow network never
+	// holds up the encoder. Elementary streams go through the Output class instead.
+	if (!elementary_stream_)
+		mux_thread_ = std::thread(&LibAvEncoder::muxThread, this);
+
 	video_thread_ = std::thread(&LibAvEncoder::videoThread, this);
 
 	if (options->Get().libav_audio)
@@ -396,6 +489,16 @@ LibAvEncoder::~LibAvEncoder()
 	abort_video_ = true;
 	video_thread_.join();
 
+	if (mux_thread_.joinable())
+	{
+		{
+			std::scoped_lock<std::mutex> lock(mux_mutex_);
+			abort_mux_ = true;
+		}
+		mux_cv_.notify_all();
+		mux_thread_.join();
+	}
+
 	avformat_free_context(out_fmt_ctx_);
 	avcodec_free_context(&codec_ctx_[Video]);
 
@@ -409,7 +512,8 @@ LibAvEncoder::~LibAvEncoder()
 	LOG(2, "libav: codec closed");
 }
 
-void LibAvEncoder::EncodeBuffer(int fd, size_t size, void *mem, StreamInfo const &info, int64_t timestamp_us)
+void LibAvEncoder::EncodeBuffer(int fd, size_t size, void *mem, StreamInfo const &info, int64_t timestamp_us,
+								EncodeToken token)
 {
 	AVFrame *frame = av_frame_alloc();
 	if (!frame)
@@ -431,10 +535,13 @@ void LibAvEncoder::EncodeBuffer(int fd, size_t size, void *mem, StreamInfo const
 
 	if (codec_ctx_[Video]->pix_fmt == AV_PIX_FMT_DRM_PRIME)
 	{
-		std::scoped_lock<std::mutex> lock(drm_queue_lock_);
-		drm_frame_queue_.emplace(std::make_unique<AVDRMFrameDescriptor>());
-		frame->buf[0] = av_buffer_create((uint8_t *)drm_frame_queue_.back().get(), sizeof(AVDRMFrameDescriptor),
-										 &LibAvEncoder::releaseBuffer, this, 0);
+		std::unique_ptr<AVDRMFrameDescriptor> drm_desc = std::make_unique<AVDRMFrameDescriptor>();
+		uint8_t *data = (uint8_t *)drm_desc.get();
+		{
+			std::scoped_lock<std::mutex> lock(input_frames_lock_);
+			input_frames_[data] = { token, std::move(drm_desc) };
+		}
+		frame->buf[0] = av_buffer_create(data, sizeof(AVDRMFrameDescriptor), &LibAvEncoder::releaseBuffer, this, 0);
 		frame->data[0] = frame->buf[0]->data;
 
 		AVDRMFrameDescriptor *desc = (AVDRMFrameDescriptor *)frame->data[0];
@@ -458,6 +565,10 @@ void LibAvEncoder::EncodeBuffer(int fd, size_t size, void *mem, StreamInfo const
 	}
 	else
 	{
+		{
+			std::scoped_lock<std::mutex> lock(input_frames_lock_);
+			input_frames_[(uint8_t *)mem] = { token, nullptr };
+		}
 		frame->buf[0] = av_buffer_create((uint8_t *)mem, size, &LibAvEncoder::releaseBuffer, this, 0);
 		av_image_fill_pointers(frame->data, AV_PIX_FMT_YUV420P, frame->height, frame->buf[0]->data, frame->linesize);
 		av_frame_make_writable(frame);
@@ -468,18 +579,31 @@ void LibAvEncoder::EncodeBuffer(int fd, size_t size, void *mem, StreamInfo const
 	video_cv_.notify_all();
 }
 
+std::string LibAvEncoder::outputFilename()
+{
+	if (output_file_.empty())
+		return "/dev/null";
+	if (!options_->Get().segment || elementary_stream_)
+		return output_file_;
+
+	char filename[256];
+	int n = snprintf(filename, sizeof(filename), output_file_.c_str(), segment_count_);
+	segment_count_++;
+	if (options_->Get().wrap)
+		segment_count_ = segment_count_ % options_->Get().wrap;
+	if (n < 0)
+		throw std::runtime_error("libav: failed to generate segment filename");
+	return filename;
+}
+
 void LibAvEncoder::initOutput()
 {
 	int ret;
 
-	// Copy the global header from the video encode context once the first frame
-	// has been encoded.
-	avcodec_parameters_from_context(stream_[Video]->codecpar, codec_ctx_[Video]);
-
 	char err[64];
 	if (!(out_fmt_ctx_->flags & AVFMT_NOFILE))
 	{
-		std::string filename = output_file_.empty() ? "/dev/null" : output_file_;
+		std::string filename = outputFilename();
 
 		// libav uses "pipe:" for stdout
 		if (filename == "-")
@@ -493,7 +617,17 @@ void LibAvEncoder::initOutput()
 		}
 	}
 
-	ret = avformat_write_header(out_fmt_ctx_, nullptr);
+	AVDictionary *format_opts = nullptr;
+	if (options_->Get().libav_fragment)
+	{
+		// Each fragment starts on a keyframe, and is flushed out as soon as it's complete.
+		av_dict_set(&format_opts, "movflags", "frag_keyframe+empty_moov+default_base_moof+cmaf", 0);
+		av_dict_set_int(&format_opts, "frag_duration", options_->Get().libav_fragment * 1000, 0);
+		out_fmt_ctx_->flush_packets = 1;
+	}
+
+	ret = avformat_write_header(out_fmt_ctx_, &format_opts);
+	av_dict_free(&format_opts);
 	if (ret < 0)
 	{
 		av_strerror(ret, err, sizeof(err));
@@ -534,36 +668,35 @@ void LibAvEncoder::encode(AVPacket *pkt, unsigned int stream_id)
 			throw std::runtime_error("libav: error receiving packet: " + std::to_string(ret));
 
 		// Initialise the ouput mux on the first received video packet, as we may need
-		// to copy global header data from the encoder.
+		// to copy global header data from the encoder. For containers, the mux thread
+		// writes the header when this packet reaches it.
 		if (stream_id == Video && !output_ready_)
 		{
-			initOutput();
+			avcodec_parameters_from_context(stream_[Video]->codecpar, codec_ctx_[Video]);
+			if (elementary_stream_)
+				initOutput();
 			output_ready_ = true;
 		}
 
+		// Count from any keyframe the codec makes by itself too, or --intra would add needless ones. The
+		// ones we forced were counted from when we sent them.
+		if (stream_id == Video && (pkt->flags & AV_PKT_FLAG_KEY) && pkt->pts != forced_keyframe_pts_)
+			frames_since_keyframe_ = 0;
+
 		pkt->stream_index = stream_id;
 		pkt->pos = -1;
 		pkt->duration = 0;
 
-		// Rescale from the codec timebase to the stream timebase.
-		av_packet_rescale_ts(pkt, codec_ctx_[stream_id]->time_base, out_fmt_ctx_->streams[stream_id]->time_base);
-
 		if (!elementary_stream_)
 		{
-			std::scoped_lock<std::mutex> lock(output_mutex_);
-			// pkt is now blank (av_interleaved_write_frame() takes ownership of
-			// its contents and resets pkt), so that no unreferencing is necessary.
-			// This would be different if one used av_write_frame().
-			ret = av_interleaved_write_frame(out_fmt_ctx_, pkt);
-			if (ret < 0)
-			{
-				char err[AV_ERROR_MAX_STRING_SIZE];
-				av_strerror(ret, err, sizeof(err));
-				throw std::runtime_error("libav: error writing output: " + std::string(err));
-			}
+			// The mux thread takes over the packet's contents, leaving pkt blank.
+			queuePacket(pkt);
 		}
 		else
 		{
+			// Rescale from the codec timebase to the stream timebase.
+			av_packet_rescale_ts(pkt, codec_ctx_[stream_id]->time_base, out_fmt_ctx_->streams[stream_id]->time_base);
+
 			// H.264 elementary streams use the Output class to write encoded data so that they can use features such as
 			// pause/circular/split/metadata, etc.
 			output_ready_callback_(pkt->data, pkt->size, pkt->pts, pkt->flags & AV_PKT_FLAG_KEY);
@@ -574,13 +707,19 @@ void LibAvEncoder::encode(AVPacket *pkt, unsigned int stream_id)
 extern "C" void LibAvEncoder::releaseBuffer(void *opaque, uint8_t *data)
 {
 	LibAvEncoder *enc = static_cast<LibAvEncoder *>(opaque);
+	EncodeToken token;
 
-	enc->input_done_callback_(nullptr);
+	{
+		// Erasing the entry also releases any AVDRMFrameDescriptor allocation.
+		std::scoped_lock<std::mutex> lock(enc->input_frames_lock_);
+		auto it = enc->input_frames_.find(data);
+		if (it == enc->input_frames_.end())
+			return;
+		token = it->second.token;
+		enc->input_frames_.erase(it);
+	}
 
-	// Pop the entry from the queue to release the AVDRMFrameDescriptor allocation
-	std::scoped_lock<std::mutex> lock(enc->drm_queue_lock_);
-	if (!enc->drm_frame_queue_.empty())
-		enc->drm_frame_queue_.pop();
+	enc->input_done_callback_(token);
 }
 
 void LibAvEncoder::videoThread()
@@ -588,6 +727,8 @@ void LibAvEncoder::videoThread()
 	AVPacket *pkt = av_packet_alloc();
 	AVFrame *frame = nullptr;
 
+	setAffinity(options_);
+
 	while (true)
 	{
 		{
@@ -611,6 +752,28 @@ void LibAvEncoder::videoThread()
 			}
 		}
 
+		uint64_t bitrate = pending_bitrate_.exchange(0);
+		if (bitrate)
+		{
+			// libx264 notices the change on the next frame, and reconfigures itself in place.
+			AVCodecContext *codec = codec_ctx_[Video];
+			if (codec->rc_max_rate)
+				codec->rc_max_rate = codec->rc_max_rate * bitrate / codec->bit_rate;
+			if (codec->rc_buffer_size)
+				codec->rc_buffer_size = codec->rc_buffer_size * bitrate / codec->bit_rate;
+			codec->bit_rate = bitrate;
+		}
+
+		// Both libx264 and h264_v4l2m2m start a new GOP when asked for an I frame.
+		unsigned int intra_period = intra_period_;
+		if (keyframe_requested_.exchange(false) || (intra_period && frames_since_keyframe_ >= intra_period))
+		{
+			frame->pict_type = AV_PICTURE_TYPE_I;
+			forced_keyframe_pts_ = frame->pts;
+			frames_since_keyframe_ = 0;
+		}
+		frames_since_keyframe_++;
+
 		int ret = avcodec_send_frame(codec_ctx_[Video], frame);
 		if (ret < 0)
 			throw std::runtime_error("libav: error encoding frame: " + std::to_string(ret));
@@ -625,7 +788,177 @@ done:
 	encode(pkt, Video);
 
 	av_packet_free(&pkt);
+	if (elementary_stream_)
+		deinitOutput();
+}
+
+bool LibAvEncoder::SetBitrate(uint64_t bitrate_bps)
+{
+	// Only libx264 can change its bitrate on the fly, and only when it was started with one.
+	if (options_->Get().libav_video_codec != "libx264" || !codec_ctx_[Video]->bit_rate)
+		return false;
+	pending_bitrate_ = bitrate_bps;
+	return true;
+}
+
+bool LibAvEncoder::SetIntraPeriod(unsigned int intra_period)
+{
+	// We can only add keyframes, so nothing longer than the codec's own interval (--intra) is possible.
+	// Zero goes back to that interval.
+	if (codec_ctx_[Video]->gop_size > 0 && intra_period > (unsigned int)codec_ctx_[Video]->gop_size)
+		return false;
+	intra_period_ = intra_period;
+	return true;
+}
+
+bool LibAvEncoder::RequestKeyframe()
+{
+	keyframe_requested_ = true;
+	return true;
+}
+
+bool LibAvEncoder::GetOutputFeedback(double &latency_ms, unsigned int &queued)
+{
+	if (elementary_stream_)
+		return false;
+	std::scoped_lock<std::mutex> lock(mux_mutex_);
+	latency_ms = write_latency_us_ / 1000.0;
+	queued = mux_queue_.size();
+	return true;
+}
+
+void LibAvEncoder::queuePacket(AVPacket *pkt)
+{
+	std::scoped_lock<std::mutex> lock(mux_mutex_);
+	bool keyframe = pkt->stream_index == Video && (pkt->flags & AV_PKT_FLAG_KEY);
+
+	// When the output can't keep up, drop everything until there's room again and we reach a keyframe,
+	// so that what does get written can still be decoded.
+	if (mux_dropping_ && keyframe && mux_queue_.size() < options_->Get().libav_mux_queue)
+	{
+		LOG(1, "libav: output caught up, " << mux_dropped_ << " packets dropped so far");
+		mux_dropping_ = false;
+	}
+	else if (!mux_dropping_ && mux_queue_.size() >= options_->Get().libav_mux_queue)
+	{
+		LOG_ERROR("WARNING: libav: output is too slow, dropping packets until the next keyframe");
+		mux_dropping_ = true;
+	}
+
+	if (mux_dropping_)
+	{
+		mux_dropped_++;
+		av_packet_unref(pkt);
+		return;
+	}
+
+	AVPacket *queued = av_packet_alloc();
+	if (!queued)
+		throw std::runtime_error("libav: could not allocate AVPacket");
+	av_packet_move_ref(queued, pkt);
+	mux_queue_.push(queued);
+	mux_cv_.notify_one();
+}
+
+void LibAvEncoder::nextSegment()
+{
+	deinitOutput();
+
+	// A finished output context can't be re-used, so make a new one with copies of the same streams.
+	AVFormatContext *ctx = nullptr;
+	avformat_alloc_output_context2(&ctx, out_fmt_ctx_->oformat, nullptr, output_file_.c_str());
+	if (!ctx)
+		throw std::runtime_error("libav: cannot allocate output context for the next segment");
+
+	for (unsigned int i = 0; i < out_fmt_ctx_->nb_streams; i++)
+	{
+		AVStream *stream = avformat_new_stream(ctx, nullptr);
+		if (!stream)
+			throw std::runtime_error("libav: cannot allocate stream for the next segment");
+		avcodec_parameters_copy(stream->codecpar, out_fmt_ctx_->streams[i]->codecpar);
+		stream->time_base = out_fmt_ctx_->streams[i]->time_base;
+		stream->avg_frame_rate = out_fmt_ctx_->streams[i]->avg_frame_rate;
+		stream->r_frame_rate = out_fmt_ctx_->streams[i]->r_frame_rate;
+		stream_[i] = stream;
+	}
+
+	avformat_free_context(out_fmt_ctx_);
+	out_fmt_ctx_ = ctx;
+	output_initialised_ = false;
+}
+
+void LibAvEncoder::writePacket(AVPacket *pkt)
+{
+	// Segments start on a video keyframe, once the current one is long enough. Each is a file that plays on
+	// its own, so its timestamps start again from zero.
+	if (output_initialised_ && options_->Get().segment && pkt->stream_index == Video &&
+		(pkt->flags & AV_PKT_FLAG_KEY) && segment_start_us_ >= 0 &&
+		pkt->pts - segment_start_us_ >= (int64_t)options_->Get().segment * 1000)
+	{
+		nextSegment();
+		segment_start_us_ = -1;
+		segment_offset_us_ = pkt->dts;
+	}
+
+	if (!output_initialised_)
+		initOutput();
+	if (segment_start_us_ < 0 && pkt->stream_index == Video)
+		segment_start_us_ = pkt->pts;
+
+	if (options_->Get().segment)
+	{
+		// Audio from before the keyframe that started this segment belongs to the last one.
+		if (pkt->stream_index != Video && pkt->pts < segment_offset_us_)
+		{
+			av_packet_unref(pkt);
+			return;
+		}
+		pkt->pts -= segment_offset_us_;
+		pkt->dts -= segment_offset_us_;
+	}
+
+	// Rescale from the codec timebase to the stream timebase.
+	unsigned int stream_id = pkt->stream_index;
+	av_packet_rescale_ts(pkt, codec_ctx_[stream_id]->time_base, out_fmt_ctx_->streams[stream_id]->time_base);
+
+	// pkt is now blank (av_interleaved_write_frame() takes ownership of
+	// its contents and resets pkt), so that no unreferencing is necessary.
+	// This would be different if one used av_write_frame().
+	auto start = std::chrono::steady_clock::now();
+	int ret = av_interleaved_write_frame(out_fmt_ctx_, pkt);
+	write_latency_us_ = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start)
+							.count();
+	if (ret < 0)
+	{
+		char err[AV_ERROR_MAX_STRING_SIZE];
+		av_strerror(ret, err, sizeof(err));
+		throw std::runtime_error("libav: error writing output: " + std::string(err));
+	}
+}
+
+void LibAvEncoder::muxThread()
+{
+	while (true)
+	{
+		AVPacket *pkt;
+		{
+			std::unique_lock<std::mutex> lock(mux_mutex_);
+			mux_cv_.wait(lock, [this] { return abort_mux_ || !mux_queue_.empty(); });
+			// Write out everything that's queued before finishing.
+			if (mux_queue_.empty())
+				break;
+			pkt = mux_queue_.front();
+			mux_queue_.pop();
+		}
+
+		writePacket(pkt);
+		av_packet_free(&pkt);
+	}
+
 	deinitOutput();
+
+	if (mux_dropped_)
+		LOG(1, "libav: " << mux_dropped_ << " packets were dropped because the output was too slow");
 }
 
 void LibAvEncoder::audioThread()
@@ -639,7 +972,7 @@ void LibAvEncoder::audioThread()
 	AVAudioFifo *fifo;
 
 	ret = swr_alloc_set_opts2(&conv, &codec_ctx_[AudioOut]->ch_layout, required_fmt,
-							  stream_[AudioOut]->codecpar->sample_rate, &codec_ctx_[AudioIn]->ch_layout,
+							  codec_ctx_[AudioOut]->sample_rate, &codec_ctx_[AudioIn]->ch_layout,
 							  codec_ctx_[AudioIn]->sample_fmt, codec_ctx_[AudioIn]->sample_rate, 0, nullptr);
 	if (ret < 0)
 		throw std::runtime_error("libav: cannot create swr context");
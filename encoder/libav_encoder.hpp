@@ -9,6 +9,7 @@
 
 #include <atomic>
 #include <condition_variable>
+#include <map>
 #include <memory>
 #include <mutex>
 #include <queue>
@@ -25,6 +26,7 @@ extern "C"
 #include "libavutil/hwcontext.h"
 #include "libavutil/hwcontext_drm.h"
 #include "libavutil/imgutils.h"
+#include "libavutil/opt.h"
 #include "libavutil/timestamp.h"
 #include "libavutil/version.h"
 #include "libswresample/swresample.h"
@@ -42,34 +44,61 @@ public:
 	LibAvEncoder(VideoOptions const *options, StreamInfo const &info);
 	~LibAvEncoder();
 	// Encode the given DMABUF.
-	void EncodeBuffer(int fd, size_t size, void *mem, StreamInfo const &info, int64_t timestamp_us) override;
+	void EncodeBuffer(int fd, size_t size, void *mem, StreamInfo const &info, int64_t timestamp_us,
+					  EncodeToken token) override;
+	bool SetBitrate(uint64_t bitrate_bps) override;
+	bool SetIntraPeriod(unsigned int intra_period) override;
+	bool RequestKeyframe() override;
+	bool GetOutputFeedback(double &latency_ms, unsigned int &queued) override;
 
 private:
 	void initVideoCodec(VideoOptions const *options, StreamInfo const &info);
 	void initAudioInCodec(VideoOptions const *options, StreamInfo const &info);
 	void initAudioOutCodec(VideoOptions const *options, StreamInfo const &info);
 
+	std::string outputFilename();
 	void initOutput();
 	void deinitOutput();
 	void encode(AVPacket *pkt, unsigned int stream_id);
 
+	// Container output is written by the mux thread, from a bounded queue of packets.
+	void queuePacket(AVPacket *pkt);
+	void writePacket(AVPacket *pkt);
+	void nextSegment();
+
 	void videoThread();
 	void audioThread();
+	void muxThread();
 
 	static void releaseBuffer(void *opaque, uint8_t *data);
 
 	std::atomic<bool> output_ready_;
+	// Applied by the video thread before the next frame, as libx264 only reconfigures between frames.
+	std::atomic<uint64_t> pending_bitrate_;
+	// Keyframes are forced by the video thread, on top of any the codec makes by itself.
+	std::atomic<bool> keyframe_requested_;
+	std::atomic<unsigned int> intra_period_;
+	unsigned int frames_since_keyframe_;
+	int64_t forced_keyframe_pts_; // the last frame we forced to be a keyframe
+	std::atomic<unsigned int> write_latency_us_;
 	bool abort_video_;
 	bool abort_audio_;
+	bool abort_mux_;
+	bool mux_dropping_;
+	uint64_t mux_dropped_;
 	uint64_t video_start_ts_;
 
 	std::queue<AVFrame *> frame_queue_;
 	std::mutex video_mutex_;
-	std::mutex output_mutex_;
 	std::condition_variable video_cv_;
 	std::thread video_thread_;
 	std::thread audio_thread_;
 
+	std::queue<AVPacket *> mux_queue_;
+	std::mutex mux_mutex_;
+	std::condition_variable mux_cv_;
+	std::thread mux_thread_;
+
 	// The ordering in the enum below must not change!
 	enum Context { Video = 0, AudioOut = 1, AudioIn = 2 };
 	AVCodecContext *codec_ctx_[3];
@@ -77,10 +106,20 @@ private:
 	AVFormatContext *in_fmt_ctx_;
 	AVFormatContext *out_fmt_ctx_;
 
-	std::mutex drm_queue_lock_;
-	std::queue<std::unique_ptr<AVDRMFrameDescriptor>> drm_frame_queue_;
+	// Frames given to the codec, by the data pointer that releaseBuffer() will see, so that we can return
+	// the right one however the codec chooses to release them.
+	struct InputFrame
+	{
+		EncodeToken token;
+		std::unique_ptr<AVDRMFrameDescriptor> drm_desc;
+	};
+	std::mutex input_frames_lock_;
+	std::map<uint8_t *, InputFrame> input_frames_;
 
 	std::string output_file_;
 	bool output_initialised_;
 	bool elementary_stream_;
+	unsigned int segment_count_;
+	int64_t segment_start_us_;
+	int64_t segment_offset_us_;
 };
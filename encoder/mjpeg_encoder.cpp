@@ -37,10 +37,11 @@ MjpegEncoder::~MjpegEncoder()
 	LOG(2, "MjpegEncoder closed");
 }
 
-void MjpegEncoder::EncodeBuffer(int fd, size_t size, void *mem, StreamInfo const &info, int64_t timestamp_us)
+void MjpegEncoder::EncodeBuffer(int fd, size_t size, void *mem, StreamInfo const &info, int64_t timestamp_us,
+								EncodeToken token)
 {
 	std::lock_guard<std::mutex> lock(encode_mutex_);
-	EncodeItem item = { mem, info, timestamp_us, index_++ };
+	EncodeItem item = { mem, info, timestamp_us, index_++, token };
 	encode_queue_.push(item);
 	encode_cond_var_.notify_all();
 }
@@ -87,6 +88,10 @@ void MjpegEncoder::encodeJPEG(struct jpeg_compress_struct &cinfo, EncodeItem &it
 		jpeg_write_raw_data(&cinfo, rows, 16);
 	}
 
+	// The image has been consumed, only the compressed data remains to be flushed out, so let the
+	// camera have its buffer back straight away rather than waiting for any earlier frames.
+	input_done_callback_(item.token);
+
 	jpeg_finish_compress(&cinfo);
 	buffer_len = jpeg_mem_len;
 }
@@ -134,8 +139,6 @@ void MjpegEncoder::encodeThread(int num)
 		encodeJPEG(cinfo, encode_item, encoded_buffer, buffer_len);
 		encode_time += (std::chrono::high_resolution_clock::now() - start_time);
 		frames++;
-		// Don't return buffers until the output thread as that's where they're
-		// in order again.
 
 		// We push this encoded buffer to another thread so that our
 		// application can take its time with the data without blocking the
@@ -184,8 +187,6 @@ void MjpegEncoder::outputThread()
 			}
 		}
 	got_item:
-		input_done_callback_(nullptr);
-
 		output_ready_callback_(item.mem, item.bytes_used, item.timestamp_us, true);
 		free(item.mem);
 		index++;
@@ -22,7 +22,11 @@ public:
 	MjpegEncoder(VideoOptions const *options);
 	~MjpegEncoder();
 	// Encode the given buffer.
-	void EncodeBuffer(int fd, size_t size, void *mem, StreamInfo const &info, int64_t timestamp_us) override;
+	void EncodeBuffer(int fd, size_t size, void *mem, StreamInfo const &info, int64_t timestamp_us,
+					  EncodeToken token) override;
+	// Every frame is a keyframe already.
+	bool SetIntraPeriod(unsigned int /* intra_period */) override { return true; }
+	bool RequestKeyframe() override { return true; }
 
 private:
 	// How many threads to use. Whichever thread is idle will pick up the next frame.
@@ -46,6 +50,7 @@ private:
 		StreamInfo info;
 		int64_t timestamp_us;
 		uint64_t index;
+		EncodeToken token;
 	};
 	std::queue<EncodeItem> encode_queue_;
 	std::mutex encode_mutex_;
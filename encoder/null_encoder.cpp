@@ -5,69 +5,189 @@
  * null_encoder.cpp - dummy "do nothing" video encoder.
  */
 
-#include <chrono>
+#include <cstring>
 #include <iostream>
 #include <stdexcept>
 
+#include <libcamera/formats.h>
+
 #include "null_encoder.hpp"
 
-NullEncoder::NullEncoder(VideoOptions const *options) : Encoder(options), abort_(false)
+NullEncoder::NullEncoder(VideoOptions const *options, StreamInfo const &info)
+	: Encoder(options), layout_(Layout::Padded), abort_input_(false), abort_output_(false),
+	  staging_buffers_(NUM_STAGING_BUFFERS)
 {
+	// Only YUV420 frames can be repacked; anything else (such as raw Bayer) goes out exactly as it is.
+	if (info.pixel_format == libcamera::formats::YUV420)
+	{
+		if (options->Get().yuv_layout == "i420")
+			layout_ = Layout::I420;
+		else if (options->Get().yuv_layout == "nv12")
+			layout_ = Layout::NV12;
+	}
+
+	for (auto &buffer : staging_buffers_)
+		free_buffers_.push_back(&buffer);
+
 	LOG(2, "Opened NullEncoder");
+	pack_thread_ = std::thread(&NullEncoder::packThread, this);
 	output_thread_ = std::thread(&NullEncoder::outputThread, this);
 }
 
 NullEncoder::~NullEncoder()
 {
-	abort_ = true;
+	// Frames already given to us are still written out, so that all the camera buffers come back.
+	{
+		std::lock_guard<std::mutex> lock(input_mutex_);
+		abort_input_ = true;
+	}
+	input_cond_var_.notify_one();
+	pack_thread_.join();
+
+	{
+		std::lock_guard<std::mutex> lock(output_mutex_);
+		abort_output_ = true;
+	}
+	output_cond_var_.notify_one();
 	output_thread_.join();
 	LOG(2, "NullEncoder closed");
 }
 
-// Push the buffer onto the output queue to be "encoded" and returned.
-void NullEncoder::EncodeBuffer(int fd, size_t size, void *mem, StreamInfo const &info, int64_t timestamp_us)
+// Push the buffer onto the input queue to be "encoded" and returned.
+void NullEncoder::EncodeBuffer(int fd, size_t size, void *mem, StreamInfo const &info, int64_t timestamp_us,
+							   EncodeToken token)
 {
-	std::lock_guard<std::mutex> lock(output_mutex_);
-	OutputItem item = { mem, size, timestamp_us };
-	output_queue_.push(item);
-	output_cond_var_.notify_one();
+	std::lock_guard<std::mutex> lock(input_mutex_);
+	InputItem item = { mem, size, info, timestamp_us, token };
+	input_queue_.push(item);
+	input_cond_var_.notify_one();
 }
 
-// Realistically we would probably want more of a queue as the caller's number
-// of buffers limits the amount of queueing possible here...
-void NullEncoder::outputThread()
+// An I420 frame with no padding is already exactly what we want.
+bool NullEncoder::needsPacking(StreamInfo const &info) const
+{
+	return layout_ == Layout::NV12 || (layout_ == Layout::I420 && info.stride != info.width);
+}
+
+size_t NullEncoder::pack(uint8_t *dst, uint8_t const *src, StreamInfo const &info) const
+{
+	unsigned int w = info.width, h = info.height, stride = info.stride;
+	unsigned int uv_w = w / 2, uv_h = h / 2, uv_stride = stride / 2;
+	uint8_t *d = dst;
+
+	// The luma is the same for both layouts, just without the padding.
+	for (unsigned int y = 0; y < h; y++, d += w)
+		memcpy(d, src + y * stride, w);
+
+	uint8_t const *u = src + stride * h;
+	uint8_t const *v = u + uv_stride * uv_h;
+	if (layout_ == Layout::I420)
+	{
+		for (unsigned int y = 0; y < uv_h; y++, d += uv_w)
+			memcpy(d, u + y * uv_stride, uv_w);
+		for (unsigned int y = 0; y < uv_h; y++, d += uv_w)
+			memcpy(d, v + y * uv_stride, uv_w);
+	}
+	else
+	{
+		for (unsigned int y = 0; y < uv_h; y++)
+		{
+			uint8_t const *u_row = u + y * uv_stride, *v_row = v + y * uv_stride;
+			for (unsigned int x = 0; x < uv_w; x++)
+			{
+				*d++ = u_row[x];
+				*d++ = v_row[x];
+			}
+		}
+	}
+
+	return d - dst;
+}
+
+// Copy each frame that needs it into a staging buffer, and give the camera buffer back as soon as we have.
+void NullEncoder::packThread()
 {
-	OutputItem item;
 	while (true)
 	{
+		InputItem item;
+		{
+			std::unique_lock<std::mutex> lock(input_mutex_);
+			input_cond_var_.wait(lock, [this] { return abort_input_ || !input_queue_.empty(); });
+			if (input_queue_.empty())
+				return;
+			item = input_queue_.front();
+			input_queue_.pop();
+		}
+
+		if (!needsPacking(item.info))
 		{
-			std::unique_lock<std::mutex> lock(output_mutex_);
-			while (true)
 			{
-				using namespace std::chrono_literals;
-				if (!output_queue_.empty())
-				{
-					item = output_queue_.front();
-					output_queue_.pop();
-					break;
-				}
-				else
-					output_cond_var_.wait_for(lock, 200ms);
-				if (abort_)
-					return;
+				std::lock_guard<std::mutex> lock(output_mutex_);
+				output_queue_.push({ nullptr, item.mem, item.length, item.timestamp_us, item.token });
 			}
+			output_cond_var_.notify_one();
+			continue;
+		}
+
+		std::vector<uint8_t> *buffer;
+		{
+			// When the output falls behind we wait here, which holds on to the camera's buffers.
+			std::unique_lock<std::mutex> lock(output_mutex_);
+			free_cond_var_.wait(lock, [this] { return !free_buffers_.empty(); });
+			buffer = free_buffers_.back();
+			free_buffers_.pop_back();
+		}
+
+		if (buffer->size() < item.length)
+			buffer->resize(item.length);
+		size_t length = pack(buffer->data(), (uint8_t const *)item.mem, item.info);
+
+		// The frame has been copied, so the camera can have its buffer back.
+		input_done_callback_(item.token);
+
+		{
+			std::lock_guard<std::mutex> lock(output_mutex_);
+			output_queue_.push({ buffer, buffer->data(), length, item.timestamp_us, item.token });
+		}
+		output_cond_var_.notify_one();
+	}
+}
+
+void NullEncoder::outputThread()
+{
+	while (true)
+	{
+		OutputItem item;
+		{
+			std::unique_lock<std::mutex> lock(output_mutex_);
+			output_cond_var_.wait(lock, [this] { return abort_output_ || !output_queue_.empty(); });
+			if (output_queue_.empty())
+				return;
+			item = output_queue_.front();
+			output_queue_.pop();
 		}
-		// Ensure the input done callback happens before the output ready callback.
-		// This is needed as the metadata queue gets pushed in the former, and popped
-		// in the latter.
-		input_done_callback_(nullptr);
+
+		if (!item.buffer)
+		{
+			// We're writing straight out of the camera buffer, so it can only go back once that's done.
+			output_ready_callback_(item.mem, item.length, item.timestamp_us, true);
+			input_done_callback_(item.token);
+			continue;
+		}
+
 		output_ready_callback_(item.mem, item.length, item.timestamp_us, true);
+
+		{
+			std::lock_guard<std::mutex> lock(output_mutex_);
+			free_buffers_.push_back(item.buffer);
+		}
+		free_cond_var_.notify_one();
 	}
 }
 
-static Encoder *Create(VideoOptions *options, [[maybe_unused]] StreamInfo const &info)
+static Encoder *Create(VideoOptions *options, StreamInfo const &info)
 {
-	return new NullEncoder(options);
+	return new NullEncoder(options, info);
 }
 
 static RegisterEncoder reg("null", &Create);
@@ -11,30 +11,71 @@
 #include <mutex>
 #include <queue>
 #include <thread>
+#include <vector>
 
 #include "core/video_options.hpp"
 #include "encoder.hpp"
 
+// Passes frames straight through as raw (unencoded) output. Frames that need repacking - YUV420 with
+// padding at the end of each row to drop, or chroma to interleave for NV12 - are copied once, into a
+// staging buffer, so that the camera can have its buffer back straight away rather than waiting for
+// the output. Anything else goes to the output exactly as the camera gave it to us, without a copy.
 class NullEncoder : public Encoder
 {
 public:
-	NullEncoder(VideoOptions const *options);
+	NullEncoder(VideoOptions const *options, StreamInfo const &info = StreamInfo());
 	~NullEncoder();
-	void EncodeBuffer(int fd, size_t size, void *mem, StreamInfo const &info, int64_t timestamp_us) override;
+	void EncodeBuffer(int fd, size_t size, void *mem, StreamInfo const &info, int64_t timestamp_us,
+					  EncodeToken token) override;
+	// Every frame is a keyframe already.
+	bool SetIntraPeriod(unsigned int /* intra_period */) override { return true; }
+	bool RequestKeyframe() override { return true; }
 
 private:
+	// Staging buffers in use at once. Beyond this the camera buffers are held until the output catches up.
+	static constexpr unsigned int NUM_STAGING_BUFFERS = 4;
+
+	enum class Layout
+	{
+		Padded,
+		I420,
+		NV12,
+	};
+
+	void packThread();
 	void outputThread();
+	bool needsPacking(StreamInfo const &info) const;
+	size_t pack(uint8_t *dst, uint8_t const *src, StreamInfo const &info) const;
+
+	Layout layout_;
+	bool abort_input_;
+	bool abort_output_;
+	struct InputItem
+	{
+		void *mem;
+		size_t length;
+		StreamInfo info;
+		int64_t timestamp_us;
+		EncodeToken token;
+	};
+	std::queue<InputItem> input_queue_;
+	std::mutex input_mutex_;
+	std::condition_variable input_cond_var_;
+	std::thread pack_thread_;
 
-	bool abort_;
-	VideoOptions options_;
 	struct OutputItem
 	{
+		std::vector<uint8_t> *buffer; // or nullptr when passing the camera's buffer straight through
 		void *mem;
 		size_t length;
 		int64_t timestamp_us;
+		EncodeToken token;
 	};
 	std::queue<OutputItem> output_queue_;
+	std::vector<std::vector<uint8_t>> staging_buffers_;
+	std::vector<std::vector<uint8_t> *> free_buffers_;
 	std::mutex output_mutex_;
 	std::condition_variable output_cond_var_;
+	std::condition_variable free_cond_var_;
 	std::thread output_thread_;
 };
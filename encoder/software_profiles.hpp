@@ -0,0 +1,46 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * Copyright (C) 2025, Raspberry Pi Ltd
+ *
+ * software_profiles.hpp - Performance profiles for the libav software video codecs.
+ */
+
+#pragma once
+
+#include <string>
+
+// Each profile trades CPU time for quality or latency in a different way, for libx264 and libx265.
+// Slice threads split every frame between the threads, so add no latency; frame threads encode
+// several frames at once, which is more efficient but delays the output by a frame per thread.
+struct SoftwareProfile
+{
+	char const *name;
+	char const *description;
+	bool slice_threads;
+	int threads; // 0 lets the codec decide
+	int slices;
+	bool intra_refresh; // spread intra coding over several frames, instead of large keyframes
+	int lookahead; // frames
+	char const *preset;
+	char const *tune; // or nullptr
+};
+
+static const SoftwareProfile software_profiles[] = {
+	{ "realtime", "lowest latency, 4 slice threads with intra refresh", true, 4, 4, true, 0, "ultrafast",
+	  "zerolatency" },
+	{ "headroom", "2 slice threads, leaving cores free for post-processing", true, 2, 2, false, 0, "ultrafast",
+	  "zerolatency" },
+	{ "balanced", "3 frame threads, no lookahead", false, 3, 1, false, 0, "superfast", nullptr },
+	{ "quality", "4 frame threads with a short lookahead", false, 4, 1, false, 10, "veryfast", nullptr },
+};
+
+// Returns nullptr if there is no such profile.
+inline SoftwareProfile const *find_software_profile(std::string const &name)
+{
+	for (auto const &profile : software_profiles)
+	{
+		if (name == profile.name)
+			return &profile;
+	}
+	return nullptr;
+}
@@ -0,0 +1,77 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * Copyright (C) 2025, Raspberry Pi Ltd
+ *
+ * synthetic_frames.hpp - Generated YUV420 frames, for driving the encoders without a camera.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <libcamera/formats.h>
+
+#include "core/stream_info.hpp"
+
+// A handful of different frames, which get cycled through.
+static constexpr unsigned int SYNTHETIC_NUM_FRAMES = 8;
+// Frames that may be with the encoder at once, like the camera's buffers.
+static constexpr unsigned int SYNTHETIC_IN_FLIGHT = 4;
+
+// The frames are laid out as the camera would give them to us, with the rows padded.
+inline StreamInfo synthetic_stream_info(unsigned int width, unsigned int height)
+{
+	StreamInfo info;
+	info.width = width;
+	info.height = height;
+	info.stride = (width + 63) & ~63;
+	info.pixel_format = libcamera::formats::YUV420;
+	return info;
+}
+
+// "bars" are the same every frame, "moving" bars shift from frame to frame, "texture" adds detail to the
+// movement and "noise" is hardest of all to compress.
+inline bool is_synthetic_pattern(std::string const &pattern)
+{
+	return pattern == "bars" || pattern == "moving" || pattern == "texture" || pattern == "noise";
+}
+
+inline std::vector<std::vector<uint8_t>> make_synthetic_frames(StreamInfo const &info, std::string const &pattern)
+{
+	std::vector<std::vector<uint8_t>> frames(SYNTHETIC_NUM_FRAMES);
+	std::minstd_rand rng(1);
+	bool noise = pattern == "noise", texture = pattern == "texture";
+	unsigned int uv_stride = info.stride / 2;
+	for (unsigned int i = 0; i < SYNTHETIC_NUM_FRAMES; i++)
+	{
+		std::vector<uint8_t> &frame = frames[i];
+		frame.resize(info.stride * info.height * 3 / 2);
+		uint8_t *u = frame.data() + info.stride * info.height, *v = u + uv_stride * info.height / 2;
+		unsigned int shift = pattern == "bars" ? 0 : i * 8;
+		for (unsigned int y = 0; y < info.height; y++)
+		{
+			for (unsigned int x = 0; x < info.width; x++)
+			{
+				uint8_t &pixel = frame[y * info.stride + x];
+				if (noise)
+					pixel = rng();
+				else if (texture)
+					pixel = ((x + shift) ^ y) + ((x * 7919 + y * 104729) & 15);
+				else
+					pixel = ((x + shift) * 8 / info.width) * 32 + 16;
+			}
+		}
+		for (unsigned int y = 0; y < info.height / 2; y++)
+		{
+			for (unsigned int x = 0; x < info.width / 2; x++)
+			{
+				u[y * uv_stride + x] = noise ? rng() : 128 + ((x + shift / (texture ? 2 : 1)) & 63) - 32;
+				v[y * uv_stride + x] = noise ? rng() : 128 + ((y + shift / (texture ? 4 : 1)) & 63) - 32;
+			}
+		}
+	}
+	return frames;
+}
@@ -0,0 +1,146 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * Copyright (C) 2025, Raspberry Pi Ltd
+ *
+ * event_output.cpp - Write a new file for each event, with a pre-roll.
+ */
+
+#include <algorithm>
+
+#include "event_output.hpp"
+
+// If the encoder produces no keyframes, the pre-roll can never be trimmed back to one, so give up
+// on it rather than letting it grow without limit.
+static constexpr size_t MAX_PREROLL_BYTES = 64 << 20;
+
+EventOutput::EventOutput(VideoOptions const *options)
+	: Output(options), active_(false), preroll_bytes_(0), fp_(nullptr), count_(0), frames_(0), bytes_(0)
+{
+}
+
+EventOutput::~EventOutput()
+{
+	closeFile();
+}
+
+void EventOutput::Trigger(bool active)
+{
+	active_ = active;
+}
+
+void EventOutput::outputBuffer(void *mem, size_t size, int64_t timestamp_us, uint32_t flags)
+{
+	// The encoder runs a few frames behind the application, so an event starts and finishes a
+	// little late in the output too. The pre-roll more than makes up for this.
+	bool active = active_;
+	if (fp_ && !active)
+		closeFile();
+
+	if (fp_)
+	{
+		writeFrame(mem, size, timestamp_us);
+		return;
+	}
+
+	preroll_.push_back({ std::vector<uint8_t>((uint8_t *)mem, (uint8_t *)mem + size), timestamp_us,
+						 !!(flags & FLAG_KEYFRAME) });
+	preroll_bytes_ += size;
+	trimPreroll();
+
+	// A file can only start with a keyframe. If there isn't one yet (because nothing was being
+	// encoded while idle, say), we keep waiting.
+	if (active && !preroll_.empty())
+	{
+		openFile();
+		for (Frame const &frame : preroll_)
+			writeFrame(frame.data.data(), frame.data.size(), frame.timestamp_us);
+		preroll_.clear();
+		preroll_bytes_ = 0;
+	}
+}
+
+void EventOutput::trimPreroll()
+{
+	// Anything before the first keyframe can't be decoded.
+	while (!preroll_.empty() && !preroll_.front().keyframe)
+	{
+		preroll_bytes_ -= preroll_.front().data.size();
+		preroll_.pop_front();
+	}
+
+	// Drop whole groups of frames from the front while the rest still cover the pre-roll time.
+	int64_t preroll_us = options_->Get().event_preroll * 1000;
+	while (!preroll_.empty())
+	{
+		auto next = std::find_if(preroll_.begin() + 1, preroll_.end(), [](Frame const &f) { return f.keyframe; });
+		if (next == preroll_.end())
+		{
+			if (preroll_bytes_ > MAX_PREROLL_BYTES)
+			{
+				LOG_ERROR("WARNING: EventOutput: no keyframes, discarding pre-roll");
+				preroll_.clear();
+				preroll_bytes_ = 0;
+			}
+			break;
+		}
+		if (preroll_.back().timestamp_us - next->timestamp_us < preroll_us)
+			break;
+		for (auto it = preroll_.begin(); it != next; it++)
+			preroll_bytes_ -= it->data.size();
+		preroll_.erase(preroll_.begin(), next);
+	}
+}
+
+void EventOutput::openFile()
+{
+	if (options_->Get().output == "-")
+		fp_ = stdout;
+	else
+	{
+		// Generate the next output file name.
+		char filename[256];
+		int n = snprintf(filename, sizeof(filename), options_->Get().output.c_str(), count_);
+		count_++;
+		if (options_->Get().wrap)
+			count_ = count_ % options_->Get().wrap;
+		if (n < 0)
+			throw std::runtime_error("failed to generate filename");
+
+		fp_ = fopen(filename, "w");
+		if (!fp_)
+			throw std::runtime_error("failed to open output file " + std::string(filename));
+		LOG(1, "EventOutput: recording to " << filename);
+	}
+	frames_ = 0;
+	bytes_ = 0;
+}
+
+void EventOutput::closeFile()
+{
+	if (fp_)
+	{
+		if (fp_ != stdout)
+			fclose(fp_);
+		else
+			fflush(fp_);
+		fp_ = nullptr;
+		LOG(1, "EventOutput: wrote " << bytes_ << " bytes (" << frames_ << " frames)");
+	}
+}
+
+void EventOutput::writeFrame(void const *mem, size_t size, int64_t timestamp_us)
+{
+	if (size && fwrite(mem, size, 1, fp_) != 1)
+		throw std::runtime_error("failed to write output bytes");
+	if (options_->Get().flush)
+		fflush(fp_);
+	if (fp_timestamps_)
+		Output::timestampReady(timestamp_us);
+	frames_++;
+	bytes_ += size;
+}
+
+void EventOutput::timestampReady(int64_t timestamp)
+{
+	// Only the frames that get written out have their timestamps saved, which writeFrame does.
+}
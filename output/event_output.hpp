@@ -0,0 +1,52 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * Copyright (C) 2025, Raspberry Pi Ltd
+ *
+ * event_output.hpp - Write a new file for each event, with a pre-roll.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <deque>
+#include <vector>
+
+#include "output.hpp"
+
+// Keeps the last few seconds of encoded frames (--event-preroll) in memory while nothing is
+// happening. When the application triggers an event, the pre-roll is written to a new file,
+// starting from its oldest keyframe, followed by everything else until the event ends. File names
+// come from --output, like --segment.
+
+class EventOutput : public Output
+{
+public:
+	EventOutput(VideoOptions const *options);
+	~EventOutput();
+	void Trigger(bool active) override;
+
+protected:
+	void outputBuffer(void *mem, size_t size, int64_t timestamp_us, uint32_t flags) override;
+	void timestampReady(int64_t timestamp) override;
+
+private:
+	struct Frame
+	{
+		std::vector<uint8_t> data;
+		int64_t timestamp_us;
+		bool keyframe;
+	};
+
+	void trimPreroll();
+	void openFile();
+	void closeFile();
+	void writeFrame(void const *mem, size_t size, int64_t timestamp_us);
+
+	std::atomic<bool> active_;
+	std::deque<Frame> preroll_;
+	size_t preroll_bytes_;
+	FILE *fp_;
+	unsigned int count_;
+	unsigned int frames_;
+	size_t bytes_;
+};
@@ -5,10 +5,15 @@
  * file_output.cpp - Write output to file.
  */
 
+#include <errno.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include "file_output.hpp"
 
 FileOutput::FileOutput(VideoOptions const *options)
-	: Output(options), fp_(nullptr), count_(0), file_start_time_ms_(0)
+	: Output(options), fp_(nullptr), stream_fd_(-1), count_(0), file_start_time_ms_(0)
 {
 }
 
@@ -32,7 +37,9 @@ void FileOutput::outputBuffer(void *mem, size_t size, int64_t timestamp_us, uint
 	}
 
 	LOG(2, "FileOutput: output buffer " << mem << " size " << size);
-	if (fp_ && size)
+	if (stream_fd_ >= 0 && size)
+		writeFd((uint8_t const *)mem, size);
+	else if (fp_ && size)
 	{
 		if (fwrite(mem, size, 1, fp_) != 1)
 			throw std::runtime_error("failed to write output bytes");
@@ -41,8 +48,26 @@ void FileOutput::outputBuffer(void *mem, size_t size, int64_t timestamp_us, uint
 	}
 }
 
+void FileOutput::writeFd(uint8_t const *mem, size_t size)
+{
+	// A pipe or socket may take less than the whole frame at once, so keep going until it's all gone.
+	while (size)
+	{
+		ssize_t n = write(stream_fd_, mem, size);
+		if (n < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			throw std::runtime_error("failed to write output bytes: " + std::string(strerror(errno)));
+		}
+		mem += n;
+		size -= n;
+	}
+}
+
 void FileOutput::openFile(int64_t timestamp_us)
 {
+	stream_fd_ = -1;
 	if (options_->Get().output == "-")
 		fp_ = stdout;
 	else if (!options_->Get().output.empty())
@@ -63,6 +88,13 @@ void FileOutput::openFile(int64_t timestamp_us)
 
 		file_start_time_ms_ = timestamp_us / 1000;
 	}
+
+	struct stat st;
+	if (fp_ && !fstat(fileno(fp_), &st) && (S_ISFIFO(st.st_mode) || S_ISSOCK(st.st_mode)))
+	{
+		fflush(fp_);
+		stream_fd_ = fileno(fp_);
+	}
 }
 
 void FileOutput::closeFile()
@@ -21,7 +21,10 @@ protected:
 private:
 	void openFile(int64_t timestamp_us);
 	void closeFile();
+	void writeFd(uint8_t const *mem, size_t size);
 	FILE *fp_;
+	// Pipes and sockets are written directly, rather than through stdio, or -1.
+	int stream_fd_;
 	unsigned int count_;
 	int64_t file_start_time_ms_;
 };
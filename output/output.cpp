@@ -5,13 +5,17 @@
  * output.cpp - video stream output base class
  */
 
+#include <chrono>
 #include <cinttypes>
+#include <optional>
 #include <stdexcept>
 
 #include "circular_output.hpp"
+#include "event_output.hpp"
 #include "file_output.hpp"
 #include "net_output.hpp"
 #include "output.hpp"
+#include "tee_output.hpp"
 
 Output::Output(VideoOptions const *options)
 	: options_(options), fp_timestamps_(nullptr), state_(WAITING_KEYFRAME), time_offset_(0), last_timestamp_(0),
@@ -54,12 +58,30 @@ void Output::Signal()
 
 void Output::OutputReady(void *mem, size_t size, int64_t timestamp_us, bool keyframe)
 {
+	// Every frame's metadata was queued before it was encoded, so take it now even if the frame gets
+	// dropped, to keep the two in step.
+	std::optional<libcamera::ControlList> metadata;
+	if (!options_->Get().metadata.empty())
+	{
+		std::lock_guard<std::mutex> lock(metadata_mutex_);
+		if (!metadata_queue_.empty())
+		{
+			metadata = std::move(metadata_queue_.front());
+			metadata_queue_.pop();
+		}
+	}
+
 	// When output is enabled, we may have to wait for the next keyframe.
 	uint32_t flags = keyframe ? FLAG_KEYFRAME : FLAG_NONE;
 	if (!enable_)
 		state_ = DISABLED;
 	else if (state_ == DISABLED)
+	{
+		// Resuming after a pause. Rather than wait for the next keyframe to come round, ask for one.
 		state_ = WAITING_KEYFRAME;
+		if (!keyframe)
+			requestKeyframe();
+	}
 	if (state_ == WAITING_KEYFRAME && keyframe)
 		state_ = RUNNING, flags |= FLAG_RESTART;
 	if (state_ != RUNNING)
@@ -70,7 +92,13 @@ void Output::OutputReady(void *mem, size_t size, int64_t timestamp_us, bool keyf
 		time_offset_ = timestamp_us - last_timestamp_;
 	last_timestamp_ = timestamp_us - time_offset_;
 
+	auto start = std::chrono::steady_clock::now();
 	outputBuffer(mem, size, last_timestamp_, flags);
+	if (feedback_callback_)
+	{
+		std::chrono::duration<double, std::milli> t = std::chrono::steady_clock::now() - start;
+		feedback_callback_(t.count(), queued());
+	}
 
 	// Save timestamps to a file, if that was requested.
 	if (fp_timestamps_)
@@ -78,12 +106,10 @@ void Output::OutputReady(void *mem, size_t size, int64_t timestamp_us, bool keyf
 		timestampReady(last_timestamp_);
 	}
 
-	if (!options_->Get().metadata.empty())
+	if (metadata)
 	{
-		libcamera::ControlList metadata = metadata_queue_.front();
-		write_metadata(buf_metadata_, options_->Get().metadata_format, metadata, !metadata_started_);
+		write_metadata(buf_metadata_, options_->Get().metadata_format, *metadata, !metadata_started_);
 		metadata_started_ = true;
-		metadata_queue_.pop();
 	}
 }
 
@@ -105,7 +131,22 @@ Output *Output::Create(VideoOptions const *options)
 				 (options->Get().codec == "h264" && options->GetPlatform() != Platform::VC4);
 	const std::string out_file = options->Get().output;
 
-	if (!libav && (strncmp(out_file.c_str(), "udp://", 6) == 0 || strncmp(out_file.c_str(), "tcp://", 6) == 0))
+	// libav writes containers itself, so only its H.264 elementary streams ever come through here.
+	bool libav_container = options->Get().LibavContainer(options->GetPlatform());
+
+	if (!options->Get().tee.empty())
+	{
+		if (libav_container)
+			throw std::runtime_error("--tee is only supported by libav for H.264 elementary streams");
+		return new TeeOutput(options);
+	}
+	else if (!options->Get().event.empty())
+	{
+		if (libav_container)
+			throw std::runtime_error("--event is only supported by libav for H.264 elementary streams");
+		return new EventOutput(options);
+	}
+	else if (!libav && (strncmp(out_file.c_str(), "udp://", 6) == 0 || strncmp(out_file.c_str(), "tcp://", 6) == 0))
 		return new NetOutput(options);
 	else if (options->Get().circular)
 		return new CircularOutput(options);
@@ -120,6 +161,7 @@ void Output::MetadataReady(libcamera::ControlList &metadata)
 	if (options_->Get().metadata.empty())
 		return;
 
+	std::lock_guard<std::mutex> lock(metadata_mutex_);
 	metadata_queue_.push(metadata);
 }
 
@@ -10,9 +10,17 @@
 #include <cstdio>
 
 #include <atomic>
+#include <functional>
+#include <mutex>
+#include <queue>
 
 #include "core/video_options.hpp"
 
+// Called with how long each buffer took to output (in ms), and how many are still waiting.
+typedef std::function<void(double, unsigned int)> OutputFeedbackCallback;
+// Called when the output is waiting for a keyframe, and would like the encoder to make one now.
+typedef std::function<void()> KeyframeRequestCallback;
+
 class Output
 {
 public:
@@ -21,10 +29,16 @@ public:
 	Output(VideoOptions const *options);
 	virtual ~Output();
 	virtual void Signal(); // a derived class might redefine what this means
+	virtual void Trigger(bool active) {} // start or stop recording an event, for outputs that do this
 	void OutputReady(void *mem, size_t size, int64_t timestamp_us, bool keyframe);
 	void MetadataReady(libcamera::ControlList &metadata);
+	void SetFeedbackCallback(OutputFeedbackCallback callback) { feedback_callback_ = callback; }
+	void SetKeyframeRequestCallback(KeyframeRequestCallback callback) { keyframe_request_callback_ = callback; }
 
 protected:
+	// Lets TeeOutput pass buffers straight to the outputs it manages.
+	friend class TeeOutput;
+
 	enum Flag
 	{
 		FLAG_NONE = 0,
@@ -33,6 +47,13 @@ protected:
 	};
 	virtual void outputBuffer(void *mem, size_t size, int64_t timestamp_us, uint32_t flags);
 	virtual void timestampReady(int64_t timestamp);
+	// Outputs that queue buffers internally report how many are waiting.
+	virtual unsigned int queued() const { return 0; }
+	void requestKeyframe()
+	{
+		if (keyframe_request_callback_)
+			keyframe_request_callback_();
+	}
 	VideoOptions const *options_;
 	FILE *fp_timestamps_;
 
@@ -50,7 +71,10 @@ private:
 	std::streambuf *buf_metadata_;
 	std::ofstream of_metadata_;
 	bool metadata_started_ = false;
+	std::mutex metadata_mutex_; // metadata is queued by the camera thread, and taken by the encoder's
 	std::queue<libcamera::ControlList> metadata_queue_;
+	OutputFeedbackCallback feedback_callback_;
+	KeyframeRequestCallback keyframe_request_callback_;
 };
 
 void start_metadata_output(std::streambuf *buf, std::string fmt);
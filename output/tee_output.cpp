@@ -0,0 +1,193 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * Copyright (C) 2025, Raspberry Pi Ltd
+ *
+ * tee_output.cpp - Write the same output to several places at once.
+ */
+
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+
+#include "circular_output.hpp"
+#include "file_output.hpp"
+#include "net_output.hpp"
+#include "tee_output.hpp"
+
+// Circular buffer size (in MB) for circular:<file> outputs when --circular doesn't give one.
+static constexpr size_t DEFAULT_CIRCULAR_SIZE = 4;
+
+TeeOutput::TeeOutput(VideoOptions const *options) : Output(options)
+{
+	// Each output gets its own copy of the options, naming its own target. Timestamps, metadata and
+	// pausing are all handled once, here, rather than by every output.
+	auto add_sink = [this, options](std::string const &target, size_t circular)
+	{
+		auto sink = std::make_unique<Sink>();
+		sink->target = target;
+		sink->options = std::make_unique<VideoOptions>();
+		sink->options->Set() = options->Get();
+		sink->options->Set().output = target;
+		sink->options->Set().circular = circular;
+		sink->options->Set().save_pts.clear();
+		sink->options->Set().metadata.clear();
+		sink->options->Set().pause = false;
+		sinks_.push_back(std::move(sink));
+	};
+
+	if (!options->Get().output.empty())
+		add_sink(options->Get().output, options->Get().circular);
+
+	std::stringstream tee(options->Get().tee);
+	std::string target;
+	while (std::getline(tee, target, ','))
+	{
+		if (target.empty())
+			continue;
+		if (target.rfind("circular:", 0) == 0)
+			add_sink(target.substr(9), options->Get().circular ? options->Get().circular : DEFAULT_CIRCULAR_SIZE);
+		else
+			add_sink(target, 0);
+	}
+
+	if (sinks_.empty())
+		throw std::runtime_error("tee: no outputs given");
+
+	// The outputs are created in their own threads too, as a network one may have to wait for a client.
+	for (auto &sink : sinks_)
+		sink->thread = std::thread(&TeeOutput::sinkThread, this, sink.get());
+}
+
+TeeOutput::~TeeOutput()
+{
+	for (auto &sink : sinks_)
+	{
+		{
+			std::scoped_lock<std::mutex> lock(sink->mutex);
+			sink->abort = true;
+		}
+		sink->cv.notify_one();
+	}
+
+	for (auto &sink : sinks_)
+	{
+		sink->thread.join();
+		if (sink->dropped)
+			LOG(1, "TeeOutput: " << sink->dropped << " frames dropped for " << sink->target);
+	}
+}
+
+void TeeOutput::outputBuffer(void *mem, size_t size, int64_t timestamp_us, uint32_t flags)
+{
+	// The encoder wants its buffer back when we return, so this is the one copy we make.
+	auto data = std::make_shared<std::vector<uint8_t>>((uint8_t *)mem, (uint8_t *)mem + size);
+	unsigned int failed = 0;
+	bool request_keyframe = false;
+
+	for (auto &sink : sinks_)
+	{
+		{
+			std::scoped_lock<std::mutex> lock(sink->mutex);
+			if (sink->failed)
+			{
+				failed++;
+				continue;
+			}
+
+			// An output that falls too far behind skips frames until the next keyframe, so that what
+			// it does write can still be decoded.
+			if (sink->waiting_keyframe && (flags & FLAG_KEYFRAME) &&
+				sink->queue.size() < options_->Get().tee_queue)
+				sink->waiting_keyframe = sink->keyframe_requested = false;
+			else if (!sink->waiting_keyframe && sink->queue.size() >= options_->Get().tee_queue)
+			{
+				LOG(1, "TeeOutput: " << sink->target << " is falling behind, dropping frames");
+				sink->waiting_keyframe = true;
+			}
+
+			if (sink->waiting_keyframe)
+			{
+				// Once it has caught up, ask for a keyframe rather than waiting for the next one.
+				if (!sink->keyframe_requested && sink->queue.size() < options_->Get().tee_queue)
+					request_keyframe = sink->keyframe_requested = true;
+				sink->dropped++;
+				continue;
+			}
+
+			sink->queue.push_back({ data, timestamp_us, flags });
+		}
+		sink->cv.notify_one();
+	}
+
+	if (failed == sinks_.size())
+		throw std::runtime_error("tee: all outputs have failed");
+	if (request_keyframe)
+		requestKeyframe();
+}
+
+unsigned int TeeOutput::queued() const
+{
+	unsigned int queued = 0;
+	for (auto &sink : sinks_)
+	{
+		std::scoped_lock<std::mutex> lock(sink->mutex);
+		if (!sink->failed)
+			queued = std::max(queued, (unsigned int)sink->queue.size());
+	}
+	return queued;
+}
+
+void TeeOutput::sinkThread(Sink *sink)
+{
+	Output *output = nullptr;
+
+	try
+	{
+		std::string const &target = sink->target;
+		VideoOptions const *options = sink->options.get();
+		if (target.rfind("udp://", 0) == 0 || target.rfind("tcp://", 0) == 0)
+			sink->output = std::make_unique<NetOutput>(options);
+		else if (options->Get().circular)
+			sink->output = std::make_unique<CircularOutput>(options);
+		else
+			sink->output = std::make_unique<FileOutput>(options);
+		output = sink->output.get();
+		LOG(2, "TeeOutput: started output " << target);
+	}
+	catch (std::exception const &e)
+	{
+		LOG_ERROR("ERROR: tee output " << sink->target << " could not be started: " << e.what());
+	}
+
+	while (true)
+	{
+		Item item;
+		{
+			std::unique_lock<std::mutex> lock(sink->mutex);
+			if (!output)
+			{
+				sink->failed = true;
+				sink->queue.clear();
+			}
+			sink->cv.wait(lock, [sink] { return sink->abort || !sink->queue.empty(); });
+			// Finish writing out everything we were given before stopping.
+			if (sink->queue.empty())
+				break;
+			item = std::move(sink->queue.front());
+			sink->queue.pop_front();
+		}
+
+		try
+		{
+			output->outputBuffer(item.data->data(), item.data->size(), item.timestamp_us, item.flags);
+		}
+		catch (std::exception const &e)
+		{
+			LOG_ERROR("ERROR: tee output " << sink->target << " failed: " << e.what());
+			output = nullptr;
+		}
+	}
+
+	// Closing the output (which writes out a circular buffer, for instance) also happens here.
+	sink->output.reset();
+}
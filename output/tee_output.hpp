@@ -0,0 +1,64 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * Copyright (C) 2025, Raspberry Pi Ltd
+ *
+ * tee_output.hpp - Write the same output to several places at once.
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "output.hpp"
+
+// Sends each encoded buffer to a number of other outputs (files, network addresses, circular
+// buffers), taken from --output and --tee. Every output has its own thread and queue, so a slow
+// one can't hold up the others, and an output that fails (such as a network client going away)
+// is simply dropped while the rest carry on.
+
+class TeeOutput : public Output
+{
+public:
+	TeeOutput(VideoOptions const *options);
+	~TeeOutput();
+
+protected:
+	void outputBuffer(void *mem, size_t size, int64_t timestamp_us, uint32_t flags) override;
+	// The longest queue of any output that is still working.
+	unsigned int queued() const override;
+
+private:
+	// One copy of each buffer is shared by all the outputs, and freed when the last one is done.
+	struct Item
+	{
+		std::shared_ptr<std::vector<uint8_t>> data;
+		int64_t timestamp_us;
+		uint32_t flags;
+	};
+
+	struct Sink
+	{
+		std::string target;
+		std::unique_ptr<VideoOptions> options;
+		std::unique_ptr<Output> output;
+		std::thread thread;
+		std::mutex mutex;
+		std::condition_variable cv;
+		std::deque<Item> queue;
+		bool abort = false;
+		bool failed = false;
+		bool waiting_keyframe = true;
+		bool keyframe_requested = false;
+		uint64_t dropped = 0;
+	};
+
+	void sinkThread(Sink *sink);
+
+	std::vector<std::unique_ptr<Sink>> sinks_;
+};
@@ -7,20 +7,25 @@
 
 // The text string can include the % directives supported by FrameInfo.
 
+// The text is drawn from a GlyphAtlas, and is only laid out again when it changes, after which
+// blending it into each frame is cheap. Giving "fg_colour" or "bg_colour" (as "#rrggbb") makes the
+// annotation coloured, otherwise only the Y plane is touched and fg and bg are grey levels.
+
 #include <time.h>
 
+#include <memory>
+
 #include <libcamera/stream.h>
 
 #include "core/frame_info.hpp"
 #include "core/rpicam_app.hpp"
 
+#include "post_processing_stages/overlay.hpp"
+#include "post_processing_stages/overlay_renderer.hpp"
 #include "post_processing_stages/post_processing_stage.hpp"
 
-#include "opencv2/core.hpp"
 #include "opencv2/imgproc.hpp"
 
-using namespace cv;
-
 using Stream = libcamera::Stream;
 
 class AnnotateCvStage : public PostProcessingStage
@@ -42,11 +47,23 @@ private:
 	std::string text_;
 	int fg_;
 	int bg_;
+	std::string fg_colour_;
+	std::string bg_colour_;
 	double scale_;
 	int thickness_;
 	double alpha_;
+	bool antialias_;
+	bool overlay_;
 	double adjusted_scale_;
 	int adjusted_thickness_;
+	std::unique_ptr<GlyphAtlas> atlas_;
+	YuvColour fg_yuv_;
+	YuvColour bg_yuv_;
+	bool colour_;
+	// The last text we drew, ready to blend into the next frame if it's the same.
+	std::string last_text_;
+	CoverageMask coverage_;
+	OverlayMask mask_;
 };
 
 #define NAME "annotate_cv"
@@ -64,6 +81,10 @@ void AnnotateCvStage::Read(boost::property_tree::ptree const &params)
 	scale_ = params.get<double>("scale", 1.0);
 	thickness_ = params.get<int>("thickness", 2);
 	alpha_ = params.get<double>("alpha", 0.5);
+	fg_colour_ = params.get<std::string>("fg_colour", "");
+	bg_colour_ = params.get<std::string>("bg_colour", "");
+	antialias_ = params.get<int>("antialias", 0);
+	overlay_ = params.get<int>("overlay", 0);
 }
 
 void AnnotateCvStage::Configure()
@@ -78,12 +99,17 @@ void AnnotateCvStage::Configure()
 	// rather harshly quantised, not much we can do about that.
 	adjusted_scale_ = scale_ * info_.width / 1200;
 	adjusted_thickness_ = std::max(thickness_ * info_.width / 700, 1u);
+
+	atlas_ = std::make_unique<GlyphAtlas>(cv::FONT_HERSHEY_SIMPLEX, adjusted_scale_, adjusted_thickness_, antialias_);
+	colour_ = !fg_colour_.empty() || !bg_colour_.empty();
+	fg_yuv_ = fg_colour_.empty() ? YuvColour { (uint8_t)fg_, 128, 128 } : ParseColour(fg_colour_, info_.colour_space);
+	bg_yuv_ = bg_colour_.empty() ? YuvColour { (uint8_t)bg_, 128, 128 } : ParseColour(bg_colour_, info_.colour_space);
+	last_text_.clear();
+	mask_ = OverlayMask();
 }
 
 bool AnnotateCvStage::Process(CompletedRequestPtr &completed_request)
 {
-	BufferWriteSync w(app_, completed_request->buffers[stream_]);
-	libcamera::Span<uint8_t> buffer = w.Get()[0];
 	FrameInfo info(completed_request);
 
 	// Other post-processing stages can supply metadata to update the text.
@@ -95,20 +121,26 @@ bool AnnotateCvStage::Process(CompletedRequestPtr &completed_request)
 	if (strftime(text_with_date, sizeof(text_with_date), text.c_str(), tm_ptr) != 0)
 		text = std::string(text_with_date);
 
-	uint8_t *ptr = (uint8_t *)buffer.data();
-	Mat im(info_.height, info_.width, CV_8U, ptr, info_.stride);
-	int font = FONT_HERSHEY_SIMPLEX;
-
-	int baseline = 0;
-	Size size = getTextSize(text, font, adjusted_scale_, adjusted_thickness_, &baseline);
+	// Leave the drawing to the overlay_cv stage.
+	if (overlay_)
+	{
+		uint32_t fg = fg_colour_.empty() ? (fg_ & 0xff) * 0x010101 : ParseRgb(fg_colour_);
+		OverlayPrimitive primitive = OverlayPrimitive::Text({ 0, 0 }, text, fg, adjusted_scale_, adjusted_thickness_);
+		primitive.bg_colour = bg_colour_.empty() ? (bg_ & 0xff) * 0x010101 : ParseRgb(bg_colour_);
+		primitive.bg_alpha = alpha_;
+		AddOverlay(completed_request->post_process_metadata, { primitive });
+		return false;
+	}
 
-	// Can't find a handy "draw rectangle with alpha" function...
-	for (int y = 0; y < size.height + baseline; y++, ptr += info_.stride)
+	BufferWriteSync w(app_, completed_request->buffers[stream_]);
+	libcamera::Span<uint8_t> buffer = w.Get()[0];
+	if (text != last_text_)
 	{
-		for (int x = 0; x < size.width; x++)
-			ptr[x] = bg_ * alpha_ + (1 - alpha_) * ptr[x];
+		atlas_->Render(text, coverage_);
+		mask_.Build(coverage_, fg_yuv_, bg_yuv_, alpha_, colour_);
+		last_text_ = text;
 	}
-	putText(im, text, Point(0, size.height), font, adjusted_scale_, fg_, adjusted_thickness_, 0);
+	mask_.Blend(buffer.data(), info_, 0, 0);
 
 	return false;
 }
@@ -0,0 +1,420 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * Copyright (C) 2025, Raspberry Pi Ltd
+ *
+ * detection_interpolate_stage.cpp - carry detections across the frames the detector doesn't run on
+ */
+
+// Detectors such as object_detect_tf and face_detect_cv only run every "refresh_rate" frames, and
+// their results arrive some frames after the image they were found in. On every other frame they
+// publish the same results again, so boxes sit still and then jump. This stage follows each box
+// from frame to frame instead, by block matching the lores image inside the box against the next
+// frame, starting from where the box's recent velocity says it should be. It replaces
+// "object_detect.results" and "detected_faces" in the metadata with the updated boxes, so it must
+// come after the detector and before anything that uses them (such as object_detect_draw_cv, with
+// "draw_faces" set to draw the faces, and face_detect_cv's own drawing turned off).
+
+// When a detector publishes the frame its results came from ("object_detect.sequence" or
+// "detected_faces.sequence") new results are first carried forward through the frames we have kept
+// to the current one; otherwise we only notice new results when they change, and take them to
+// belong to the current frame.
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+#include <libcamera/geometry.h>
+#include <libcamera/stream.h>
+
+#include "core/rpicam_app.hpp"
+
+#include "post_processing_stages/object_detect.hpp"
+#include "post_processing_stages/post_processing_stage.hpp"
+
+using Rectangle = libcamera::Rectangle;
+using Stream = libcamera::Stream;
+
+class DetectionInterpolateStage : public PostProcessingStage
+{
+public:
+	DetectionInterpolateStage(RPiCamApp *app) : PostProcessingStage(app) {}
+
+	char const *Name() const override;
+
+	void Read(boost::property_tree::ptree const &params) override;
+
+	void Configure() override;
+
+	bool Process(CompletedRequestPtr &completed_request) override;
+
+private:
+	// A box in lores image coordinates, with its motion in pixels per frame.
+	struct Box
+	{
+		float x, y, width, height;
+		float velocity_x, velocity_y;
+	};
+	// The boxes for one kind of result, and what the detector last told us.
+	template <typename T>
+	struct Results
+	{
+		std::vector<T> input;
+		unsigned int input_sequence = 0;
+		bool have_input = false;
+		std::vector<T> output;
+		std::vector<Box> boxes;
+	};
+	struct Frame
+	{
+		unsigned int sequence;
+		PreprocessedImagePtr luma;
+	};
+
+	Frame const *findFrame(unsigned int sequence) const;
+	void track(Box &box, Frame const &from, Frame const &to) const;
+	void track(std::vector<Box> &boxes, unsigned int from, unsigned int to) const;
+	Box toLores(Rectangle const &r) const;
+	Rectangle toMain(Box const &box) const;
+	void merge(std::vector<Box> &boxes, std::vector<Box> const &previous, bool take_velocity) const;
+	template <typename T>
+	void update(Results<T> &results, std::vector<T> *input, unsigned int const *inference_sequence,
+				unsigned int sequence);
+
+	static Rectangle &rect(Rectangle &r) { return r; }
+	static Rectangle &rect(Detection &d) { return d.box; }
+	static Rectangle const &rect(Rectangle const &r) { return r; }
+	static Rectangle const &rect(Detection const &d) { return d.box; }
+
+	struct Config
+	{
+		unsigned int search_range;
+		unsigned int samples;
+		float min_contrast;
+		float smoothing;
+		unsigned int history;
+		bool verbose;
+	} config_;
+
+	Stream *lores_stream_;
+	StreamInfo lores_info_;
+	StreamInfo main_info_;
+	float scale_x_, scale_y_; // main image pixels per lores pixel
+	std::mutex mutex_;
+	std::deque<Frame> frames_;
+	unsigned int last_sequence_;
+	bool first_frame_;
+	Results<Detection> objects_;
+	Results<Rectangle> faces_;
+};
+
+#define NAME "detection_interpolate"
+
+char const *DetectionInterpolateStage::Name() const
+{
+	return NAME;
+}
+
+void DetectionInterpolateStage::Read(boost::property_tree::ptree const &params)
+{
+	// Furthest a box may move between frames, beyond where its velocity takes it, in lores pixels.
+	config_.search_range = params.get<unsigned int>("search_range", 6);
+	// Each box is matched on a grid of at most this many samples in each direction.
+	config_.samples = std::max(params.get<unsigned int>("samples", 16), 2u);
+	// Boxes with less contrast than this (mean absolute deviation of the samples) can't be matched
+	// reliably, so just carry on at their current velocity.
+	config_.min_contrast = params.get<float>("min_contrast", 4.0);
+	// How much of a box's previous position to keep when new results arrive, from 0 to 1.
+	config_.smoothing = std::clamp(params.get<float>("smoothing", 0.25), 0.0f, 1.0f);
+	// Frames to keep for catching up with results from earlier images.
+	config_.history = std::max(params.get<unsigned int>("history", 8), 2u);
+	config_.verbose = params.get<int>("verbose", 0);
+}
+
+void DetectionInterpolateStage::Configure()
+{
+	lores_stream_ = app_->LoresStream(&lores_info_);
+	if (!lores_stream_)
+	{
+		if (config_.verbose)
+			LOG(1, "DetectionInterpolateStage: no low resolution stream");
+		return;
+	}
+
+	// Detections are reported in the main image's coordinates.
+	Stream *main_stream = app_->GetMainStream();
+	main_info_ = main_stream ? app_->GetStreamInfo(main_stream) : lores_info_;
+	scale_x_ = main_info_.width / (float)lores_info_.width;
+	scale_y_ = main_info_.height / (float)lores_info_.height;
+
+	frames_.clear();
+	objects_ = {};
+	faces_ = {};
+	first_frame_ = true;
+}
+
+DetectionInterpolateStage::Frame const *DetectionInterpolateStage::findFrame(unsigned int sequence) const
+{
+	for (auto const &frame : frames_)
+	{
+		if (frame.sequence == sequence)
+			return &frame;
+	}
+	return nullptr;
+}
+
+DetectionInterpolateStage::Box DetectionInterpolateStage::toLores(Rectangle const &r) const
+{
+	return { r.x / scale_x_, r.y / scale_y_, r.width / scale_x_, r.height / scale_y_, 0, 0 };
+}
+
+Rectangle DetectionInterpolateStage::toMain(Box const &box) const
+{
+	float x = std::clamp(box.x * scale_x_, 0.0f, (float)main_info_.width - 1);
+	float y = std::clamp(box.y * scale_y_, 0.0f, (float)main_info_.height - 1);
+	float width = std::min(box.width * scale_x_, main_info_.width - x);
+	float height = std::min(box.height * scale_y_, main_info_.height - y);
+	return Rectangle(std::lround(x), std::lround(y), std::lround(width), std::lround(height));
+}
+
+void DetectionInterpolateStage::track(Box &box, Frame const &from, Frame const &to) const
+{
+	int const width = lores_info_.width, height = lores_info_.height, stride = width;
+	uint8_t const *src = from.luma->Data(), *dst = to.luma->Data();
+
+	// Sample the middle of the box in the first frame, where it's least likely to be background.
+	float x0 = box.x + box.width / 4, y0 = box.y + box.height / 4;
+	float w = box.width / 2, h = box.height / 2;
+	unsigned int nx = std::clamp<unsigned int>(w, 1, config_.samples);
+	unsigned int ny = std::clamp<unsigned int>(h, 1, config_.samples);
+
+	std::vector<int> xs, ys, values;
+	xs.reserve(nx * ny), ys.reserve(nx * ny), values.reserve(nx * ny);
+	int sum = 0;
+	for (unsigned int j = 0; j < ny; j++)
+	{
+		int y = y0 + (j + 0.5f) * h / ny;
+		if (y < 0 || y >= height)
+			continue;
+		for (unsigned int i = 0; i < nx; i++)
+		{
+			int x = x0 + (i + 0.5f) * w / nx;
+			if (x < 0 || x >= width)
+				continue;
+			xs.push_back(x), ys.push_back(y);
+			values.push_back(src[y * stride + x]);
+			sum += values.back();
+		}
+	}
+
+	int predicted_x = std::lround(box.velocity_x), predicted_y = std::lround(box.velocity_y);
+	float dx = box.velocity_x, dy = box.velocity_y;
+
+	if (values.size() >= 4)
+	{
+		float mean = sum / (float)values.size(), contrast = 0;
+		for (int v : values)
+			contrast += std::abs(v - mean);
+		contrast /= values.size();
+
+		if (contrast >= config_.min_contrast)
+		{
+			int range = config_.search_range, size = 2 * range + 1;
+			unsigned int best = UINT_MAX;
+			int best_i = range, best_j = range;
+			for (int j = 0; j < size; j++)
+			{
+				for (int i = 0; i < size; i++)
+				{
+					int ox = predicted_x + i - range, oy = predicted_y + j - range;
+					unsigned int total = 0;
+					for (unsigned int k = 0; k < values.size() && total < best; k++)
+					{
+						int x = std::clamp(xs[k] + ox, 0, width - 1), y = std::clamp(ys[k] + oy, 0, height - 1);
+						total += std::abs(dst[y * stride + x] - values[k]);
+					}
+					if (total < best)
+						best = total, best_i = i, best_j = j;
+				}
+			}
+
+			// Refine to a fraction of a pixel by fitting a parabola through the neighbouring costs. The
+			// early exit above leaves those underestimated, so recompute them.
+			auto cost = [&](int i, int j) {
+				int ox = predicted_x + i - range, oy = predicted_y + j - range;
+				unsigned int total = 0;
+				for (unsigned int k = 0; k < values.size(); k++)
+				{
+					int x = std::clamp(xs[k] + ox, 0, width - 1), y = std::clamp(ys[k] + oy, 0, height - 1);
+					total += std::abs(dst[y * stride + x] - values[k]);
+				}
+				return (float)total;
+			};
+			auto refine = [](float left, float centre, float right) {
+				float denominator = left - 2 * centre + right;
+				return denominator > 0 ? std::clamp(0.5f * (left - right) / denominator, -0.5f, 0.5f) : 0.0f;
+			};
+			float fx = 0, fy = 0;
+			if (best_i > 0 && best_i < size - 1)
+				fx = refine(cost(best_i - 1, best_j), best, cost(best_i + 1, best_j));
+			if (best_j > 0 && best_j < size - 1)
+				fy = refine(cost(best_i, best_j - 1), best, cost(best_i, best_j + 1));
+
+			dx = predicted_x + best_i - range + fx;
+			dy = predicted_y + best_j - range + fy;
+		}
+	}
+
+	box.x += dx;
+	box.y += dy;
+	box.velocity_x = 0.5 * box.velocity_x + 0.5 * dx;
+	box.velocity_y = 0.5 * box.velocity_y + 0.5 * dy;
+}
+
+void DetectionInterpolateStage::track(std::vector<Box> &boxes, unsigned int from, unsigned int to) const
+{
+	Frame const *previous = findFrame(from);
+	for (unsigned int sequence = from + 1; previous && sequence <= to; sequence++)
+	{
+		Frame const *next = findFrame(sequence);
+		if (!next)
+			continue; // a dropped frame, so match across the gap
+		for (auto &box : boxes)
+			track(box, *previous, *next);
+		previous = next;
+	}
+}
+
+// New boxes keep some of the position of the box they replace, so that they don't jump, and its velocity
+// if they don't have one of their own yet.
+void DetectionInterpolateStage::merge(std::vector<Box> &boxes, std::vector<Box> const &previous,
+									  bool take_velocity) const
+{
+	for (auto &box : boxes)
+	{
+		Box const *best = nullptr;
+		float best_iou = 0.3;
+		for (auto const &old : previous)
+		{
+			float ix = std::min(box.x + box.width, old.x + old.width) - std::max(box.x, old.x);
+			float iy = std::min(box.y + box.height, old.y + old.height) - std::max(box.y, old.y);
+			if (ix <= 0 || iy <= 0)
+				continue;
+			float iou = ix * iy / (box.width * box.height + old.width * old.height - ix * iy);
+			if (iou > best_iou)
+				best = &old, best_iou = iou;
+		}
+		if (!best)
+			continue;
+
+		float s = config_.smoothing;
+		box.x = s * best->x + (1 - s) * box.x;
+		box.y = s * best->y + (1 - s) * box.y;
+		box.width = s * best->width + (1 - s) * box.width;
+		box.height = s * best->height + (1 - s) * box.height;
+		if (take_velocity)
+			box.velocity_x = best->velocity_x, box.velocity_y = best->velocity_y;
+	}
+}
+
+template <typename T>
+void DetectionInterpolateStage::update(Results<T> &results, std::vector<T> *input,
+									   unsigned int const *inference_sequence, unsigned int sequence)
+{
+	bool fresh = false;
+	if (input)
+	{
+		if (inference_sequence)
+			fresh = !results.have_input || *inference_sequence != results.input_sequence;
+		else
+		{
+			fresh = !results.have_input || input->size() != results.input.size() ||
+					!std::equal(input->begin(), input->end(), results.input.begin(),
+								[](auto const &a, auto const &b) { return rect(a) == rect(b); });
+		}
+	}
+
+	if (fresh)
+	{
+		results.input = *input;
+		results.input_sequence = inference_sequence ? *inference_sequence : sequence;
+		results.have_input = true;
+
+		std::vector<Box> boxes;
+		for (auto const &item : results.input)
+			boxes.push_back(toLores(rect(item)));
+		// Carry the results forward from the frame they were found in. If we no longer have that
+		// frame, treat them as belonging to this one.
+		bool caught_up = results.input_sequence < sequence && findFrame(results.input_sequence);
+		if (caught_up)
+			track(boxes, results.input_sequence, sequence);
+		merge(boxes, results.boxes, !caught_up);
+
+		if (config_.verbose)
+			LOG(1, "DetectionInterpolateStage: " << boxes.size() << " new results from frame "
+												 << results.input_sequence << " at frame " << sequence);
+
+		results.boxes = std::move(boxes);
+		results.output = results.input;
+	}
+	else
+		track(results.boxes, last_sequence_, sequence);
+
+	for (unsigned int i = 0; i < results.boxes.size(); i++)
+		rect(results.output[i]) = toMain(results.boxes[i]);
+	if (input)
+		*input = results.output;
+}
+
+bool DetectionInterpolateStage::Process(CompletedRequestPtr &completed_request)
+{
+	if (!lores_stream_)
+		return false;
+
+	unsigned int sequence = completed_request->sequence;
+	Metadata &metadata = completed_request->post_process_metadata;
+
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	// Requests can be processed slightly out of order. We can't go backwards, so just report where
+	// everything is now.
+	if (!first_frame_ && sequence <= last_sequence_)
+	{
+		std::lock_guard<Metadata> metadata_lock(metadata);
+		if (auto objects = metadata.GetLocked<std::vector<Detection>>("object_detect.results"))
+			*objects = objects_.output;
+		if (auto faces = metadata.GetLocked<std::vector<Rectangle>>("detected_faces"))
+			*faces = faces_.output;
+		return false;
+	}
+
+	// Only the Y plane is needed, and other stages may well want the same copy.
+	if (frames_.size() >= config_.history)
+		frames_.pop_front();
+	PreprocessKey key { lores_stream_, lores_info_.width, lores_info_.height, PreprocessKey::Format::Y };
+	frames_.push_back({ sequence, GetPreprocessed(completed_request, key) });
+
+	if (first_frame_)
+		last_sequence_ = sequence, first_frame_ = false;
+
+	{
+		std::lock_guard<Metadata> metadata_lock(metadata);
+		update(objects_, metadata.GetLocked<std::vector<Detection>>("object_detect.results"),
+			   metadata.GetLocked<unsigned int>("object_detect.sequence"), sequence);
+		update(faces_, metadata.GetLocked<std::vector<Rectangle>>("detected_faces"),
+			   metadata.GetLocked<unsigned int>("detected_faces.sequence"), sequence);
+	}
+
+	last_sequence_ = sequence;
+
+	return false;
+}
+
+static PostProcessingStage *Create(RPiCamApp *app)
+{
+	return new DetectionInterpolateStage(app);
+}
+
+static RegisterStage reg(NAME, &Create);
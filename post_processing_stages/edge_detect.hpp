@@ -0,0 +1,27 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * Copyright (C) 2025, Raspberry Pi Ltd
+ *
+ * edge_detect.hpp - Results published by the edge_detect stage.
+ */
+
+#pragma once
+
+#include <vector>
+
+// The edge_detect stage adds one of these to the post-processing metadata as "edge_detect.result".
+// Edge strengths are the mean of the absolute Sobel x and y gradients of the lightly blurred image,
+// from 0 to 255, as sobel_cv draws them.
+struct EdgeDetectResult
+{
+	struct Zone
+	{
+		float density; // fraction of the zone's pixels with an edge strength of at least the threshold
+		float sharpness; // mean edge strength
+	};
+
+	unsigned int zones_x;
+	unsigned int zones_y;
+	std::vector<Zone> zones; // in rows, from the top left of the region of interest
+	Zone total; // over the whole region of interest
+};
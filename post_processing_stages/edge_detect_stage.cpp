@@ -0,0 +1,309 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * Copyright (C) 2025, Raspberry Pi Ltd
+ *
+ * edge_detect_stage.cpp - edge density and sharpness measurement
+ */
+
+// This stage measures how much edge detail there is across the image, zone by zone, which makes a
+// cheap focus indicator, and shows up a camera that has been covered, knocked or defocused. It is
+// meant to run all the time, so normally works on the lores stream, or on a region of interest that
+// can be decimated by "decimate" in each direction.
+//
+// The edges are found much as the sobel_cv stage does, with a 3x3 Gaussian blur followed by 3x3
+// Sobel gradients. Here, though, the blur, both gradients and the edge strength are all done in a
+// single pass down the image in integer arithmetic, keeping only the few rows each step needs. The
+// working rows are allocated once and stay in the cache, rather than whole frames being made and
+// passed over several times.
+//
+// The result goes in the metadata as "edge_detect.result" (see edge_detect.hpp). With "draw" set,
+// the edge strengths are also written back over the region of interest, like sobel_cv, though only
+// when it isn't decimated.
+
+#include <algorithm>
+#include <cstring>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+#include <libcamera/formats.h>
+#include <libcamera/stream.h>
+
+#include "core/rpicam_app.hpp"
+
+#include "post_processing_stages/edge_detect.hpp"
+#include "post_processing_stages/post_processing_stage.hpp"
+
+using Stream = libcamera::Stream;
+
+class EdgeDetectStage : public PostProcessingStage
+{
+public:
+	EdgeDetectStage(RPiCamApp *app) : PostProcessingStage(app) {}
+
+	char const *Name() const override;
+
+	void Read(boost::property_tree::ptree const &params) override;
+
+	void Configure() override;
+
+	bool Process(CompletedRequestPtr &completed_request) override;
+
+private:
+	// In the Config, the region of interest is given as fractions of the image size.
+	struct Config
+	{
+		std::string stream;
+		float roi_x, roi_y;
+		float roi_width, roi_height;
+		unsigned int decimate;
+		unsigned int zones_x, zones_y;
+		unsigned int threshold;
+		unsigned int frame_period;
+		bool draw;
+	} config_;
+
+	Stream *stream_ = nullptr;
+	StreamInfo info_;
+	// The region of interest in the image, and its size once decimated.
+	unsigned int roi_x_, roi_y_;
+	unsigned int width_, height_;
+	std::vector<unsigned int> x_edges_;
+	std::vector<unsigned int> y_edges_;
+
+	// Working rows: one decimated input row, and rings of three horizontally blurred and three fully
+	// blurred rows. Blurred values are kept unnormalised, 16 times larger.
+	std::mutex mutex_;
+	std::vector<uint8_t> input_;
+	std::vector<uint16_t> hblur_;
+	std::vector<uint16_t> blur_;
+	std::vector<uint8_t> edges_;
+};
+
+#define NAME "edge_detect"
+
+char const *EdgeDetectStage::Name() const
+{
+	return NAME;
+}
+
+void EdgeDetectStage::Read(boost::property_tree::ptree const &params)
+{
+	config_.stream = params.get<std::string>("stream", "lores");
+	config_.roi_x = params.get<float>("roi_x", 0.0);
+	config_.roi_y = params.get<float>("roi_y", 0.0);
+	config_.roi_width = params.get<float>("roi_width", 1.0);
+	config_.roi_height = params.get<float>("roi_height", 1.0);
+	config_.decimate = std::max(params.get<unsigned int>("decimate", 1), 1u);
+	config_.zones_x = std::max(params.get<unsigned int>("zones_x", 8), 1u);
+	config_.zones_y = std::max(params.get<unsigned int>("zones_y", 6), 1u);
+	config_.threshold = params.get<unsigned int>("threshold", 32);
+	config_.frame_period = params.get<unsigned int>("frame_period", 1);
+	config_.draw = params.get<int>("draw", 0);
+}
+
+void EdgeDetectStage::Configure()
+{
+	stream_ = app_->GetStream(config_.stream, &info_);
+	if (!stream_)
+	{
+		LOG(1, "EdgeDetectStage: no \"" << config_.stream << "\" stream, using the main stream instead");
+		stream_ = app_->GetMainStream();
+		if (!stream_)
+			return;
+		info_ = app_->GetStreamInfo(stream_);
+	}
+	if (stream_->configuration().pixelFormat != libcamera::formats::YUV420)
+		throw std::runtime_error("EdgeDetectStage: only YUV420 format supported");
+
+	// Keep the region on even pixels so that drawing can grey out the matching chroma.
+	roi_x_ = std::clamp<unsigned int>(config_.roi_x * info_.width, 0, info_.width) & ~1;
+	roi_y_ = std::clamp<unsigned int>(config_.roi_y * info_.height, 0, info_.height) & ~1;
+	unsigned int roi_width = std::clamp<unsigned int>(config_.roi_width * info_.width, 0, info_.width - roi_x_);
+	unsigned int roi_height = std::clamp<unsigned int>(config_.roi_height * info_.height, 0, info_.height - roi_y_);
+	width_ = roi_width / config_.decimate;
+	height_ = roi_height / config_.decimate;
+	if (width_ < 3 || height_ < 3)
+		throw std::runtime_error("EdgeDetectStage: region of interest too small");
+
+	if (config_.draw && config_.decimate > 1)
+	{
+		LOG(1, "EdgeDetectStage: can't draw a decimated region of interest");
+		config_.draw = false;
+	}
+
+	unsigned int zones_x = std::min(config_.zones_x, width_), zones_y = std::min(config_.zones_y, height_);
+	x_edges_.resize(zones_x + 1);
+	y_edges_.resize(zones_y + 1);
+	for (unsigned int i = 0; i <= zones_x; i++)
+		x_edges_[i] = i * width_ / zones_x;
+	for (unsigned int i = 0; i <= zones_y; i++)
+		y_edges_[i] = i * height_ / zones_y;
+
+	// The input and fully blurred rows have a pixel of padding at each end.
+	input_.resize(width_ + 2);
+	hblur_.resize(3 * width_);
+	blur_.resize(3 * (width_ + 2));
+	edges_.resize(width_);
+
+	LOG(2, "EdgeDetectStage: roi " << roi_x_ << "," << roi_y_ << " " << roi_width << "x" << roi_height
+								   << ", measuring " << width_ << "x" << height_);
+}
+
+// These loops are all written so that the compiler can vectorise them. The rows passed in are the
+// blurred ones above, at and below the output row, starting with their padding.
+static void edge_row(uint16_t const *__restrict b0, uint16_t const *__restrict b1, uint16_t const *__restrict b2,
+					 uint8_t *__restrict out, unsigned int width)
+{
+	for (int x = 0; x < (int)width; x++)
+	{
+		int d0 = b0[x + 2] - b0[x], d1 = b1[x + 2] - b1[x], d2 = b2[x + 2] - b2[x];
+		int s0 = b0[x] + 2 * b0[x + 1] + b0[x + 2], s2 = b2[x] + 2 * b2[x + 1] + b2[x + 2];
+		int gx = std::abs(d0 + 2 * d1 + d2) >> 4, gy = std::abs(s2 - s0) >> 4;
+		out[x] = (std::min(gx, 255) + std::min(gy, 255) + 1) >> 1;
+	}
+}
+
+static void hblur_row(uint8_t const *__restrict in, uint16_t *__restrict out, unsigned int width)
+{
+	for (int x = 0; x < (int)width; x++)
+		out[x] = in[x] + 2 * in[x + 1] + in[x + 2];
+}
+
+static void vblur_row(uint16_t const *__restrict h0, uint16_t const *__restrict h1, uint16_t const *__restrict h2,
+					  uint16_t *__restrict out, unsigned int width)
+{
+	for (unsigned int x = 0; x < width; x++)
+		out[x + 1] = h0[x] + 2 * h1[x] + h2[x];
+	out[0] = out[1];
+	out[width + 1] = out[width];
+}
+
+static void sum_edges(uint8_t const *__restrict edges, unsigned int count, uint8_t threshold, uint32_t &sum,
+					  uint32_t &above)
+{
+	uint32_t s = 0, a = 0;
+	for (unsigned int i = 0; i < count; i++)
+	{
+		s += edges[i];
+		a += edges[i] >= threshold;
+	}
+	sum += s, above += a;
+}
+
+bool EdgeDetectStage::Process(CompletedRequestPtr &completed_request)
+{
+	if (!stream_)
+		return false;
+
+	if (config_.frame_period > 1 && completed_request->sequence % config_.frame_period)
+		return false;
+
+	struct Sums
+	{
+		uint32_t sum, above;
+	};
+	unsigned int zones_x = x_edges_.size() - 1, zones_y = y_edges_.size() - 1;
+	std::vector<Sums> sums(zones_x * zones_y, Sums {});
+	uint8_t threshold = std::min(config_.threshold, 255u);
+	unsigned int step = config_.decimate, padded = width_ + 2;
+
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		// Only take the buffer for writing if we must.
+		std::optional<BufferReadSync> read_sync;
+		std::optional<BufferWriteSync> write_sync;
+		libcamera::FrameBuffer *buffer = completed_request->buffers[stream_];
+		uint8_t *image = config_.draw ? write_sync.emplace(app_, buffer).Get()[0].data()
+									  : read_sync.emplace(app_, buffer).Get()[0].data();
+
+		// Rows beyond the edges of the region repeat the first or last row.
+		auto row = [this](int r) { return (unsigned int)std::clamp<int>(r, 0, height_ - 1); };
+		auto hblur = [this](unsigned int r) { return &hblur_[(r % 3) * width_]; };
+		auto blur = [this, padded](unsigned int r) { return &blur_[(r % 3) * padded]; };
+		auto load_row = [&](unsigned int r) {
+			uint8_t const *src = image + (roi_y_ + r * step) * info_.stride + roi_x_;
+			if (step == 1)
+				memcpy(&input_[1], src, width_);
+			else
+			{
+				for (unsigned int x = 0; x < width_; x++)
+					input_[x + 1] = src[x * step];
+			}
+			input_[0] = input_[1];
+			input_[width_ + 1] = input_[width_];
+			hblur_row(input_.data(), hblur(r), width_);
+		};
+
+		// Output row r - 1 needs blurred rows r - 2 to r, and blurred row r needs horizontally
+		// blurred rows r - 1 to r + 1. Once we've been past a row of the image, only the output
+		// is written back to it.
+		load_row(0);
+		for (unsigned int r = 0; r <= height_; r++)
+		{
+			if (r < height_)
+			{
+				if (r + 1 < height_)
+					load_row(r + 1);
+				vblur_row(hblur(row(r - 1)), hblur(r), hblur(row(r + 1)), blur(r), width_);
+			}
+			if (r == 0)
+				continue;
+
+			unsigned int out_row = r - 1;
+			edge_row(blur(row((int)out_row - 1)), blur(out_row), blur(row(out_row + 1)), edges_.data(), width_);
+
+			unsigned int zy = std::upper_bound(y_edges_.begin(), y_edges_.end(), out_row) - y_edges_.begin() - 1;
+			for (unsigned int zx = 0; zx < zones_x; zx++)
+			{
+				Sums &s = sums[zy * zones_x + zx];
+				sum_edges(&edges_[x_edges_[zx]], x_edges_[zx + 1] - x_edges_[zx], threshold, s.sum, s.above);
+			}
+
+			if (config_.draw)
+				memcpy(image + (roi_y_ + out_row) * info_.stride + roi_x_, edges_.data(), width_);
+		}
+
+		if (config_.draw)
+		{
+			// Grey out the colour, as sobel_cv does.
+			unsigned int uv_stride = info_.stride / 2;
+			uint8_t *u_plane = image + info_.stride * info_.height;
+			uint8_t *v_plane = u_plane + uv_stride * (info_.height / 2);
+			for (unsigned int y = roi_y_ / 2; y < (roi_y_ + height_) / 2; y++)
+			{
+				memset(u_plane + y * uv_stride + roi_x_ / 2, 128, width_ / 2);
+				memset(v_plane + y * uv_stride + roi_x_ / 2, 128, width_ / 2);
+			}
+		}
+	}
+
+	EdgeDetectResult result;
+	result.zones_x = zones_x;
+	result.zones_y = zones_y;
+	result.zones.resize(sums.size());
+	uint64_t total_sum = 0, total_above = 0;
+	for (unsigned int zy = 0; zy < zones_y; zy++)
+	{
+		for (unsigned int zx = 0; zx < zones_x; zx++)
+		{
+			Sums const &s = sums[zy * zones_x + zx];
+			float count = (x_edges_[zx + 1] - x_edges_[zx]) * (y_edges_[zy + 1] - y_edges_[zy]);
+			result.zones[zy * zones_x + zx] = { s.above / count, s.sum / count };
+			total_sum += s.sum, total_above += s.above;
+		}
+	}
+	float count = width_ * height_;
+	result.total = { total_above / count, total_sum / count };
+
+	completed_request->post_process_metadata.Set("edge_detect.result", std::move(result));
+
+	return false;
+}
+
+static PostProcessingStage *Create(RPiCamApp *app)
+{
+	return new EdgeDetectStage(app);
+}
+
+static RegisterStage reg(NAME, &Create);
@@ -17,6 +17,7 @@
 
 #include "core/rpicam_app.hpp"
 
+#include "post_processing_stages/overlay.hpp"
 #include "post_processing_stages/post_processing_stage.hpp"
 
 #include "opencv2/imgproc.hpp"
@@ -42,8 +43,9 @@ public:
 	void Stop() override;
 
 private:
-	void detectFeatures(cv::CascadeClassifier &cascade);
+	void detectFeatures(cv::CascadeClassifier &cascade, unsigned int sequence);
 	void drawFeatures(cv::Mat &img);
+	std::vector<OverlayPrimitive> getFeatures();
 
 	Stream *stream_;
 	StreamInfo low_res_info_;
@@ -52,8 +54,10 @@ private:
 	std::unique_ptr<std::future<void>> future_ptr_;
 	std::mutex face_mutex_;
 	std::mutex future_ptr_mutex_;
+	PreprocessedImagePtr lores_image_;
 	Mat image_;
 	std::vector<cv::Rect> faces_;
+	unsigned int faces_sequence_ = 0; // the frame the faces were found in
 	CascadeClassifier cascade_;
 	std::string cascadeName_;
 	double scaling_factor_;
@@ -62,6 +66,7 @@ private:
 	int max_size_;
 	int refresh_rate_;
 	int draw_features_;
+	bool overlay_;
 };
 
 #define NAME "face_detect_cv"
@@ -83,6 +88,7 @@ void FaceDetectCvStage::Read(boost::property_tree::ptree const &params)
 	max_size_ = params.get<int>("max_size", 256);
 	refresh_rate_ = params.get<int>("refresh_rate", 5);
 	draw_features_ = params.get<int>("draw_features", 1);
+	overlay_ = params.get<int>("overlay", 0);
 }
 
 void FaceDetectCvStage::Configure()
@@ -120,14 +126,14 @@ bool FaceDetectCvStage::Process(CompletedRequestPtr &completed_request)
 		if (completed_request->sequence % refresh_rate_ == 0 &&
 			(!future_ptr_ || future_ptr_->wait_for(std::chrono::seconds(0)) == std::future_status::ready))
 		{
-			BufferReadSync r(app_, completed_request->buffers[stream_]);
-			libcamera::Span<uint8_t> buffer = r.Get()[0];
-			uint8_t *ptr = (uint8_t *)buffer.data();
-			Mat image(low_res_info_.height, low_res_info_.width, CV_8U, ptr, low_res_info_.stride);
-			image_ = image.clone();
+			// Other stages may want the same copy of the lores image, so share it with them.
+			lores_image_ = GetPreprocessed(
+				completed_request, { stream_, low_res_info_.width, low_res_info_.height, PreprocessKey::Format::Y });
 
 			future_ptr_ = std::make_unique<std::future<void>>();
-			*future_ptr_ = std::async(std::launch::async, [this] { detectFeatures(cascade_); });
+			unsigned int sequence = completed_request->sequence;
+			*future_ptr_ =
+				std::async(std::launch::async, [this, sequence] { detectFeatures(cascade_, sequence); });
 		}
 	}
 
@@ -137,8 +143,12 @@ bool FaceDetectCvStage::Process(CompletedRequestPtr &completed_request)
 	std::transform(faces_.begin(), faces_.end(), std::back_inserter(temprect),
 				   [](Rect &r) { return libcamera::Rectangle(r.x, r.y, r.width, r.height); });
 	completed_request->post_process_metadata.Set("detected_faces", temprect);
+	completed_request->post_process_metadata.Set("detected_faces.sequence", faces_sequence_);
 
-	if (draw_features_)
+	// The overlay_cv stage can draw the faces in colour.
+	if (draw_features_ && overlay_)
+		AddOverlay(completed_request->post_process_metadata, getFeatures());
+	else if (draw_features_)
 	{
 		BufferWriteSync w(app_, completed_request->buffers[full_stream_]);
 		libcamera::Span<uint8_t> buffer = w.Get()[0];
@@ -150,9 +160,12 @@ bool FaceDetectCvStage::Process(CompletedRequestPtr &completed_request)
 	return false;
 }
 
-void FaceDetectCvStage::detectFeatures(CascadeClassifier &cascade)
+void FaceDetectCvStage::detectFeatures(CascadeClassifier &cascade, unsigned int sequence)
 {
-	equalizeHist(image_, image_);
+	// The lores image is shared, so leave it as it is and write the equalised copy to image_.
+	Mat image(low_res_info_.height, low_res_info_.width, CV_8U, (void *)lores_image_->Data(), lores_image_->stride);
+	equalizeHist(image, image_);
+	lores_image_.reset();
 
 	std::vector<Rect> temp_faces;
 	cascade.detectMultiScale(image_, temp_faces, scaling_factor_, min_neighbors_, CASCADE_SCALE_IMAGE,
@@ -170,6 +183,7 @@ void FaceDetectCvStage::detectFeatures(CascadeClassifier &cascade)
 	}
 	std::unique_lock<std::mutex> lock(face_mutex_);
 	faces_ = std::move(temp_faces);
+	faces_sequence_ = sequence;
 }
 
 void FaceDetectCvStage::drawFeatures(Mat &img)
@@ -200,6 +214,31 @@ void FaceDetectCvStage::drawFeatures(Mat &img)
 	}
 }
 
+std::vector<OverlayPrimitive> FaceDetectCvStage::getFeatures()
+{
+	// The same colours as drawFeatures, as 0xrrggbb.
+	const static uint32_t colours[] = { 0x0000ff, 0x0080ff, 0x00ffff, 0x00ff00,
+										0xff8000, 0xffff00, 0xff0000, 0xff00ff };
+
+	std::vector<OverlayPrimitive> primitives;
+	for (size_t i = 0; i < faces_.size(); i++)
+	{
+		Rect r = faces_[i];
+		uint32_t colour = colours[i % 8];
+		double aspect_ratio = (double)r.width / r.height;
+
+		if (0.75 < aspect_ratio && aspect_ratio < 1.3)
+		{
+			libcamera::Point center { cvRound(r.x + r.width * 0.5), cvRound(r.y + r.height * 0.5) };
+			primitives.push_back(OverlayPrimitive::Circle(center, cvRound((r.width + r.height) * 0.25), colour, 3));
+		}
+		else
+			primitives.push_back(
+				OverlayPrimitive::Box(libcamera::Rectangle(r.x, r.y, r.width, r.height), colour, 3));
+	}
+	return primitives;
+}
+
 void FaceDetectCvStage::Stop()
 {
 	if (future_ptr_)
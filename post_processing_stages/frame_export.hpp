@@ -0,0 +1,42 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * Copyright (C) 2025, Raspberry Pi Ltd
+ *
+ * frame_export.hpp - Wire format used by the frame_export stage.
+ */
+
+#pragma once
+
+#include <cstdint>
+
+// The frame_export stage listens on a Unix SOCK_SEQPACKET socket. For every frame it sends each
+// subscriber one message holding a FrameExportHeader, followed by metadata_size bytes of camera
+// metadata as "name=value" lines. The dma-buf fd of the frame is attached as SCM_RIGHTS ancillary
+// data, so the image itself is never copied.
+//
+// The camera can't re-use the buffer until every subscriber has acknowledged the frame by sending
+// back a FrameExportAck with the same id. Subscribers that take longer than the stage's timeout
+// lose the frame anyway, so that a stalled client never starves the camera.
+
+constexpr uint32_t FRAME_EXPORT_MAGIC = 0x58455246; // "FREX"
+constexpr uint16_t FRAME_EXPORT_VERSION = 1;
+
+struct FrameExportHeader
+{
+	uint32_t magic;
+	uint16_t version;
+	uint16_t header_size;
+	uint64_t id;
+	int64_t timestamp_ns;
+	uint32_t width;
+	uint32_t height;
+	uint32_t stride;
+	uint32_t pixel_format; // fourcc
+	uint32_t buffer_size;
+	uint32_t metadata_size;
+};
+
+struct FrameExportAck
+{
+	uint64_t id;
+};
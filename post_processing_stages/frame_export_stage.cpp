@@ -0,0 +1,397 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * Copyright (C) 2025, Raspberry Pi Ltd
+ *
+ * frame_export_stage.cpp - share frames with other processes without copying them
+ */
+
+// This stage publishes the dma-buf of every frame of one stream, along with its format and metadata,
+// to any number of local subscribers over a Unix socket. See frame_export.hpp for the wire format.
+//
+// Each frame sent out keeps a reference to its CompletedRequest until all its subscribers have
+// acknowledged it, and only then does the buffer go back to the camera. To stop a slow or stuck
+// subscriber from starving the camera, a subscriber only ever holds max_frames frames at once (it
+// simply misses any others), and loses its claim on a frame after timeout_ms.
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include <libcamera/stream.h>
+
+#include "core/rpicam_app.hpp"
+
+#include "post_processing_stages/frame_export.hpp"
+#include "post_processing_stages/post_processing_stage.hpp"
+
+using Stream = libcamera::Stream;
+using Clock = std::chrono::steady_clock;
+
+class FrameExportStage : public PostProcessingStage
+{
+public:
+	FrameExportStage(RPiCamApp *app) : PostProcessingStage(app) {}
+	~FrameExportStage();
+
+	char const *Name() const override;
+
+	void Read(boost::property_tree::ptree const &params) override;
+
+	void Configure() override;
+
+	void Start() override;
+
+	bool Process(CompletedRequestPtr &completed_request) override;
+
+	void Stop() override;
+
+	void Teardown() override;
+
+private:
+	struct Subscriber
+	{
+		int fd;
+		// Frames this subscriber has yet to acknowledge, and when we sent them.
+		std::map<uint64_t, Clock::time_point> outstanding;
+		unsigned int timeouts = 0;
+	};
+	struct Frame
+	{
+		CompletedRequestPtr completed_request;
+		unsigned int refs;
+	};
+
+	void serviceThread();
+	void acceptSubscriber();
+	bool readAcks(Subscriber &subscriber, std::vector<CompletedRequestPtr> &released);
+	void release(uint64_t id, std::vector<CompletedRequestPtr> &released);
+	void dropSubscriber(Subscriber &subscriber, std::vector<CompletedRequestPtr> &released);
+	std::string serialiseMetadata(libcamera::ControlList const &metadata) const;
+
+	std::string socket_path_;
+	std::string stream_name_;
+	std::chrono::milliseconds timeout_;
+	unsigned int max_frames_;
+
+	Stream *stream_ = nullptr;
+	StreamInfo info_;
+	int listen_fd_ = -1;
+	std::vector<Subscriber> subscribers_;
+	std::map<uint64_t, Frame> frames_;
+	uint64_t frames_sent_ = 0;
+	std::mutex mutex_;
+	std::thread service_thread_;
+	std::atomic<bool> abort_ = false;
+};
+
+#define NAME "frame_export"
+
+char const *FrameExportStage::Name() const
+{
+	return NAME;
+}
+
+FrameExportStage::~FrameExportStage()
+{
+	abort_ = true;
+	if (service_thread_.joinable())
+		service_thread_.join();
+
+	for (auto &subscriber : subscribers_)
+		close(subscriber.fd);
+	if (listen_fd_ >= 0)
+	{
+		close(listen_fd_);
+		unlink(socket_path_.c_str());
+	}
+}
+
+void FrameExportStage::Read(boost::property_tree::ptree const &params)
+{
+	socket_path_ = params.get<std::string>("socket", "/tmp/rpicam-frames.sock");
+	stream_name_ = params.get<std::string>("stream", "lores");
+	timeout_ = std::chrono::milliseconds(params.get<unsigned int>("timeout_ms", 100));
+	max_frames_ = std::max(params.get<unsigned int>("max_frames", 2), 1u);
+
+	// The socket outlives camera restarts, so subscribers stay connected across mode switches.
+	sockaddr_un addr = {};
+	addr.sun_family = AF_UNIX;
+	if (socket_path_.size() >= sizeof(addr.sun_path))
+		throw std::runtime_error("FrameExportStage: socket path too long: " + socket_path_);
+	strcpy(addr.sun_path, socket_path_.c_str());
+	unlink(socket_path_.c_str());
+
+	listen_fd_ = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (listen_fd_ < 0)
+		throw std::runtime_error("FrameExportStage: failed to create socket");
+	if (bind(listen_fd_, (sockaddr *)&addr, sizeof(addr)) < 0 || listen(listen_fd_, 8) < 0)
+		throw std::runtime_error("FrameExportStage: failed to listen on " + socket_path_ + ": " + strerror(errno));
+
+	LOG(1, "FrameExportStage: exporting \"" << stream_name_ << "\" frames on " << socket_path_);
+}
+
+void FrameExportStage::Configure()
+{
+	stream_ = app_->GetStream(stream_name_, &info_);
+	if (!stream_)
+	{
+		LOG(1, "FrameExportStage: no \"" << stream_name_ << "\" stream, exporting the main stream instead");
+		stream_ = app_->GetMainStream();
+		if (stream_)
+			info_ = app_->GetStreamInfo(stream_);
+	}
+}
+
+void FrameExportStage::Start()
+{
+	abort_ = false;
+	service_thread_ = std::thread(&FrameExportStage::serviceThread, this);
+}
+
+bool FrameExportStage::Process(CompletedRequestPtr &completed_request)
+{
+	if (!stream_)
+		return false;
+
+	auto it = completed_request->buffers.find(stream_);
+	if (it == completed_request->buffers.end())
+		return false;
+	libcamera::FrameBuffer *buffer = it->second;
+
+	FrameExportHeader header = {};
+	header.magic = FRAME_EXPORT_MAGIC;
+	header.version = FRAME_EXPORT_VERSION;
+	header.header_size = sizeof(header);
+	header.id = completed_request->sequence;
+	header.timestamp_ns = completed_request->metadata.get(controls::SensorTimestamp).value_or(0);
+	header.width = info_.width;
+	header.height = info_.height;
+	header.stride = info_.stride;
+	header.pixel_format = info_.pixel_format.fourcc();
+	for (auto const &plane : buffer->planes())
+		header.buffer_size = std::max<uint32_t>(header.buffer_size, plane.offset + plane.length);
+
+	std::string metadata;
+	int fd = buffer->planes()[0].fd.get();
+
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	unsigned int refs = 0;
+	for (auto &subscriber : subscribers_)
+	{
+		// A subscriber that is still busy with earlier frames simply misses this one.
+		if (subscriber.fd < 0 || subscriber.outstanding.size() >= max_frames_)
+			continue;
+
+		if (metadata.empty())
+		{
+			metadata = serialiseMetadata(completed_request->metadata);
+			header.metadata_size = metadata.size();
+		}
+
+		iovec iov[2] = { { &header, sizeof(header) }, { metadata.data(), metadata.size() } };
+		char control[CMSG_SPACE(sizeof(int))] = {};
+		msghdr msg = {};
+		msg.msg_iov = iov;
+		msg.msg_iovlen = 2;
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+		cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+		memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+
+		// A full socket just means the subscriber isn't keeping up. Anything worse gets noticed, and the
+		// subscriber dropped, by the service thread.
+		if (sendmsg(subscriber.fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL) < 0)
+			continue;
+
+		subscriber.outstanding[header.id] = Clock::now();
+		refs++;
+	}
+
+	if (refs)
+	{
+		frames_[header.id] = { completed_request, refs };
+		frames_sent_++;
+	}
+
+	return false;
+}
+
+void FrameExportStage::Stop()
+{
+	// Don't join the service thread here. It may be handing a request back to the camera, which the
+	// application won't allow while it is in the middle of stopping, so we wait for it in Teardown().
+	abort_ = true;
+}
+
+void FrameExportStage::Teardown()
+{
+	if (service_thread_.joinable())
+		service_thread_.join();
+
+	// The camera has stopped, so anything we still hold can go, and we don't want acknowledgements
+	// for these frames to be confused with ones from the next run.
+	std::vector<CompletedRequestPtr> released;
+	std::lock_guard<std::mutex> lock(mutex_);
+	for (auto &frame : frames_)
+		released.push_back(std::move(frame.second.completed_request));
+	frames_.clear();
+	for (auto &subscriber : subscribers_)
+		subscriber.outstanding.clear();
+
+	LOG(2, "FrameExportStage: sent " << frames_sent_ << " frames");
+}
+
+void FrameExportStage::serviceThread()
+{
+	while (!abort_)
+	{
+		std::vector<pollfd> fds;
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			fds.push_back({ listen_fd_, POLLIN, 0 });
+			for (auto const &subscriber : subscribers_)
+				fds.push_back({ subscriber.fd, POLLIN, 0 });
+		}
+
+		// Wake up regularly to check for timeouts and for being stopped.
+		int ret = poll(fds.data(), fds.size(), std::min<int>(timeout_.count() / 2 + 1, 20));
+		if (ret < 0 && errno != EINTR)
+		{
+			LOG_ERROR("FrameExportStage: poll failed: " << strerror(errno));
+			break;
+		}
+
+		// Requests are released only once we've let go of the lock, as releasing them re-queues them
+		// with the camera.
+		std::vector<CompletedRequestPtr> released;
+		std::lock_guard<std::mutex> lock(mutex_);
+
+		if (ret > 0 && (fds[0].revents & POLLIN))
+			acceptSubscriber();
+
+		for (unsigned int i = 1; ret > 0 && i < fds.size(); i++)
+		{
+			if (!fds[i].revents)
+				continue;
+			for (auto &subscriber : subscribers_)
+			{
+				if (subscriber.fd == fds[i].fd && !readAcks(subscriber, released))
+					dropSubscriber(subscriber, released);
+			}
+		}
+
+		auto now = Clock::now();
+		for (auto &subscriber : subscribers_)
+		{
+			for (auto it = subscriber.outstanding.begin(); it != subscriber.outstanding.end();)
+			{
+				if (now - it->second < timeout_)
+				{
+					it++;
+					continue;
+				}
+				if (!subscriber.timeouts++)
+					LOG(1, "FrameExportStage: subscriber too slow, frame " << it->first << " reclaimed");
+				release(it->first, released);
+				it = subscriber.outstanding.erase(it);
+			}
+		}
+
+		subscribers_.erase(std::remove_if(subscribers_.begin(), subscribers_.end(),
+										  [](auto const &s) { return s.fd < 0; }),
+						   subscribers_.end());
+	}
+}
+
+void FrameExportStage::acceptSubscriber()
+{
+	int fd = accept4(listen_fd_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+	if (fd < 0)
+		return;
+
+	subscribers_.push_back({ fd, {}, 0 });
+	LOG(1, "FrameExportStage: subscriber connected (" << subscribers_.size() << " total)");
+}
+
+bool FrameExportStage::readAcks(Subscriber &subscriber, std::vector<CompletedRequestPtr> &released)
+{
+	while (true)
+	{
+		FrameExportAck ack;
+		ssize_t ret = recv(subscriber.fd, &ack, sizeof(ack), MSG_DONTWAIT);
+		if (ret == 0)
+			return false; // hung up
+		if (ret < 0)
+			return errno == EAGAIN || errno == EWOULDBLOCK;
+		if (ret != sizeof(ack))
+			continue;
+
+		// Acknowledgements for frames that timed out, or were never sent, are ignored.
+		auto it = subscriber.outstanding.find(ack.id);
+		if (it == subscriber.outstanding.end())
+			continue;
+		subscriber.outstanding.erase(it);
+		release(ack.id, released);
+	}
+}
+
+void FrameExportStage::release(uint64_t id, std::vector<CompletedRequestPtr> &released)
+{
+	auto it = frames_.find(id);
+	if (it == frames_.end())
+		return;
+
+	if (--it->second.refs == 0)
+	{
+		released.push_back(std::move(it->second.completed_request));
+		frames_.erase(it);
+	}
+}
+
+void FrameExportStage::dropSubscriber(Subscriber &subscriber, std::vector<CompletedRequestPtr> &released)
+{
+	for (auto const &outstanding : subscriber.outstanding)
+		release(outstanding.first, released);
+	subscriber.outstanding.clear();
+
+	close(subscriber.fd);
+	subscriber.fd = -1; // removed by the service thread
+	LOG(1, "FrameExportStage: subscriber disconnected");
+}
+
+std::string FrameExportStage::serialiseMetadata(libcamera::ControlList const &metadata) const
+{
+	std::stringstream ss;
+	for (auto const &[id, value] : metadata)
+	{
+		auto it = libcamera::controls::controls.find(id);
+		if (it != libcamera::controls::controls.end())
+			ss << it->second->name();
+		else
+			ss << id;
+		ss << "=" << value.toString() << "\n";
+	}
+	return ss.str();
+}
+
+static PostProcessingStage *Create(RPiCamApp *app)
+{
+	return new FrameExportStage(app);
+}
+
+static RegisterStage reg(NAME, &Create);
@@ -6,10 +6,14 @@
  */
 
 #include <algorithm>
+#include <array>
+#include <cstring>
 #include <mutex>
 #include <string>
 #include <sys/mman.h>
 
+#include <libcamera/formats.h>
+
 #include <opencv2/highgui.hpp>
 #include <opencv2/imgproc.hpp>
 #include <opencv2/opencv.hpp>
@@ -91,8 +95,68 @@ private:
 } // namespace
 
 
-Allocator::Allocator()
+// The free blocks, and the statistics, live here rather than in the Allocator itself so that blocks
+// freed after the Allocator has gone still have somewhere to go.
+struct Allocator::Pool
 {
+	// Size classes are whole pages: 1 to 4 pages exactly, and then 4 steps for each power of 2.
+	static constexpr unsigned int PAGE_SIZE = 4096;
+	static constexpr unsigned int NUM_CLASSES = 4 * 20;
+	// Enough for all the tensors of a few jobs in flight. Anything beyond this is unmapped when freed.
+	static constexpr unsigned int MAX_FREE = 8;
+
+	static unsigned int SizeClass(size_t size)
+	{
+		size_t pages = std::max<size_t>((size + PAGE_SIZE - 1) / PAGE_SIZE, 1);
+		if (pages <= 4)
+			return pages - 1;
+		unsigned int e = 63 - __builtin_clzll(pages - 1);
+		return 4 * (e - 1) + ((pages - 1) >> (e - 2)) - 4;
+	}
+
+	static size_t ClassSize(unsigned int size_class)
+	{
+		if (size_class < 4)
+			return (size_class + 1) * PAGE_SIZE;
+		return ((size_t)(size_class % 4 + 5) << (size_class / 4 - 1)) * PAGE_SIZE;
+	}
+
+	~Pool()
+	{
+		for (unsigned int i = 0; i < NUM_CLASSES; i++)
+		{
+			for (uint8_t *ptr : free_lists[i])
+				munmap(ptr, ClassSize(i));
+		}
+	}
+
+	void Free(uint8_t *ptr, unsigned int size_class)
+	{
+		{
+			std::scoped_lock<std::mutex> l(lock);
+			if (free_lists[size_class].size() < MAX_FREE)
+			{
+				free_lists[size_class].push_back(ptr);
+				return;
+			}
+			mapped_bytes -= ClassSize(size_class);
+		}
+		munmap(ptr, ClassSize(size_class));
+	}
+
+	std::mutex lock; // only ever held to push or pop a free list, or read the statistics
+	std::array<std::vector<uint8_t *>, NUM_CLASSES> free_lists;
+	uint64_t allocations = 0;
+	uint64_t mappings = 0;
+	size_t mapped_bytes = 0;
+	size_t high_water_bytes = 0;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+};
+
+Allocator::Allocator() : pool_(std::make_shared<Pool>())
+{
+	for (auto &free_list : pool_->free_lists)
+		free_list.reserve(Pool::MAX_FREE);
 }
 
 Allocator::~Allocator()
@@ -102,48 +166,74 @@ Allocator::~Allocator()
 
 void Allocator::Reset()
 {
-	std::scoped_lock<std::mutex> l(lock_);
+	Stats stats = GetStats();
+	if (stats.allocations)
+		LOG(2, "Allocator: " << stats.allocations << " allocations (" << stats.allocation_rate << "/s), "
+							 << stats.mappings << " needed mapping, high water " << stats.high_water_bytes / 1024
+							 << "kB");
 
-	for (auto &info : alloc_info_)
-		munmap(info.ptr, info.size);
+	std::array<std::vector<uint8_t *>, Pool::NUM_CLASSES> free_lists;
+	{
+		std::scoped_lock<std::mutex> l(pool_->lock);
+		for (unsigned int i = 0; i < Pool::NUM_CLASSES; i++)
+		{
+			free_lists[i].swap(pool_->free_lists[i]);
+			pool_->free_lists[i].reserve(Pool::MAX_FREE);
+			pool_->mapped_bytes -= free_lists[i].size() * Pool::ClassSize(i);
+		}
+		pool_->allocations = pool_->mappings = 0;
+		pool_->high_water_bytes = pool_->mapped_bytes;
+		pool_->start = std::chrono::steady_clock::now();
+	}
 
-	alloc_info_.clear();
+	for (unsigned int i = 0; i < Pool::NUM_CLASSES; i++)
+	{
+		for (uint8_t *ptr : free_lists[i])
+			munmap(ptr, Pool::ClassSize(i));
+	}
 }
 
 std::shared_ptr<uint8_t> Allocator::Allocate(unsigned int size)
 {
-	std::scoped_lock<std::mutex> l(lock_);
+	unsigned int size_class = Pool::SizeClass(size);
+	if (size_class >= Pool::NUM_CLASSES)
+		return {};
+	size_t class_size = Pool::ClassSize(size_class);
 	uint8_t *ptr = nullptr;
 
-	auto info = std::find_if(alloc_info_.begin(), alloc_info_.end(),
-							 [size](const AllocInfo &info) { return info.free && info.size == size; });
-	if (info != alloc_info_.end())
 	{
-		info->free = false;
-		ptr = info->ptr;
+		std::scoped_lock<std::mutex> l(pool_->lock);
+		pool_->allocations++;
+		auto &free_list = pool_->free_lists[size_class];
+		if (!free_list.empty())
+		{
+			ptr = free_list.back();
+			free_list.pop_back();
+		}
 	}
 
 	if (!ptr)
 	{
-		void *addr = mmap(NULL, size, PROT_WRITE | PROT_READ, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+		void *addr = mmap(NULL, class_size, PROT_WRITE | PROT_READ, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
 		if (addr == MAP_FAILED)
 			return {};
-
 		ptr = static_cast<uint8_t *>(addr);
-		alloc_info_.emplace_back(ptr, size, false);
+
+		std::scoped_lock<std::mutex> l(pool_->lock);
+		pool_->mappings++;
+		pool_->mapped_bytes += class_size;
+		pool_->high_water_bytes = std::max(pool_->high_water_bytes, pool_->mapped_bytes);
 	}
 
-	return std::shared_ptr<uint8_t>(ptr, [this](uint8_t *ptr) { this->free(ptr); });
+	return std::shared_ptr<uint8_t>(ptr, [pool = pool_, size_class](uint8_t *ptr) { pool->Free(ptr, size_class); });
 }
 
-void Allocator::free(uint8_t *ptr)
+Allocator::Stats Allocator::GetStats() const
 {
-	std::scoped_lock<std::mutex> l(lock_);
-
-	auto info =	std::find_if(alloc_info_.begin(), alloc_info_.end(),
-							 [ptr](const AllocInfo &info) { return info.ptr == ptr; });
-	if (info != alloc_info_.end())
-		info->free = true;
+	std::scoped_lock<std::mutex> l(pool_->lock);
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - pool_->start;
+	return { pool_->allocations, pool_->mappings, pool_->allocations / std::max(elapsed.count(), 1e-3),
+			 pool_->mapped_bytes, pool_->high_water_bytes };
 }
 
 HailoPostProcessingStage::HailoPostProcessingStage(RPiCamApp *app)
@@ -164,6 +254,15 @@ void HailoPostProcessingStage::Read(boost::property_tree::ptree const &params)
 	hef_file_8L_ = params.get<std::string>("hef_file_8L", "");
 }
 
+void HailoPostProcessingStage::AdjustConfig(std::string const &use_case, StreamConfiguration *config)
+{
+	// Ask for RGB lores rows with no padding, so that the image can go straight to the accelerator without
+	// being copied. libcamera may still insist on padding, in which case we copy it as before.
+	if (use_case == "lores" && (config->pixelFormat == libcamera::formats::RGB888 ||
+								config->pixelFormat == libcamera::formats::BGR888))
+		config->stride = config->size.width * 3;
+}
+
 void HailoPostProcessingStage::Configure()
 {
 	output_stream_ = app_->GetMainStream();
@@ -246,6 +345,56 @@ int HailoPostProcessingStage::configureHailoRT()
 	return 0;
 }
 
+uint8_t *HailoPostProcessingStage::LoresInputTensor(libcamera::Span<uint8_t> const &buffer,
+													std::shared_ptr<uint8_t> &storage, bool copy)
+{
+	if (low_res_info_.pixel_format == libcamera::formats::YUV420)
+	{
+		StreamInfo rgb_info;
+		rgb_info.width = InputTensorSize().width;
+		rgb_info.height = InputTensorSize().height;
+		rgb_info.stride = rgb_info.width * 3;
+
+		storage = allocator_.Allocate(rgb_info.stride * rgb_info.height);
+		if (!storage)
+		{
+			LOG_ERROR("Could not allocate an input buffer!");
+			return nullptr;
+		}
+
+		Yuv420ToRgb(storage.get(), buffer.data(), low_res_info_, rgb_info);
+		return storage.get();
+	}
+	else if (low_res_info_.pixel_format == libcamera::formats::RGB888 ||
+			 low_res_info_.pixel_format == libcamera::formats::BGR888)
+	{
+		unsigned int stride = low_res_info_.width * 3;
+
+		if (low_res_info_.stride == stride && !copy)
+			return buffer.data();
+
+		storage = allocator_.Allocate(stride * low_res_info_.height);
+		if (!storage)
+		{
+			LOG_ERROR("Could not allocate an input buffer!");
+			return nullptr;
+		}
+
+		// Drop any padding on the right edge of the buffer.
+		if (low_res_info_.stride == stride)
+			memcpy(storage.get(), buffer.data(), stride * low_res_info_.height);
+		else
+		{
+			for (unsigned int i = 0; i < low_res_info_.height; i++)
+				memcpy(storage.get() + i * stride, buffer.data() + i * low_res_info_.stride, stride);
+		}
+		return storage.get();
+	}
+
+	LOG_ERROR("Unexpected lores format " << low_res_info_.pixel_format);
+	return nullptr;
+}
+
 hailo_status HailoPostProcessingStage::DispatchJob(const uint8_t *input, AsyncInferJob &job,
 												   std::vector<OutTensor> &output_tensors)
 {
@@ -26,33 +26,36 @@
 
 #include "hailo_postproc_lib.h"
 
+// Memory for input and output tensors. Sizes are rounded up to one of a set of size classes (no more
+// than 25% bigger), and freed blocks go on a short free list for their class, so that the handful of
+// sizes wanted every frame are handed straight back out without searching or another mmap. Blocks
+// may outlive the Allocator, for example while the display thread still has them.
 class Allocator
 {
 public:
+	struct Stats
+	{
+		uint64_t allocations; // since the last Reset
+		uint64_t mappings; // allocations that needed a new mmap
+		double allocation_rate; // allocations per second
+		size_t mapped_bytes; // now, whether in use or free
+		size_t high_water_bytes; // the most mapped at once
+	};
+
 	Allocator();
 	~Allocator();
 
+	// Unmap all the free blocks, and start the statistics again. Blocks in use go back on the free lists
+	// when they are freed.
 	void Reset();
 
 	std::shared_ptr<uint8_t> Allocate(unsigned int size);
 
-private:
-	void free(uint8_t *ptr);
+	Stats GetStats() const;
 
-	struct AllocInfo
-	{
-		AllocInfo(uint8_t *_ptr, unsigned int _size, bool _free)
-			: ptr(_ptr), size(_size), free(_free)
-		{
-		}
-
-		uint8_t *ptr;
-		unsigned int size;
-		bool free;
-	};
-
-	std::vector<AllocInfo> alloc_info_;
-	std::mutex lock_;
+private:
+	struct Pool;
+	std::shared_ptr<Pool> pool_;
 };
 
 class OutTensor
@@ -152,6 +155,8 @@ public:
 
 	void Read(boost::property_tree::ptree const &params) override;
 
+	void AdjustConfig(std::string const &use_case, StreamConfiguration *config) override;
+
 	void Configure() override;
 
 protected:
@@ -170,6 +175,13 @@ protected:
 		return input_tensor_size_;
 	}
 
+	// Get the lores image in the given buffer as an RGB input tensor. Where the lores stream is already RGB
+	// with no padding at the end of the rows, that's just the buffer itself, unless a copy is asked for (to
+	// keep the image beyond the request). Otherwise the image is converted or copied into allocator memory,
+	// held in storage. Returns nullptr if the lores format can't be used.
+	uint8_t *LoresInputTensor(libcamera::Span<uint8_t> const &buffer, std::shared_ptr<uint8_t> &storage,
+							  bool copy = false);
+
 	hailo_status DispatchJob(const uint8_t *input, hailort::AsyncInferJob &job, std::vector<OutTensor> &output_tensors);
 	HailoROIPtr MakeROI(const std::vector<OutTensor> &output_tensors) const;
 
@@ -349,38 +349,10 @@ bool Scrfd::Process(CompletedRequestPtr &completed_request)
 	BufferReadSync r(app_, completed_request->buffers[low_res_stream_]);
 	libcamera::Span<uint8_t> low_res_buffer = r.Get()[0];
 	std::shared_ptr<uint8_t> input;
-	uint8_t *input_ptr;
-
-	if (low_res_info_.pixel_format == libcamera::formats::YUV420)
-	{
-		StreamInfo rgb_info;
-		rgb_info.width = InputTensorSize().width;
-		rgb_info.height = InputTensorSize().height;
-		rgb_info.stride = rgb_info.width * 3;
-
-		input = allocator_.Allocate(rgb_info.stride * rgb_info.height);
-		input_ptr = input.get();
-
-		Yuv420ToRgb(input.get(), low_res_buffer.data(), low_res_info_, rgb_info);
-	}
-	else if (low_res_info_.pixel_format == libcamera::formats::RGB888 ||
-			 low_res_info_.pixel_format == libcamera::formats::BGR888)
-	{
-		unsigned int stride = low_res_info_.width * 3;
-
-		input = allocator_.Allocate(stride * low_res_info_.height);
-		input_ptr = input.get();
-
-		// If the stride shows we have padding on the right edge of the buffer, we must copy it out to another buffer
-		// without padding.
-		for (unsigned int i = 0; i < low_res_info_.height; i++)
-			memcpy(input_ptr + i * stride, low_res_buffer.data() + i * low_res_info_.stride, stride);
-	}
-	else
-	{
-		LOG_ERROR("Unexpected lores format " << low_res_info_.pixel_format);
+	// The input is drawn on and displayed, so it must be a copy that we can keep.
+	uint8_t *input_ptr = LoresInputTensor(low_res_buffer, input, true);
+	if (!input_ptr)
 		return false;
-	}
 
 	BufferWriteSync w(app_, completed_request->buffers[output_stream_]);
 	libcamera::Span<uint8_t> buffer = w.Get()[0];
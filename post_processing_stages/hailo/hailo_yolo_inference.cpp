@@ -18,6 +18,7 @@
 
 #include "core/rpicam_app.hpp"
 #include "post_processing_stages/object_detect.hpp"
+#include "post_processing_stages/object_tracker.hpp"
 
 #include "detection/yolo_hailortpp.hpp"
 
@@ -51,17 +52,9 @@ public:
 
 private:
 	std::vector<Detection> runInference(const uint8_t *frame, const std::vector<libcamera::Rectangle> &scaler_crops);
-	void filterOutputObjects(std::vector<Detection> &objects);
 
-	struct LtObject
-	{
-		Detection params;
-		unsigned int visible;
-		unsigned int hidden;
-		bool matched;
-	};
-
-	std::vector<LtObject> lt_objects_;
+	ObjectTracker tracker_;
+	unsigned int frame_count_ = 0;
 	std::mutex lock_;
 	DlLib postproc_nms_;
 	YoloParamsNMS *yolo_params_ = nullptr;
@@ -72,10 +65,7 @@ private:
 	unsigned int max_detections_;
 	float threshold_;
 	bool temporal_filtering_;
-	float tolerance_;
-	float factor_;
-	unsigned int visible_frames_;
-	unsigned int hidden_frames_;
+	unsigned int inference_interval_;
 };
 
 YoloInference::YoloInference(RPiCamApp *app)
@@ -103,16 +93,12 @@ void YoloInference::Read(boost::property_tree::ptree const &params)
 	max_detections_ = params.get<unsigned int>("max_detections");
 	threshold_ = params.get<float>("threshold", 0.5f);
 
-	if (params.find("temporal_filter") != params.not_found())
-	{
-		temporal_filtering_ = true;
-		tolerance_ = params.get<float>("temporal_filter.tolerance", 0.05);
-		factor_ = params.get<float>("temporal_filter.factor", 0.2);
-		visible_frames_ = params.get<unsigned int>("temporal_filter.visible_frames", 5);
-		hidden_frames_ = params.get<unsigned int>("temporal_filter.hidden_frames", 2);
-	}
-	else
-		temporal_filtering_ = false;
+	tracker_.GetConfig().visible_frames = 5;
+	temporal_filtering_ = tracker_.Read(params);
+	// With temporal filtering, the tracker can fill in the frames in between detector runs.
+	inference_interval_ = std::max(1u, params.get<unsigned int>("inference_interval", 1));
+	if (inference_interval_ > 1 && !temporal_filtering_)
+		throw std::runtime_error("hailo_yolo_inference: inference_interval needs temporal_filter");
 
 	InitFuncPtr init = reinterpret_cast<InitFuncPtr>(postproc_nms_.GetSymbol("init"));
 	const std::string config_file = params.get<std::string>("hailopp_config_file", {});
@@ -129,6 +115,8 @@ void YoloInference::Read(boost::property_tree::ptree const &params)
 void YoloInference::Configure()
 {
 	HailoPostProcessingStage::Configure();
+	tracker_.Configure(output_stream_->configuration().size);
+	frame_count_ = 0;
 }
 
 bool YoloInference::Process(CompletedRequestPtr &completed_request)
@@ -145,46 +133,24 @@ bool YoloInference::Process(CompletedRequestPtr &completed_request)
 		return false;
 	}
 
-	BufferReadSync r(app_, completed_request->buffers[low_res_stream_]);
-	libcamera::Span<uint8_t> buffer = r.Get()[0];
-	std::shared_ptr<uint8_t> input;
-	uint8_t *input_ptr;
-
-	if (low_res_info_.pixel_format == libcamera::formats::YUV420)
+	if (temporal_filtering_)
 	{
-		StreamInfo rgb_info;
-		rgb_info.width = InputTensorSize().width;
-		rgb_info.height = InputTensorSize().height;
-		rgb_info.stride = rgb_info.width * 3;
-
-		input = allocator_.Allocate(rgb_info.stride * rgb_info.height);
-		input_ptr = input.get();
-
-		Yuv420ToRgb(input.get(), buffer.data(), low_res_info_, rgb_info);
-	}
-	else if (low_res_info_.pixel_format == libcamera::formats::RGB888 ||
-			 low_res_info_.pixel_format == libcamera::formats::BGR888)
-	{
-		unsigned int stride = low_res_info_.width * 3;
-
-		// If the stride shows we have padding on the right edge of the buffer, we must copy it out to another buffer
-		// without padding.
-		if (low_res_info_.stride != stride)
+		// Between detector runs, the tracker predicts where everything has gone.
+		std::scoped_lock<std::mutex> l(lock_);
+		if (frame_count_++ % inference_interval_)
 		{
-			input = allocator_.Allocate(stride * low_res_info_.height);
-			input_ptr = input.get();
-
-			for (unsigned int i = 0; i < low_res_info_.height; i++)
-				memcpy(input_ptr + i * stride, buffer.data() + i * low_res_info_.stride, stride);
+			tracker_.Predict();
+			tracker_.Publish(completed_request->post_process_metadata);
+			return false;
 		}
-		else
-			input_ptr = buffer.data();
 	}
-	else
-	{
-		LOG_ERROR("Unexpected lores format " << low_res_info_.pixel_format);
+
+	BufferReadSync r(app_, completed_request->buffers[low_res_stream_]);
+	libcamera::Span<uint8_t> buffer = r.Get()[0];
+	std::shared_ptr<uint8_t> input;
+	uint8_t *input_ptr = LoresInputTensor(buffer, input);
+	if (!input_ptr)
 		return false;
-	}
 
 	std::vector<Rectangle> scaler_crops;
 	auto scaler_crop = completed_request->metadata.get(controls::ScalerCrop);
@@ -203,29 +169,17 @@ bool YoloInference::Process(CompletedRequestPtr &completed_request)
 	}
 
 	std::vector<Detection> objects = runInference(input_ptr, scaler_crops);
-	if (objects.size())
+	if (temporal_filtering_)
 	{
-		if (temporal_filtering_)
-		{
-			// Process() can be concurrently called through different threads for consecutive CompletedRequests if
-			// things are running behind.  So protect access to the inference state.
-			std::scoped_lock<std::mutex> l(lock_);
-
-			filterOutputObjects(objects);
-			if (lt_objects_.size())
-			{
-				objects.clear();
-				for (auto const &obj : lt_objects_)
-				{
-					if (!obj.hidden)
-						objects.push_back(obj.params);
-				}
-			}
-		}
+		// Process() can be concurrently called through different threads for consecutive CompletedRequests if
+		// things are running behind.  So protect access to the tracker state.
+		std::scoped_lock<std::mutex> l(lock_);
 
-		if (objects.size())
-			completed_request->post_process_metadata.Set("object_detect.results", objects);
+		tracker_.Update(objects);
+		tracker_.Publish(completed_request->post_process_metadata);
 	}
+	else if (objects.size())
+		completed_request->post_process_metadata.Set("object_detect.results", objects);
 
 	return false;
 }
@@ -285,65 +239,6 @@ std::vector<Detection> YoloInference::runInference(const uint8_t *frame, const s
 	return results;
 }
 
-void YoloInference::filterOutputObjects(std::vector<Detection> &objects)
-{
-	const Size isp_output_size = output_stream_->configuration().size;
-
-	for (auto &lt_obj : lt_objects_)
-		lt_obj.matched = false;
-
-	for (auto const &object : objects)
-	{
-		bool matched = false;
-		for (auto &lt_obj : lt_objects_)
-		{
-			// Try and match a detected object in our long term list.
-			if (object.category == lt_obj.params.category &&
-				std::abs(object.box.x - lt_obj.params.box.x) < tolerance_ * isp_output_size.width &&
-				std::abs(object.box.y - lt_obj.params.box.y) < tolerance_ * isp_output_size.height &&
-				std::abs((int)object.box.width - (int)lt_obj.params.box.width) < tolerance_ * isp_output_size.width &&
-				std::abs((int)object.box.height - (int)lt_obj.params.box.height) < tolerance_ * isp_output_size.height)
-			{
-				lt_obj.matched = matched = true;
-				lt_obj.params.confidence = object.confidence;
-				lt_obj.params.box.x = factor_ * object.box.x + (1 - factor_) * lt_obj.params.box.x;
-				lt_obj.params.box.y = factor_ * object.box.y + (1 - factor_) * lt_obj.params.box.y;
-				lt_obj.params.box.width = factor_ * object.box.width + (1 - factor_) * lt_obj.params.box.width;
-				lt_obj.params.box.height = factor_ * object.box.height + (1 - factor_) * lt_obj.params.box.height;
-				// Reset the visibility counter for when the object next disappears.
-				lt_obj.visible = visible_frames_;
-				// Decrement the hidden counter until the object becomes visible in the list.
-				lt_obj.hidden = std::max(0, (int)lt_obj.hidden - 1);
-				break;
-			}
-		}
-
-		// Add the object to the long term list if not found.  This object will remain hidden for hidden_frames_
-		// consecutive frames.
-		if (!matched)
-			lt_objects_.push_back({ object, visible_frames_, hidden_frames_, 1 });
-	}
-
-	for (auto &lt_obj : lt_objects_)
-	{
-		if (!lt_obj.matched)
-		{
-			// If a non matched object in the long term list is still hidden, set visible count to 0 so that it must be
-			// matched for hidden_frames_ consecutive frames before becoming visible. Otherwise, decrement the visible
-			// count of unmatched objects in the long term list.
-			if (lt_obj.hidden)
-				lt_obj.visible = 0;
-			else
-				lt_obj.visible--;
-		}
-	}
-
-	// Remove now invisible objects from the long term list.
-	lt_objects_.erase(std::remove_if(lt_objects_.begin(), lt_objects_.end(),
-									 [](const LtObject &obj) { return !obj.matched && !obj.visible; }),
-					  lt_objects_.end());
-}
-
 static PostProcessingStage *Create(RPiCamApp *app)
 {
 	return new YoloInference(app);
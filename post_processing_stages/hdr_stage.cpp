@@ -144,7 +144,7 @@ void HdrImage::Accumulate(uint8_t const *src, int stride)
 // Forward pass of the IIR low pass filter.
 
 static void forward_pass(std::vector<double> &fwd_pixels, std::vector<double> &fwd_weight_sums, HdrImage const &in,
-						 std::vector<double> &weights, std::vector<double> &threshold, int width, int height, int size,
+						 std::vector<double> &weights, std::vector<double> &scales, int width, int height, int size,
 						 double strength)
 
 {
@@ -155,7 +155,7 @@ static void forward_pass(std::vector<double> &fwd_pixels, std::vector<double> &f
 		for (int x = size; x < width; x++, off++)
 		{
 			int pixel = in.P(off);
-			double scale = 10 / threshold[pixel];
+			double scale = scales[pixel];
 			double pixel_wt_sum = pixel * strength, wt_sum = strength;
 
 			// Compiler generates faster code from this:
@@ -189,8 +189,10 @@ static void forward_pass(std::vector<double> &fwd_pixels, std::vector<double> &f
 
 HdrImage HdrImage::LpFilter(LpFilterConfig const &config) const
 {
-	// Cache threshold values, computing them would be slow.
-	std::vector<double> threshold = config.threshold.GenerateLut<double>();
+	// Cache the scale factors that come from the threshold values, computing them would be slow.
+	std::vector<double> scales = config.threshold.GenerateLut<double>();
+	for (auto &scale : scales)
+		scale = 10 / scale;
 
 	// Cache values of e^(-x^2) for 0 <= x <= 3, it will be much quicker
 	std::vector<double> weights(31);
@@ -209,7 +211,7 @@ HdrImage HdrImage::LpFilter(LpFilterConfig const &config) const
 
 	// Run the forward pass in other thread, so that the two passes run in parallel.
 	std::thread fwd_pass(forward_pass, std::ref(fwd_pixels), std::ref(fwd_weight_sums), std::ref(*this),
-						 std::ref(weights), std::ref(threshold), width, height, size, strength);
+						 std::ref(weights), std::ref(scales), width, height, size, strength);
 
 	// Reverse pass, but otherwise the same as the forward pass. There could be a small
 	// saving in omitting it, but it's not huge given that they run in parallel.
@@ -222,7 +224,7 @@ HdrImage HdrImage::LpFilter(LpFilterConfig const &config) const
 		for (int x = width - 1 - size; x >= 0; x--, off--)
 		{
 			int pixel = P(off);
-			double scale = 10 / threshold[pixel];
+			double scale = scales[pixel];
 			double pixel_wt_sum = pixel * strength, wt_sum = strength;
 
 			// Compiler generates faster code from this:
@@ -302,10 +304,12 @@ void HdrImage::Tonemap(HdrImage const &lp, HdrConfig const &config)
 {
 	Pwl tonemap = CreateTonemap(config.global_tonemap);
 
-	// Make LUTs for the all the Pwls, it'll be much quicker.
-	std::vector<int> tonemap_lut = tonemap.GenerateLut<int>();
-	std::vector<double> pos_strength_lut = config.local_tonemap.pos_strength.GenerateLut<double>();
-	std::vector<double> neg_strength_lut = config.local_tonemap.neg_strength.GenerateLut<double>();
+	// Make fixed point LUTs for the all the Pwls, it'll be much quicker. The strengths are applied to
+	// the high pass detail with STRENGTH_BITS of fraction.
+	constexpr unsigned int STRENGTH_BITS = 12;
+	PwlLut<int32_t> tonemap_lut(tonemap);
+	PwlLut<int32_t> pos_strength_lut(config.local_tonemap.pos_strength, STRENGTH_BITS);
+	PwlLut<int32_t> neg_strength_lut(config.local_tonemap.neg_strength, STRENGTH_BITS);
 	double colour_scale = config.local_tonemap.colour_scale;
 
 	int maxval = dynamic_range - 1;
@@ -318,8 +322,9 @@ void HdrImage::Tonemap(HdrImage const &lp, HdrConfig const &config)
 		{
 			int Y_lp_orig = lp.P(off_Y), Y_hp = P(off_Y) - Y_lp_orig;
 			int Y_lp_mapped = tonemap_lut[Y_lp_orig];
-			double strength = (Y_hp > 0 ? pos_strength_lut : neg_strength_lut)[Y_lp_orig];
-			int Y_final = std::clamp(Y_lp_mapped + (int)(strength * Y_hp), 0, maxval);
+			int strength = (Y_hp > 0 ? pos_strength_lut : neg_strength_lut)[Y_lp_orig];
+			int Y_detail = (strength * Y_hp + (1 << (STRENGTH_BITS - 1))) >> STRENGTH_BITS;
+			int Y_final = std::clamp(Y_lp_mapped + Y_detail, 0, maxval);
 			P(off_Y) = Y_final;
 			if (!(x & 1) && !(y & 1))
 			{
@@ -0,0 +1,61 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * Copyright (C) 2025, Raspberry Pi Ltd
+ *
+ * image_stats.hpp - Statistics published by the image_stats stage.
+ */
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+// The image_stats stage adds one of these to the post-processing metadata as "image_stats". Values
+// are in the 0 to 255 range of the image's own YUV420 samples.
+struct ImageStats
+{
+	struct Zone
+	{
+		float y, u, v; // means
+		float bright; // fraction of the zone's pixels at or above the bright threshold
+		float dark; // fraction at or below the dark threshold
+	};
+
+	unsigned int zones_x;
+	unsigned int zones_y;
+	std::array<uint32_t, 256> histogram; // of Y, over every sampled pixel of the image
+	std::vector<Zone> zones; // in rows, from the top left
+};
+
+// The stage can also publish the statistics on a Unix SOCK_SEQPACKET socket. Each subscriber is sent
+// one message per frame: an ImageStatsHeader, then histogram_bins uint32_t histogram counts, and then
+// zones_x * zones_y ImageStatsZones. Subscribers that fall behind just miss frames.
+
+constexpr uint32_t IMAGE_STATS_MAGIC = 0x54415453; // "STAT"
+constexpr uint16_t IMAGE_STATS_VERSION = 1;
+
+struct ImageStatsHeader
+{
+	uint32_t magic;
+	uint16_t version;
+	uint16_t header_size;
+	uint64_t sequence;
+	int64_t timestamp_ns;
+	uint32_t width; // of the image the statistics came from
+	uint32_t height;
+	uint16_t zones_x;
+	uint16_t zones_y;
+	uint16_t histogram_bins;
+	uint16_t reserved;
+};
+
+// Means in 8.8 fixed point, and the bright and dark fractions scaled to 65535.
+struct ImageStatsZone
+{
+	uint16_t y;
+	uint16_t u;
+	uint16_t v;
+	uint16_t bright;
+	uint16_t dark;
+};
@@ -0,0 +1,316 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * Copyright (C) 2025, Raspberry Pi Ltd
+ *
+ * image_stats_stage.cpp - luma histogram and per-zone statistics for external exposure control
+ */
+
+// This stage measures each frame of a YUV420 stream, normally the lores one, so that exposure and
+// white balance can be controlled by something outside rpicam-apps without having to decode the
+// video. It finds
+//
+// - a 256 bin histogram of Y,
+// - the mean Y, U and V of each of a grid of zones,
+// - and the fraction of each zone's pixels that are bright (at or above "bright") or dark (at or
+//   below "dark"), which shows where the image is clipping.
+//
+// The statistics go in the post-processing metadata as "image_stats" (see image_stats.hpp), and can
+// also be sent to any number of local subscribers on a Unix socket.
+//
+// Only every vskip'th row is looked at, and the histogram only uses every hskip'th pixel of those
+// rows. The zone sums run over whole rows, as loops like that vectorise well, so with the default
+// settings a 640x480 lores image takes only a small fraction of a millisecond.
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+#include <libcamera/control_ids.h>
+#include <libcamera/formats.h>
+#include <libcamera/stream.h>
+
+#include "core/rpicam_app.hpp"
+
+#include "post_processing_stages/image_stats.hpp"
+#include "post_processing_stages/post_processing_stage.hpp"
+
+using Stream = libcamera::Stream;
+
+class ImageStatsStage : public PostProcessingStage
+{
+public:
+	ImageStatsStage(RPiCamApp *app) : PostProcessingStage(app) {}
+	~ImageStatsStage();
+
+	char const *Name() const override;
+
+	void Read(boost::property_tree::ptree const &params) override;
+
+	void Configure() override;
+
+	bool Process(CompletedRequestPtr &completed_request) override;
+
+private:
+	void publish(CompletedRequest const &completed_request, ImageStats const &stats);
+
+	std::string stream_name_;
+	unsigned int zones_x_;
+	unsigned int zones_y_;
+	unsigned int hskip_;
+	unsigned int vskip_;
+	uint8_t bright_;
+	uint8_t dark_;
+	std::string socket_path_;
+
+	Stream *stream_ = nullptr;
+	StreamInfo info_;
+	// Zone boundaries in the Y plane, always even so that they fall on chroma samples too.
+	std::vector<unsigned int> x_edges_;
+	std::vector<unsigned int> y_edges_;
+
+	int listen_fd_ = -1;
+	std::mutex mutex_; // for the subscribers and message buffer
+	std::vector<int> subscribers_;
+	std::vector<uint8_t> message_;
+};
+
+#define NAME "image_stats"
+
+char const *ImageStatsStage::Name() const
+{
+	return NAME;
+}
+
+ImageStatsStage::~ImageStatsStage()
+{
+	for (int fd : subscribers_)
+		close(fd);
+	if (listen_fd_ >= 0)
+	{
+		close(listen_fd_);
+		unlink(socket_path_.c_str());
+	}
+}
+
+void ImageStatsStage::Read(boost::property_tree::ptree const &params)
+{
+	stream_name_ = params.get<std::string>("stream", "lores");
+	zones_x_ = std::clamp(params.get<unsigned int>("zones_x", 16), 1u, 256u);
+	zones_y_ = std::clamp(params.get<unsigned int>("zones_y", 12), 1u, 256u);
+	hskip_ = std::max(params.get<unsigned int>("hskip", 2), 1u);
+	vskip_ = std::max(params.get<unsigned int>("vskip", 2), 1u);
+	bright_ = std::min(params.get<unsigned int>("bright", 250), 255u);
+	dark_ = std::min(params.get<unsigned int>("dark", 5), 255u);
+	socket_path_ = params.get<std::string>("socket", "");
+
+	if (socket_path_.empty())
+		return;
+
+	// As with frame_export, the socket outlives camera restarts so subscribers stay connected.
+	sockaddr_un addr = {};
+	addr.sun_family = AF_UNIX;
+	if (socket_path_.size() >= sizeof(addr.sun_path))
+		throw std::runtime_error("ImageStatsStage: socket path too long: " + socket_path_);
+	strcpy(addr.sun_path, socket_path_.c_str());
+	unlink(socket_path_.c_str());
+
+	listen_fd_ = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (listen_fd_ < 0)
+		throw std::runtime_error("ImageStatsStage: failed to create socket");
+	if (bind(listen_fd_, (sockaddr *)&addr, sizeof(addr)) < 0 || listen(listen_fd_, 8) < 0)
+		throw std::runtime_error("ImageStatsStage: failed to listen on " + socket_path_ + ": " + strerror(errno));
+
+	LOG(1, "ImageStatsStage: publishing statistics on " << socket_path_);
+}
+
+void ImageStatsStage::Configure()
+{
+	stream_ = app_->GetStream(stream_name_, &info_);
+	if (!stream_)
+	{
+		LOG(1, "ImageStatsStage: no \"" << stream_name_ << "\" stream, using the main stream instead");
+		stream_ = app_->GetMainStream();
+		if (!stream_)
+			return;
+		info_ = app_->GetStreamInfo(stream_);
+	}
+	if (stream_->configuration().pixelFormat != libcamera::formats::YUV420)
+		throw std::runtime_error("ImageStatsStage: only YUV420 format supported");
+
+	unsigned int zones_x = std::min(zones_x_, info_.width / 2), zones_y = std::min(zones_y_, info_.height / 2);
+	x_edges_.resize(zones_x + 1);
+	y_edges_.resize(zones_y + 1);
+	for (unsigned int i = 0; i <= zones_x; i++)
+		x_edges_[i] = (i * info_.width / zones_x) & ~1;
+	for (unsigned int i = 0; i <= zones_y; i++)
+		y_edges_[i] = (i * info_.height / zones_y) & ~1;
+}
+
+// These loops are written so that the compiler can vectorise them.
+static void sum_luma(uint8_t const *__restrict pixels, unsigned int count, uint8_t bright, uint8_t dark, uint32_t &sum,
+					 uint32_t &bright_count, uint32_t &dark_count)
+{
+	uint32_t s = 0, b = 0, d = 0;
+	for (unsigned int i = 0; i < count; i++)
+	{
+		s += pixels[i];
+		b += pixels[i] >= bright;
+		d += pixels[i] <= dark;
+	}
+	sum += s, bright_count += b, dark_count += d;
+}
+
+static uint32_t sum_chroma(uint8_t const *__restrict pixels, unsigned int count)
+{
+	uint32_t s = 0;
+	for (unsigned int i = 0; i < count; i++)
+		s += pixels[i];
+	return s;
+}
+
+bool ImageStatsStage::Process(CompletedRequestPtr &completed_request)
+{
+	if (!stream_)
+		return false;
+
+	struct Sums
+	{
+		uint32_t y, u, v;
+		uint32_t bright, dark;
+		uint32_t count, uv_count;
+	};
+	unsigned int zones_x = x_edges_.size() - 1, zones_y = y_edges_.size() - 1;
+	std::vector<Sums> sums(zones_x * zones_y, Sums {});
+	// Several histograms, filled in turn, stop consecutive pixels of the same value waiting on each
+	// other's increments.
+	uint32_t histograms[4][256] = {};
+
+	{
+		BufferReadSync r(app_, completed_request->buffers[stream_]);
+		uint8_t const *y_plane = r.Get()[0].data();
+		unsigned int uv_stride = info_.stride / 2;
+		uint8_t const *u_plane = y_plane + info_.stride * info_.height;
+		uint8_t const *v_plane = u_plane + uv_stride * (info_.height / 2);
+
+		for (unsigned int zy = 0; zy < zones_y; zy++)
+		{
+			Sums *zone_sums = &sums[zy * zones_x];
+			for (unsigned int y = y_edges_[zy]; y < y_edges_[zy + 1]; y += vskip_)
+			{
+				uint8_t const *row = y_plane + y * info_.stride;
+				for (unsigned int zx = 0; zx < zones_x; zx++)
+				{
+					Sums &s = zone_sums[zx];
+					unsigned int count = x_edges_[zx + 1] - x_edges_[zx];
+					sum_luma(row + x_edges_[zx], count, bright_, dark_, s.y, s.bright, s.dark);
+					s.count += count;
+				}
+
+				unsigned int i = 0;
+				for (unsigned int x = 0; x < info_.width; x += hskip_, i++)
+					histograms[i & 3][row[x]]++;
+			}
+
+			// The chroma rows of the zone, with the same subsampling.
+			for (unsigned int y = y_edges_[zy] / 2; y < y_edges_[zy + 1] / 2; y += vskip_)
+			{
+				for (unsigned int zx = 0; zx < zones_x; zx++)
+				{
+					Sums &s = zone_sums[zx];
+					unsigned int offset = y * uv_stride + x_edges_[zx] / 2;
+					unsigned int count = (x_edges_[zx + 1] - x_edges_[zx]) / 2;
+					s.u += sum_chroma(u_plane + offset, count);
+					s.v += sum_chroma(v_plane + offset, count);
+					s.uv_count += count;
+				}
+			}
+		}
+	}
+
+	ImageStats stats;
+	stats.zones_x = zones_x;
+	stats.zones_y = zones_y;
+	for (unsigned int i = 0; i < 256; i++)
+		stats.histogram[i] = histograms[0][i] + histograms[1][i] + histograms[2][i] + histograms[3][i];
+	stats.zones.resize(sums.size());
+	for (unsigned int i = 0; i < sums.size(); i++)
+	{
+		Sums const &s = sums[i];
+		float count = std::max<uint32_t>(s.count, 1), uv_count = std::max<uint32_t>(s.uv_count, 1);
+		stats.zones[i] = { s.y / count, s.u / uv_count, s.v / uv_count, s.bright / count, s.dark / count };
+	}
+
+	if (listen_fd_ >= 0)
+		publish(*completed_request, stats);
+
+	completed_request->post_process_metadata.Set("image_stats", std::move(stats));
+
+	return false;
+}
+
+void ImageStatsStage::publish(CompletedRequest const &completed_request, ImageStats const &stats)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	// Pick up anyone who has connected since the last frame.
+	int fd;
+	while ((fd = accept4(listen_fd_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
+	{
+		subscribers_.push_back(fd);
+		LOG(1, "ImageStatsStage: subscriber connected (" << subscribers_.size() << " total)");
+	}
+	if (subscribers_.empty())
+		return;
+
+	ImageStatsHeader header = {};
+	header.magic = IMAGE_STATS_MAGIC;
+	header.version = IMAGE_STATS_VERSION;
+	header.header_size = sizeof(header);
+	header.sequence = completed_request.sequence;
+	header.timestamp_ns = completed_request.metadata.get(libcamera::controls::SensorTimestamp).value_or(0);
+	header.width = info_.width;
+	header.height = info_.height;
+	header.zones_x = stats.zones_x;
+	header.zones_y = stats.zones_y;
+	header.histogram_bins = stats.histogram.size();
+
+	message_.resize(sizeof(header) + sizeof(stats.histogram) + stats.zones.size() * sizeof(ImageStatsZone));
+	uint8_t *dest = message_.data();
+	memcpy(dest, &header, sizeof(header));
+	dest += sizeof(header);
+	memcpy(dest, stats.histogram.data(), sizeof(stats.histogram));
+	dest += sizeof(stats.histogram);
+	auto fixed = [](float value, float scale) { return (uint16_t)std::min<float>(value * scale + 0.5, 65535); };
+	for (auto const &zone : stats.zones)
+	{
+		ImageStatsZone z = { fixed(zone.y, 256), fixed(zone.u, 256), fixed(zone.v, 256), fixed(zone.bright, 65535),
+							 fixed(zone.dark, 65535) };
+		memcpy(dest, &z, sizeof(z));
+		dest += sizeof(z);
+	}
+
+	// A full socket means the subscriber is behind and misses this frame. Anything else means it's gone.
+	for (int &fd : subscribers_)
+	{
+		if (send(fd, message_.data(), message_.size(), MSG_DONTWAIT | MSG_NOSIGNAL) < 0 && errno != EAGAIN &&
+			errno != EWOULDBLOCK)
+		{
+			close(fd);
+			fd = -1;
+			LOG(1, "ImageStatsStage: subscriber disconnected");
+		}
+	}
+	subscribers_.erase(std::remove(subscribers_.begin(), subscribers_.end(), -1), subscribers_.end());
+}
+
+static PostProcessingStage *Create(RPiCamApp *app)
+{
+	return new ImageStatsStage(app);
+}
+
+static RegisterStage reg(NAME, &Create);
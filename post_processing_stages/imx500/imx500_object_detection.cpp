@@ -16,6 +16,7 @@
 
 #include "core/rpicam_app.hpp"
 #include "post_processing_stages/object_detect.hpp"
+#include "post_processing_stages/object_tracker.hpp"
 #include "post_processing_stages/post_processing_stage.hpp"
 
 #include "imx500_post_processing_stage.hpp"
@@ -58,17 +59,10 @@ public:
 private:
 	int processOutputTensor(std::vector<Detection> &objects, const std::vector<float> &output_tensor,
 							const CnnOutputTensorInfo &output_tensor_info, const Rectangle &scaler_crop) const;
-	void filterOutputObjects(std::vector<Detection> &objects);
 
-	struct LtObject
-	{
-		Detection params;
-		unsigned int visible;
-		unsigned int hidden;
-		bool matched;
-	};
-
-	std::vector<LtObject> lt_objects_;
+	ObjectTracker tracker_;
+	// Without temporal filtering, the last results are repeated on frames that have no output tensor.
+	std::vector<Detection> last_objects_;
 	std::mutex lt_lock_;
 
 	// Config params
@@ -76,10 +70,6 @@ private:
 	float threshold_;
 	std::vector<std::string> classes_;
 	bool temporal_filtering_;
-	float tolerance_;
-	float factor_;
-	unsigned int visible_frames_;
-	unsigned int hidden_frames_;
 	bool started_ = false;
 };
 
@@ -94,24 +84,19 @@ void ObjectDetection::Read(boost::property_tree::ptree const &params)
 	threshold_ = params.get<float>("threshold", 0.5f);
 	classes_ = PostProcessingStage::GetJsonArray<std::string>(params, "classes");
 
-	if (params.find("temporal_filter") != params.not_found())
-	{
-		temporal_filtering_ = true;
-		tolerance_ = params.get<float>("temporal_filter.tolerance", 0.05);
-		factor_ = params.get<float>("temporal_filter.factor", 0.2);
-		visible_frames_ = params.get<unsigned int>("temporal_filter.visible_frames", 5);
-		hidden_frames_ = params.get<unsigned int>("temporal_filter.hidden_frames", 2);
-	}
-	else
-		temporal_filtering_ = false;
+	ObjectTracker::Config &config = tracker_.GetConfig();
+	config.visible_frames = 5;
+	config.show_first = true;
+	temporal_filtering_ = tracker_.Read(params);
 
 	IMX500PostProcessingStage::Read(params);
 }
 
 void ObjectDetection::Configure()
 {
-	lt_objects_.clear();
 	IMX500PostProcessingStage::Configure();
+	tracker_.Configure(output_stream_->configuration().size);
+	last_objects_.clear();
 	if (!started_)
 	{
 		IMX500PostProcessingStage::ShowFwProgressBar();
@@ -133,7 +118,7 @@ bool ObjectDetection::Process(CompletedRequestPtr &completed_request)
 	std::vector<Detection> objects;
 
 	// Process() can be concurrently called through different threads for consecutive CompletedRequests if
-	// things are running behind.  So protect access to the lt_objects_ state object.
+	// things are running behind.  So protect access to the tracker state.
 	std::scoped_lock<std::mutex> l(lt_lock_);
 
 	if (output && info)
@@ -144,39 +129,20 @@ bool ObjectDetection::Process(CompletedRequestPtr &completed_request)
 		processOutputTensor(objects, output_tensor, output_tensor_info, *scaler_crop);
 
 		if (temporal_filtering_)
-		{
-			filterOutputObjects(objects);
-			if (lt_objects_.size())
-			{
-				objects.clear();
-				for (auto const &obj : lt_objects_)
-				{
-					if (!obj.hidden)
-						objects.push_back(obj.params);
-				}
-			}
-		}
+			tracker_.Update(objects);
 		else
-		{
-			// If no temporal filtering, make sure we fill lt_objects_ with the current result as it may be used if
-			// there is no output tensor on subsequent frames.
-			lt_objects_.clear();
-			for (auto const &obj : objects)
-				lt_objects_.push_back({ obj, 0, 0, 0 });
-		}
+			last_objects_ = objects;
 	}
-	else
+	else if (temporal_filtering_)
 	{
-		// No output tensor, so simply reuse the results from the lt_objects_.
-		for (auto const &obj : lt_objects_)
-		{
-			if (!obj.hidden)
-				objects.push_back(obj.params);
-		}
+		// No output tensor, so the tracker predicts where the objects have gone.
+		tracker_.Predict();
 	}
 
-	if (objects.size())
-		completed_request->post_process_metadata.Set("object_detect.results", objects);
+	if (temporal_filtering_)
+		tracker_.Publish(completed_request->post_process_metadata);
+	else if (last_objects_.size())
+		completed_request->post_process_metadata.Set("object_detect.results", last_objects_);
 
 	return IMX500PostProcessingStage::Process(completed_request);
 }
@@ -277,69 +243,6 @@ int ObjectDetection::processOutputTensor(std::vector<Detection> &objects, const
 	return 0;
 }
 
-void ObjectDetection::filterOutputObjects(std::vector<Detection> &objects)
-{
-	const Size isp_output_size = output_stream_->configuration().size;
-	bool empty = lt_objects_.empty();
-
-	for (auto &lt_obj : lt_objects_)
-		lt_obj.matched = false;
-
-	for (auto const &object : objects)
-	{
-		bool matched = false;
-		for (auto &lt_obj : lt_objects_)
-		{
-			// Try and match a detected object in our long term list.
-			if (object.category == lt_obj.params.category &&
-				std::abs(object.box.x - lt_obj.params.box.x) < tolerance_ * isp_output_size.width &&
-				std::abs(object.box.y - lt_obj.params.box.y) < tolerance_ * isp_output_size.height &&
-				std::abs((int)object.box.width - (int)lt_obj.params.box.width) < tolerance_ * isp_output_size.width &&
-				std::abs((int)object.box.height - (int)lt_obj.params.box.height) < tolerance_ * isp_output_size.height)
-			{
-				lt_obj.matched = matched = true;
-				lt_obj.params.confidence = object.confidence;
-				lt_obj.params.box.x = factor_ * object.box.x + (1 - factor_) * lt_obj.params.box.x;
-				lt_obj.params.box.y = factor_ * object.box.y + (1 - factor_) * lt_obj.params.box.y;
-				lt_obj.params.box.width = factor_ * object.box.width + (1 - factor_) * lt_obj.params.box.width;
-				lt_obj.params.box.height = factor_ * object.box.height + (1 - factor_) * lt_obj.params.box.height;
-				// Reset the visibility counter for when the object next disappears.
-				lt_obj.visible = visible_frames_;
-				// Decrement the hidden counter until the object becomes visible in the list.
-				lt_obj.hidden = std::max(0, (int)lt_obj.hidden - 1);
-				break;
-			}
-		}
-
-		// Add the object to the long term list if not found.  This object will remain hidden for hidden_frames_
-		// consecutive frames unless the long term list started out empty.
-		if (!matched)
-		{
-			const unsigned int hidden_frames = empty ? 0 : hidden_frames_;
-			lt_objects_.push_back({ object, visible_frames_, hidden_frames, 1 });
-		}
-	}
-
-	for (auto &lt_obj : lt_objects_)
-	{
-		if (!lt_obj.matched)
-		{
-			// If a non matched object in the long term list is still hidden, set visible count to 0 so that it must be
-			// matched for hidden_frames_ consecutive frames before becoming visible. Otherwise, decrement the visible
-			// count of unmatched objects in the long term list.
-			if (lt_obj.hidden)
-				lt_obj.visible = 0;
-			else
-				lt_obj.visible--;
-		}
-	}
-
-	// Remove now invisible objects from the long term list.
-	lt_objects_.erase(std::remove_if(lt_objects_.begin(), lt_objects_.end(),
-						[] (const LtObject &obj) { return !obj.matched && !obj.visible; }),
-					  lt_objects_.end());
-}
-
 static PostProcessingStage *Create(RPiCamApp *app)
 {
 	return new ObjectDetection(app);
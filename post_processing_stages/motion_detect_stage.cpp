@@ -20,6 +20,8 @@
 // the application can take that as true immediately. To be sure there's no motion,
 // an application should probably wait for "a few frames" of "no motion".
 
+#include <optional>
+
 #include <libcamera/stream.h>
 
 #include "core/rpicam_app.hpp"
@@ -56,6 +58,7 @@ private:
 		std::string region_name;
 	} config_;
 	Stream *stream_;
+	unsigned int lores_width_, lores_height_;
 	unsigned lores_stride_;
 	// Here we convert the dimensions to pixel locations in the lores image, as if subsampled
 	// by hskip and vskip.
@@ -98,6 +101,10 @@ void MotionDetectStage::Configure()
 	if (!stream_)
 		return;
 
+	// For finding a luma-only copy of the lores image that another stage may have made.
+	lores_width_ = info.width;
+	lores_height_ = info.height;
+
 	config_.hskip = std::max(config_.hskip, 1);
 	config_.vskip = std::max(config_.vskip, 1);
 	info.width /= config_.hskip;
@@ -135,9 +142,17 @@ bool MotionDetectStage::Process(CompletedRequestPtr &completed_request)
 	if (config_.frame_period && completed_request->sequence % config_.frame_period)
 		return false;
 
-	BufferReadSync r(app_, completed_request->buffers[stream_]);
-	libcamera::Span<uint8_t> buffer = r.Get()[0];
-	uint8_t *image = buffer.data();
+	// We only look at a few of the pixels, so it's not worth making a copy of the image, but if another
+	// stage has already made one, it's quicker to read.
+	PreprocessedImagePtr lores = completed_request->preprocess_cache.Find(
+		{ stream_, lores_width_, lores_height_, PreprocessKey::Format::Y });
+	std::optional<BufferReadSync> read_sync;
+	uint8_t const *image;
+	unsigned int stride;
+	if (lores)
+		image = lores->Data(), stride = lores->stride * config_.vskip;
+	else
+		image = read_sync.emplace(app_, completed_request->buffers[stream_]).Get()[0].data(), stride = lores_stride_;
 
 	// We need to protect access to first_time_, previous_frame_ and motion_detected_.
 	std::lock_guard<std::mutex> lock(mutex_);
@@ -147,7 +162,7 @@ bool MotionDetectStage::Process(CompletedRequestPtr &completed_request)
 		first_time_ = false;
 		for (unsigned int y = 0; y < roi_height_; y++)
 		{
-			uint8_t *new_value_ptr = image + (roi_y_ + y) * lores_stride_ + roi_x_ * config_.hskip;
+			uint8_t const *new_value_ptr = image + (roi_y_ + y) * stride + roi_x_ * config_.hskip;
 			uint8_t *old_value_ptr = &previous_frame_[0] + y * roi_width_;
 			for (unsigned int x = 0; x < roi_width_; x++, new_value_ptr += config_.hskip)
 				*(old_value_ptr++) = *new_value_ptr;
@@ -165,7 +180,7 @@ bool MotionDetectStage::Process(CompletedRequestPtr &completed_request)
 	// exceeds the threshold. At the same time, update the previous image buffer.
 	for (unsigned int y = 0; y < roi_height_; y++)
 	{
-		uint8_t *new_value_ptr = image + (roi_y_ + y) * lores_stride_ + roi_x_ * config_.hskip;
+		uint8_t const *new_value_ptr = image + (roi_y_ + y) * stride + roi_x_ * config_.hskip;
 		uint8_t *old_value_ptr = &previous_frame_[0] + y * roi_width_;
 		for (unsigned int x = 0; x < roi_width_; x++, new_value_ptr += config_.hskip)
 		{
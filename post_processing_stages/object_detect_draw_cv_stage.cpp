@@ -12,6 +12,7 @@
 #include "post_processing_stages/post_processing_stage.hpp"
 
 #include "object_detect.hpp"
+#include "overlay.hpp"
 
 using namespace cv;
 
@@ -35,6 +36,8 @@ private:
 	Stream *stream_;
 	int line_thickness_;
 	double font_size_;
+	bool overlay_;
+	bool draw_faces_;
 };
 
 #define NAME "object_detect_draw_cv"
@@ -53,6 +56,9 @@ void ObjectDetectDrawCvStage::Read(boost::property_tree::ptree const &params)
 {
 	line_thickness_ = params.get<int>("line_thickness", 1);
 	font_size_ = params.get<double>("font_size", 1.0);
+	overlay_ = params.get<int>("overlay", 0);
+	// face_detect_cv draws its own faces unless its draw_features is turned off.
+	draw_faces_ = params.get<int>("draw_faces", 0);
 }
 
 bool ObjectDetectDrawCvStage::Process(CompletedRequestPtr &completed_request)
@@ -60,15 +66,38 @@ bool ObjectDetectDrawCvStage::Process(CompletedRequestPtr &completed_request)
 	if (!stream_)
 		return false;
 
+	std::vector<Detection> detections;
+
+	completed_request->post_process_metadata.Get("object_detect.results", detections);
+
+	// Faces from face_detect_cv have no labels.
+	std::vector<Rectange> faces;
+	if (draw_faces_)
+		completed_request->post_process_metadata.Get("detected_faces", faces);
+
+	// Leave the drawing to the overlay_cv stage.
+	if (overlay_)
+	{
+		std::vector<OverlayPrimitive> primitives;
+		for (auto &detection : detections)
+		{
+			std::stringstream text_stream;
+			text_stream << detection.name << " " << (int)(detection.confidence * 100) << "%";
+			primitives.push_back(OverlayPrimitive::Box(detection.box, 0xffffff, line_thickness_));
+			primitives.push_back(OverlayPrimitive::Text({ detection.box.x + 5, detection.box.y + 5 }, text_stream.str(),
+														0xffffff, font_size_, 2));
+		}
+		for (auto &face : faces)
+			primitives.push_back(OverlayPrimitive::Box(face, 0xffffff, line_thickness_));
+		AddOverlay(completed_request->post_process_metadata, primitives);
+		return false;
+	}
+
 	BufferWriteSync w(app_, completed_request->buffers[stream_]);
 	libcamera::Span<uint8_t> buffer = w.Get()[0];
 	uint32_t *ptr = (uint32_t *)buffer.data();
 	StreamInfo info = app_->GetStreamInfo(stream_);
 
-	std::vector<Detection> detections;
-
-	completed_request->post_process_metadata.Get("object_detect.results", detections);
-
 	Mat image(info.height, info.width, CV_8U, ptr, info.stride);
 	Scalar colour = Scalar(255, 255, 255);
 	int font = FONT_HERSHEY_SIMPLEX;
@@ -86,6 +115,9 @@ bool ObjectDetectDrawCvStage::Process(CompletedRequestPtr &completed_request)
 		putText(image, text, text_origin, font, font_size_, colour, 2);
 	}
 
+	for (auto &face : faces)
+		rectangle(image, Rect(face.x, face.y, face.width, face.height), colour, line_thickness_);
+
 	return false;
 }
 
@@ -95,6 +95,7 @@ void ObjectDetectTfStage::checkConfiguration()
 void ObjectDetectTfStage::applyResults(CompletedRequestPtr &completed_request)
 {
 	completed_request->post_process_metadata.Set("object_detect.results", output_results_);
+	completed_request->post_process_metadata.Set("object_detect.sequence", results_sequence_);
 }
 
 static unsigned int area(const Rectangle &r)
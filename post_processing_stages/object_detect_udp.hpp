@@ -0,0 +1,47 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * Copyright (C) 2025, Raspberry Pi Ltd
+ *
+ * object_detect_udp.hpp - Wire format used by the object_detect_udp stage.
+ */
+
+#pragma once
+
+#include <cstdint>
+
+// Every frame gets one datagram, even when nothing was detected, holding an ObjectDetectUdpHeader
+// and then count detections, each packed (all little-endian) as:
+//
+//     int32_t x, y, width, height;  // in the coordinates of a width x height image
+//     float confidence;
+//     uint8_t name_length;
+//     char name[name_length];       // not null terminated
+//
+// Frames with too many detections for one datagram are split into fragments numbered 0 to
+// fragments - 1, all with the same sequence number. The detections of each fragment follow on from
+// those in the fragment before, up to total_count of them altogether.
+//
+// Version 1 of the protocol was one datagram per detection, with no header at all (see
+// utils/udp_object_detection.py). Setting "protocol" : 1 still sends that.
+
+constexpr uint32_t OBJECT_DETECT_UDP_MAGIC = 0x54454452; // "RDET"
+constexpr uint16_t OBJECT_DETECT_UDP_VERSION = 2;
+
+struct ObjectDetectUdpHeader
+{
+	uint32_t magic;
+	uint16_t version;
+	uint16_t header_size;
+	uint32_t sequence; // frame the message is for
+	uint32_t result_sequence; // frame the detector ran on, which can be older
+	int64_t timestamp_ns; // sensor timestamp of the frame
+	uint32_t width;
+	uint32_t height;
+	uint16_t total_count; // detections in the whole frame
+	uint16_t count; // detections in this datagram
+	uint8_t fragment;
+	uint8_t fragments;
+	uint16_t reserved;
+};
+
+constexpr unsigned int OBJECT_DETECT_UDP_DETECTION_SIZE = 4 * sizeof(int32_t) + sizeof(float) + sizeof(uint8_t);
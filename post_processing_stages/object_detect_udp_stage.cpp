@@ -5,54 +5,87 @@
  * object_detect_udp.cpp - sends detection results over UDP socket
  */
 
-#include "core/rpicam_app.hpp"
-
-#include "post_processing_stages/post_processing_stage.hpp"
-
-#include "object_detect.hpp"
+// Each frame's detections go out in a single message (see object_detect_udp.hpp), to a UDP address
+// or, for consumers on the same device, to a Unix datagram socket. The message is built in a buffer
+// that we keep from one frame to the next, and sent with one sendmsg, or one sendmmsg when it has
+// to be split into several datagrams.
 
-#include <array>
-#include <string>
-#include <sys/socket.h>
-#include <netinet/in.h>
 #include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include <unistd.h>
-#include <iostream>
+
+#include <algorithm>
+#include <cstring>
+#include <mutex>
 #include <string>
 #include <vector>
-#include <sstream>
 
+#include <libcamera/control_ids.h>
+
+#include "core/rpicam_app.hpp"
+
+#include "post_processing_stages/object_detect.hpp"
+#include "post_processing_stages/object_detect_udp.hpp"
+#include "post_processing_stages/post_processing_stage.hpp"
 
-using Rectange = libcamera::Rectangle;
 using Stream = libcamera::Stream;
 
 // Define the start delimiter for our binary protocol
 constexpr static uint32_t START_DELIMITER = 0xDDCCBBAA; // little-endian representation of 0xAA, 0xBB, 0xCC, 0xDD
-#define UDP_IP_DEFAULT false
+// Version 1 names always take this many bytes.
+constexpr static unsigned int LEGACY_NAME_LENGTH = 255;
 #define UDP_IP "127.0.0.1"
 #define UDP_PORT 12347
+// Small enough to go in a single Ethernet frame without IP fragmentation.
+#define MAX_PACKET 1400
 
 class ObjectDetectUDPStage : public PostProcessingStage
 {
 public:
-	ObjectDetectUDPStage(RPiCamApp *app) : PostProcessingStage(app), sockfd_(-1) {}
+	ObjectDetectUDPStage(RPiCamApp *app) : PostProcessingStage(app) {}
 
 	char const *Name() const override;
 
 	void Read(boost::property_tree::ptree const &params) override;
 
 	void Configure() override;
-	
+
 	bool Process(CompletedRequestPtr &completed_request) override;
 
 	virtual ~ObjectDetectUDPStage() override;
-	
+
 private:
-	Stream *stream_;
-	std::string udp_broadcast_address = "127.0.0.1";
-	u_int16_t udp_broadcast_port = 12345;
-	int sockfd_;
-	struct sockaddr_in servaddr_;
+	struct Packet
+	{
+		size_t offset;
+		size_t size;
+		unsigned int count;
+	};
+
+	void buildFrame(CompletedRequest &completed_request, std::vector<Detection> const &detections);
+	void buildLegacy(std::vector<Detection> const &detections);
+	void send();
+
+	Stream *stream_ = nullptr;
+	StreamInfo info_;
+	std::string udp_broadcast_address;
+	uint16_t udp_broadcast_port;
+	std::string socket_path_;
+	unsigned int protocol_;
+	unsigned int max_packet_;
+	int sockfd_ = -1;
+	sockaddr_storage addr_ = {};
+	socklen_t addr_len_ = 0;
+	bool send_failed_ = false;
+
+	// Everything below is re-used for every frame, so needs the lock.
+	std::mutex mutex_;
+	std::vector<uint8_t> buffer_;
+	std::vector<Packet> packets_;
+	std::vector<iovec> iovecs_;
+	std::vector<mmsghdr> messages_;
 };
 
 #define NAME "object_detect_udp"
@@ -62,60 +95,186 @@ char const *ObjectDetectUDPStage::Name() const
 	return NAME;
 }
 
-
 ObjectDetectUDPStage::~ObjectDetectUDPStage()
 {
 	if (sockfd_ != -1)
-	{
 		close(sockfd_);
-		std::cerr << "UDP socket closed." << std::endl;
-	}
 }
 
+void ObjectDetectUDPStage::Read(boost::property_tree::ptree const &params)
+{
+	udp_broadcast_address = params.get<std::string>("ip", UDP_IP);
+	udp_broadcast_port = params.get<uint16_t>("port", UDP_PORT);
+	socket_path_ = params.get<std::string>("socket", "");
+	protocol_ = params.get<unsigned int>("protocol", OBJECT_DETECT_UDP_VERSION);
+	if (protocol_ != 1 && protocol_ != OBJECT_DETECT_UDP_VERSION)
+		throw std::runtime_error("ObjectDetectUDPStage: unknown protocol " + std::to_string(protocol_));
+	// Every datagram must have room for at least the header and one detection with the longest name.
+	max_packet_ = std::max<unsigned int>(params.get<unsigned int>("max_packet", MAX_PACKET),
+										 sizeof(ObjectDetectUdpHeader) + OBJECT_DETECT_UDP_DETECTION_SIZE + 255);
+
+	// The socket doesn't depend on the camera configuration, so it stays open across mode switches.
+	if (!socket_path_.empty())
+	{
+		sockaddr_un *addr = (sockaddr_un *)&addr_;
+		addr->sun_family = AF_UNIX;
+		if (socket_path_.size() >= sizeof(addr->sun_path))
+			throw std::runtime_error("ObjectDetectUDPStage: socket path too long: " + socket_path_);
+		strcpy(addr->sun_path, socket_path_.c_str());
+		addr_len_ = sizeof(sockaddr_un);
+	}
+	else
+	{
+		sockaddr_in *addr = (sockaddr_in *)&addr_;
+		addr->sin_family = AF_INET;
+		addr->sin_port = htons(udp_broadcast_port);
+		if (inet_pton(AF_INET, udp_broadcast_address.c_str(), &addr->sin_addr) <= 0)
+			throw std::runtime_error("ObjectDetectUDPStage: invalid address " + udp_broadcast_address);
+		addr_len_ = sizeof(sockaddr_in);
+	}
+
+	sockfd_ = socket(addr_.ss_family, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	if (sockfd_ < 0)
+		throw std::runtime_error("ObjectDetectUDPStage: failed to create socket: " + std::string(strerror(errno)));
+
+	if (socket_path_.empty())
+		LOG(1, "ObjectDetectUDPStage: sending to " << udp_broadcast_address << ":" << udp_broadcast_port);
+	else
+		LOG(1, "ObjectDetectUDPStage: sending to " << socket_path_);
+}
 
 void ObjectDetectUDPStage::Configure()
 {
+	// Detections are always in main stream coordinates.
 	stream_ = app_->GetMainStream();
-	
-	// Initialize UDP socket
-	sockfd_ = socket(AF_INET, SOCK_DGRAM, 0);
-	if (sockfd_ < 0)
+	if (stream_)
+		info_ = app_->GetStreamInfo(stream_);
+}
+
+template <typename T>
+static uint8_t *append(uint8_t *dest, T const &value)
+{
+	std::memcpy(dest, &value, sizeof(T));
+	return dest + sizeof(T);
+}
+
+static uint8_t *append_detection(uint8_t *dest, Detection const &detection, bool padded_name)
+{
+	dest = append<int32_t>(dest, detection.box.x);
+	dest = append<int32_t>(dest, detection.box.y);
+	dest = append<int32_t>(dest, detection.box.width);
+	dest = append<int32_t>(dest, detection.box.height);
+	if (padded_name)
 	{
-		perror("UDP socket creation failed");
-		// Handle error, perhaps throw an exception or exit
-		return;
+		// Version 1 always has a length of 255, then the name NUL-padded to that, before the confidence.
+		*dest++ = LEGACY_NAME_LENGTH;
+		size_t name_length = std::min<size_t>(detection.name.size(), LEGACY_NAME_LENGTH - 1);
+		std::memcpy(dest, detection.name.data(), name_length);
+		std::memset(dest + name_length, 0, LEGACY_NAME_LENGTH - name_length);
+		dest += LEGACY_NAME_LENGTH;
+		return append<float>(dest, detection.confidence);
 	}
 
-	memset(&servaddr_, 0, sizeof(servaddr_));
+	dest = append<float>(dest, detection.confidence);
+	uint8_t name_length = std::min<size_t>(detection.name.size(), 255);
+	*dest++ = name_length;
+	std::memcpy(dest, detection.name.data(), name_length);
+	return dest + name_length;
+}
 
-	// Filling server information
-	servaddr_.sin_family = AF_INET;
-	servaddr_.sin_port = htons(udp_broadcast_port);
-	if (inet_pton(AF_INET, udp_broadcast_address.c_str(), &servaddr_.sin_addr) <= 0)
+void ObjectDetectUDPStage::buildFrame(CompletedRequest &completed_request, std::vector<Detection> const &detections)
+{
+	// Work out which detections go in which datagram, and so how much space we need.
+	size_t total_size = 0, packet_size = sizeof(ObjectDetectUdpHeader);
+	unsigned int total_count = 0, packet_count = 0;
+	for (auto &detection : detections)
 	{
-		perror("Invalid address/ Address not supported");
-		close(sockfd_);
-		sockfd_ = -1; // Mark as invalid
-		return;
+		size_t size = OBJECT_DETECT_UDP_DETECTION_SIZE + std::min<size_t>(detection.name.size(), 255);
+		if (packet_count && packet_size + size > max_packet_)
+		{
+			// The header can only number 255 fragments, though we should never get close.
+			if (packets_.size() == 254)
+				break;
+			packets_.push_back({ total_size, packet_size, packet_count });
+			total_size += packet_size;
+			packet_size = sizeof(ObjectDetectUdpHeader), packet_count = 0;
+		}
+		if (total_count == UINT16_MAX)
+			break;
+		packet_size += size, packet_count++, total_count++;
+	}
+	packets_.push_back({ total_size, packet_size, packet_count });
+	buffer_.resize(total_size + packet_size);
+
+	ObjectDetectUdpHeader header = {};
+	header.magic = OBJECT_DETECT_UDP_MAGIC;
+	header.version = OBJECT_DETECT_UDP_VERSION;
+	header.header_size = sizeof(header);
+	header.sequence = completed_request.sequence;
+	header.result_sequence = completed_request.sequence;
+	completed_request.post_process_metadata.Get("object_detect.sequence", header.result_sequence);
+	header.timestamp_ns = completed_request.metadata.get(libcamera::controls::SensorTimestamp).value_or(0);
+	header.width = info_.width;
+	header.height = info_.height;
+	header.total_count = total_count;
+	header.fragments = packets_.size();
+
+	auto detection = detections.begin();
+	for (unsigned int i = 0; i < packets_.size(); i++)
+	{
+		header.count = packets_[i].count;
+		header.fragment = i;
+		uint8_t *dest = append(&buffer_[packets_[i].offset], header);
+		for (unsigned int j = 0; j < packets_[i].count; j++)
+			dest = append_detection(dest, *detection++, false);
 	}
-
-	std::cerr
-		<< "UDP socket initialized for IP: " << udp_broadcast_address << ", Port: " << udp_broadcast_port << std::endl;
 }
 
-void ObjectDetectUDPStage::Read(boost::property_tree::ptree const &params)
+void ObjectDetectUDPStage::buildLegacy(std::vector<Detection> const &detections)
 {
-	udp_broadcast_address = params.get<std::string>("ip", UDP_IP);
-	udp_broadcast_port = params.get<u_int16_t>("port", UDP_PORT);
+	// Every packet is the same size.
+	size_t size = sizeof(START_DELIMITER) + OBJECT_DETECT_UDP_DETECTION_SIZE + LEGACY_NAME_LENGTH;
+	for (unsigned int i = 0; i < detections.size(); i++)
+		packets_.push_back({ i * size, size, 1 });
+	buffer_.resize(detections.size() * size);
+
+	for (unsigned int i = 0; i < packets_.size(); i++)
+	{
+		uint8_t *dest = append(&buffer_[packets_[i].offset], START_DELIMITER);
+		append_detection(dest, detections[i], true);
+	}
 }
 
-template <typename T>
-void append(std::vector<char> &buffer, const T &value)
+void ObjectDetectUDPStage::send()
 {
-	const char *raw = reinterpret_cast<const char *>(&value);
-	size_t old_size = buffer.size();
-	buffer.resize(old_size + sizeof(T));
-	std::memcpy(buffer.data() + old_size, raw, sizeof(T));
+	if (packets_.empty())
+		return;
+
+	// Only now is the buffer finished, so that these pointers into it stay valid.
+	iovecs_.resize(packets_.size());
+	messages_.resize(packets_.size());
+	for (unsigned int i = 0; i < packets_.size(); i++)
+	{
+		iovecs_[i] = { &buffer_[packets_[i].offset], packets_[i].size };
+		messages_[i] = {};
+		messages_[i].msg_hdr.msg_name = &addr_;
+		messages_[i].msg_hdr.msg_namelen = addr_len_;
+		messages_[i].msg_hdr.msg_iov = &iovecs_[i];
+		messages_[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	int ret;
+	if (messages_.size() == 1)
+		ret = sendmsg(sockfd_, &messages_[0].msg_hdr, MSG_DONTWAIT);
+	else
+		ret = sendmmsg(sockfd_, messages_.data(), messages_.size(), MSG_DONTWAIT);
+
+	// Nobody listening on a local socket is quite normal, so only say so when things change.
+	if (ret < 0 && !send_failed_)
+		LOG_ERROR("ObjectDetectUDPStage: failed to send detections: " << strerror(errno));
+	else if (ret >= 0 && send_failed_)
+		LOG(1, "ObjectDetectUDPStage: sending detections again");
+	send_failed_ = ret < 0;
 }
 
 bool ObjectDetectUDPStage::Process(CompletedRequestPtr &completed_request)
@@ -126,52 +285,13 @@ bool ObjectDetectUDPStage::Process(CompletedRequestPtr &completed_request)
 	std::vector<Detection> detections;
 	completed_request->post_process_metadata.Get("object_detect.results", detections);
 
-	if (sockfd_ == -1)
-		return false;
-
-	for (auto &detection : detections)
-	{
-		// Draw rectangle and text on the image
-		std::stringstream text_stream;
-		text_stream << detection.name << " " << (int)(detection.confidence * 100) << "%";
-		std::string text = text_stream.str();
-		
-		// Use a vector to dynamically build the binary message
-		std::vector<char> udp_data_buffer;
-
-		// 1. Add start delimiter (4 bytes)
-		append(udp_data_buffer, START_DELIMITER);
-
-		// 2. Add x, y, width, height (4 bytes each)
-		const int32_t x = detection.box.x;
-		const int32_t y = detection.box.y;
-		const int32_t width = detection.box.width;
-		const int32_t height = detection.box.height;
-
-		append(udp_data_buffer, x);
-		append(udp_data_buffer, y);
-		append(udp_data_buffer, width);
-		append(udp_data_buffer, height);
-
-		// 3. Add name length and name string
-		constexpr uint8_t name_length = 255;
-		udp_data_buffer.push_back(static_cast<char>(name_length));
-
-		std::array<uint8_t, name_length> name;
-		memcpy(name.data(), detection.name.c_str(), name_length - 2);
-		name[name_length - 1] = '\0';
-		append(udp_data_buffer, name);
-
-		// 4. Add confidence (4 bytes)
-		const float confidence = detection.confidence;
-		append(udp_data_buffer, confidence);
-
-		// Send data via UDP
-		const ssize_t bytes_sent = sendto(sockfd_, udp_data_buffer.data(), udp_data_buffer.size(), 0,
-										  (const struct sockaddr *)&servaddr_, sizeof(servaddr_));
-		if (bytes_sent < 0)
-			perror("Failed to send UDP message");
-	}
+	std::lock_guard<std::mutex> lock(mutex_);
+	packets_.clear();
+	if (protocol_ == 1)
+		buildLegacy(detections);
+	else
+		buildFrame(*completed_request, detections);
+	send();
 
 	return false;
 }
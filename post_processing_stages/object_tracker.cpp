@@ -0,0 +1,295 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * Copyright (C) 2025, Raspberry Pi Ltd
+ *
+ * object_tracker.cpp - multi-object tracker for object detection results
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "post_processing_stages/object_tracker.hpp"
+
+// The cost of pairings we won't allow.
+static constexpr double NO_MATCH = 1e6;
+
+// Minimum cost assignment (the Hungarian algorithm) for a cost matrix with no more rows than columns.
+// Returns the column chosen for each row.
+static std::vector<int> assign(std::vector<std::vector<double>> const &cost)
+{
+	const unsigned int n = cost.size(), m = cost[0].size();
+	const double inf = std::numeric_limits<double>::infinity();
+	// 1-based, with row/column 0 as a sentinel.
+	std::vector<double> u(n + 1), v(m + 1);
+	std::vector<unsigned int> p(m + 1), way(m + 1);
+
+	for (unsigned int i = 1; i <= n; i++)
+	{
+		p[0] = i;
+		unsigned int j0 = 0;
+		std::vector<double> minv(m + 1, inf);
+		std::vector<bool> used(m + 1, false);
+		do
+		{
+			used[j0] = true;
+			unsigned int i0 = p[j0], j1 = 0;
+			double delta = inf;
+			for (unsigned int j = 1; j <= m; j++)
+			{
+				if (used[j])
+					continue;
+				double cur = cost[i0 - 1][j - 1] - u[i0] - v[j];
+				if (cur < minv[j])
+					minv[j] = cur, way[j] = j0;
+				if (minv[j] < delta)
+					delta = minv[j], j1 = j;
+			}
+			for (unsigned int j = 0; j <= m; j++)
+			{
+				if (used[j])
+					u[p[j]] += delta, v[j] -= delta;
+				else
+					minv[j] -= delta;
+			}
+			j0 = j1;
+		} while (p[j0] != 0);
+		do
+		{
+			unsigned int j1 = way[j0];
+			p[j0] = p[j1];
+			j0 = j1;
+		} while (j0);
+	}
+
+	std::vector<int> result(n, -1);
+	for (unsigned int j = 1; j <= m; j++)
+	{
+		if (p[j])
+			result[p[j] - 1] = j - 1;
+	}
+	return result;
+}
+
+bool ObjectTracker::Read(boost::property_tree::ptree const &params)
+{
+	if (params.find("temporal_filter") == params.not_found())
+		return false;
+
+	Config &config = config_;
+	config.tolerance = params.get<float>("temporal_filter.tolerance", config.tolerance);
+	config.min_iou = params.get<float>("temporal_filter.min_iou", config.min_iou);
+	config.factor = params.get<float>("temporal_filter.factor", config.factor);
+	config.visible_frames = params.get<unsigned int>("temporal_filter.visible_frames", config.visible_frames);
+	config.hidden_frames = params.get<unsigned int>("temporal_filter.hidden_frames", config.hidden_frames);
+	config.process_noise = params.get<float>("temporal_filter.process_noise", config.process_noise);
+	config.measurement_noise = params.get<float>("temporal_filter.measurement_noise", config.measurement_noise);
+	return true;
+}
+
+void ObjectTracker::Axis::init(float z, float r, float v_var)
+{
+	pos = z;
+	vel = 0;
+	p00 = r;
+	p01 = 0;
+	p11 = v_var;
+}
+
+void ObjectTracker::Axis::predict(float q)
+{
+	// One frame of constant velocity, with a random acceleration of variance q.
+	pos += vel;
+	p00 += 2 * p01 + p11 + q / 4;
+	p01 += p11 + q / 2;
+	p11 += q;
+}
+
+void ObjectTracker::Axis::correct(float z, float r)
+{
+	float s = p00 + r;
+	float k0 = p00 / s, k1 = p01 / s;
+	float y = z - pos;
+	pos += k0 * y;
+	vel += k1 * y;
+	p11 -= k1 * p01;
+	p00 *= 1 - k0;
+	p01 *= 1 - k0;
+}
+
+void ObjectTracker::Configure(libcamera::Size const &image_size)
+{
+	image_size_ = image_size;
+	tracks_.clear();
+	states_.clear();
+}
+
+void ObjectTracker::predictAll()
+{
+	float qx = std::pow(config_.process_noise * image_size_.width, 2);
+	float qy = std::pow(config_.process_noise * image_size_.height, 2);
+	for (unsigned int i = 0; i < tracks_.size(); i++)
+	{
+		states_[i].x.predict(qx);
+		states_[i].y.predict(qy);
+		tracks_[i].predicted = true;
+		updateBox(tracks_[i], states_[i]);
+	}
+}
+
+void ObjectTracker::Predict()
+{
+	predictAll();
+}
+
+float ObjectTracker::cost(unsigned int track, Detection const &detection) const
+{
+	if (detection.category != tracks_[track].detection.category)
+		return NO_MATCH;
+
+	State const &state = states_[track];
+	float x0 = state.x.pos - state.width / 2, x1 = state.x.pos + state.width / 2;
+	float y0 = state.y.pos - state.height / 2, y1 = state.y.pos + state.height / 2;
+	libcamera::Rectangle const &box = detection.box;
+	float ix = std::max(0.0f, std::min(x1, (float)(box.x + box.width)) - std::max(x0, (float)box.x));
+	float iy = std::max(0.0f, std::min(y1, (float)(box.y + box.height)) - std::max(y0, (float)box.y));
+	float intersection = ix * iy;
+	float area_union = state.width * state.height + (float)box.width * box.height - intersection;
+	float iou = area_union > 0 ? intersection / area_union : 0;
+	if (iou >= config_.min_iou)
+		return 1 - iou;
+
+	// Small or fast-moving objects may not overlap with where we thought they'd be, so also allow
+	// nearby ones, though any overlapping match is better.
+	float dx = std::abs(box.x + box.width / 2.0f - state.x.pos) / image_size_.width;
+	float dy = std::abs(box.y + box.height / 2.0f - state.y.pos) / image_size_.height;
+	if (dx < config_.tolerance && dy < config_.tolerance)
+		return 1 + std::max(dx, dy) / config_.tolerance;
+
+	return NO_MATCH;
+}
+
+void ObjectTracker::updateBox(Track &track, State const &state) const
+{
+	float x0 = std::clamp(state.x.pos - state.width / 2, 0.0f, (float)image_size_.width);
+	float y0 = std::clamp(state.y.pos - state.height / 2, 0.0f, (float)image_size_.height);
+	float x1 = std::clamp(state.x.pos + state.width / 2, 0.0f, (float)image_size_.width);
+	float y1 = std::clamp(state.y.pos + state.height / 2, 0.0f, (float)image_size_.height);
+	track.detection.box = libcamera::Rectangle(std::lround(x0), std::lround(y0), std::lround(x1 - x0),
+											   std::lround(y1 - y0));
+	track.velocity_x = state.x.vel;
+	track.velocity_y = state.y.vel;
+}
+
+void ObjectTracker::Update(std::vector<Detection> const &detections)
+{
+	bool show = config_.show_first && tracks_.empty();
+	predictAll();
+
+	// Pair up tracks and detections, always with the shorter list as the rows.
+	std::vector<int> detection_track(detections.size(), -1);
+	if (!tracks_.empty() && !detections.empty())
+	{
+		bool by_track = tracks_.size() <= detections.size();
+		unsigned int rows = by_track ? tracks_.size() : detections.size();
+		unsigned int cols = by_track ? detections.size() : tracks_.size();
+		std::vector<std::vector<double>> costs(rows, std::vector<double>(cols));
+		for (unsigned int t = 0; t < tracks_.size(); t++)
+		{
+			for (unsigned int d = 0; d < detections.size(); d++)
+			{
+				double c = cost(t, detections[d]);
+				if (by_track)
+					costs[t][d] = c;
+				else
+					costs[d][t] = c;
+			}
+		}
+
+		std::vector<int> result = assign(costs);
+		for (unsigned int r = 0; r < rows; r++)
+		{
+			if (result[r] < 0 || costs[r][result[r]] >= NO_MATCH)
+				continue;
+			if (by_track)
+				detection_track[result[r]] = r;
+			else
+				detection_track[r] = result[r];
+		}
+	}
+
+	float rx = std::pow(config_.measurement_noise * image_size_.width, 2);
+	float ry = std::pow(config_.measurement_noise * image_size_.height, 2);
+	std::vector<bool> matched(tracks_.size(), false);
+	for (unsigned int d = 0; d < detections.size(); d++)
+	{
+		Detection const &detection = detections[d];
+		float cx = detection.box.x + detection.box.width / 2.0f, cy = detection.box.y + detection.box.height / 2.0f;
+		int t = detection_track[d];
+		if (t >= 0)
+		{
+			State &state = states_[t];
+			state.x.correct(cx, rx);
+			state.y.correct(cy, ry);
+			state.width += config_.factor * (detection.box.width - state.width);
+			state.height += config_.factor * (detection.box.height - state.height);
+
+			Track &track = tracks_[t];
+			track.detection.confidence = detection.confidence;
+			track.detection.name = detection.name;
+			track.hits++;
+			track.missed = 0;
+			track.predicted = false;
+			updateBox(track, state);
+			matched[t] = true;
+		}
+		else
+		{
+			State state;
+			state.x.init(cx, rx, std::pow(config_.tolerance * image_size_.width, 2));
+			state.y.init(cy, ry, std::pow(config_.tolerance * image_size_.height, 2));
+			state.width = detection.box.width;
+			state.height = detection.box.height;
+			state.show = show;
+			states_.push_back(state);
+			tracks_.push_back({ next_id_++, detection, 0, 0, 1, 0, false });
+			matched.push_back(true);
+		}
+	}
+
+	// Objects that haven't been confirmed yet must be found every time, and others are forgotten
+	// once they've been missing for long enough.
+	unsigned int n = 0;
+	for (unsigned int i = 0; i < tracks_.size(); i++)
+	{
+		if (!matched[i] && (++tracks_[i].missed >= config_.visible_frames || !confirmed(i)))
+			continue;
+		tracks_[n] = tracks_[i];
+		states_[n] = states_[i];
+		n++;
+	}
+	tracks_.erase(tracks_.begin() + n, tracks_.end());
+	states_.erase(states_.begin() + n, states_.end());
+}
+
+std::vector<Detection> ObjectTracker::Detections() const
+{
+	std::vector<Detection> detections;
+	for (unsigned int i = 0; i < tracks_.size(); i++)
+	{
+		if (confirmed(i))
+			detections.push_back(tracks_[i].detection);
+	}
+	return detections;
+}
+
+void ObjectTracker::Publish(Metadata &metadata) const
+{
+	if (tracks_.empty())
+		return;
+
+	metadata.Set("object_detect.tracks", tracks_);
+	std::vector<Detection> detections = Detections();
+	if (detections.size())
+		metadata.Set("object_detect.results", std::move(detections));
+}
@@ -0,0 +1,106 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * Copyright (C) 2025, Raspberry Pi Ltd
+ *
+ * object_tracker.hpp - multi-object tracker for object detection results
+ */
+
+#pragma once
+
+#include <vector>
+
+#include <boost/property_tree/ptree.hpp>
+
+#include <libcamera/geometry.h>
+
+#include "core/metadata.hpp"
+#include "post_processing_stages/object_detect.hpp"
+
+// An object followed from frame to frame. The detection's box is the tracker's estimate, which on
+// frames where the detector didn't run (or missed the object) is a prediction.
+struct Track
+{
+	unsigned int id;
+	Detection detection;
+	float velocity_x; // pixels per frame
+	float velocity_y;
+	unsigned int hits; // frames the detector has found it on
+	unsigned int missed; // detector runs since it was last found
+	bool predicted;
+};
+
+// Matches each frame's detections to the objects we're already tracking, using the overlap of the
+// boxes (or how near their centres are, for small fast-moving objects) and a minimum cost
+// assignment. Each track has a constant velocity Kalman filter for the centre of its box, so it can
+// be carried across frames where the detector doesn't run at all, and the detector needn't run on
+// every frame. Publishes "object_detect.tracks", and the confirmed tracks as "object_detect.results".
+class ObjectTracker
+{
+public:
+	struct Config
+	{
+		// Boxes whose centres are within this fraction of the image size may match even if they don't overlap.
+		float tolerance = 0.05;
+		// Otherwise they must overlap by at least this much (intersection over union).
+		float min_iou = 0.1;
+		// How quickly the width and height follow new detections, from 0 to 1.
+		float factor = 0.2;
+		// Detector runs an object may be missing from before we forget it.
+		unsigned int visible_frames = 4;
+		// Further detector runs a new object must be found on before we report it.
+		unsigned int hidden_frames = 2;
+		// Report new objects immediately when we weren't tracking anything.
+		bool show_first = false;
+		// Standard deviations of an object's acceleration (per frame) and the detector's error, as
+		// fractions of the image size.
+		float process_noise = 0.005;
+		float measurement_noise = 0.01;
+	};
+
+	// Reads the "temporal_filter" block of a detection stage's parameters. Returns false if there isn't one.
+	bool Read(boost::property_tree::ptree const &params);
+	Config &GetConfig() { return config_; }
+
+	// Call from the stage's Configure(), with the size of the image the boxes are in.
+	void Configure(libcamera::Size const &image_size);
+	// A frame that the detector ran on.
+	void Update(std::vector<Detection> const &detections);
+	// A frame that it didn't, so every track moves on by its velocity.
+	void Predict();
+
+	std::vector<Track> const &Tracks() const { return tracks_; }
+	// The tracks that are confirmed, with their current boxes.
+	std::vector<Detection> Detections() const;
+	void Publish(Metadata &metadata) const;
+
+private:
+	// Position and velocity along one axis.
+	struct Axis
+	{
+		float pos;
+		float vel;
+		float p00, p01, p11; // covariance
+		void init(float z, float r, float v_var);
+		void predict(float q);
+		void correct(float z, float r);
+	};
+	struct State
+	{
+		Axis x;
+		Axis y;
+		float width;
+		float height;
+		bool show; // reported straight away, without waiting for hidden_frames
+	};
+
+	void predictAll();
+	float cost(unsigned int track, Detection const &detection) const;
+	void updateBox(Track &track, State const &state) const;
+	bool confirmed(unsigned int i) const { return tracks_[i].hits > config_.hidden_frames || states_[i].show; }
+
+	Config config_;
+	libcamera::Size image_size_;
+	std::vector<Track> tracks_;
+	std::vector<State> states_; // alongside tracks_
+	unsigned int next_id_ = 0;
+};
@@ -0,0 +1,91 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * Copyright (C) 2025, Raspberry Pi Ltd
+ *
+ * overlay.hpp - shapes and text for the overlay_cv stage to draw
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <libcamera/geometry.h>
+
+#include "core/metadata.hpp"
+
+// Rather than each drawing on the image themselves, stages can add what they want drawn to the
+// "overlay.primitives" metadata, and the overlay_cv stage draws everything in one go. Coordinates
+// are in the main image's pixels (like object detection results), whichever image ends up being
+// drawn on. Colours are 0xrrggbb.
+struct OverlayPrimitive
+{
+	enum class Type
+	{
+		Box,
+		Line,
+		Circle,
+		Text,
+	};
+
+	Type type = Type::Box;
+	libcamera::Point p0; // top left of a box or text, start of a line, or centre of a circle
+	libcamera::Point p1; // bottom right of a box (inclusive) or end of a line
+	int radius = 0;
+	int thickness = 1; // FILLED for solid boxes and circles
+	uint32_t colour = 0xffffff;
+	float alpha = 1.0;
+	// Text is drawn in the OpenCV Hershey simplex font, optionally on a background box.
+	std::string text;
+	double scale = 1.0;
+	uint32_t bg_colour = 0;
+	float bg_alpha = 0;
+
+	static constexpr int FILLED = -1;
+
+	static OverlayPrimitive Box(libcamera::Rectangle const &r, uint32_t colour, int thickness = 1)
+	{
+		OverlayPrimitive box;
+		box.type = Type::Box;
+		box.p0 = { r.x, r.y };
+		box.p1 = { r.x + (int)r.width - 1, r.y + (int)r.height - 1 };
+		box.colour = colour, box.thickness = thickness;
+		return box;
+	}
+	static OverlayPrimitive Line(libcamera::Point p0, libcamera::Point p1, uint32_t colour, int thickness = 1)
+	{
+		OverlayPrimitive line;
+		line.type = Type::Line;
+		line.p0 = p0, line.p1 = p1;
+		line.colour = colour, line.thickness = thickness;
+		return line;
+	}
+	static OverlayPrimitive Circle(libcamera::Point centre, int radius, uint32_t colour, int thickness = 1)
+	{
+		OverlayPrimitive circle;
+		circle.type = Type::Circle;
+		circle.p0 = centre, circle.p1 = centre;
+		circle.radius = radius, circle.colour = colour, circle.thickness = thickness;
+		return circle;
+	}
+	static OverlayPrimitive Text(libcamera::Point top_left, std::string const &text, uint32_t colour, double scale,
+								 int thickness)
+	{
+		OverlayPrimitive t;
+		t.type = Type::Text;
+		t.p0 = top_left, t.p1 = top_left;
+		t.text = text, t.colour = colour, t.scale = scale, t.thickness = thickness;
+		return t;
+	}
+};
+
+// Add to whatever other stages have already asked to be drawn on this frame.
+inline void AddOverlay(Metadata &metadata, std::vector<OverlayPrimitive> const &primitives)
+{
+	std::lock_guard<Metadata> lock(metadata);
+	auto existing = metadata.GetLocked<std::vector<OverlayPrimitive>>("overlay.primitives");
+	if (existing)
+		existing->insert(existing->end(), primitives.begin(), primitives.end());
+	else
+		metadata.SetLocked("overlay.primitives", primitives);
+}
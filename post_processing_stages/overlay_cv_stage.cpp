@@ -0,0 +1,384 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * Copyright (C) 2025, Raspberry Pi Ltd
+ *
+ * overlay_cv_stage.cpp - draw everything other stages have asked for, in one pass
+ */
+
+// Stages such as object_detect_draw_cv, plot_pose_cv, face_detect_cv and annotate_cv can be told
+// (with "overlay" : 1) to add OverlayPrimitives to the metadata instead of drawing them. This stage,
+// which should come last, then draws them all at once. The image is divided into tiles, and only the
+// tiles that something is drawn in are touched: the primitives are rasterised into a small buffer
+// for the tile and then blended into the YUV420 image (colour included) with fixed-point arithmetic.
+
+// Setting "stream" to "lores" draws on the low resolution image instead, for example to put the
+// overlays on a --simulcast stream of it while the main recording stays clean.
+
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <tuple>
+
+#include <libcamera/stream.h>
+
+#include "core/rpicam_app.hpp"
+
+#include "post_processing_stages/overlay.hpp"
+#include "post_processing_stages/overlay_renderer.hpp"
+#include "post_processing_stages/post_processing_stage.hpp"
+
+#include "opencv2/imgproc.hpp"
+
+using Stream = libcamera::Stream;
+
+class OverlayCvStage : public PostProcessingStage
+{
+public:
+	OverlayCvStage(RPiCamApp *app) : PostProcessingStage(app) {}
+
+	char const *Name() const override;
+
+	void Read(boost::property_tree::ptree const &params) override;
+
+	void Configure() override;
+
+	bool Process(CompletedRequestPtr &completed_request) override;
+
+private:
+	// A primitive scaled to the image we draw on, with its colours converted and text laid out.
+	struct Item
+	{
+		OverlayPrimitive primitive;
+		YuvColour colour;
+		YuvColour bg_colour;
+		CoverageMask const *text;
+		std::vector<cv::Rect> bounds; // the areas it may draw in
+	};
+	// The tile's image of the overlay, in packed YUV, and how much it covers each pixel.
+	struct Tile
+	{
+		cv::Rect rect;
+		cv::Mat paint;
+		cv::Mat coverage;
+	};
+
+	Item prepare(OverlayPrimitive const &primitive);
+	void draw(Item const &item, Tile &tile) const;
+	void blend(Tile const &tile, uint8_t *image) const;
+	GlyphAtlas const &atlas(double scale, int thickness);
+
+	Stream *stream_;
+	StreamInfo info_;
+	float scale_x_, scale_y_; // image pixels per main image pixel
+	std::string stream_name_;
+	unsigned int tile_size_;
+	bool antialias_;
+	std::mutex mutex_;
+	std::map<std::pair<double, int>, std::unique_ptr<GlyphAtlas>> atlases_;
+	// The strings we drew last time, which are probably the ones we'll draw this time.
+	std::map<std::tuple<GlyphAtlas const *, std::string>, CoverageMask> text_cache_;
+	std::map<std::tuple<GlyphAtlas const *, std::string>, CoverageMask> old_text_cache_;
+};
+
+#define NAME "overlay_cv"
+
+char const *OverlayCvStage::Name() const
+{
+	return NAME;
+}
+
+void OverlayCvStage::Read(boost::property_tree::ptree const &params)
+{
+	stream_name_ = params.get<std::string>("stream", "main");
+	if (stream_name_ != "main" && stream_name_ != "lores")
+		throw std::runtime_error("OverlayCvStage: stream must be \"main\" or \"lores\"");
+	tile_size_ = std::max(params.get<unsigned int>("tile_size", 64) & ~1u, 16u);
+	antialias_ = params.get<int>("antialias", 0);
+}
+
+void OverlayCvStage::Configure()
+{
+	stream_ = stream_name_ == "lores" ? app_->LoresStream() : app_->GetMainStream();
+	if (!stream_)
+		return;
+	info_ = app_->GetStreamInfo(stream_);
+	if (info_.pixel_format != libcamera::formats::YUV420)
+		throw std::runtime_error("OverlayCvStage: only YUV420 format supported");
+
+	Stream *main_stream = app_->GetMainStream();
+	StreamInfo main_info = main_stream ? app_->GetStreamInfo(main_stream) : info_;
+	scale_x_ = info_.width / (float)main_info.width;
+	scale_y_ = info_.height / (float)main_info.height;
+
+	text_cache_.clear();
+	old_text_cache_.clear();
+}
+
+GlyphAtlas const &OverlayCvStage::atlas(double scale, int thickness)
+{
+	auto &atlas = atlases_[{ scale, thickness }];
+	if (!atlas)
+		atlas = std::make_unique<GlyphAtlas>(cv::FONT_HERSHEY_SIMPLEX, scale, thickness, antialias_);
+	return *atlas;
+}
+
+OverlayCvStage::Item OverlayCvStage::prepare(OverlayPrimitive const &primitive)
+{
+	Item item { primitive, RgbToYuv(primitive.colour, info_.colour_space),
+				RgbToYuv(primitive.bg_colour, info_.colour_space), nullptr, {} };
+	OverlayPrimitive &p = item.primitive;
+	p.p0 = { (int)std::lround(p.p0.x * scale_x_), (int)std::lround(p.p0.y * scale_y_) };
+	p.p1 = { (int)std::lround(p.p1.x * scale_x_), (int)std::lround(p.p1.y * scale_y_) };
+	p.radius = std::lround(p.radius * scale_x_);
+	if (p.thickness > 0)
+		p.thickness = std::max<int>(std::lround(p.thickness * scale_x_), 1);
+	p.scale *= scale_x_;
+
+	// Thick lines stick out by half their thickness, and anti-aliasing adds a pixel.
+	int margin = std::max(p.thickness, 1) / 2 + 2;
+	cv::Rect bounds(cv::Point(std::min(p.p0.x, p.p1.x) - margin, std::min(p.p0.y, p.p1.y) - margin),
+					cv::Point(std::max(p.p0.x, p.p1.x) + margin + 1, std::max(p.p0.y, p.p1.y) + margin + 1));
+
+	switch (p.type)
+	{
+	case OverlayPrimitive::Type::Box:
+		if (p.thickness == OverlayPrimitive::FILLED)
+			item.bounds.push_back(bounds);
+		else
+		{
+			// Only the edges of an outline are drawn, so don't touch the tiles in the middle.
+			int w = 2 * margin + 1;
+			item.bounds.emplace_back(bounds.x, bounds.y, bounds.width, w);
+			item.bounds.emplace_back(bounds.x, bounds.y + bounds.height - w, bounds.width, w);
+			item.bounds.emplace_back(bounds.x, bounds.y, w, bounds.height);
+			item.bounds.emplace_back(bounds.x + bounds.width - w, bounds.y, w, bounds.height);
+		}
+		break;
+	case OverlayPrimitive::Type::Line:
+		item.bounds.push_back(bounds);
+		break;
+	case OverlayPrimitive::Type::Circle:
+		item.bounds.emplace_back(bounds.x - p.radius, bounds.y - p.radius, bounds.width + 2 * p.radius,
+								 bounds.height + 2 * p.radius);
+		break;
+	case OverlayPrimitive::Type::Text:
+	{
+		GlyphAtlas const *glyphs = &atlas(p.scale, std::max(p.thickness, 1));
+		auto key = std::make_tuple(glyphs, p.text);
+		auto it = text_cache_.find(key);
+		if (it == text_cache_.end())
+		{
+			auto old = old_text_cache_.find(key);
+			if (old != old_text_cache_.end())
+				it = text_cache_.emplace(key, std::move(old->second)).first;
+			else
+			{
+				it = text_cache_.emplace(key, CoverageMask()).first;
+				glyphs->Render(p.text, it->second);
+			}
+		}
+		item.text = &it->second;
+		item.bounds.emplace_back(p.p0.x, p.p0.y, item.text->width, item.text->height);
+		break;
+	}
+	}
+
+	return item;
+}
+
+void OverlayCvStage::draw(Item const &item, Tile &tile) const
+{
+	OverlayPrimitive const &p = item.primitive;
+	cv::Point offset(-tile.rect.x, -tile.rect.y);
+	cv::Point p0 = cv::Point(p.p0.x, p.p0.y) + offset, p1 = cv::Point(p.p1.x, p.p1.y) + offset;
+	cv::Scalar paint(item.colour.y, item.colour.u, item.colour.v);
+	cv::Scalar coverage(std::clamp(p.alpha, 0.0f, 1.0f) * 255);
+	int line_type = antialias_ ? cv::LINE_AA : cv::LINE_8;
+	// Antialiasing only applies to the coverage. Blending the colour too would mix it with whatever was in
+	// the tile before, so the paint is drawn solid, and wide enough to reach all the partly covered pixels.
+	int spread = antialias_ ? 2 : 0;
+	int paint_thickness = p.thickness < 0 ? p.thickness : p.thickness + spread;
+
+	switch (p.type)
+	{
+	case OverlayPrimitive::Type::Box:
+		cv::rectangle(tile.paint, p0, p1, paint, paint_thickness, cv::LINE_8);
+		if (p.thickness < 0 && spread)
+			cv::rectangle(tile.paint, p0, p1, paint, 1 + spread, cv::LINE_8);
+		cv::rectangle(tile.coverage, p0, p1, coverage, p.thickness, line_type);
+		break;
+	case OverlayPrimitive::Type::Line:
+		cv::line(tile.paint, p0, p1, paint, paint_thickness, cv::LINE_8);
+		cv::line(tile.coverage, p0, p1, coverage, p.thickness, line_type);
+		break;
+	case OverlayPrimitive::Type::Circle:
+		cv::circle(tile.paint, p0, p.radius, paint, paint_thickness, cv::LINE_8);
+		if (p.thickness < 0 && spread)
+			cv::circle(tile.paint, p0, p.radius, paint, 1 + spread, cv::LINE_8);
+		cv::circle(tile.coverage, p0, p.radius, coverage, p.thickness, line_type);
+		break;
+	case OverlayPrimitive::Type::Text:
+	{
+		CoverageMask const &text = *item.text;
+		int x0 = std::max(0, -p0.x), x1 = std::min<int>(text.width, tile.rect.width - p0.x);
+		int y0 = std::max(0, -p0.y), y1 = std::min<int>(text.height, tile.rect.height - p0.y);
+		uint8_t bg_coverage = std::clamp(p.bg_alpha, 0.0f, 1.0f) * 255;
+		uint8_t fg_scale = std::clamp(p.alpha, 0.0f, 1.0f) * 255;
+		for (int y = y0; y < y1; y++)
+		{
+			uint8_t *paint_row = tile.paint.ptr<uint8_t>(p0.y + y);
+			uint8_t *coverage_row = tile.coverage.ptr<uint8_t>(p0.y + y);
+			uint8_t const *text_row = &text.coverage[y * text.width];
+			for (int x = x0; x < x1; x++)
+			{
+				uint8_t *pixel = paint_row + 3 * (p0.x + x);
+				uint8_t c = text_row[x] * fg_scale / 255;
+				if (c)
+				{
+					pixel[0] = item.colour.y, pixel[1] = item.colour.u, pixel[2] = item.colour.v;
+					coverage_row[p0.x + x] = std::max(c, bg_coverage);
+				}
+				else if (bg_coverage)
+				{
+					pixel[0] = item.bg_colour.y, pixel[1] = item.bg_colour.u, pixel[2] = item.bg_colour.v;
+					coverage_row[p0.x + x] = bg_coverage;
+				}
+			}
+		}
+		break;
+	}
+	}
+}
+
+// Each pixel becomes pixel * (1 - coverage) + paint * coverage, with coverage scaled to 256. The
+// chroma of each 2x2 block uses the total coverage of its 4 pixels, and their coverage-weighted paint.
+void OverlayCvStage::blend(Tile const &tile, uint8_t *image) const
+{
+	unsigned int const w = tile.rect.width, h = tile.rect.height;
+	std::vector<uint16_t> c(w * h);
+	for (unsigned int y = 0; y < h; y++)
+	{
+		uint8_t const *coverage = tile.coverage.ptr<uint8_t>(y);
+		for (unsigned int x = 0; x < w; x++)
+			c[y * w + x] = coverage[x] + (coverage[x] >> 7);
+	}
+
+	for (unsigned int y = 0; y < h; y++)
+	{
+		uint8_t *pixels = image + (tile.rect.y + y) * info_.stride + tile.rect.x;
+		uint8_t const *paint = tile.paint.ptr<uint8_t>(y);
+		uint16_t const *cov = &c[y * w];
+		for (unsigned int x = 0; x < w; x++)
+			pixels[x] = (uint16_t)(pixels[x] * (256 - cov[x]) + paint[3 * x] * cov[x] + 128) >> 8;
+	}
+
+	// Tiles start on even pixels, but at the edges of an image with odd dimensions they may end with half a
+	// chroma sample, for which we use the last column or row twice.
+	unsigned int uv_stride = info_.stride / 2, uv_width = (info_.width + 1) / 2, uv_height = (info_.height + 1) / 2;
+	uint8_t *u_plane = image + info_.stride * info_.height;
+	uint8_t *v_plane = u_plane + uv_stride * uv_height;
+	unsigned int uv_w = std::min((w + 1) / 2, uv_width - tile.rect.x / 2);
+	unsigned int uv_h = std::min((h + 1) / 2, uv_height - tile.rect.y / 2);
+	for (unsigned int y = 0; y < uv_h; y++)
+	{
+		unsigned int y1 = std::min(2 * y + 1, h - 1);
+		unsigned int offset = (tile.rect.y / 2 + y) * uv_stride + tile.rect.x / 2;
+		uint8_t *u = u_plane + offset, *v = v_plane + offset;
+		uint8_t const *paint0 = tile.paint.ptr<uint8_t>(2 * y), *paint1 = tile.paint.ptr<uint8_t>(y1);
+		uint16_t const *c0 = &c[2 * y * w], *c1 = &c[y1 * w];
+		for (unsigned int x = 0; x < uv_w; x++)
+		{
+			unsigned int i = 2 * x, j = std::min(2 * x + 1, w - 1);
+			uint32_t total = c0[i] + c0[j] + c1[i] + c1[j];
+			uint32_t paint_u = paint0[3 * i + 1] * c0[i] + paint0[3 * j + 1] * c0[j] + paint1[3 * i + 1] * c1[i] +
+							   paint1[3 * j + 1] * c1[j];
+			uint32_t paint_v = paint0[3 * i + 2] * c0[i] + paint0[3 * j + 2] * c0[j] + paint1[3 * i + 2] * c1[i] +
+							   paint1[3 * j + 2] * c1[j];
+			u[x] = (u[x] * (1024 - total) + paint_u + 512) >> 10;
+			v[x] = (v[x] * (1024 - total) + paint_v + 512) >> 10;
+		}
+	}
+}
+
+bool OverlayCvStage::Process(CompletedRequestPtr &completed_request)
+{
+	if (!stream_)
+		return false;
+
+	std::vector<OverlayPrimitive> primitives;
+	if (completed_request->post_process_metadata.Get("overlay.primitives", primitives) || primitives.empty())
+		return false;
+
+	// Requests can be processed in parallel, but they all share the text cache.
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	// Text we didn't draw last time gets dropped from the cache.
+	std::swap(text_cache_, old_text_cache_);
+	text_cache_.clear();
+	std::vector<Item> items;
+	for (auto const &primitive : primitives)
+		items.push_back(prepare(primitive));
+	old_text_cache_.clear();
+
+	unsigned int tiles_x = (info_.width + tile_size_ - 1) / tile_size_;
+	unsigned int tiles_y = (info_.height + tile_size_ - 1) / tile_size_;
+	cv::Rect image_rect(0, 0, info_.width, info_.height);
+
+	// Find which tiles each item may touch.
+	std::vector<std::vector<unsigned int>> tile_items(tiles_x * tiles_y);
+	for (unsigned int i = 0; i < items.size(); i++)
+	{
+		for (cv::Rect const &bounds : items[i].bounds)
+		{
+			cv::Rect r = bounds & image_rect;
+			if (r.width <= 0 || r.height <= 0)
+				continue;
+			for (unsigned int ty = r.y / tile_size_; ty <= (r.y + r.height - 1) / tile_size_; ty++)
+			{
+				for (unsigned int tx = r.x / tile_size_; tx <= (r.x + r.width - 1) / tile_size_; tx++)
+				{
+					std::vector<unsigned int> &list = tile_items[ty * tiles_x + tx];
+					if (list.empty() || list.back() != i)
+						list.push_back(i);
+				}
+			}
+		}
+	}
+
+	BufferWriteSync w(app_, completed_request->buffers[stream_]);
+	uint8_t *image = w.Get()[0].data();
+
+	Tile tile;
+	for (unsigned int ty = 0; ty < tiles_y; ty++)
+	{
+		for (unsigned int tx = 0; tx < tiles_x; tx++)
+		{
+			std::vector<unsigned int> const &list = tile_items[ty * tiles_x + tx];
+			if (list.empty())
+				continue;
+
+			tile.rect = cv::Rect(tx * tile_size_, ty * tile_size_, tile_size_, tile_size_) & image_rect;
+			tile.paint.create(tile.rect.height, tile.rect.width, CV_8UC3);
+			tile.paint.setTo(0);
+			tile.coverage.create(tile.rect.height, tile.rect.width, CV_8U);
+			tile.coverage.setTo(0);
+			for (unsigned int i : list)
+				draw(items[i], tile);
+
+			// The bounds are only approximate, so there may turn out to be nothing here after all.
+			if (cv::countNonZero(tile.coverage))
+				blend(tile, image);
+		}
+	}
+
+	return false;
+}
+
+static PostProcessingStage *Create(RPiCamApp *app)
+{
+	return new OverlayCvStage(app);
+}
+
+static RegisterStage reg(NAME, &Create);
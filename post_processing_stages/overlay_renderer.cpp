@@ -0,0 +1,212 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * Copyright (C) 2025, Raspberry Pi Ltd
+ *
+ * overlay_renderer.cpp - draw text and shapes over YUV420 images without redrawing them every frame
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+#include "opencv2/core.hpp"
+#include "opencv2/imgproc.hpp"
+
+#include "overlay_renderer.hpp"
+
+using libcamera::ColorSpace;
+
+uint32_t ParseRgb(std::string const &colour)
+{
+	std::string hex = colour;
+	if (hex.size() && hex[0] == '#')
+		hex = hex.substr(1);
+	else if (hex.size() > 2 && hex[0] == '0' && (hex[1] == 'x' || hex[1] == 'X'))
+		hex = hex.substr(2);
+	if (hex.size() != 6 || hex.find_first_not_of("0123456789abcdefABCDEF") != std::string::npos)
+		throw std::runtime_error("bad colour " + colour + ", expected #rrggbb");
+
+	return std::stoul(hex, nullptr, 16);
+}
+
+YuvColour ParseColour(std::string const &colour, std::optional<ColorSpace> const &colour_space)
+{
+	return RgbToYuv(ParseRgb(colour), colour_space);
+}
+
+YuvColour RgbToYuv(uint32_t rgb, std::optional<ColorSpace> const &colour_space)
+{
+	float r = ((rgb >> 16) & 0xff) / 255.0, g = ((rgb >> 8) & 0xff) / 255.0, b = (rgb & 0xff) / 255.0;
+
+	float kr = 0.299, kb = 0.114;
+	bool full_range = true;
+	if (colour_space)
+	{
+		if (colour_space->ycbcrEncoding == ColorSpace::YcbcrEncoding::Rec709)
+			kr = 0.2126, kb = 0.0722;
+		else if (colour_space->ycbcrEncoding == ColorSpace::YcbcrEncoding::Rec2020)
+			kr = 0.2627, kb = 0.0593;
+		full_range = colour_space->range == ColorSpace::Range::Full;
+	}
+
+	float y = kr * r + (1 - kr - kb) * g + kb * b;
+	float u = (b - y) / (2 * (1 - kb)), v = (r - y) / (2 * (1 - kr));
+	float y_scale = full_range ? 255 : 219, y_offset = full_range ? 0 : 16, uv_scale = full_range ? 255 : 224;
+
+	auto to_byte = [](float value) { return (uint8_t)std::clamp<long>(std::lround(value), 0, 255); };
+	return { to_byte(y_offset + y * y_scale), to_byte(128 + u * uv_scale), to_byte(128 + v * uv_scale) };
+}
+
+void CoverageMask::Resize(unsigned int w, unsigned int h)
+{
+	width = w;
+	height = h;
+	coverage.assign(w * h, 0);
+}
+
+// OpenCV draws these, and anything else comes out as a '?'.
+static constexpr char FIRST_CHAR = ' ';
+static constexpr char LAST_CHAR = '~';
+
+GlyphAtlas::GlyphAtlas(int font, double scale, int thickness, bool antialias)
+{
+	int baseline = 0;
+	cv::Size size = cv::getTextSize("X", font, scale, thickness, &baseline);
+	ascent_ = size.height;
+	height_ = size.height + baseline;
+	thickness_ = thickness;
+	// Room for the thick strokes that stick out to either side of the pen.
+	pad_ = thickness + 1;
+
+	for (char c = FIRST_CHAR; c <= LAST_CHAR; c++)
+	{
+		Glyph glyph;
+		// getTextSize rounds the width, so measure a long run of the character to find its advance to
+		// a fraction of a pixel. That lets us place the characters of a string where putText would.
+		static constexpr unsigned int RUN = 32;
+		int run_width = cv::getTextSize(std::string(RUN, c), font, scale, thickness, &baseline).width;
+		glyph.advance = (run_width - thickness) / (float)RUN;
+
+		glyph.mask.Resize(std::ceil(glyph.advance) + 2 * pad_, height_);
+		cv::Mat image(glyph.mask.height, glyph.mask.width, CV_8U, glyph.mask.coverage.data());
+		cv::putText(image, std::string(1, c), cv::Point(pad_, ascent_), font, scale, 255, thickness,
+					antialias ? cv::LINE_AA : cv::LINE_8);
+		glyphs_.push_back(std::move(glyph));
+	}
+}
+
+GlyphAtlas::Glyph const &GlyphAtlas::glyph(char c) const
+{
+	if (c < FIRST_CHAR || c > LAST_CHAR)
+		c = '?';
+	return glyphs_[c - FIRST_CHAR];
+}
+
+void GlyphAtlas::Render(std::string const &text, CoverageMask &mask) const
+{
+	float width = 0;
+	for (char c : text)
+		width += glyph(c).advance;
+	mask.Resize(text.empty() ? 0 : std::lround(width + thickness_), height_);
+
+	float pen = 0;
+	for (char c : text)
+	{
+		Glyph const &g = glyph(c);
+		int x0 = std::lround(pen) - pad_;
+		int start = std::max(0, -x0), end = std::min<int>(g.mask.width, mask.width - x0);
+		for (unsigned int y = 0; y < height_ && start < end; y++)
+		{
+			uint8_t const *src = &g.mask.coverage[y * g.mask.width];
+			uint8_t *dst = &mask.coverage[y * mask.width];
+			// Characters can overlap a little, so keep the larger coverage.
+			for (int x = start; x < end; x++)
+				dst[x0 + x] = std::max(dst[x0 + x], src[x]);
+		}
+		pen += g.advance;
+	}
+}
+
+void OverlayMask::Build(CoverageMask const &mask, YuvColour fg, YuvColour bg, float bg_alpha, bool colour)
+{
+	width_ = mask.width;
+	height_ = mask.height;
+	colour_ = colour;
+
+	// Work out what the blend does to a pixel with the given coverage, as a weight for the pixel's
+	// own value and an amount to add, both scaled by 128. The sum of 255 * weight + add always fits in
+	// 16 bits.
+	auto blend = [bg_alpha](float coverage, uint8_t fg_value, uint8_t bg_value, uint16_t &weight, uint16_t &add) {
+		float c = coverage / 255;
+		weight = std::lround(128 * (1 - bg_alpha) * (1 - c));
+		add = std::lround(128 * (bg_value * bg_alpha * (1 - c) + fg_value * c));
+	};
+
+	y_weight_.resize(width_ * height_);
+	y_add_.resize(width_ * height_);
+	for (unsigned int i = 0; i < width_ * height_; i++)
+		blend(mask.coverage[i], fg.y, bg.y, y_weight_[i], y_add_[i]);
+
+	if (!colour_)
+		return;
+
+	unsigned int uv_width = (width_ + 1) / 2, uv_height = (height_ + 1) / 2;
+	uv_weight_.resize(uv_width * uv_height);
+	u_add_.resize(uv_width * uv_height);
+	v_add_.resize(uv_width * uv_height);
+	for (unsigned int y = 0; y < uv_height; y++)
+	{
+		for (unsigned int x = 0; x < uv_width; x++)
+		{
+			// The chroma sample covers up to 4 pixels.
+			float total = 0;
+			unsigned int count = 0;
+			for (unsigned int j = 2 * y; j < std::min(2 * y + 2, height_); j++)
+			{
+				for (unsigned int i = 2 * x; i < std::min(2 * x + 2, width_); i++)
+					total += mask.coverage[j * width_ + i], count++;
+			}
+			unsigned int index = y * uv_width + x;
+			uint16_t v_weight;
+			blend(total / count, fg.u, bg.u, uv_weight_[index], u_add_[index]);
+			blend(total / count, fg.v, bg.v, v_weight, v_add_[index]);
+		}
+	}
+}
+
+// Each output is (pixel * weight + add) / 128, rounded. Everything stays in 16 bits so the compiler
+// can vectorise it.
+static void blend_row(uint8_t *__restrict pixels, uint16_t const *__restrict weight, uint16_t const *__restrict add,
+					  unsigned int count)
+{
+	for (unsigned int i = 0; i < count; i++)
+		pixels[i] = (uint16_t)(pixels[i] * weight[i] + add[i] + 64) >> 7;
+}
+
+void OverlayMask::Blend(uint8_t *image, StreamInfo const &info, int x, int y) const
+{
+	x &= ~1;
+	y &= ~1;
+	int x0 = std::max(0, -x), x1 = std::min<int>(width_, info.width - x);
+	int y0 = std::max(0, -y), y1 = std::min<int>(height_, info.height - y);
+	if (x0 >= x1 || y0 >= y1)
+		return;
+
+	for (int j = y0; j < y1; j++)
+		blend_row(image + (y + j) * info.stride + (x + x0), &y_weight_[j * width_ + x0], &y_add_[j * width_ + x0],
+				  x1 - x0);
+
+	if (!colour_)
+		return;
+
+	unsigned int uv_stride = info.stride / 2, uv_width = (width_ + 1) / 2;
+	uint8_t *u_plane = image + info.stride * info.height;
+	uint8_t *v_plane = u_plane + uv_stride * (info.height / 2);
+	int u0 = x0 / 2, u1 = (x1 + 1) / 2;
+	for (int j = y0 / 2; j < (y1 + 1) / 2; j++)
+	{
+		unsigned int offset = (y / 2 + j) * uv_stride + x / 2 + u0, index = j * uv_width + u0;
+		blend_row(u_plane + offset, &uv_weight_[index], &u_add_[index], u1 - u0);
+		blend_row(v_plane + offset, &uv_weight_[index], &v_add_[index], u1 - u0);
+	}
+}
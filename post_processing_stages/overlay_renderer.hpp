@@ -0,0 +1,94 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * Copyright (C) 2025, Raspberry Pi Ltd
+ *
+ * overlay_renderer.hpp - draw text and shapes over YUV420 images without redrawing them every frame
+ */
+
+#pragma once
+
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <libcamera/color_space.h>
+
+#include "core/stream_info.hpp"
+
+struct YuvColour
+{
+	uint8_t y;
+	uint8_t u;
+	uint8_t v;
+};
+
+// Colours are given as "#rrggbb" (or "0xrrggbb"), and converted using the image's colour space. We
+// assume Rec.601 full range (as for JPEG) if the image doesn't have one.
+YuvColour ParseColour(std::string const &colour, std::optional<libcamera::ColorSpace> const &colour_space);
+YuvColour RgbToYuv(uint32_t rgb, std::optional<libcamera::ColorSpace> const &colour_space);
+// Just turn "#rrggbb" into 0xrrggbb.
+uint32_t ParseRgb(std::string const &colour);
+
+// Coverage (0 to 255) of some pixels by the thing being drawn.
+struct CoverageMask
+{
+	unsigned int width = 0;
+	unsigned int height = 0;
+	std::vector<uint8_t> coverage;
+
+	void Resize(unsigned int w, unsigned int h);
+};
+
+// Every printable ASCII character, rasterised once with the OpenCV Hershey fonts. Strings are then
+// made by copying the characters into place, rather than drawing them all again with putText.
+class GlyphAtlas
+{
+public:
+	GlyphAtlas(int font, double scale, int thickness, bool antialias);
+
+	// Lay out the string as putText would, with the top left of the text at (0, 0). The mask's height
+	// includes room for descenders, and it's as wide as the text.
+	void Render(std::string const &text, CoverageMask &mask) const;
+
+private:
+	struct Glyph
+	{
+		float advance;
+		CoverageMask mask; // with the pen position at x = pad_
+	};
+
+	Glyph const &glyph(char c) const;
+
+	int pad_;
+	unsigned int ascent_; // cap height, where putText puts the baseline
+	unsigned int height_; // including descenders
+	float thickness_;
+	std::vector<Glyph> glyphs_;
+};
+
+// A CoverageMask turned into a small piece of overlay that can be blended into YUV420 images as fast
+// as possible. The area is filled with the background colour at the given alpha (0 leaves the image
+// alone), and then the covered parts are painted with the foreground colour. Every pixel of the
+// output is simply (pixel * weight + add) / 128, with the weights and additions worked out in
+// advance, and the blending loops are kept free of anything that would stop the compiler
+// vectorising them.
+class OverlayMask
+{
+public:
+	// Without colour only the Y plane is changed, so the image keeps its colours under a grey overlay.
+	void Build(CoverageMask const &mask, YuvColour fg, YuvColour bg, float bg_alpha, bool colour);
+
+	// The top left corner goes at (x, y) in the image, which should be even. Anything outside the
+	// image is clipped.
+	void Blend(uint8_t *image, StreamInfo const &info, int x, int y) const;
+
+	unsigned int Width() const { return width_; }
+	unsigned int Height() const { return height_; }
+
+private:
+	unsigned int width_ = 0;
+	unsigned int height_ = 0;
+	bool colour_ = false;
+	std::vector<uint16_t> y_weight_, y_add_;
+	std::vector<uint16_t> uv_weight_, u_add_, v_add_; // one for each 2x2 block
+};
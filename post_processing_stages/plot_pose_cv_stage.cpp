@@ -17,6 +17,7 @@
 
 #include "core/rpicam_app.hpp"
 
+#include "post_processing_stages/overlay.hpp"
 #include "post_processing_stages/post_processing_stage.hpp"
 
 #include "opencv2/imgproc.hpp"
@@ -62,10 +63,12 @@ public:
 	bool Process(CompletedRequestPtr &completed_request) override;
 
 private:
-	void drawFeatures(cv::Mat &img, std::vector<Point> locations, std::vector<float> confidences);
+	void getFeatures(std::vector<libcamera::Point> const &locations, std::vector<float> const &confidences,
+					 std::vector<OverlayPrimitive> &primitives);
 
 	Stream *stream_;
 	float confidence_threshold_;
+	bool overlay_;
 };
 
 #define NAME "plot_pose_cv"
@@ -83,6 +86,7 @@ void PlotPoseCvStage::Configure()
 void PlotPoseCvStage::Read(boost::property_tree::ptree const &params)
 {
 	confidence_threshold_ = params.get<float>("confidence_threshold", -1.0);
+	overlay_ = params.get<int>("overlay", 0);
 }
 
 bool PlotPoseCvStage::Process(CompletedRequestPtr &completed_request)
@@ -90,100 +94,107 @@ bool PlotPoseCvStage::Process(CompletedRequestPtr &completed_request)
 	if (!stream_)
 		return false;
 
-	BufferWriteSync w(app_, completed_request->buffers[stream_]);
-	libcamera::Span<uint8_t> buffer = w.Get()[0];
-	uint32_t *ptr = (uint32_t *)buffer.data();
-	StreamInfo info = app_->GetStreamInfo(stream_);
-
 	std::vector<std::vector<libcamera::Point>> lib_locations;
 	std::vector<std::vector<float>> confidences;
 	completed_request->post_process_metadata.Get("pose_estimation.locations", lib_locations);
 	completed_request->post_process_metadata.Get("pose_estimation.confidences", confidences);
 
+	std::vector<OverlayPrimitive> primitives;
 	unsigned int i = 0;
 	for (auto const &loc : lib_locations)
 	{
-		std::vector<cv::Rect> rects;
-		std::vector<Point> cv_locations;
-
 		std::vector<float> &conf = confidences[i];
 
 		if (!conf.empty() && !loc.empty())
-		{
-			Mat image(info.height, info.width, CV_8U, ptr, info.stride);
-			for (libcamera::Point lib_location : loc)
-			{
-				Point cv_location;
-				cv_location.x = lib_location.x;
-				cv_location.y = lib_location.y;
-				cv_locations.push_back(cv_location);
-			}
-			drawFeatures(image, cv_locations, conf);
-		}
+			getFeatures(loc, conf, primitives);
+	}
+
+	// Either leave the drawing to the overlay_cv stage, or do it now.
+	if (overlay_)
+	{
+		AddOverlay(completed_request->post_process_metadata, primitives);
+		return false;
+	}
+
+	BufferWriteSync w(app_, completed_request->buffers[stream_]);
+	libcamera::Span<uint8_t> buffer = w.Get()[0];
+	StreamInfo info = app_->GetStreamInfo(stream_);
+	Mat image(info.height, info.width, CV_8U, buffer.data(), info.stride);
+	for (auto const &p : primitives)
+	{
+		if (p.type == OverlayPrimitive::Type::Circle)
+			circle(image, Point(p.p0.x, p.p0.y), p.radius, Scalar(255, 255, 255), p.thickness, 8, 0);
+		else
+			line(image, Point(p.p0.x, p.p0.y), Point(p.p1.x, p.p1.y), Scalar(255, 255, 255), p.thickness);
 	}
+
 	return false;
 }
 
-void PlotPoseCvStage::drawFeatures(Mat &img, std::vector<cv::Point> locations, std::vector<float> confidences)
+void PlotPoseCvStage::getFeatures(std::vector<libcamera::Point> const &locations, std::vector<float> const &confidences,
+								  std::vector<OverlayPrimitive> &primitives)
 {
-	Scalar colour = Scalar(255, 255, 255);
+	uint32_t colour = 0xffffff;
 	int radius = 5;
+	auto line = [&](int from, int to) {
+		primitives.push_back(OverlayPrimitive::Line(locations[from], locations[to], colour, 2));
+	};
 
 	for (int i = 0; i < FEATURE_SIZE; i++)
 	{
 		if (confidences[i] < confidence_threshold_)
-			circle(img, locations[i], radius, colour, 2, 8, 0);
+			primitives.push_back(OverlayPrimitive::Circle(locations[i], radius, colour, 2));
 	}
 
 	if (confidences[leftShoulder] > confidence_threshold_)
 	{
 		if (confidences[rightShoulder] > confidence_threshold_)
-			line(img, locations[leftShoulder], locations[rightShoulder], colour, 2);
+			line(leftShoulder, rightShoulder);
 
 		if (confidences[leftElbow] > confidence_threshold_)
-			line(img, locations[leftShoulder], locations[leftElbow], colour, 2);
+			line(leftShoulder, leftElbow);
 
 		if (confidences[leftHip] > confidence_threshold_)
-			line(img, locations[leftShoulder], locations[leftHip], colour, 2);
+			line(leftShoulder, leftHip);
 	}
 	if (confidences[rightShoulder] > confidence_threshold_)
 	{
 		if (confidences[rightElbow] > confidence_threshold_)
-			line(img, locations[rightShoulder], locations[rightElbow], colour, 2);
+			line(rightShoulder, rightElbow);
 
 		if (confidences[rightHip] > confidence_threshold_)
-			line(img, locations[rightShoulder], locations[rightHip], colour, 2);
+			line(rightShoulder, rightHip);
 	}
 	if (confidences[leftElbow] > confidence_threshold_)
 	{
 		if (confidences[leftWrist] > confidence_threshold_)
-			line(img, locations[leftElbow], locations[leftWrist], colour, 2);
+			line(leftElbow, leftWrist);
 	}
 	if (confidences[rightElbow] > confidence_threshold_)
 	{
 		if (confidences[rightWrist] > confidence_threshold_)
-			line(img, locations[rightElbow], locations[rightWrist], colour, 2);
+			line(rightElbow, rightWrist);
 	}
 	if (confidences[leftHip] > confidence_threshold_)
 	{
 		if (confidences[rightHip] > confidence_threshold_)
-			line(img, locations[leftHip], locations[rightHip], colour, 2);
+			line(leftHip, rightHip);
 
 		if (confidences[leftKnee] > confidence_threshold_)
-			line(img, locations[leftHip], locations[leftKnee], colour, 2);
+			line(leftHip, leftKnee);
 	}
 	if (confidences[leftKnee] > confidence_threshold_)
 	{
 		if (confidences[leftAnkle] > confidence_threshold_)
-			line(img, locations[leftKnee], locations[leftAnkle], colour, 2);
+			line(leftKnee, leftAnkle);
 	}
 	if (confidences[rightKnee] > confidence_threshold_)
 	{
 		if (confidences[rightHip] > confidence_threshold_)
-			line(img, locations[rightKnee], locations[rightHip], colour, 2);
+			line(rightKnee, rightHip);
 
 		if (confidences[rightAnkle] > confidence_threshold_)
-			line(img, locations[rightKnee], locations[rightAnkle], colour, 2);
+			line(rightKnee, rightAnkle);
 	}
 }
 
@@ -5,6 +5,8 @@
  * post_processing_stage.cpp - Post processing stage base class implementation.
  */
 
+#include "core/rpicam_app.hpp"
+
 #include "post_processing_stage.hpp"
 
 PostProcessingStage::PostProcessingStage(RPiCamApp *app) : app_(app)
@@ -41,6 +43,47 @@ void PostProcessingStage::Teardown()
 {
 }
 
+PreprocessedImagePtr PostProcessingStage::GetPreprocessed(CompletedRequestPtr &completed_request,
+														  PreprocessKey const &key)
+{
+	StreamInfo src_info = app_->GetStreamInfo(key.stream);
+	if (src_info.pixel_format != libcamera::formats::YUV420)
+		throw std::runtime_error("PostProcessingStage: preprocessing needs a YUV420 image");
+	if (key.width > src_info.width || key.height > src_info.height)
+		throw std::runtime_error("PostProcessingStage: preprocessed image larger than source");
+
+	// Normalised images are made from the RGB one, which is then there for anyone else who wants it.
+	PreprocessedImagePtr rgb;
+	if (key.format == PreprocessKey::Format::RGB_FLOAT)
+		rgb = GetPreprocessed(completed_request, { key.stream, key.width, key.height, PreprocessKey::Format::RGB });
+
+	return completed_request->preprocess_cache.Get(key, [&](PreprocessedImage &image) {
+		if (rgb)
+		{
+			float *dst = (float *)image.Data();
+			uint8_t const *src = rgb->Data();
+			for (size_t i = 0; i < rgb->Size(); i++)
+				dst[i] = (src[i] - key.offset) / key.scale;
+			return;
+		}
+
+		BufferReadSync r(app_, completed_request->buffers[key.stream]);
+		uint8_t const *src = r.Get()[0].data();
+		if (key.format == PreprocessKey::Format::Y)
+		{
+			unsigned int off_x = (src_info.width - key.width) / 2, off_y = (src_info.height - key.height) / 2;
+			for (unsigned int y = 0; y < key.height; y++)
+				memcpy(image.Data() + y * image.stride, src + (y + off_y) * src_info.stride + off_x, key.width);
+		}
+		else
+		{
+			StreamInfo dst_info;
+			dst_info.width = key.width, dst_info.height = key.height, dst_info.stride = image.stride;
+			Yuv420ToRgb(image.Data(), src, src_info, dst_info);
+		}
+	});
+}
+
 std::vector<uint8_t> PostProcessingStage::Yuv420ToRgb(const uint8_t *src, StreamInfo &src_info, StreamInfo &dst_info)
 {
 	std::vector<uint8_t> output(dst_info.height * dst_info.stride);
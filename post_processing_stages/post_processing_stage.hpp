@@ -41,6 +41,7 @@ public:
 
 	virtual void Read(boost::property_tree::ptree const &params);
 
+	// use_case is "viewfinder", "still" or "video" for the main stream, or "lores" for the low resolution one.
 	virtual void AdjustConfig(std::string const &use_case, StreamConfiguration *config);
 
 	virtual void Configure();
@@ -62,6 +63,10 @@ public:
 	static void Yuv420ToRgb(uint8_t *dst, const uint8_t *src, StreamInfo &src_info, StreamInfo &dst_info);
 
 protected:
+	// Get a converted copy of one of the request's YUV420 images (normally the lores one). If another
+	// stage has already asked for the same conversion of this request's image, we get theirs.
+	PreprocessedImagePtr GetPreprocessed(CompletedRequestPtr &completed_request, PreprocessKey const &key);
+
 	// Helper to calculate the execution time of any callable object and return it in as a std::chrono::duration.
 	// For functions returning a value, the simplest thing would be to wrap the call in a lambda and capture
 	// the return value.
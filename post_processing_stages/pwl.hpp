@@ -8,7 +8,10 @@
 
 #include <math.h>
 
+#include <algorithm>
+#include <cstdint>
 #include <functional>
+#include <limits>
 #include <vector>
 
 #include <boost/property_tree/ptree.hpp>
@@ -92,3 +95,55 @@ private:
 	int findSpan(double x, int span) const;
 	std::vector<Point> points_;
 };
+
+// A Pwl compiled into a table with an entry for every integer from 0 to the end of its domain, for
+// mapping lots of pixels through it. The entries are in fixed point with frac_bits fractional bits,
+// rounded and saturated to T, and inputs outside the table are clamped to it. To apply several
+// curves in turn, Compose them first and make a single table.
+template <typename T> class PwlLut
+{
+public:
+	PwlLut() {}
+	PwlLut(Pwl const &pwl, unsigned int frac_bits = 0) : frac_bits_(frac_bits)
+	{
+		int end = pwl.Domain().end + 1, span = 0;
+		double scale = 1 << frac_bits;
+		table_.resize(std::max(end, 1));
+		for (int x = 0; x < end; x++)
+			table_[x] = std::clamp<double>(std::round(pwl.Eval(x, &span) * scale), std::numeric_limits<T>::lowest(),
+										   std::numeric_limits<T>::max());
+		max_ = table_.size() - 1;
+	}
+
+	T operator[](int x) const { return table_[std::clamp(x, 0, max_)]; }
+
+	// Evaluate between the entries, where x has x_frac_bits fractional bits of its own.
+	T Interpolate(int32_t x, unsigned int x_frac_bits) const
+	{
+		int i = x >> x_frac_bits;
+		if (i < 0)
+			return table_[0];
+		if (i >= max_)
+			return table_[max_];
+		int64_t frac = x & ((1 << x_frac_bits) - 1);
+		return table_[i] + (((int64_t)table_[i + 1] - table_[i]) * frac >> x_frac_bits);
+	}
+
+	// Map a row of pixels through the table. This is just a gather, which the compiler can vectorise
+	// where there are gather instructions. The input and output may be the same.
+	template <typename In> void Apply(In const *in, T *out, unsigned int count) const
+	{
+		T const *table = table_.data();
+		int max = max_;
+		for (unsigned int i = 0; i < count; i++)
+			out[i] = table[std::clamp<int>(in[i], 0, max)];
+	}
+
+	unsigned int FracBits() const { return frac_bits_; }
+	unsigned int Size() const { return table_.size(); }
+
+private:
+	std::vector<T> table_;
+	int max_ = 0;
+	unsigned int frac_bits_ = 0;
+};
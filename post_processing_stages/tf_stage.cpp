@@ -4,6 +4,8 @@
  *
  * tf_stage.hpp - base class for TensorFlowLite stages
  */
+#include <cstring>
+
 #include "tf_stage.hpp"
 
 TfStage::TfStage(RPiCamApp *app, int tf_w, int tf_h) : PostProcessingStage(app), tf_w_(tf_w), tf_h_(tf_h)
@@ -100,17 +102,28 @@ bool TfStage::Process(CompletedRequestPtr &completed_request)
 		if (config_->refresh_rate && completed_request->sequence % config_->refresh_rate == 0 &&
 			(!future_ || future_->wait_for(std::chrono::seconds(0)) == std::future_status::ready))
 		{
-			BufferReadSync r(app_, completed_request->buffers[lores_stream_]);
-			libcamera::Span<uint8_t> buffer = r.Get()[0];
-
-			// Copy the lores image here and let the asynchronous thread convert it to RGB.
-			// Doing the "extra" copy is in fact hugely beneficial because it turns uncacned
+			// If another stage has already converted the lores image the way we want it, use that.
+			PreprocessCache &cache = completed_request->preprocess_cache;
+			if (interpreter_->tensor(interpreter_->inputs()[0])->type == kTfLiteFloat32)
+				input_image_ = cache.Find({ lores_stream_, tf_w_, tf_h_, PreprocessKey::Format::RGB_FLOAT,
+											config_->normalisation_offset, config_->normalisation_scale });
+			if (!input_image_)
+				input_image_ = cache.Find({ lores_stream_, tf_w_, tf_h_, PreprocessKey::Format::RGB });
+
+			// Otherwise copy the lores image here and let the asynchronous thread convert it to RGB.
+			// Doing the "extra" copy is in fact hugely beneficial because it turns uncached
 			// memory into cached memory, which is then *much* quicker.
-			lores_copy_.assign(buffer.data(), buffer.data() + buffer.size());
+			if (!input_image_)
+			{
+				BufferReadSync r(app_, completed_request->buffers[lores_stream_]);
+				libcamera::Span<uint8_t> buffer = r.Get()[0];
+				lores_copy_.assign(buffer.data(), buffer.data() + buffer.size());
+			}
+			lores_sequence_ = completed_request->sequence;
 
 			future_ = std::make_unique<std::future<void>>();
 			*future_ = std::async(std::launch::async, [this] {
-				auto time_taken = ExecutionTime<std::micro>(&TfStage::runInference, this).count();
+				auto time_taken = ExecutionTime<std::milli>(&TfStage::runInference, this).count();
 
 				if (config_->verbose)
 					LOG(1, "TfStage: Inference time: " << time_taken << " ms");
@@ -127,27 +140,43 @@ bool TfStage::Process(CompletedRequestPtr &completed_request)
 void TfStage::runInference()
 {
 	int input = interpreter_->inputs()[0];
-	StreamInfo tf_info;
-	tf_info.width = tf_w_, tf_info.height = tf_h_, tf_info.stride = tf_w_ * 3;
-	std::vector<uint8_t> rgb_image = Yuv420ToRgb(lores_copy_.data(), lores_info_, tf_info);
 
-	if (interpreter_->tensor(input)->type == kTfLiteUInt8)
+	if (input_image_ && input_image_->key.format == PreprocessKey::Format::RGB_FLOAT)
 	{
-		uint8_t *tensor = interpreter_->typed_tensor<uint8_t>(input);
-		for (unsigned int i = 0; i < rgb_image.size(); i++)
-			tensor[i] = rgb_image[i];
+		// Already normalised, exactly as the tensor wants it.
+		memcpy(interpreter_->tensor(input)->data.raw, input_image_->Data(), input_image_->Size());
 	}
-	else if (interpreter_->tensor(input)->type == kTfLiteFloat32)
+	else
 	{
-		float *tensor = interpreter_->typed_tensor<float>(input);
-		for (unsigned int i = 0; i < rgb_image.size(); i++)
-			tensor[i] = (rgb_image[i] - config_->normalisation_offset) / config_->normalisation_scale;
+		std::vector<uint8_t> rgb_image;
+		uint8_t const *rgb;
+		size_t size;
+		if (input_image_)
+			rgb = input_image_->Data(), size = input_image_->Size();
+		else
+		{
+			StreamInfo tf_info;
+			tf_info.width = tf_w_, tf_info.height = tf_h_, tf_info.stride = tf_w_ * 3;
+			rgb_image = Yuv420ToRgb(lores_copy_.data(), lores_info_, tf_info);
+			rgb = rgb_image.data(), size = rgb_image.size();
+		}
+
+		if (interpreter_->tensor(input)->type == kTfLiteUInt8)
+			memcpy(interpreter_->typed_tensor<uint8_t>(input), rgb, size);
+		else if (interpreter_->tensor(input)->type == kTfLiteFloat32)
+		{
+			float *tensor = interpreter_->typed_tensor<float>(input);
+			for (unsigned int i = 0; i < size; i++)
+				tensor[i] = (rgb[i] - config_->normalisation_offset) / config_->normalisation_scale;
+		}
 	}
+	input_image_.reset();
 
 	if (interpreter_->Invoke() != kTfLiteOk)
 		throw std::runtime_error("TfStage: Failed to invoke TFLite");
 
 	std::unique_lock<std::mutex> lock(output_mutex_);
+	results_sequence_ = lores_sequence_;
 	interpretOutputs();
 }
 
@@ -94,12 +94,17 @@ protected:
 	std::unique_ptr<tflite::FlatBufferModel> model_;
 	std::unique_ptr<tflite::Interpreter> interpreter_;
 
+	// Sequence number of the frame that the results from interpretOutputs came from.
+	unsigned int results_sequence_ = 0;
+
 private:
 	void initialise();
 	void runInference();
 
 	std::mutex future_mutex_;
 	std::unique_ptr<std::future<void>> future_;
-	std::vector<uint8_t> lores_copy_;
+	PreprocessedImagePtr input_image_; // when another stage has already converted the image for us
+	std::vector<uint8_t> lores_copy_; // when it hasn't
+	unsigned int lores_sequence_ = 0;
 	std::mutex output_mutex_;
 };
@@ -0,0 +1,111 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * Copyright (C) 2025, Raspberry Pi Ltd
+ *
+ * tone_curve_stage.cpp - apply a tone curve and gamma to the luma of each frame
+ */
+
+// This stage maps the Y values of every frame of a YUV420 stream through a fixed curve, to brighten
+// the shadows, add contrast and so on, cheaply enough for video. The curve is given as a Pwl over
+// 0 to 255, and a gamma can be applied after it. The two are compiled into a single lookup table
+// when the stage is configured, so each pixel costs no more than one table read.
+//
+// For example:
+//
+//     "tone_curve" : { "curve" : [ 0, 0, 64, 80, 192, 200, 255, 255 ], "gamma" : 1.2 }
+
+#include <libcamera/formats.h>
+#include <libcamera/stream.h>
+
+#include "core/rpicam_app.hpp"
+
+#include "post_processing_stages/post_processing_stage.hpp"
+#include "post_processing_stages/pwl.hpp"
+
+using Stream = libcamera::Stream;
+
+class ToneCurveStage : public PostProcessingStage
+{
+public:
+	ToneCurveStage(RPiCamApp *app) : PostProcessingStage(app) {}
+
+	char const *Name() const override;
+
+	void Read(boost::property_tree::ptree const &params) override;
+
+	void Configure() override;
+
+	bool Process(CompletedRequestPtr &completed_request) override;
+
+private:
+	std::string stream_name_;
+	Stream *stream_ = nullptr;
+	StreamInfo info_;
+	PwlLut<uint8_t> lut_;
+};
+
+#define NAME "tone_curve"
+
+char const *ToneCurveStage::Name() const
+{
+	return NAME;
+}
+
+void ToneCurveStage::Read(boost::property_tree::ptree const &params)
+{
+	stream_name_ = params.get<std::string>("stream", "main");
+
+	Pwl curve({ { 0, 0 }, { 255, 255 } });
+	if (params.count("curve"))
+	{
+		curve = Pwl();
+		curve.Read(params.get_child("curve"));
+		curve.MatchDomain(Pwl::Interval(0, 255));
+	}
+
+	double gamma = params.get<double>("gamma", 1.0);
+	if (gamma <= 0)
+		throw std::runtime_error("ToneCurveStage: gamma must be positive");
+	if (gamma != 1.0)
+	{
+		// Plenty of points to follow the gamma curve closely, with extra ones near black where it's
+		// steepest.
+		Pwl gamma_curve;
+		for (double x : { 0.0, 0.5, 1.0, 2.0, 4.0 })
+			gamma_curve.Append(x, 255 * std::pow(x / 255, 1 / gamma));
+		for (int x = 8; x <= 256; x += 8)
+			gamma_curve.Append(std::min(x, 255), 255 * std::pow(std::min(x, 255) / 255.0, 1 / gamma));
+		curve = curve.Compose(gamma_curve);
+	}
+
+	lut_ = PwlLut<uint8_t>(curve);
+}
+
+void ToneCurveStage::Configure()
+{
+	stream_ = app_->GetStream(stream_name_, &info_);
+	if (!stream_)
+		return;
+	if (stream_->configuration().pixelFormat != libcamera::formats::YUV420)
+		throw std::runtime_error("ToneCurveStage: only YUV420 format supported");
+}
+
+bool ToneCurveStage::Process(CompletedRequestPtr &completed_request)
+{
+	if (!stream_)
+		return false;
+
+	BufferWriteSync w(app_, completed_request->buffers[stream_]);
+	uint8_t *ptr = w.Get()[0].data();
+	for (unsigned int y = 0; y < info_.height; y++, ptr += info_.stride)
+		lut_.Apply(ptr, ptr, info_.width);
+
+	return false;
+}
+
+static PostProcessingStage *Create(RPiCamApp *app)
+{
+	return new ToneCurveStage(app);
+}
+
+static RegisterStage reg(NAME, &Create);
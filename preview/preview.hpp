@@ -9,16 +9,15 @@
 
 #include <functional>
 #include <map>
-#include <set>
 #include <string>
 #include <vector>
 
 #include <libcamera/base/span.h>
 
+#include "core/plugin_loader.hpp"
 #include "core/stream_info.hpp"
 
 struct Options;
-class DlLib;
 
 class Preview
 {
@@ -63,7 +62,8 @@ public:
 
 	PreviewCreateFunc CreatePreview(const std::string &name);
 
-	bool HasPreview(const std::string &name) const;
+	// Looking up a preview may load the library that provides it.
+	bool HasPreview(const std::string &name);
 	const std::map<std::string, PreviewCreateFunc> &GetPreviews() const { return previews_; }
 
 private:
@@ -71,8 +71,7 @@ private:
 	~PreviewFactory() = default;
 
 	std::map<std::string, PreviewCreateFunc> previews_;
-	std::vector<DlLib> preview_libraries_;
-	std::set<std::string> loaded_library_paths_;
+	PluginLoader preview_libraries_;
 };
 
 struct RegisterPreview
@@ -0,0 +1,79 @@
+#!/usr/bin/env python3
+#
+# SPDX-License-Identifier: BSD-2-Clause
+#
+# Copyright (C) 2025, Raspberry Pi Ltd.
+#
+# frame_export_client.py - An example subscriber for the frame_export
+# post-processing stage. It receives each frame's dma-buf fd over the
+# stage's Unix socket, maps it to read the image without copying, and
+# acknowledges the frame so that the camera can re-use the buffer.
+
+import argparse
+import mmap
+import os
+import socket
+import struct
+import sys
+
+FRAME_EXPORT_MAGIC = 0x58455246
+# magic, version, header_size, id, timestamp_ns, width, height, stride,
+# pixel_format, buffer_size, metadata_size (see frame_export.hpp).
+HEADER_FORMAT = '<IHHQqIIIIII'
+HEADER_SIZE = struct.calcsize(HEADER_FORMAT)
+ACK_FORMAT = '<Q'
+
+
+def fourcc_to_str(fourcc: int) -> str:
+    return ''.join(chr((fourcc >> (8 * i)) & 0xff) for i in range(4))
+
+
+def main():
+    parser = argparse.ArgumentParser(description='frame_export stage subscriber')
+    parser.add_argument('--socket', default='/tmp/rpicam-frames.sock', help='Socket path given to the stage')
+    parser.add_argument('--frames', type=int, default=0, help='Number of frames to receive (0 = forever)')
+    parser.add_argument('--metadata', action='store_true', help='Print the metadata of each frame')
+    args = parser.parse_args()
+
+    sock = socket.socket(socket.AF_UNIX, socket.SOCK_SEQPACKET)
+    try:
+        sock.connect(args.socket)
+    except socket.error as e:
+        print(f"Failed to connect to {args.socket}: {e}", file=sys.stderr)
+        sys.exit(1)
+
+    count = 0
+    while args.frames == 0 or count < args.frames:
+        msg, fds, _, _ = socket.recv_fds(sock, 65536, 1)
+        if not msg:
+            print("Stage closed the connection", file=sys.stderr)
+            break
+        if len(msg) < HEADER_SIZE or not fds:
+            print("Malformed frame message", file=sys.stderr)
+            continue
+
+        (magic, version, header_size, frame_id, timestamp_ns, width, height, stride,
+         pixel_format, buffer_size, metadata_size) = struct.unpack(HEADER_FORMAT, msg[:HEADER_SIZE])
+        if magic != FRAME_EXPORT_MAGIC:
+            print("Bad magic number", file=sys.stderr)
+            for fd in fds:
+                os.close(fd)
+            continue
+
+        with mmap.mmap(fds[0], buffer_size, mmap.MAP_SHARED, mmap.PROT_READ) as image:
+            # The Y plane of a YUV420 image, or the first row of an RGB one, starts here.
+            mean = sum(image[0:width]) / max(width, 1)
+        os.close(fds[0])
+
+        # Let the camera have its buffer back as soon as possible.
+        sock.send(struct.pack(ACK_FORMAT, frame_id))
+
+        print(f"Frame {frame_id}: {width}x{height} stride {stride} {fourcc_to_str(pixel_format)} "
+              f"ts {timestamp_ns} first row mean {mean:.1f}")
+        if args.metadata:
+            print(msg[header_size:header_size + metadata_size].decode('utf-8'), end='')
+        count += 1
+
+
+if __name__ == '__main__':
+    main()
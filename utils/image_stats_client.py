@@ -0,0 +1,75 @@
+#!/usr/bin/env python3
+#
+# SPDX-License-Identifier: BSD-2-Clause
+#
+# Copyright (C) 2025, Raspberry Pi Ltd.
+#
+# image_stats_client.py - An example subscriber for the image_stats
+# post-processing stage. It receives the histogram and zone statistics
+# of every frame from the stage's Unix socket, as an external exposure
+# or white balance algorithm would.
+
+import argparse
+import socket
+import struct
+import sys
+
+IMAGE_STATS_MAGIC = 0x54415453
+# magic, version, header_size, sequence, timestamp_ns, width, height,
+# zones_x, zones_y, histogram_bins, reserved (see image_stats.hpp).
+HEADER_FORMAT = '<IHHQqIIHHHH'
+HEADER_SIZE = struct.calcsize(HEADER_FORMAT)
+# Y, U and V means in 8.8 fixed point, bright and dark fractions out of 65535.
+ZONE_FORMAT = '<HHHHH'
+ZONE_SIZE = struct.calcsize(ZONE_FORMAT)
+
+
+def main():
+    parser = argparse.ArgumentParser(description='image_stats stage subscriber')
+    parser.add_argument('--socket', default='/tmp/rpicam-stats.sock', help='Socket path given to the stage')
+    parser.add_argument('--frames', type=int, default=0, help='Number of frames to receive (0 = forever)')
+    parser.add_argument('--zones', action='store_true', help='Print the mean Y of every zone')
+    args = parser.parse_args()
+
+    sock = socket.socket(socket.AF_UNIX, socket.SOCK_SEQPACKET)
+    try:
+        sock.connect(args.socket)
+    except socket.error as e:
+        print(f"Failed to connect to {args.socket}: {e}", file=sys.stderr)
+        sys.exit(1)
+
+    count = 0
+    while args.frames == 0 or count < args.frames:
+        msg = sock.recv(65536)
+        if not msg:
+            print("Stage closed the connection", file=sys.stderr)
+            break
+        if len(msg) < HEADER_SIZE:
+            print("Malformed statistics message", file=sys.stderr)
+            continue
+
+        (magic, version, header_size, sequence, timestamp_ns, width, height,
+         zones_x, zones_y, bins, _) = struct.unpack(HEADER_FORMAT, msg[:HEADER_SIZE])
+        if magic != IMAGE_STATS_MAGIC:
+            print("Bad magic number", file=sys.stderr)
+            continue
+
+        offset = header_size
+        histogram = struct.unpack(f'<{bins}I', msg[offset:offset + 4 * bins])
+        offset += 4 * bins
+        zones = [struct.unpack(ZONE_FORMAT, msg[offset + i * ZONE_SIZE:offset + (i + 1) * ZONE_SIZE])
+                 for i in range(zones_x * zones_y)]
+
+        total = max(sum(histogram), 1)
+        mean = sum(i * n for i, n in enumerate(histogram)) / total
+        bright = sum(z[3] for z in zones) / (65535 * len(zones))
+        print(f"Frame {sequence}: {width}x{height} ts {timestamp_ns} mean Y {mean:.1f} "
+              f"bright {100 * bright:.2f}%")
+        if args.zones:
+            for y in range(zones_y):
+                print(' '.join(f"{zones[y * zones_x + x][0] / 256:5.1f}" for x in range(zones_x)))
+        count += 1
+
+
+if __name__ == '__main__':
+    main()
@@ -8,12 +8,17 @@
 # designed to process object detection information. It's specifically
 # tailored to receive data sent by `object_detect_udp_stage.cpp`,
 # but can also be used with generic UDP senders like `nc -ulp 12347`
-# for debugging raw data.
+# for debugging raw data. It understands both the per-frame messages
+# of the current protocol (see object_detect_udp.hpp) and the single
+# detection packets of version 1, and can listen on a Unix socket
+# instead when the stage is given one.
 
+import argparse
+import os
 import socket
 import struct
 import sys
-from dataclasses import dataclass
+from dataclasses import dataclass, field
 
 # --- Data Structures ---
 
@@ -28,6 +33,17 @@ class ParsedDetection:
     name: str
     confidence: float
 
+
+@dataclass
+class ParsedFrame:
+    """All the detections for one frame. Version 1 packets have no frame information."""
+    sequence: int | None = None
+    result_sequence: int | None = None
+    timestamp_ns: int | None = None
+    width: int | None = None
+    height: int | None = None
+    detections: list[ParsedDetection] = field(default_factory=list)
+
 # --- UDP_AI_Receiver Class Definition ---
 
 
@@ -36,29 +52,122 @@ class UDP_AI_Receiver:
     The UDP_AI_Receiver class handles the establishment of a UDP socket,
     receiving incoming data, and parsing it into the ParsedDetection format.
     """
-    MAX_BUFFER_SIZE = 1024
+    MAX_BUFFER_SIZE = 65536
+
+    START_DELIMITER_LE = 0xDDCCBBAA
+    FRAME_MAGIC = 0x54454452
+    # magic, version, header_size, sequence, result_sequence, timestamp_ns, width, height,
+    # total_count, count, fragment, fragments, reserved (see object_detect_udp.hpp).
+    HEADER_FORMAT = '<IHHIIqIIHHBBH'
+    HEADER_SIZE = struct.calcsize(HEADER_FORMAT)
 
-    def __init__(self, port: int):
+    def __init__(self, port: int, socket_path: str | None = None):
         """
         Constructor: Initializes the UDP receiver.
         :param port: The UDP port number to listen on.
+        :param socket_path: Listen on this Unix socket instead, if given.
         """
+        self.sock = None
+        self.socket_path = socket_path
+        # Fragments of the frame currently being put back together.
+        self.partial = None
         try:
-            # Create a UDP socket.
-            # AF_INET specifies the IPv4 address family.
-            # SOCK_DGRAM specifies a UDP (datagram) socket.
-            self.sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
-            # Bind the created socket to the specified IP address and port.
-            self.sock.bind(('', port))
+            if socket_path:
+                self.sock = socket.socket(socket.AF_UNIX, socket.SOCK_DGRAM)
+                if os.path.exists(socket_path):
+                    os.unlink(socket_path)
+                self.sock.bind(socket_path)
+            else:
+                # Create a UDP socket.
+                # AF_INET specifies the IPv4 address family.
+                # SOCK_DGRAM specifies a UDP (datagram) socket.
+                self.sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+                # Bind the created socket to the specified IP address and port.
+                self.sock.bind(('', port))
         except socket.error as e:
             print(f"Failed to create or bind socket: {e}", file=sys.stderr)
             sys.exit(1)
 
-        print(f"Listening for UDP detection packets on port {port}...")
+        print(f"Listening for detection packets on {socket_path or f'port {port}'}...")
 
     def __del__(self):
         """Destructor: Cleans up resources by closing the socket."""
-        self.sock.close()
+        if self.sock:
+            self.sock.close()
+        if self.socket_path and os.path.exists(self.socket_path):
+            os.unlink(self.socket_path)
+
+    def receive_frame(self) -> ParsedFrame | None:
+        """
+        Method to receive the detections for the next frame, waiting for all its fragments if it
+        was split up. A version 1 packet comes back as a frame of its own holding one detection.
+        :return: A ParsedFrame object, or None if a packet could not be received or parsed.
+        """
+        while True:
+            try:
+                buffer = self.sock.recv(self.MAX_BUFFER_SIZE)
+            except socket.error as e:
+                print(f"Failed to receive detection message: {e}", file=sys.stderr)
+                return None
+
+            if len(buffer) >= 4 and struct.unpack('<I', buffer[0:4])[0] == self.START_DELIMITER_LE:
+                detection = self._parse_detection(buffer)
+                return ParsedFrame(detections=[detection]) if detection else None
+
+            parsed = self._parse_frame(buffer)
+            if parsed is None:
+                return None
+            frame, fragment, fragments, total_count = parsed
+
+            # Anything left over from a frame whose fragments didn't all arrive is lost.
+            if fragment == 0 or self.partial is None or self.partial.sequence != frame.sequence:
+                self.partial = frame if fragment == 0 else None
+            else:
+                self.partial.detections += frame.detections
+            if self.partial is not None and fragment == fragments - 1:
+                frame, self.partial = self.partial, None
+                if len(frame.detections) != total_count:
+                    print("Frame has the wrong number of detections.", file=sys.stderr)
+                return frame
+
+    @classmethod
+    def _parse_frame(cls, buffer: bytes):
+        """
+        Helper method to parse one datagram of a per-frame message.
+        :param buffer: A byte string containing the received data.
+        :return: A tuple of the ParsedFrame, its fragment number, the number of fragments and the
+                 total number of detections in the frame, or None if the datagram is malformed.
+        """
+        if len(buffer) < cls.HEADER_SIZE:
+            print("Packet too small to be a valid frame.", file=sys.stderr)
+            return None
+
+        (magic, version, header_size, sequence, result_sequence, timestamp_ns, width, height,
+         total_count, count, fragment, fragments, _) = struct.unpack(cls.HEADER_FORMAT, buffer[:cls.HEADER_SIZE])
+        if magic != cls.FRAME_MAGIC:
+            print("Invalid packet: delimiter not found.", file=sys.stderr)
+            return None
+        if version != 2:
+            print(f"Unsupported protocol version {version}.", file=sys.stderr)
+            return None
+
+        frame = ParsedFrame(sequence, result_sequence, timestamp_ns, width, height)
+        offset = header_size
+        try:
+            for _ in range(count):
+                x, y, w, h, confidence, name_length = struct.unpack('<iiiifB', buffer[offset:offset + 21])
+                offset += 21
+                if offset + name_length > len(buffer):
+                    print("Invalid packet: name length exceeds buffer size.", file=sys.stderr)
+                    return None
+                name = buffer[offset:offset + name_length].decode('utf-8', errors='replace')
+                offset += name_length
+                frame.detections.append(ParsedDetection(x, y, w, h, name, confidence))
+        except struct.error as e:
+            print(f"Error unpacking packet data: {e}", file=sys.stderr)
+            return None
+
+        return frame, fragment, fragments, total_count
 
     def receive_detection(self) -> ParsedDetection | None:
         """
@@ -114,8 +223,8 @@ class UDP_AI_Receiver:
                       file=sys.stderr)
                 return None
 
-            # Unpack the name string.
-            name = buffer[offset:offset + name_length].decode('utf-8')
+            # Unpack the name string, which is padded with NULs.
+            name = buffer[offset:offset + name_length].decode('utf-8', errors='replace').rstrip('\0')
             offset += name_length
 
             # Unpack the confidence score.
@@ -131,14 +240,23 @@ class UDP_AI_Receiver:
 
 
 if __name__ == "__main__":
-    port = 12347  # The UDP port number this receiver will listen on.
+    parser = argparse.ArgumentParser(description='object_detect_udp stage receiver')
     # Ensure this matches the port your sender is transmitting to.
-    receiver = UDP_AI_Receiver(port)
+    parser.add_argument('--port', type=int, default=12347, help='UDP port to listen on')
+    parser.add_argument('--socket', help='Unix socket path to listen on instead (the stage\'s "socket")')
+    args = parser.parse_args()
+    receiver = UDP_AI_Receiver(args.port, args.socket)
 
     # Enter an infinite loop to continuously receive and process detection packets.
     while True:
-        detection = receiver.receive_detection()
-        if detection:
+        frame = receiver.receive_frame()
+        if frame is None:
+            continue
+        if frame.sequence is not None:
+            print(f"Frame {frame.sequence} (detected on frame {frame.result_sequence}), "
+                  f"timestamp {frame.timestamp_ns} ns, {frame.width}x{frame.height}: "
+                  f"{len(frame.detections)} detections")
+        for detection in frame.detections:
             # If a packet was successfully received and parsed, print its contents.
             print("Received Detection:")
             print(